@@ -8,65 +8,114 @@
  */
 
 #include "access.h"
-#include "ls.h"
+#include "filter.h"
 #include "tunables.h"
 #include "str.h"
+#include "sysutil.h"
+#include "defs.h"
+
+static int is_upload_temp(const struct mystr* p_filename_str);
+static int is_matched(const struct mystr* p_filename_str,
+                      struct vsf_filter** p_p_filter,
+                      struct mystr* p_filter_str, const char* p_setting);
 
 int
 vsf_access_check_file(const struct mystr* p_filename_str)
 {
   static struct mystr s_access_str;
+  static struct vsf_filter* s_p_filter;
 
-  if (!tunable_deny_file)
-  {
-    return 1;
-  }
-  if (str_isempty(&s_access_str))
-  {
-    str_alloc_text(&s_access_str, tunable_deny_file);
-  }
-  if (vsf_filename_passes_filter(p_filename_str, &s_access_str))
+  if (is_upload_temp(p_filename_str))
   {
     return 0;
   }
-  else
+  if (!tunable_deny_file)
   {
-    struct str_locate_result loc_res =
-      str_locate_str(p_filename_str, &s_access_str);
-    if (loc_res.found)
-    {
-      return 0;
-    }
+    return 1;
   }
-  return 1;
+  return !is_matched(p_filename_str, &s_p_filter, &s_access_str,
+                     tunable_deny_file);
 }
 
 int
 vsf_access_check_file_visible(const struct mystr* p_filename_str)
 {
   static struct mystr s_access_str;
+  static struct vsf_filter* s_p_filter;
 
+  if (is_upload_temp(p_filename_str))
+  {
+    return 0;
+  }
   if (!tunable_hide_file)
   {
     return 1;
   }
-  if (str_isempty(&s_access_str))
+  return !is_matched(p_filename_str, &s_p_filter, &s_access_str,
+                     tunable_hide_file);
+}
+
+static int
+is_matched(const struct mystr* p_filename_str, struct vsf_filter** p_p_filter,
+           struct mystr* p_filter_str, const char* p_setting)
+{
+  struct str_locate_result loc_res;
+  /* Parse the setting on first use; every path and every listed directory
+   * entry after that just runs the compiled filter
+   */
+  if (*p_p_filter == 0)
   {
-    str_alloc_text(&s_access_str, tunable_hide_file);
+    str_alloc_text(p_filter_str, p_setting);
+    *p_p_filter = vsf_filter_compile(p_filter_str);
   }
-  if (vsf_filename_passes_filter(p_filename_str, &s_access_str))
+  if (vsf_filter_matches(*p_p_filter, p_filename_str))
+  {
+    return 1;
+  }
+  loc_res = str_locate_str(p_filename_str, p_filter_str);
+  return loc_res.found;
+}
+
+static int
+is_upload_temp(const struct mystr* p_filename_str)
+{
+  /* Uploads in progress are nobody's business, under any path */
+  static struct mystr s_name_str;
+  struct str_locate_result loc_res;
+  unsigned int i;
+  if (!tunable_atomic_upload_enable)
   {
     return 0;
   }
+  loc_res = str_locate_text_reverse(p_filename_str, "/");
+  if (loc_res.found)
+  {
+    str_mid_to_end(p_filename_str, &s_name_str, loc_res.index + 1);
+  }
   else
   {
-    struct str_locate_result loc_res =
-      str_locate_str(p_filename_str, &s_access_str);
-    if (loc_res.found)
+    str_copy(&s_name_str, p_filename_str);
+  }
+  /* Exactly what get_upload_temp_filename() makes: the prefix, a name, a
+   * dot and a pid. Anyone's own ".in.whatever" files are left alone.
+   */
+  loc_res = str_locate_text(&s_name_str, VSFTP_UPLOAD_TEMP_PREFIX);
+  if (!loc_res.found || loc_res.index != 0)
+  {
+    return 0;
+  }
+  loc_res = str_locate_text_reverse(&s_name_str, ".");
+  if (loc_res.index <= vsf_sysutil_strlen(VSFTP_UPLOAD_TEMP_PREFIX) ||
+      loc_res.index + 1 == str_getlen(&s_name_str))
+  {
+    return 0;
+  }
+  for (i = loc_res.index + 1; i < str_getlen(&s_name_str); ++i)
+  {
+    if (!vsf_sysutil_isdigit(str_get_char_at(&s_name_str, i)))
     {
       return 0;
     }
   }
   return 1;
 }
-
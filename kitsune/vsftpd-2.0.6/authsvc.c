@@ -0,0 +1,280 @@
+/*
+ * Part of Very Secure FTPd
+ * Licence: GPL v2
+ * Author: Chris Evans
+ * authsvc.c
+ *
+ * Authentication workers. A small pool of root processes, forked by the
+ * standalone listener, which check local logins on behalf of sessions. A
+ * worker keeps its PAM modules loaded from one login to the next, though
+ * each login gets a PAM handle of its own, and remembers recent successes
+ * for a few seconds, which pays off for automated clients which log in over
+ * and over.
+ *
+ * A request is one datagram: "user\0password\0address\0", carrying one end
+ * of a fresh socketpair over which the worker sends back '1' or '0'. Only
+ * the answer comes back; a session still sets up its own PAM session.
+ */
+
+#include "authsvc.h"
+#include "str.h"
+#include "sysutil.h"
+#include "sysdeputil.h"
+#include "checksum.h"
+#include "tunables.h"
+#include "defs.h"
+#include "utility.h"
+
+/* Room for the three strings, their terminators, and an IPv6 address */
+#define VSF_AUTHSVC_REQ_MAX (VSFTP_USERNAME_MAX + VSFTP_PASSWORD_MAX + 64)
+#define VSF_AUTHSVC_SALT_LEN 16
+
+struct vsf_authsvc_cache_entry
+{
+  struct mystr key_str;
+  long expires;
+};
+
+/* Session side state */
+static int s_sock = -1;
+
+/* Worker side state */
+static char s_salt[VSF_AUTHSVC_SALT_LEN];
+static struct vsf_authsvc_cache_entry s_cache[VSFTP_AUTH_CACHE_SIZE];
+
+static unsigned int build_request(char* p_buf, const struct mystr* p_user_str,
+                                  const struct mystr* p_pass_str,
+                                  const struct mystr* p_remote_host);
+static int parse_request(const char* p_buf, unsigned int len,
+                         struct mystr* p_user_str, struct mystr* p_pass_str,
+                         struct mystr* p_remote_host);
+static int check_login(const char* p_req, unsigned int req_len,
+                       const struct mystr* p_user_str,
+                       const struct mystr* p_pass_str,
+                       const struct mystr* p_remote_host);
+static void init_salt(void);
+
+void
+vsf_authsvc_attach(int sock)
+{
+  s_sock = sock;
+}
+
+void
+vsf_authsvc_close(void)
+{
+  if (s_sock != -1)
+  {
+    vsf_sysutil_close(s_sock);
+    s_sock = -1;
+  }
+}
+
+int
+vsf_authsvc_check(const struct mystr* p_user_str,
+                  const struct mystr* p_pass_str,
+                  const struct mystr* p_remote_host)
+{
+  char req_buf[VSF_AUTHSVC_REQ_MAX];
+  struct vsf_sysutil_socketpair_retval sockets;
+  unsigned int req_len;
+  char result;
+  int retval;
+  if (s_sock == -1)
+  {
+    return -1;
+  }
+  req_len = build_request(req_buf, p_user_str, p_pass_str, p_remote_host);
+  if (req_len == 0)
+  {
+    return -1;
+  }
+  sockets = vsf_sysutil_unix_stream_socketpair();
+  retval = vsf_sysutil_send_msg(s_sock, req_buf, req_len, sockets.socket_two);
+  vsf_sysutil_memclr(req_buf, sizeof(req_buf));
+  vsf_sysutil_close(sockets.socket_two);
+  if (vsf_sysutil_retval_is_error(retval))
+  {
+    vsf_sysutil_close(sockets.socket_one);
+    return -1;
+  }
+  /* A worker dying on us (e.g. restarted by a SIGHUP) shows up as EOF */
+  retval = vsf_sysutil_read_loop(sockets.socket_one, &result, 1);
+  vsf_sysutil_close(sockets.socket_one);
+  if (retval != 1)
+  {
+    return -1;
+  }
+  return result == '1';
+}
+
+void
+vsf_authsvc_worker(int sock)
+{
+  static struct mystr s_user_str;
+  static struct mystr s_pass_str;
+  static struct mystr s_host_str;
+  char req_buf[VSF_AUTHSVC_REQ_MAX];
+  vsf_sysutil_exit_with_parent();
+  /* PAM modules may run helpers and wait for them. The listener restarts us
+   * to pick up a new config, so a stray SIGHUP must not kill us.
+   */
+  vsf_sysutil_default_sig(kVSFSysUtilSigCHLD);
+  vsf_sysutil_install_null_sighandler(kVSFSysUtilSigHUP);
+  vsf_sysutil_unblock_sig(kVSFSysUtilSigCHLD);
+  vsf_sysutil_unblock_sig(kVSFSysUtilSigHUP);
+  if (tunable_setproctitle_enable)
+  {
+    vsf_sysutil_setproctitle("AUTH WORKER");
+  }
+  init_salt();
+  vsf_sysdep_init_verify_auth();
+  while (1)
+  {
+    int reply_fd;
+    char result = '0';
+    int retval = vsf_sysutil_recv_msg(sock, req_buf, sizeof(req_buf),
+                                      &reply_fd);
+    if (vsf_sysutil_retval_is_error(retval))
+    {
+      die("recvmsg in auth worker");
+    }
+    if (reply_fd == -1)
+    {
+      continue;
+    }
+    if (parse_request(req_buf, (unsigned int) retval, &s_user_str,
+                      &s_pass_str, &s_host_str) &&
+        check_login(req_buf, (unsigned int) retval, &s_user_str, &s_pass_str,
+                    &s_host_str))
+    {
+      result = '1';
+    }
+    vsf_sysutil_memclr(req_buf, sizeof(req_buf));
+    str_empty(&s_pass_str);
+    /* The session may have given up on us; no matter */
+    (void) vsf_sysutil_write_loop(reply_fd, &result, 1);
+    vsf_sysutil_close_failok(reply_fd);
+  }
+}
+
+static unsigned int
+build_request(char* p_buf, const struct mystr* p_user_str,
+              const struct mystr* p_pass_str,
+              const struct mystr* p_remote_host)
+{
+  const struct mystr* p_strs[3];
+  unsigned int pos = 0;
+  unsigned int i;
+  p_strs[0] = p_user_str;
+  p_strs[1] = p_pass_str;
+  p_strs[2] = p_remote_host;
+  for (i = 0; i < 3; ++i)
+  {
+    unsigned int len = str_getlen(p_strs[i]);
+    if (pos + len + 1 > VSF_AUTHSVC_REQ_MAX)
+    {
+      return 0;
+    }
+    vsf_sysutil_memcpy(p_buf + pos, str_getbuf(p_strs[i]), len);
+    p_buf[pos + len] = '\0';
+    pos += len + 1;
+  }
+  return pos;
+}
+
+static int
+parse_request(const char* p_buf, unsigned int len, struct mystr* p_user_str,
+              struct mystr* p_pass_str, struct mystr* p_remote_host)
+{
+  struct mystr* p_strs[3];
+  unsigned int pos = 0;
+  unsigned int i;
+  p_strs[0] = p_user_str;
+  p_strs[1] = p_pass_str;
+  p_strs[2] = p_remote_host;
+  for (i = 0; i < 3; ++i)
+  {
+    unsigned int start = pos;
+    while (pos < len && p_buf[pos] != '\0')
+    {
+      pos++;
+    }
+    if (pos == len)
+    {
+      return 0;
+    }
+    str_alloc_text(p_strs[i], p_buf + start);
+    pos++;
+  }
+  /* Exactly three strings; anything else (e.g. a password with a NUL in it,
+   * or a truncated datagram) is refused
+   */
+  return pos == len;
+}
+
+static int
+check_login(const char* p_req, unsigned int req_len,
+            const struct mystr* p_user_str, const struct mystr* p_pass_str,
+            const struct mystr* p_remote_host)
+{
+  static struct mystr s_key_str;
+  static char s_key_buf[VSF_AUTHSVC_SALT_LEN + VSF_AUTHSVC_REQ_MAX];
+  struct vsf_authsvc_cache_entry* p_victim = &s_cache[0];
+  long now;
+  unsigned int i;
+  if (tunable_auth_cache_ttl == 0)
+  {
+    return vsf_sysdep_verify_auth(p_user_str, p_pass_str, p_remote_host);
+  }
+  /* Only a salted hash is kept, never the password itself. The address is
+   * part of the key, as PAM may treat clients differently.
+   */
+  vsf_sysutil_memcpy(s_key_buf, s_salt, VSF_AUTHSVC_SALT_LEN);
+  vsf_sysutil_memcpy(s_key_buf + VSF_AUTHSVC_SALT_LEN, p_req, req_len);
+  vsf_checksum_buf(kVSFChecksumSHA256, s_key_buf,
+                   VSF_AUTHSVC_SALT_LEN + req_len, &s_key_str);
+  vsf_sysutil_memclr(s_key_buf, sizeof(s_key_buf));
+  vsf_sysutil_update_cached_time();
+  now = vsf_sysutil_get_cached_time_sec();
+  for (i = 0; i < VSFTP_AUTH_CACHE_SIZE; ++i)
+  {
+    struct vsf_authsvc_cache_entry* p_entry = &s_cache[i];
+    if (p_entry->expires > now && str_equal(&p_entry->key_str, &s_key_str))
+    {
+      return 1;
+    }
+    if (p_entry->expires < p_victim->expires)
+    {
+      p_victim = p_entry;
+    }
+  }
+  /* Failures are never cached; a wrong guess always costs a real check */
+  if (!vsf_sysdep_verify_auth(p_user_str, p_pass_str, p_remote_host))
+  {
+    return 0;
+  }
+  str_copy(&p_victim->key_str, &s_key_str);
+  p_victim->expires = now + (long) tunable_auth_cache_ttl;
+  return 1;
+}
+
+static void
+init_salt(void)
+{
+  int retval = -1;
+  int fd = vsf_sysutil_open_file("/dev/urandom", kVSFSysUtilOpenReadOnly);
+  if (!vsf_sysutil_retval_is_error(fd))
+  {
+    retval = vsf_sysutil_read_loop(fd, s_salt, sizeof(s_salt));
+    vsf_sysutil_close(fd);
+  }
+  if (retval != (int) sizeof(s_salt))
+  {
+    unsigned int i;
+    for (i = 0; i < sizeof(s_salt); ++i)
+    {
+      s_salt[i] = (char) vsf_sysutil_get_random_byte();
+    }
+  }
+}
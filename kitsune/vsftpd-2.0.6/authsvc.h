@@ -0,0 +1,53 @@
+#ifndef VSF_AUTHSVC_H
+#define VSF_AUTHSVC_H
+
+struct mystr;
+
+/* vsf_authsvc_worker()
+ * PURPOSE
+ * Run an authentication worker, as forked by the standalone listener when
+ * auth_workers is set. Workers share one end of a datagram socket and each
+ * request goes to whichever worker is free. A request carries the
+ * credentials and a socket for the one byte answer. PAM modules stay loaded
+ * between requests, and successful logins are remembered for auth_cache_ttl
+ * seconds, keyed on a salted SHA-256 of the credentials.
+ * PARAMETERS
+ * sock         - the workers' end of the request socket
+ * RETURNS
+ * Never returns.
+ */
+void vsf_authsvc_worker(int sock);
+
+/* vsf_authsvc_attach()
+ * PURPOSE
+ * Tell a session where the authentication workers are.
+ * PARAMETERS
+ * sock         - the sessions' end of the request socket
+ */
+void vsf_authsvc_attach(int sock);
+
+/* vsf_authsvc_close()
+ * PURPOSE
+ * Drop this process's access to the authentication workers. Anything which
+ * is not the pre-login privileged parent must not keep it: it would be a
+ * password oracle with no delay_failed_login or max_login_fails.
+ */
+void vsf_authsvc_close(void);
+
+/* vsf_authsvc_check()
+ * PURPOSE
+ * Ask the authentication workers whether a user and password are good.
+ * PARAMETERS
+ * p_user_str   - the user name
+ * p_pass_str   - the password
+ * p_remote_host - the client's address, for PAM_RHOST
+ * RETURNS
+ * 1 if good, 0 if not, -1 if there are no workers to ask (the caller should
+ * check for itself).
+ */
+int vsf_authsvc_check(const struct mystr* p_user_str,
+                      const struct mystr* p_pass_str,
+                      const struct mystr* p_remote_host);
+
+#endif /* VSF_AUTHSVC_H */
+
@@ -4,6 +4,7 @@
 #undef VSF_BUILD_TCPWRAPPERS
 #define VSF_BUILD_PAM
 #undef VSF_BUILD_SSL
+#undef VSF_BUILD_ZLIB
 
 #endif /* VSF_BUILDDEFS_H */
 
@@ -0,0 +1,516 @@
+/*
+ * Part of Very Secure FTPd
+ * Licence: GPL v2
+ * Author: Chris Evans
+ * checksum.c
+ *
+ * Routines to checksum files, for HASH and the X* checksum commands. The
+ * algorithms are implemented here rather than pulled in from a crypto
+ * library, so they are always available.
+ */
+
+#include "checksum.h"
+#include "str.h"
+#include "sysutil.h"
+#include "secbuf.h"
+#include "defs.h"
+#include "utility.h"
+
+struct checksum_ctx
+{
+  enum EVSFChecksumType type;
+  unsigned int state[8];
+  filesize_t total_len;
+  unsigned char block[64];
+  unsigned int block_len;
+};
+
+static void checksum_init(struct checksum_ctx* p_ctx,
+                          enum EVSFChecksumType type);
+static void checksum_update(struct checksum_ctx* p_ctx,
+                            const unsigned char* p_buf, unsigned int len);
+static void checksum_final(struct checksum_ctx* p_ctx, struct mystr* p_hex_str);
+static void crc32_update(struct checksum_ctx* p_ctx,
+                         const unsigned char* p_buf, unsigned int len);
+static void md5_block(unsigned int* p_state, const unsigned char* p_block);
+static void sha1_block(unsigned int* p_state, const unsigned char* p_block);
+static void sha256_block(unsigned int* p_state, const unsigned char* p_block);
+static void append_hex_word(struct mystr* p_str, unsigned int word,
+                            int little_endian);
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const unsigned int s_md5_k[64] =
+{
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+  0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+  0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+  0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+  0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+  0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+  0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+  0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+  0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const unsigned int s_md5_r[64] =
+{
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static const unsigned int s_sha256_k[64] =
+{
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+const char*
+vsf_checksum_get_name(enum EVSFChecksumType type)
+{
+  switch (type)
+  {
+    case kVSFChecksumCRC32:
+      return "CRC32";
+    case kVSFChecksumMD5:
+      return "MD5";
+    case kVSFChecksumSHA1:
+      return "SHA-1";
+    case kVSFChecksumSHA256:
+      return "SHA-256";
+    default:
+      bug("unknown type in vsf_checksum_get_name");
+      break;
+  }
+  return 0;
+}
+
+enum EVSFChecksumType
+vsf_checksum_parse_name(const struct mystr* p_name_str)
+{
+  if (str_equal_text(p_name_str, "CRC32"))
+  {
+    return kVSFChecksumCRC32;
+  }
+  else if (str_equal_text(p_name_str, "MD5"))
+  {
+    return kVSFChecksumMD5;
+  }
+  else if (str_equal_text(p_name_str, "SHA-1"))
+  {
+    return kVSFChecksumSHA1;
+  }
+  else if (str_equal_text(p_name_str, "SHA-256"))
+  {
+    return kVSFChecksumSHA256;
+  }
+  return kVSFChecksumNone;
+}
+
+void
+vsf_checksum_buf(enum EVSFChecksumType type, const void* p_buf,
+                 unsigned int len, struct mystr* p_hex_str)
+{
+  struct checksum_ctx ctx;
+  checksum_init(&ctx, type);
+  checksum_update(&ctx, (const unsigned char*) p_buf, len);
+  checksum_final(&ctx, p_hex_str);
+}
+
+int
+vsf_checksum_file(enum EVSFChecksumType type, int fd, filesize_t start,
+                  filesize_t end, struct mystr* p_hex_str)
+{
+  static char* p_readbuf;
+  struct checksum_ctx ctx;
+  filesize_t remaining = end - start;
+  if (p_readbuf == 0)
+  {
+    vsf_secbuf_alloc(&p_readbuf, VSFTP_DATA_BUFSIZE);
+  }
+  checksum_init(&ctx, type);
+  vsf_sysutil_lseek_to(fd, start);
+  while (remaining > 0)
+  {
+    unsigned int chunk = VSFTP_DATA_BUFSIZE;
+    int retval;
+    if ((filesize_t) chunk > remaining)
+    {
+      chunk = (unsigned int) remaining;
+    }
+    retval = vsf_sysutil_read(fd, p_readbuf, chunk);
+    if (vsf_sysutil_retval_is_error(retval))
+    {
+      return -1;
+    }
+    else if (retval == 0)
+    {
+      /* Truncated under our feet. Checksum what we got. */
+      break;
+    }
+    checksum_update(&ctx, (const unsigned char*) p_readbuf,
+                    (unsigned int) retval);
+    remaining -= retval;
+  }
+  checksum_final(&ctx, p_hex_str);
+  return 0;
+}
+
+static void
+checksum_init(struct checksum_ctx* p_ctx, enum EVSFChecksumType type)
+{
+  vsf_sysutil_memclr(p_ctx, sizeof(*p_ctx));
+  p_ctx->type = type;
+  switch (type)
+  {
+    case kVSFChecksumCRC32:
+      p_ctx->state[0] = 0xffffffff;
+      break;
+    case kVSFChecksumMD5:
+      p_ctx->state[0] = 0x67452301;
+      p_ctx->state[1] = 0xefcdab89;
+      p_ctx->state[2] = 0x98badcfe;
+      p_ctx->state[3] = 0x10325476;
+      break;
+    case kVSFChecksumSHA1:
+      p_ctx->state[0] = 0x67452301;
+      p_ctx->state[1] = 0xefcdab89;
+      p_ctx->state[2] = 0x98badcfe;
+      p_ctx->state[3] = 0x10325476;
+      p_ctx->state[4] = 0xc3d2e1f0;
+      break;
+    case kVSFChecksumSHA256:
+      p_ctx->state[0] = 0x6a09e667;
+      p_ctx->state[1] = 0xbb67ae85;
+      p_ctx->state[2] = 0x3c6ef372;
+      p_ctx->state[3] = 0xa54ff53a;
+      p_ctx->state[4] = 0x510e527f;
+      p_ctx->state[5] = 0x9b05688c;
+      p_ctx->state[6] = 0x1f83d9ab;
+      p_ctx->state[7] = 0x5be0cd19;
+      break;
+    default:
+      bug("unknown type in checksum_init");
+      break;
+  }
+}
+
+static void
+checksum_update(struct checksum_ctx* p_ctx, const unsigned char* p_buf,
+                unsigned int len)
+{
+  p_ctx->total_len += len;
+  if (p_ctx->type == kVSFChecksumCRC32)
+  {
+    crc32_update(p_ctx, p_buf, len);
+    return;
+  }
+  while (len > 0)
+  {
+    /* Whole blocks straight from the caller's buffer where possible */
+    if (p_ctx->block_len == 0 && len >= 64)
+    {
+      if (p_ctx->type == kVSFChecksumMD5)
+      {
+        md5_block(p_ctx->state, p_buf);
+      }
+      else if (p_ctx->type == kVSFChecksumSHA1)
+      {
+        sha1_block(p_ctx->state, p_buf);
+      }
+      else
+      {
+        sha256_block(p_ctx->state, p_buf);
+      }
+      p_buf += 64;
+      len -= 64;
+      continue;
+    }
+    p_ctx->block[p_ctx->block_len++] = *p_buf++;
+    len--;
+    if (p_ctx->block_len == 64)
+    {
+      if (p_ctx->type == kVSFChecksumMD5)
+      {
+        md5_block(p_ctx->state, p_ctx->block);
+      }
+      else if (p_ctx->type == kVSFChecksumSHA1)
+      {
+        sha1_block(p_ctx->state, p_ctx->block);
+      }
+      else
+      {
+        sha256_block(p_ctx->state, p_ctx->block);
+      }
+      p_ctx->block_len = 0;
+    }
+  }
+}
+
+static void
+checksum_final(struct checksum_ctx* p_ctx, struct mystr* p_hex_str)
+{
+  unsigned char pad[72];
+  unsigned int pad_len;
+  unsigned int num_words = 0;
+  unsigned int i;
+  filesize_t bit_len = p_ctx->total_len * 8;
+  int little_endian = (p_ctx->type == kVSFChecksumMD5);
+  str_empty(p_hex_str);
+  if (p_ctx->type == kVSFChecksumCRC32)
+  {
+    append_hex_word(p_hex_str, p_ctx->state[0] ^ 0xffffffff, 0);
+    return;
+  }
+  /* Pad with 0x80, zeros, then the 64-bit message length in bits */
+  vsf_sysutil_memclr(pad, sizeof(pad));
+  pad[0] = 0x80;
+  pad_len = (p_ctx->block_len < 56) ? (56 - p_ctx->block_len) :
+                                      (120 - p_ctx->block_len);
+  for (i = 0; i < 8; i++)
+  {
+    unsigned int shift = little_endian ? (i * 8) : ((7 - i) * 8);
+    pad[pad_len + i] = (unsigned char) ((bit_len >> shift) & 0xff);
+  }
+  /* Note - this bumps total_len too, but we already have bit_len */
+  checksum_update(p_ctx, pad, pad_len + 8);
+  switch (p_ctx->type)
+  {
+    case kVSFChecksumMD5:
+      num_words = 4;
+      break;
+    case kVSFChecksumSHA1:
+      num_words = 5;
+      break;
+    case kVSFChecksumSHA256:
+      num_words = 8;
+      break;
+    default:
+      bug("unknown type in checksum_final");
+      break;
+  }
+  for (i = 0; i < num_words; i++)
+  {
+    append_hex_word(p_hex_str, p_ctx->state[i], little_endian);
+  }
+}
+
+static void
+append_hex_word(struct mystr* p_str, unsigned int word, int little_endian)
+{
+  static const char s_hex[] = "0123456789abcdef";
+  unsigned int i;
+  for (i = 0; i < 4; i++)
+  {
+    unsigned int shift = little_endian ? (i * 8) : ((3 - i) * 8);
+    unsigned int the_byte = (word >> shift) & 0xff;
+    str_append_char(p_str, s_hex[the_byte >> 4]);
+    str_append_char(p_str, s_hex[the_byte & 0xf]);
+  }
+}
+
+static void
+crc32_update(struct checksum_ctx* p_ctx, const unsigned char* p_buf,
+             unsigned int len)
+{
+  static unsigned int s_table[256];
+  static int s_table_inited;
+  unsigned int crc = p_ctx->state[0];
+  if (!s_table_inited)
+  {
+    unsigned int i;
+    for (i = 0; i < 256; i++)
+    {
+      unsigned int c = i;
+      unsigned int j;
+      for (j = 0; j < 8; j++)
+      {
+        c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+      }
+      s_table[i] = c;
+    }
+    s_table_inited = 1;
+  }
+  while (len--)
+  {
+    crc = s_table[(crc ^ *p_buf++) & 0xff] ^ (crc >> 8);
+  }
+  p_ctx->state[0] = crc;
+}
+
+static void
+md5_block(unsigned int* p_state, const unsigned char* p_block)
+{
+  unsigned int w[16];
+  unsigned int a = p_state[0];
+  unsigned int b = p_state[1];
+  unsigned int c = p_state[2];
+  unsigned int d = p_state[3];
+  unsigned int i;
+  for (i = 0; i < 16; i++)
+  {
+    w[i] = (unsigned int) p_block[i * 4] |
+           ((unsigned int) p_block[i * 4 + 1] << 8) |
+           ((unsigned int) p_block[i * 4 + 2] << 16) |
+           ((unsigned int) p_block[i * 4 + 3] << 24);
+  }
+  for (i = 0; i < 64; i++)
+  {
+    unsigned int f;
+    unsigned int g;
+    unsigned int temp;
+    if (i < 16)
+    {
+      f = (b & c) | (~b & d);
+      g = i;
+    }
+    else if (i < 32)
+    {
+      f = (d & b) | (~d & c);
+      g = (5 * i + 1) & 15;
+    }
+    else if (i < 48)
+    {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) & 15;
+    }
+    else
+    {
+      f = c ^ (b | ~d);
+      g = (7 * i) & 15;
+    }
+    temp = d;
+    d = c;
+    c = b;
+    b = b + ROTL(a + f + s_md5_k[i] + w[g], s_md5_r[i]);
+    a = temp;
+  }
+  p_state[0] += a;
+  p_state[1] += b;
+  p_state[2] += c;
+  p_state[3] += d;
+}
+
+static void
+sha1_block(unsigned int* p_state, const unsigned char* p_block)
+{
+  unsigned int w[80];
+  unsigned int a = p_state[0];
+  unsigned int b = p_state[1];
+  unsigned int c = p_state[2];
+  unsigned int d = p_state[3];
+  unsigned int e = p_state[4];
+  unsigned int i;
+  for (i = 0; i < 16; i++)
+  {
+    w[i] = ((unsigned int) p_block[i * 4] << 24) |
+           ((unsigned int) p_block[i * 4 + 1] << 16) |
+           ((unsigned int) p_block[i * 4 + 2] << 8) |
+           (unsigned int) p_block[i * 4 + 3];
+  }
+  for (i = 16; i < 80; i++)
+  {
+    unsigned int x = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+    w[i] = ROTL(x, 1);
+  }
+  for (i = 0; i < 80; i++)
+  {
+    unsigned int f;
+    unsigned int k;
+    unsigned int temp;
+    if (i < 20)
+    {
+      f = (b & c) | (~b & d);
+      k = 0x5a827999;
+    }
+    else if (i < 40)
+    {
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1;
+    }
+    else if (i < 60)
+    {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8f1bbcdc;
+    }
+    else
+    {
+      f = b ^ c ^ d;
+      k = 0xca62c1d6;
+    }
+    temp = ROTL(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = ROTL(b, 30);
+    b = a;
+    a = temp;
+  }
+  p_state[0] += a;
+  p_state[1] += b;
+  p_state[2] += c;
+  p_state[3] += d;
+  p_state[4] += e;
+}
+
+static void
+sha256_block(unsigned int* p_state, const unsigned char* p_block)
+{
+  unsigned int w[64];
+  unsigned int v[8];
+  unsigned int i;
+  for (i = 0; i < 16; i++)
+  {
+    w[i] = ((unsigned int) p_block[i * 4] << 24) |
+           ((unsigned int) p_block[i * 4 + 1] << 16) |
+           ((unsigned int) p_block[i * 4 + 2] << 8) |
+           (unsigned int) p_block[i * 4 + 3];
+  }
+  for (i = 16; i < 64; i++)
+  {
+    unsigned int s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^
+                      (w[i - 15] >> 3);
+    unsigned int s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^
+                      (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+  for (i = 0; i < 8; i++)
+  {
+    v[i] = p_state[i];
+  }
+  for (i = 0; i < 64; i++)
+  {
+    unsigned int s1 = ROTR(v[4], 6) ^ ROTR(v[4], 11) ^ ROTR(v[4], 25);
+    unsigned int ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+    unsigned int temp1 = v[7] + s1 + ch + s_sha256_k[i] + w[i];
+    unsigned int s0 = ROTR(v[0], 2) ^ ROTR(v[0], 13) ^ ROTR(v[0], 22);
+    unsigned int maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+    unsigned int temp2 = s0 + maj;
+    v[7] = v[6];
+    v[6] = v[5];
+    v[5] = v[4];
+    v[4] = v[3] + temp1;
+    v[3] = v[2];
+    v[2] = v[1];
+    v[1] = v[0];
+    v[0] = temp1 + temp2;
+  }
+  for (i = 0; i < 8; i++)
+  {
+    p_state[i] += v[i];
+  }
+}
+
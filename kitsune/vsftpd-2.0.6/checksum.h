@@ -0,0 +1,67 @@
+#ifndef VSF_CHECKSUM_H
+#define VSF_CHECKSUM_H
+
+#ifndef VSF_FILESIZE_H
+#include "filesize.h"
+#endif
+
+struct mystr;
+
+enum EVSFChecksumType
+{
+  kVSFChecksumNone = 0,
+  kVSFChecksumCRC32,
+  kVSFChecksumMD5,
+  kVSFChecksumSHA1,
+  kVSFChecksumSHA256
+};
+
+/* vsf_checksum_get_name()
+ * PURPOSE
+ * Get the name of a checksum algorithm, as used by the HASH command.
+ * PARAMETERS
+ * type         - the algorithm
+ * RETURNS
+ * The name, e.g. "SHA-256".
+ */
+const char* vsf_checksum_get_name(enum EVSFChecksumType type);
+
+/* vsf_checksum_parse_name()
+ * PURPOSE
+ * Look up a checksum algorithm by the name used by the HASH command.
+ * PARAMETERS
+ * p_name_str   - the name, which must be in upper case
+ * RETURNS
+ * The algorithm, or kVSFChecksumNone if it is not one we support.
+ */
+enum EVSFChecksumType vsf_checksum_parse_name(const struct mystr* p_name_str);
+
+/* vsf_checksum_file()
+ * PURPOSE
+ * Compute the checksum of a byte range of an open file.
+ * PARAMETERS
+ * type         - the algorithm to use
+ * fd           - the file descriptor of the file; its offset is changed
+ * start        - the offset of the first byte to include
+ * end          - the offset after the last byte to include
+ * p_hex_str    - where to store the checksum, in lower case hex
+ * RETURNS
+ * 0 on success, -1 if reading the file failed.
+ */
+int vsf_checksum_file(enum EVSFChecksumType type, int fd, filesize_t start,
+                      filesize_t end, struct mystr* p_hex_str);
+
+/* vsf_checksum_buf()
+ * PURPOSE
+ * Compute the checksum of a buffer in memory.
+ * PARAMETERS
+ * type         - the algorithm to use
+ * p_buf        - the data
+ * len          - the length of the data
+ * p_hex_str    - where to store the checksum, in lower case hex
+ */
+void vsf_checksum_buf(enum EVSFChecksumType type, const void* p_buf,
+                      unsigned int len, struct mystr* p_hex_str);
+
+#endif /* VSF_CHECKSUM_H */
+
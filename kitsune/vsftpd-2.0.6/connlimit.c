@@ -0,0 +1,321 @@
+/*
+ * Part of Very Secure FTPd
+ * Licence: GPL v2
+ * Author: Chris Evans
+ * connlimit.c
+ *
+ * Session counts shared between listener shards. Each shard owns an area
+ * holding its number of sessions and an open addressing table of per-address
+ * counts; only the owner writes to it. A shard wanting a total adds up the
+ * areas of all shards. A reader may catch another shard's table half way
+ * through an update and miss an entry; the limits are then briefly a little
+ * generous, which is fine.
+ *
+ * The layout of the shared pages is kept in each shard's own memory, never
+ * read back from the pages, and sessions unmap the pages as soon as they
+ * are forked.
+ */
+
+#include "connlimit.h"
+#include "sysutil.h"
+#include "sysdeputil.h"
+#include "utility.h"
+
+#define VSF_CONNLIMIT_ADDR_MAX  16
+
+struct vsf_connlimit_entry
+{
+  /* 0 means the entry is free */
+  unsigned int count;
+  unsigned char addr[VSF_CONNLIMIT_ADDR_MAX];
+};
+
+struct vsf_connlimit_shard
+{
+  unsigned int num_sessions;
+  struct vsf_connlimit_entry entries[1];
+};
+
+struct vsf_connlimit
+{
+  unsigned int num_shards;
+  unsigned int addr_size;
+  unsigned int num_entries;
+  /* Where in a shard's area its table of session pids starts */
+  unsigned int pids_offset;
+  unsigned int shard_size;
+  /* Shared: num_shards areas of shard_size bytes */
+  char* p_base;
+};
+
+/* Listener side state */
+static unsigned int s_shard;
+
+static struct vsf_connlimit_shard*
+get_shard(const struct vsf_connlimit* p_limit, unsigned int shard)
+{
+  return (struct vsf_connlimit_shard*) (p_limit->p_base +
+                                        shard * p_limit->shard_size);
+}
+
+static int*
+get_pids(const struct vsf_connlimit* p_limit, unsigned int shard)
+{
+  return (int*) ((char*) get_shard(p_limit, shard) + p_limit->pids_offset);
+}
+
+static unsigned int
+hash_addr(const struct vsf_connlimit* p_limit, const void* p_raw_addr)
+{
+  const unsigned char* p_addr = (const unsigned char*) p_raw_addr;
+  unsigned int val = 2166136261U;
+  unsigned int i;
+  for (i = 0; i < p_limit->addr_size; ++i)
+  {
+    val ^= p_addr[i];
+    val *= 16777619U;
+  }
+  return val % p_limit->num_entries;
+}
+
+static int
+find_addr(const struct vsf_connlimit* p_limit,
+          const struct vsf_connlimit_shard* p_shard, const void* p_raw_addr)
+{
+  unsigned int index = hash_addr(p_limit, p_raw_addr);
+  unsigned int i;
+  for (i = 0; i < p_limit->num_entries; ++i)
+  {
+    const struct vsf_connlimit_entry* p_entry = &p_shard->entries[index];
+    if (p_entry->count == 0)
+    {
+      break;
+    }
+    if (vsf_sysutil_memcmp(p_entry->addr, p_raw_addr,
+                           p_limit->addr_size) == 0)
+    {
+      return (int) index;
+    }
+    index = (index + 1) % p_limit->num_entries;
+  }
+  return -1;
+}
+
+struct vsf_connlimit*
+vsf_connlimit_alloc(unsigned int num_shards, unsigned int addr_size,
+                    unsigned int max_addrs)
+{
+  struct vsf_connlimit* p_limit;
+  /* Keep the tables at most half full so probe sequences stay short */
+  unsigned int num_entries = max_addrs * 2 + 1;
+  unsigned int pids_offset = sizeof(struct vsf_connlimit_shard) +
+    (num_entries - 1) * sizeof(struct vsf_connlimit_entry);
+  unsigned int shard_size = pids_offset + num_entries * sizeof(int);
+  if (addr_size > VSF_CONNLIMIT_ADDR_MAX)
+  {
+    bug("addr_size too big in vsf_connlimit_alloc");
+  }
+  p_limit = vsf_sysutil_malloc(sizeof(*p_limit));
+  p_limit->p_base = vsf_sysutil_map_shared_pages(num_shards * shard_size);
+  p_limit->num_shards = num_shards;
+  p_limit->addr_size = addr_size;
+  p_limit->num_entries = num_entries;
+  p_limit->pids_offset = pids_offset;
+  p_limit->shard_size = shard_size;
+  return p_limit;
+}
+
+void
+vsf_connlimit_detach(struct vsf_connlimit* p_limit)
+{
+  vsf_sysutil_memunmap(p_limit->p_base,
+                       p_limit->num_shards * p_limit->shard_size);
+  vsf_sysutil_free(p_limit);
+}
+
+void
+vsf_connlimit_set_shard(struct vsf_connlimit* p_limit, unsigned int shard)
+{
+  if (shard >= p_limit->num_shards)
+  {
+    bug("bad shard in vsf_connlimit_set_shard");
+  }
+  s_shard = shard;
+}
+
+void
+vsf_connlimit_clear_shard(struct vsf_connlimit* p_limit, unsigned int shard)
+{
+  /* Warning: called from the SIGCHLD handler */
+  if (shard >= p_limit->num_shards)
+  {
+    bug("bad shard in vsf_connlimit_clear_shard");
+  }
+  vsf_sysutil_memclr(get_shard(p_limit, shard), p_limit->shard_size);
+}
+
+unsigned int
+vsf_connlimit_add(struct vsf_connlimit* p_limit, const void* p_raw_addr)
+{
+  struct vsf_connlimit_shard* p_shard = get_shard(p_limit, s_shard);
+  int index = find_addr(p_limit, p_shard, p_raw_addr);
+  unsigned int total = 0;
+  unsigned int i;
+  p_shard->num_sessions++;
+  if (index != -1)
+  {
+    p_shard->entries[index].count++;
+  }
+  else
+  {
+    unsigned int free_index = hash_addr(p_limit, p_raw_addr);
+    for (i = 0; i < p_limit->num_entries; ++i)
+    {
+      struct vsf_connlimit_entry* p_entry = &p_shard->entries[free_index];
+      if (p_entry->count == 0)
+      {
+        /* Address first, so a reader never matches a half written entry */
+        vsf_sysutil_memcpy(p_entry->addr, p_raw_addr, p_limit->addr_size);
+        p_entry->count = 1;
+        break;
+      }
+      free_index = (free_index + 1) % p_limit->num_entries;
+    }
+    if (i == p_limit->num_entries)
+    {
+      /* Table full; we can't track this one, but still count it now */
+      total = 1;
+    }
+  }
+  for (i = 0; i < p_limit->num_shards; ++i)
+  {
+    const struct vsf_connlimit_shard* p_other = get_shard(p_limit, i);
+    index = find_addr(p_limit, p_other, p_raw_addr);
+    if (index != -1)
+    {
+      total += p_other->entries[index].count;
+    }
+  }
+  return total;
+}
+
+void
+vsf_connlimit_drop(struct vsf_connlimit* p_limit, const void* p_raw_addr)
+{
+  struct vsf_connlimit_shard* p_shard = get_shard(p_limit, s_shard);
+  int index = find_addr(p_limit, p_shard, p_raw_addr);
+  unsigned int hole;
+  unsigned int next;
+  if (p_shard->num_sessions > 0)
+  {
+    p_shard->num_sessions--;
+  }
+  if (index == -1)
+  {
+    return;
+  }
+  if (--p_shard->entries[index].count > 0)
+  {
+    return;
+  }
+  /* Entry now free. Shift later entries of the probe sequence back into the
+   * hole, so lookups never need to skip deleted entries.
+   */
+  hole = (unsigned int) index;
+  next = hole;
+  while (1)
+  {
+    struct vsf_connlimit_entry* p_next;
+    unsigned int home;
+    next = (next + 1) % p_limit->num_entries;
+    p_next = &p_shard->entries[next];
+    if (p_next->count == 0)
+    {
+      break;
+    }
+    home = hash_addr(p_limit, p_next->addr);
+    /* Can the entry at "next" legally live at "hole"? Only if its home is
+     * not cyclically within (hole, next].
+     */
+    if ((hole < next && (home <= hole || home > next)) ||
+        (hole > next && (home <= hole && home > next)))
+    {
+      p_shard->entries[hole] = *p_next;
+      p_next->count = 0;
+      hole = next;
+    }
+  }
+}
+
+void
+vsf_connlimit_add_pid(struct vsf_connlimit* p_limit, int pid)
+{
+  int* p_pids = get_pids(p_limit, s_shard);
+  unsigned int index = (unsigned int) pid % p_limit->num_entries;
+  unsigned int i;
+  for (i = 0; i < p_limit->num_entries; ++i)
+  {
+    if (p_pids[index] == 0)
+    {
+      p_pids[index] = pid;
+      return;
+    }
+    index = (index + 1) % p_limit->num_entries;
+  }
+  /* Table full; that session can't be cleaned up if we die */
+}
+
+void
+vsf_connlimit_drop_pid(struct vsf_connlimit* p_limit, int pid)
+{
+  /* Warning: called from the SIGCHLD handler */
+  int* p_pids = get_pids(p_limit, s_shard);
+  unsigned int index = (unsigned int) pid % p_limit->num_entries;
+  unsigned int i;
+  /* Free entries don't end the search, so dropping needs no shuffling */
+  for (i = 0; i < p_limit->num_entries; ++i)
+  {
+    if (p_pids[index] == pid)
+    {
+      p_pids[index] = 0;
+      return;
+    }
+    index = (index + 1) % p_limit->num_entries;
+  }
+}
+
+int
+vsf_connlimit_take_pid(struct vsf_connlimit* p_limit, unsigned int shard)
+{
+  /* Warning: called from the SIGCHLD handler */
+  int* p_pids;
+  unsigned int i;
+  if (shard >= p_limit->num_shards)
+  {
+    bug("bad shard in vsf_connlimit_take_pid");
+  }
+  p_pids = get_pids(p_limit, shard);
+  for (i = 0; i < p_limit->num_entries; ++i)
+  {
+    if (p_pids[i] != 0)
+    {
+      int pid = p_pids[i];
+      p_pids[i] = 0;
+      return pid;
+    }
+  }
+  return 0;
+}
+
+unsigned int
+vsf_connlimit_get_sessions(const struct vsf_connlimit* p_limit)
+{
+  unsigned int total = 0;
+  unsigned int i;
+  for (i = 0; i < p_limit->num_shards; ++i)
+  {
+    total += get_shard(p_limit, i)->num_sessions;
+  }
+  return total;
+}
+
@@ -0,0 +1,117 @@
+#ifndef VSF_CONNLIMIT_H
+#define VSF_CONNLIMIT_H
+
+struct vsf_connlimit;
+
+/* vsf_connlimit_alloc()
+ * PURPOSE
+ * Allocate the session counts shared by a set of listener shards, so that
+ * max_clients and max_per_ip apply across all of them. Each shard has its
+ * own area, which only it writes to while it lives, so there is no locking;
+ * a shard reads everybody's area to get the totals. Totals may therefore be briefly off by
+ * a connection or two while several shards accept at once.
+ * PARAMETERS
+ * num_shards   - the number of listener shards
+ * addr_size    - the size of a raw IP address
+ * max_addrs    - the most distinct addresses one shard can track
+ * RETURNS
+ * A handle to the shared counts.
+ */
+struct vsf_connlimit* vsf_connlimit_alloc(unsigned int num_shards,
+                                          unsigned int addr_size,
+                                          unsigned int max_addrs);
+
+/* vsf_connlimit_detach()
+ * PURPOSE
+ * Unmap the shared counts and free the handle. Called in a newly launched
+ * session, which has no business with them.
+ * PARAMETERS
+ * p_limit      - the shared counts
+ */
+void vsf_connlimit_detach(struct vsf_connlimit* p_limit);
+
+/* vsf_connlimit_set_shard()
+ * PURPOSE
+ * Say which shard this listener process is. Must be called before counting.
+ * PARAMETERS
+ * p_limit      - the shared counts
+ * shard        - this shard's number, from 0
+ */
+void vsf_connlimit_set_shard(struct vsf_connlimit* p_limit,
+                             unsigned int shard);
+
+/* vsf_connlimit_clear_shard()
+ * PURPOSE
+ * Forget every session counted against a shard which has died. Its sessions
+ * should be gone first; see vsf_connlimit_take_pid().
+ * PARAMETERS
+ * p_limit      - the shared counts
+ * shard        - the dead shard's number
+ */
+void vsf_connlimit_clear_shard(struct vsf_connlimit* p_limit,
+                               unsigned int shard);
+
+/* vsf_connlimit_add()
+ * PURPOSE
+ * Count a new session from an address against this shard.
+ * PARAMETERS
+ * p_limit      - the shared counts
+ * p_raw_addr   - the raw IP address of the client
+ * RETURNS
+ * The number of sessions from that address, across all shards.
+ */
+unsigned int vsf_connlimit_add(struct vsf_connlimit* p_limit,
+                               const void* p_raw_addr);
+
+/* vsf_connlimit_drop()
+ * PURPOSE
+ * Stop counting a session which this shard launched.
+ * PARAMETERS
+ * p_limit      - the shared counts
+ * p_raw_addr   - the raw IP address of the client
+ */
+void vsf_connlimit_drop(struct vsf_connlimit* p_limit, const void* p_raw_addr);
+
+/* vsf_connlimit_add_pid()
+ * PURPOSE
+ * Note the process ID of a session this shard launched, so that it can be
+ * found should the shard die.
+ * PARAMETERS
+ * p_limit      - the shared counts
+ * pid          - the process ID of the session
+ */
+void vsf_connlimit_add_pid(struct vsf_connlimit* p_limit, int pid);
+
+/* vsf_connlimit_drop_pid()
+ * PURPOSE
+ * Forget the process ID of a session this shard launched, once it exits.
+ * PARAMETERS
+ * p_limit      - the shared counts
+ * pid          - the process ID of the session
+ */
+void vsf_connlimit_drop_pid(struct vsf_connlimit* p_limit, int pid);
+
+/* vsf_connlimit_take_pid()
+ * PURPOSE
+ * Remove and return one session process ID noted by a shard which has died.
+ * Called repeatedly by shard 0 to find the sessions it must end.
+ * PARAMETERS
+ * p_limit      - the shared counts
+ * shard        - the dead shard's number
+ * RETURNS
+ * A process ID, or 0 once there are none left.
+ */
+int vsf_connlimit_take_pid(struct vsf_connlimit* p_limit, unsigned int shard);
+
+/* vsf_connlimit_get_sessions()
+ * PURPOSE
+ * Get the number of sessions running, across all shards.
+ * PARAMETERS
+ * p_limit      - the shared counts
+ * RETURNS
+ * The number of sessions.
+ */
+unsigned int vsf_connlimit_get_sessions(const struct vsf_connlimit* p_limit);
+
+#endif /* VSF_CONNLIMIT_H */
+
@@ -12,11 +12,47 @@
 #define VSFTP_DIR_BUFSIZE       16384
 #define VSFTP_PATH_MAX          4096
 #define VSFTP_CONF_FILE_MAX     100000
+#define VSFTP_CONF_CACHE_BUCKETS 1021
+/* user_list, banned e-mail and e-mail password files */
+#define VSFTP_LIST_FILE_MAX     (64 * 1024 * 1024)
 #define VSFTP_LISTEN_BACKLOG    32
+/* Sessions tracked by stats_socket and scoreboard_file when max_clients is
+ * unlimited
+ */
+#define VSFTP_DEFAULT_STATS_SLOTS 1024
 #define VSFTP_SECURE_UMASK      077
 #define VSFTP_ROOT_UID          0
+/* SSL session cache process: number of entries, and the largest DER encoded
+ * session we will store (client certificates make sessions bigger)
+ */
+#define VSFTP_SSL_SESSION_CACHE_SIZE  512
+#define VSFTP_SSL_SESSION_MAX         2048
+/* Checksum cache process: number of entries */
+#define VSFTP_CHECKSUM_CACHE_SIZE     1024
+/* Secure buffers: the pool's arena, and the biggest buffer it hands out */
+#define VSFTP_SECBUF_ARENA_SIZE (4 * 1024 * 1024)
+#define VSFTP_SECBUF_POOL_MAX   (VSFTP_DATA_BUFSIZE * 2)
+/* stream_download_size: how much of a streamed download is read ahead, how
+ * many big files we track the popularity of, how quickly it fades, and how
+ * popular a file must be to stay in the cache
+ */
+#define VSFTP_STREAM_WINDOW     (8 * 1024 * 1024)
+#define VSFTP_DLHEAT_SIZE       1024
+#define VSFTP_DLHEAT_SECS       600
+#define VSFTP_STREAM_HOT_COUNT  3
+/* auth_workers: cached successful logins per worker */
+#define VSFTP_AUTH_CACHE_SIZE   256
+/* atomic_upload_enable: what temporary upload names start with.
+ * upload_sync_enable: most files the sync worker flushes in one batch
+ */
+#define VSFTP_UPLOAD_TEMP_PREFIX ".in."
+#define VSFTP_SYNC_BATCH_MAX    64
+/* SITE CPTO: most bytes copied by one system call, so signals get a look in */
+#define VSFTP_COPY_CHUNK        (64 * 1024 * 1024)
 /* Must be greater than both VSFTP_MAX_COMMAND_LINE and VSFTP_DIR_BUFSIZE */
 #define VSFTP_PRIVSOCK_MAXSTR   VSFTP_DIR_BUFSIZE
+/* A framed privsock message: room for two strings plus the other fields */
+#define VSFTP_PRIVSOCK_MAXMSG   (2 * VSFTP_PRIVSOCK_MAXSTR + 64)
 
 #endif /* VSF_DEFS_H */
 
@@ -0,0 +1,99 @@
+/*
+ * Part of Very Secure FTPd
+ * Licence: GPL v2
+ * Author: Chris Evans
+ * dlheat.c
+ *
+ * How often large files have been downloaded lately, in memory shared
+ * between the standalone listener and its sessions. Used to decide which
+ * big downloads are worth keeping in the page cache. The table is a small
+ * open hash; when a file's neighbourhood is full, the entry least recently
+ * downloaded makes way.
+ *
+ * There is no locking. Sessions racing on one entry may lose a count, or
+ * even briefly see another file's; the worst that happens is a download
+ * cached when it need not be, or the other way round.
+ */
+
+#include "dlheat.h"
+#include "sysutil.h"
+#include "sysdeputil.h"
+#include "defs.h"
+
+/* How far along the table to look for a file */
+#define VSF_DLHEAT_PROBES       8
+
+struct vsf_dlheat_entry
+{
+  filesize_t inode;
+  filesize_t size;
+  long mtime;
+  /* Downloads started, halved for every VSFTP_DLHEAT_SECS since
+   * period_start
+   */
+  long period_start;
+  unsigned int count;
+};
+
+struct vsf_dlheat
+{
+  struct vsf_dlheat_entry entries[VSFTP_DLHEAT_SIZE];
+};
+
+/* Session side state */
+static struct vsf_dlheat* s_p_heat;
+
+struct vsf_dlheat*
+vsf_dlheat_alloc(void)
+{
+  return vsf_sysutil_map_shared_pages(sizeof(struct vsf_dlheat));
+}
+
+void
+vsf_dlheat_attach(struct vsf_dlheat* p_heat)
+{
+  s_p_heat = p_heat;
+}
+
+unsigned int
+vsf_dlheat_note(filesize_t inode, filesize_t size, long mtime)
+{
+  struct vsf_dlheat_entry* p_victim = 0;
+  unsigned int start;
+  unsigned int i;
+  long now;
+  if (s_p_heat == 0)
+  {
+    return 0;
+  }
+  vsf_sysutil_update_cached_time();
+  now = vsf_sysutil_get_cached_time_sec();
+  start = (unsigned int) (inode % VSFTP_DLHEAT_SIZE);
+  for (i = 0; i < VSF_DLHEAT_PROBES; ++i)
+  {
+    struct vsf_dlheat_entry* p_entry =
+      &s_p_heat->entries[(start + i) % VSFTP_DLHEAT_SIZE];
+    if (p_entry->inode == inode && p_entry->size == size &&
+        p_entry->mtime == mtime && p_entry->count > 0)
+    {
+      long periods = (now - p_entry->period_start) / VSFTP_DLHEAT_SECS;
+      if (periods > 0)
+      {
+        /* Old popularity fades rather than vanishing all at once */
+        p_entry->count = periods < 32 ? p_entry->count >> periods : 0;
+        p_entry->period_start = now;
+      }
+      return ++p_entry->count;
+    }
+    if (p_victim == 0 || p_entry->period_start < p_victim->period_start)
+    {
+      p_victim = p_entry;
+    }
+  }
+  p_victim->inode = inode;
+  p_victim->size = size;
+  p_victim->mtime = mtime;
+  p_victim->period_start = now;
+  p_victim->count = 1;
+  return 1;
+}
@@ -0,0 +1,46 @@
+#ifndef VSF_DLHEAT_H
+#define VSF_DLHEAT_H
+
+#ifndef VSF_FILESIZE_H
+#include "filesize.h"
+#endif
+
+struct vsf_dlheat;
+
+/* vsf_dlheat_alloc()
+ * PURPOSE
+ * Allocate the table of recently downloaded large files. This is called by
+ * the standalone listener, and the memory is shared with every session it
+ * launches, so that a session can tell whether a big file it is about to
+ * send is popular right now.
+ * RETURNS
+ * A handle to the table.
+ */
+struct vsf_dlheat* vsf_dlheat_alloc(void);
+
+/* vsf_dlheat_attach()
+ * PURPOSE
+ * Called in a newly launched session so that it records into the table.
+ * PARAMETERS
+ * p_heat       - the table, or null for none
+ */
+void vsf_dlheat_attach(struct vsf_dlheat* p_heat);
+
+/* vsf_dlheat_note()
+ * PURPOSE
+ * Record that a download of a file is starting, and find out how many
+ * downloads of it have started recently.
+ * PARAMETERS
+ * inode        - the file's inode number
+ * size         - the file's size
+ * mtime        - the file's modification time; with the size, this tells
+ *                a replaced file from the one it replaced
+ * RETURNS
+ * The number of downloads of the file started lately, this one included,
+ * where the count halves every VSFTP_DLHEAT_SECS seconds; or 0 if there is
+ * no table.
+ */
+unsigned int vsf_dlheat_note(filesize_t inode, filesize_t size, long mtime);
+
+#endif /* VSF_DLHEAT_H */
+
@@ -26,6 +26,7 @@
 #include "sysutil.h"
 #include "tunables.h"
 #include "dsu.h"
+#include "lineidx.h"
 
 struct mystr_list_node
 {
@@ -59,7 +60,6 @@ int LOCAL_XFORM(main, the_session)(void *session) {
 		free(old_session->p_port_sockaddr);
 	}
 	new_session->data_fd = old_session->data_fd;
-	new_session->data_progress = old_session->data_progress;
 	new_session->bw_rate_max = old_session->bw_rate_max;
 	new_session->bw_send_start_sec = old_session->bw_send_start_sec;
 	new_session->bw_send_start_usec = old_session->bw_send_start_usec;
@@ -99,8 +99,14 @@ int LOCAL_XFORM(main, the_session)(void *session) {
 		/* guest_user_uid added; main should init it properly */
 
 	/* copy cache */
-	str_copy(&(new_session->banned_email_str), &(old_session->banned_email_str));
-	str_copy(&(new_session->userlist_str), &(old_session->userlist_str));
+	if (!str_isempty(&(old_session->banned_email_str))) {
+		new_session->p_banned_email_idx =
+			vsf_lineidx_from_str(&(old_session->banned_email_str));
+	}
+	if (!str_isempty(&(old_session->userlist_str))) {
+		new_session->p_userlist_idx =
+			vsf_lineidx_from_str(&(old_session->userlist_str));
+	}
 	str_copy(&(new_session->banner_str), &(old_session->banner_str));
 	new_session->tcp_wrapper_ok = old_session->tcp_wrapper_ok;
 
@@ -11,6 +11,8 @@
 #include "ftpcodes.h"
 #include "ftpcmdio.h"
 #include "tunables.h"
+#include "session.h"
+#include "checksum.h"
 
 void
 handle_feat(struct vsf_session* p_sess)
@@ -29,7 +31,36 @@ handle_feat(struct vsf_session* p_sess)
   {
     vsf_cmdio_write_raw(p_sess, " EPSV\r\n");
   }
+  if (tunable_download_enable)
+  {
+    /* The '*' marks the algorithm currently selected with OPTS HASH */
+    static struct mystr s_hash_str;
+    enum EVSFChecksumType type;
+    str_alloc_text(&s_hash_str, " HASH ");
+    for (type = kVSFChecksumCRC32; type <= kVSFChecksumSHA256; type++)
+    {
+      if (type != kVSFChecksumCRC32)
+      {
+        str_append_char(&s_hash_str, ';');
+      }
+      str_append_text(&s_hash_str, vsf_checksum_get_name(type));
+      if ((int) type == p_sess->hash_type)
+      {
+        str_append_char(&s_hash_str, '*');
+      }
+    }
+    str_append_text(&s_hash_str, "\r\n");
+    vsf_cmdio_write_raw(p_sess, str_getbuf(&s_hash_str));
+  }
   vsf_cmdio_write_raw(p_sess, " MDTM\r\n");
+  if (tunable_block_mode_enable)
+  {
+    vsf_cmdio_write_raw(p_sess, " MODE B\r\n");
+  }
+  if (tunable_deflate_enable)
+  {
+    vsf_cmdio_write_raw(p_sess, " MODE Z\r\n");
+  }
   if (tunable_pasv_enable)
   {
     vsf_cmdio_write_raw(p_sess, " PASV\r\n");
@@ -39,6 +70,7 @@ handle_feat(struct vsf_session* p_sess)
     vsf_cmdio_write_raw(p_sess, " PBSZ\r\n");
     vsf_cmdio_write_raw(p_sess, " PROT\r\n");
   }
+  vsf_cmdio_write_raw(p_sess, " RANG STREAM\r\n");
   vsf_cmdio_write_raw(p_sess, " REST STREAM\r\n");
   vsf_cmdio_write_raw(p_sess, " SIZE\r\n");
   vsf_cmdio_write_raw(p_sess, " TVFS\r\n");
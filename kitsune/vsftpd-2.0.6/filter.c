@@ -0,0 +1,379 @@
+/*
+ * Part of Very Secure FTPd
+ * Licence: GPL v2
+ * Author: Chris Evans
+ * filter.c
+ *
+ * Compiled filename filters, for deny_file, hide_file and LIST filters that
+ * get tried against every name in a directory. vsf_filename_passes_filter()
+ * parses the filter afresh for every name, copying strings as it goes, and
+ * builds a new filter string for every {,} alternative. Here the parsing
+ * happens once, into a flat list of steps that match in place.
+ *
+ * The steps reproduce the interpreter exactly. In particular there is no
+ * backtracking: text after a "*" is matched at its first occurrence only,
+ * so "*ab" does not match "abab". A textbook glob automaton would "fix"
+ * that, and change which files a working config denies or hides.
+ */
+
+#include "filter.h"
+#include "ls.h"
+#include "str.h"
+#include "strlist.h"
+#include "sysutil.h"
+
+/* Each {,} group is compiled once per alternative before it, so several
+ * groups in one filter multiply. Past this many steps we give up and leave
+ * the filter to the interpreter.
+ */
+#define VSF_FILTER_MAX_STEPS    4096
+
+enum EVSFFilterStep
+{
+  /* Text, at the current position if anchored, else at its first
+   * occurrence from there
+   */
+  kVSFFilterText = 1,
+  /* A "?" */
+  kVSFFilterAnyChar,
+  /* A "{" with no "}" after it, which matches itself */
+  kVSFFilterOpenBrace,
+  /* A {,} group: the first alternative matching the rest of the name wins.
+   * Each alternative is compiled with the rest of the filter appended.
+   */
+  kVSFFilterAlternatives,
+  /* End of filter: anything left over fails, unless not anchored (the
+   * filter ended with a "*")
+   */
+  kVSFFilterEnd
+};
+
+struct vsf_filter_step
+{
+  enum EVSFFilterStep type;
+  int anchored;
+  /* Text: offset and length in the text buffer. Alternatives: offset and
+   * count in the alternatives table.
+   */
+  unsigned int start;
+  unsigned int len;
+};
+
+struct vsf_filter
+{
+  struct vsf_filter_step* p_steps;
+  unsigned int num_steps;
+  unsigned int alloc_steps;
+  /* Index of the first step of each alternative */
+  unsigned int* p_alts;
+  unsigned int num_alts;
+  unsigned int alloc_alts;
+  struct mystr text_str;
+  /* Set if compiling gave up; the filter is then interpreted */
+  int is_interpreted;
+  struct mystr filter_str;
+};
+
+static int compile_filter(struct vsf_filter* p_filter,
+                          const struct mystr* p_filter_str);
+static int add_step(struct vsf_filter* p_filter, enum EVSFFilterStep type,
+                    int anchored, unsigned int start, unsigned int len);
+static unsigned int add_alts(struct vsf_filter* p_filter, unsigned int num);
+static int match_steps(const struct vsf_filter* p_filter, unsigned int step,
+                       const char* p_name, unsigned int len);
+
+struct vsf_filter*
+vsf_filter_compile(const struct mystr* p_filter_str)
+{
+  struct vsf_filter* p_filter = vsf_sysutil_malloc(sizeof(*p_filter));
+  vsf_sysutil_memclr(p_filter, sizeof(*p_filter));
+  if (!compile_filter(p_filter, p_filter_str))
+  {
+    p_filter->is_interpreted = 1;
+    str_copy(&p_filter->filter_str, p_filter_str);
+  }
+  return p_filter;
+}
+
+void
+vsf_filter_free(struct vsf_filter* p_filter)
+{
+  if (p_filter == 0)
+  {
+    return;
+  }
+  if (p_filter->p_steps != 0)
+  {
+    vsf_sysutil_free(p_filter->p_steps);
+  }
+  if (p_filter->p_alts != 0)
+  {
+    vsf_sysutil_free(p_filter->p_alts);
+  }
+  str_free(&p_filter->text_str);
+  str_free(&p_filter->filter_str);
+  vsf_sysutil_free(p_filter);
+}
+
+int
+vsf_filter_matches(const struct vsf_filter* p_filter,
+                   const struct mystr* p_filename_str)
+{
+  if (p_filter->is_interpreted)
+  {
+    return vsf_filename_passes_filter(p_filename_str, &p_filter->filter_str);
+  }
+  return match_steps(p_filter, 0, str_getbuf(p_filename_str),
+                     str_getlen(p_filename_str));
+}
+
+static int
+compile_filter(struct vsf_filter* p_filter, const struct mystr* p_filter_str)
+{
+  /* This follows the parsing in vsf_filename_passes_filter() line by line;
+   * see there for what each token means.
+   */
+  struct mystr filter_remain_str = INIT_MYSTR;
+  struct mystr match_needed_str = INIT_MYSTR;
+  struct mystr temp_str = INIT_MYSTR;
+  struct mystr brace_list_str = INIT_MYSTR;
+  struct mystr new_filter_str = INIT_MYSTR;
+  struct mystr_list alt_list = INIT_STRLIST;
+  int ret = 0;
+  char last_token = 0;
+  int must_match_at_current_pos = 1;
+  str_copy(&filter_remain_str, p_filter_str);
+
+  while (!str_isempty(&filter_remain_str))
+  {
+    struct str_locate_result locate_result =
+      str_locate_chars(&filter_remain_str, "*?{");
+    if (locate_result.found)
+    {
+      unsigned int indexx = locate_result.index;
+      str_left(&filter_remain_str, &match_needed_str, indexx);
+      str_mid_to_end(&filter_remain_str, &temp_str, indexx + 1);
+      str_copy(&filter_remain_str, &temp_str);
+      last_token = locate_result.char_found;
+    }
+    else
+    {
+      str_copy(&match_needed_str, &filter_remain_str);
+      str_empty(&filter_remain_str);
+      last_token = 0;
+    }
+    if (!str_isempty(&match_needed_str))
+    {
+      if (!add_step(p_filter, kVSFFilterText, must_match_at_current_pos,
+                    str_getlen(&p_filter->text_str),
+                    str_getlen(&match_needed_str)))
+      {
+        goto out;
+      }
+      str_append_str(&p_filter->text_str, &match_needed_str);
+    }
+    if (last_token == '?')
+    {
+      if (!add_step(p_filter, kVSFFilterAnyChar, 1, 0, 0))
+      {
+        goto out;
+      }
+      must_match_at_current_pos = 1;
+    }
+    else if (last_token == '{')
+    {
+      struct str_locate_result end_brace =
+        str_locate_char(&filter_remain_str, '}');
+      must_match_at_current_pos = 1;
+      if (end_brace.found)
+      {
+        unsigned int alt;
+        unsigned int num_alts;
+        unsigned int first_alt;
+        str_split_char(&filter_remain_str, &temp_str, '}');
+        str_copy(&brace_list_str, &filter_remain_str);
+        str_copy(&filter_remain_str, &temp_str);
+        str_split_char(&brace_list_str, &temp_str, ',');
+        /* As in the interpreter, an empty alternative ends the list */
+        while (!str_isempty(&brace_list_str))
+        {
+          str_copy(&new_filter_str, &brace_list_str);
+          str_append_str(&new_filter_str, &filter_remain_str);
+          str_list_add(&alt_list, &new_filter_str, 0);
+          str_copy(&brace_list_str, &temp_str);
+          str_split_char(&brace_list_str, &temp_str, ',');
+        }
+        num_alts = (unsigned int) str_list_get_length(&alt_list);
+        first_alt = add_alts(p_filter, num_alts);
+        if (!add_step(p_filter, kVSFFilterAlternatives, 1, first_alt,
+                      num_alts))
+        {
+          goto out;
+        }
+        for (alt = 0; alt < num_alts; alt++)
+        {
+          p_filter->p_alts[first_alt + alt] = p_filter->num_steps;
+          if (!compile_filter(p_filter, str_list_get_pstr(&alt_list, alt)))
+          {
+            goto out;
+          }
+        }
+        ret = 1;
+        goto out;
+      }
+      else if (!add_step(p_filter, kVSFFilterOpenBrace, 1, 0, 0))
+      {
+        goto out;
+      }
+    }
+    else
+    {
+      must_match_at_current_pos = 0;
+    }
+  }
+  if (!add_step(p_filter, kVSFFilterEnd, last_token != '*', 0, 0))
+  {
+    goto out;
+  }
+  ret = 1;
+out:
+  str_free(&filter_remain_str);
+  str_free(&match_needed_str);
+  str_free(&temp_str);
+  str_free(&brace_list_str);
+  str_free(&new_filter_str);
+  str_list_free(&alt_list);
+  return ret;
+}
+
+static int
+add_step(struct vsf_filter* p_filter, enum EVSFFilterStep type, int anchored,
+         unsigned int start, unsigned int len)
+{
+  struct vsf_filter_step* p_step;
+  if (p_filter->num_steps == VSF_FILTER_MAX_STEPS)
+  {
+    return 0;
+  }
+  if (p_filter->num_steps == p_filter->alloc_steps)
+  {
+    if (p_filter->alloc_steps == 0)
+    {
+      p_filter->alloc_steps = 16;
+      p_filter->p_steps = vsf_sysutil_malloc(p_filter->alloc_steps *
+                                             sizeof(struct vsf_filter_step));
+    }
+    else
+    {
+      p_filter->alloc_steps *= 2;
+      p_filter->p_steps = vsf_sysutil_realloc(p_filter->p_steps,
+                                              p_filter->alloc_steps *
+                                              sizeof(struct vsf_filter_step));
+    }
+  }
+  p_step = &p_filter->p_steps[p_filter->num_steps++];
+  p_step->type = type;
+  p_step->anchored = anchored;
+  p_step->start = start;
+  p_step->len = len;
+  return 1;
+}
+
+static unsigned int
+add_alts(struct vsf_filter* p_filter, unsigned int num)
+{
+  unsigned int first = p_filter->num_alts;
+  if (num == 0)
+  {
+    return first;
+  }
+  if (p_filter->num_alts + num > p_filter->alloc_alts)
+  {
+    while (p_filter->num_alts + num > p_filter->alloc_alts)
+    {
+      p_filter->alloc_alts = p_filter->alloc_alts ?
+                             p_filter->alloc_alts * 2 : 16;
+    }
+    if (p_filter->p_alts == 0)
+    {
+      p_filter->p_alts = vsf_sysutil_malloc(p_filter->alloc_alts *
+                                            sizeof(unsigned int));
+    }
+    else
+    {
+      p_filter->p_alts = vsf_sysutil_realloc(p_filter->p_alts,
+                                             p_filter->alloc_alts *
+                                             sizeof(unsigned int));
+    }
+  }
+  p_filter->num_alts += num;
+  return first;
+}
+
+static int
+match_steps(const struct vsf_filter* p_filter, unsigned int step,
+            const char* p_name, unsigned int len)
+{
+  const char* p_text = str_getbuf(&p_filter->text_str);
+  while (1)
+  {
+    const struct vsf_filter_step* p_step = &p_filter->p_steps[step++];
+    switch (p_step->type)
+    {
+      case kVSFFilterText:
+      {
+        const char* p_match = p_text + p_step->start;
+        unsigned int i = 0;
+        if (p_step->len > len)
+        {
+          return 0;
+        }
+        /* The first occurrence only - no backtracking */
+        while (p_name[i] != p_match[0] ||
+               vsf_sysutil_memcmp(p_name + i, p_match, p_step->len) != 0)
+        {
+          if (p_step->anchored || i == len - p_step->len)
+          {
+            return 0;
+          }
+          i++;
+        }
+        p_name += i + p_step->len;
+        len -= i + p_step->len;
+        break;
+      }
+      case kVSFFilterAnyChar:
+        if (len == 0)
+        {
+          return 0;
+        }
+        p_name++;
+        len--;
+        break;
+      case kVSFFilterOpenBrace:
+        if (len == 0 || p_name[0] != '{')
+        {
+          return 0;
+        }
+        p_name++;
+        len--;
+        break;
+      case kVSFFilterAlternatives:
+      {
+        unsigned int alt;
+        for (alt = 0; alt < p_step->len; alt++)
+        {
+          if (match_steps(p_filter, p_filter->p_alts[p_step->start + alt],
+                          p_name, len))
+          {
+            return 1;
+          }
+        }
+        return 0;
+      }
+      case kVSFFilterEnd:
+      default:
+        return len == 0 || !p_step->anchored;
+    }
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef VSF_FILTER_H
+#define VSF_FILTER_H
+
+struct mystr;
+struct vsf_filter;
+
+/* vsf_filter_compile()
+ * PURPOSE
+ * Compile a filter string, as understood by vsf_filename_passes_filter(),
+ * into a list of match steps, so that the filter is parsed once rather than
+ * once per filename it is tried against.
+ * PARAMETERS
+ * p_filter_str - the filter to compile
+ * RETURNS
+ * The compiled filter.
+ */
+struct vsf_filter* vsf_filter_compile(const struct mystr* p_filter_str);
+
+/* vsf_filter_free()
+ * PURPOSE
+ * Free a filter made by vsf_filter_compile().
+ * PARAMETERS
+ * p_filter     - the filter to free, or null
+ */
+void vsf_filter_free(struct vsf_filter* p_filter);
+
+/* vsf_filter_matches()
+ * PURPOSE
+ * Match a filename against a compiled filter. The result is always that of
+ * vsf_filename_passes_filter() on the original filter string, quirks and
+ * all.
+ * PARAMETERS
+ * p_filter       - the compiled filter
+ * p_filename_str - the filename to match
+ * RETURNS
+ * Returns 1 if there is a match, 0 otherwise.
+ */
+int vsf_filter_matches(const struct vsf_filter* p_filter,
+                       const struct mystr* p_filename_str);
+
+#endif /* VSF_FILTER_H */
+
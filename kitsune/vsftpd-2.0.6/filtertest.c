@@ -0,0 +1,173 @@
+/*
+ * Part of Very Secure FTPd
+ * Licence: GPL v2
+ * Author: Chris Evans
+ * filtertest.c
+ *
+ * Differential test for filter.c: every compiled filter must give the same
+ * answer as vsf_filename_passes_filter() on the string it was compiled from.
+ * Run with "make filtertest"; exits non-zero on the first disagreement.
+ */
+
+#include "filter.h"
+#include "ls.h"
+#include "str.h"
+
+#include <stdio.h>
+
+/* Random filters and names are drawn from these. The filter alphabet has
+ * every token the parser knows about, and the name alphabet includes the
+ * braces and comma so that literal and unterminated braces get exercised.
+ */
+static const char k_filter_chars[] = "ab*?{},.";
+static const char k_name_chars[] = "ab{},.";
+
+#define FILTERTEST_RANDOM_FILTERS   200000
+#define FILTERTEST_NAMES_PER_FILTER 8
+#define FILTERTEST_MAX_LEN          12
+
+static const char* k_filters[] =
+{
+  "",
+  "*",
+  "**",
+  "?",
+  "???",
+  "*?*",
+  "?*?",
+  "a*b",
+  "*ab",
+  "ab*",
+  "a?b*",
+  "*.mp3",
+  /* Brace groups, including empty alternatives and nesting after a "*" */
+  "{a,b}",
+  "{a,b}*",
+  "*{a,b}",
+  "{a,,b}",
+  "{,a}",
+  "{}",
+  "x{a,b}y{c,d}z",
+  "*{.mp3,.avi}",
+  "{*.mp3,*.avi,core}",
+  "{a*,*b}?",
+  "{a,b{c,d}",
+  /* Unterminated "{", which matches a literal "{" */
+  "{",
+  "a{",
+  "{ab",
+  "*{*",
+  "?{?",
+  "a}b",
+  /* Each group multiplies the steps of the rest of the filter, so this one
+   * goes over VSF_FILTER_MAX_STEPS and is left to the interpreter.
+   */
+  "{a,b,c,d}{a,b,c,d}{a,b,c,d}{a,b,c,d}{a,b,c,d}{a,b,c,d}{a,b,c,d}x",
+  "*{a,b,c,d}*{a,b,c,d}*{a,b,c,d}*{a,b,c,d}*{a,b,c,d}*{a,b,c,d}*{a,b,c,d}*"
+};
+
+static const char* k_names[] =
+{
+  "",
+  "a",
+  "b",
+  "ab",
+  "abab",
+  "aab",
+  "x.mp3",
+  "core",
+  "{",
+  "a{",
+  "{ab",
+  "a}b",
+  "xaybz",
+  "xbydz",
+  "abcdabcx",
+  "dddddddx",
+  "abcdabc",
+  "aabbccddaabbccdd"
+};
+
+static unsigned int s_seed = 1;
+
+static unsigned int
+next_rand(void)
+{
+  s_seed = s_seed * 1103515245 + 12345;
+  return (s_seed >> 16) & 0x7fff;
+}
+
+static void
+random_str(struct mystr* p_str, const char* p_chars, unsigned int num_chars)
+{
+  char buf[FILTERTEST_MAX_LEN + 1];
+  unsigned int len = next_rand() % (FILTERTEST_MAX_LEN + 1);
+  unsigned int i;
+  for (i = 0; i < len; i++)
+  {
+    buf[i] = p_chars[next_rand() % num_chars];
+  }
+  buf[len] = '\0';
+  str_alloc_text(p_str, buf);
+}
+
+static int
+check(const struct vsf_filter* p_filter, const struct mystr* p_filter_str,
+      const struct mystr* p_name_str)
+{
+  int expected = vsf_filename_passes_filter(p_name_str, p_filter_str);
+  int got = vsf_filter_matches(p_filter, p_name_str);
+  if (expected != got)
+  {
+    printf("filter \"%s\" name \"%s\": interpreted %d, compiled %d\n",
+           str_getbuf(p_filter_str), str_getbuf(p_name_str), expected, got);
+    return 0;
+  }
+  return 1;
+}
+
+int
+main(void)
+{
+  struct mystr filter_str = INIT_MYSTR;
+  struct mystr name_str = INIT_MYSTR;
+  unsigned int num_checks = 0;
+  unsigned int i;
+  unsigned int j;
+  for (i = 0; i < sizeof(k_filters) / sizeof(k_filters[0]); i++)
+  {
+    struct vsf_filter* p_filter;
+    str_alloc_text(&filter_str, k_filters[i]);
+    p_filter = vsf_filter_compile(&filter_str);
+    for (j = 0; j < sizeof(k_names) / sizeof(k_names[0]); j++)
+    {
+      str_alloc_text(&name_str, k_names[j]);
+      if (!check(p_filter, &filter_str, &name_str))
+      {
+        return 1;
+      }
+      num_checks++;
+    }
+    vsf_filter_free(p_filter);
+  }
+  for (i = 0; i < FILTERTEST_RANDOM_FILTERS; i++)
+  {
+    struct vsf_filter* p_filter;
+    random_str(&filter_str, k_filter_chars, sizeof(k_filter_chars) - 1);
+    p_filter = vsf_filter_compile(&filter_str);
+    for (j = 0; j < FILTERTEST_NAMES_PER_FILTER; j++)
+    {
+      random_str(&name_str, k_name_chars, sizeof(k_name_chars) - 1);
+      if (!check(p_filter, &filter_str, &name_str))
+      {
+        return 1;
+      }
+      num_checks++;
+    }
+    vsf_filter_free(p_filter);
+  }
+  str_free(&filter_str);
+  str_free(&name_str);
+  printf("filtertest: %u checks passed\n", num_checks);
+  return 0;
+}
@@ -19,6 +19,7 @@
 #include "logging.h"
 #include "session.h"
 #include "readwrite.h"
+#include "stats.h"
 
 /* Internal functions */
 static void control_getline(struct mystr* p_str, struct vsf_session* p_sess);
@@ -169,11 +170,19 @@ vsf_cmdio_get_cmd_and_arg(struct vsf_session* p_sess, struct mystr* p_cmd_str,
   if (set_alarm)
   {
     vsf_cmdio_set_alarm(p_sess);
+    /* Reading the next command from the main loop means the last one is
+     * done. Don't do this for an ABOR read in the middle of a transfer!
+     */
+    vsf_stats_cmd_end();
   }
   /* Blocks */
   control_getline(p_cmd_str, p_sess);
   str_split_char(p_cmd_str, p_arg_str, ' ');
   str_upper(p_cmd_str);
+  if (set_alarm)
+  {
+    vsf_stats_cmd_start(p_cmd_str, p_arg_str);
+  }
   if (tunable_log_ftp_protocol)
   {
     static struct mystr s_log_str;
@@ -1,6 +1,7 @@
 #ifndef VSF_FTPCODES_H
 #define VSF_FTPCODES_H
 
+#define FTP_DATACONN_OPEN     125
 #define FTP_DATACONN          150
 
 #define FTP_NOOPOK            200
@@ -15,12 +16,14 @@
 #define FTP_PBSZOK            200
 #define FTP_PROTOK            200
 #define FTP_OPTSOK            200
+#define FTP_ALLOSPACEOK       200
 #define FTP_ALLOOK            202
 #define FTP_FEAT              211
 #define FTP_STATOK            211
 #define FTP_SIZEOK            213
 #define FTP_MDTMOK            213
 #define FTP_STATFILE_OK       213
+#define FTP_HASHOK            213
 #define FTP_SITEHELP          214
 #define FTP_HELP              214
 #define FTP_SYSTOK            215
@@ -37,12 +40,15 @@
 #define FTP_RMDIROK           250
 #define FTP_DELEOK            250
 #define FTP_RENAMEOK          250
+#define FTP_CHECKSUMOK        250
+#define FTP_COPYOK            250
 #define FTP_PWDOK             257
 #define FTP_MKDIROK           257
 
 #define FTP_GIVEPWORD         331
 #define FTP_RESTOK            350
 #define FTP_RNFROK            350
+#define FTP_CPFROK            350
 
 #define FTP_IDLE_TIMEOUT      421
 #define FTP_DATA_TIMEOUT      421
@@ -59,6 +65,7 @@
 #define FTP_COMMANDNOTIMPL    502
 #define FTP_NEEDUSER          503
 #define FTP_NEEDRNFR          503
+#define FTP_NEEDCPFR          503
 #define FTP_BADPBSZ           503
 #define FTP_BADPROT           503
 #define FTP_BADSTRU           504
@@ -29,18 +29,70 @@
 #include "ls.h"
 #include "ssl.h"
 #include "readwrite.h"
+#include "zlibio.h"
+#include "stats.h"
+#include "dlheat.h"
+
+/* One level of a recursive (LIST -R) directory walk: the directory's path
+ * and the subdirectories of it we have yet to visit.
+ */
+struct dir_walk_level
+{
+  struct mystr base_str;
+  struct mystr_list subdir_list;
+  unsigned int next_index;
+};
+
+/* Upload write-behind: what has been written since we last pushed a batch
+ * out to disk, and the batch before that, which we drop from the cache once
+ * it is on disk.
+ */
+struct write_behind
+{
+  int enabled;
+  filesize_t pending;
+  filesize_t prev_start;
+  filesize_t prev_len;
+};
+
+/* MODE B (RFC 959 block mode): each block is a descriptor byte and a 16 bit
+ * byte count, then that many bytes of data. A file ends with a block marked
+ * EOF, after which the connection is free for the next transfer.
+ */
+#define VSF_BLOCK_HEADER_LEN    3
+#define VSF_BLOCK_MAX_LEN       65535
+#define VSF_BLOCK_DESC_EOF      64
+#define VSF_BLOCK_DESC_RESTART  16
 
 static void init_data_sock_params(struct vsf_session* p_sess, int sock_fd);
+static void size_sock_buffers(struct vsf_session* p_sess, int sock_fd);
+static unsigned int get_sockbuf_size(struct vsf_session* p_sess,
+                                     unsigned int rtt_usec);
+static int set_sockbuf_if_smaller(int sock_fd, int is_recv, unsigned int size);
 static filesize_t calc_num_send(int file_fd, filesize_t init_offset);
+static int is_stream_download(int file_fd, filesize_t bytes_to_send);
 static struct vsf_transfer_ret do_file_send_sendfile(
   struct vsf_session* p_sess, int net_fd, int file_fd,
   filesize_t curr_file_offset, filesize_t bytes_to_send);
 static struct vsf_transfer_ret do_file_send_rwloop(
-  struct vsf_session* p_sess, int file_fd, int is_ascii);
+  struct vsf_session* p_sess, int file_fd, int is_ascii,
+  struct vsf_zlib_stream* p_zstream, filesize_t max_send);
 static struct vsf_transfer_ret do_file_recv(
-  struct vsf_session* p_sess, int file_fd, int is_ascii);
-static void handle_sigalrm(void* p_private);
-static void start_data_alarm(struct vsf_session* p_sess);
+  struct vsf_session* p_sess, int file_fd, int is_ascii,
+  struct vsf_zlib_stream* p_zstream);
+static int recv_store(int file_fd, char* p_buf, unsigned int len,
+                      int is_ascii, int* p_prev_cr,
+                      struct write_behind* p_wb);
+static void write_behind(int file_fd, struct write_behind* p_wb,
+                         unsigned int len);
+static int deflate_write(struct vsf_session* p_sess,
+                         struct vsf_zlib_stream* p_zstream,
+                         const char* p_buf, unsigned int len, int finish);
+static int write_dir_str(struct vsf_session* p_sess,
+                         const struct mystr* p_str, enum EVSFRWTarget target);
+static int write_dir_sink(void* p_private, const char* p_buf,
+                          unsigned int len);
+static void start_data_timeout(void);
 static void handle_io(int retval, int fd, void* p_private);
 static int transfer_dir_internal(
   struct vsf_session* p_sess, int is_control, struct vsf_sysutil_dir* p_dir,
@@ -49,7 +101,40 @@ static int transfer_dir_internal(
 static int write_dir_list(struct vsf_session* p_sess,
                           struct mystr_list* p_dir_list,
                           enum EVSFRWTarget target);
-static unsigned int get_chunk_size();
+static int write_one_dir(struct vsf_session* p_sess,
+                         enum EVSFRWTarget target,
+                         struct vsf_sysutil_dir* p_dir,
+                         struct mystr_list* p_subdir_list,
+                         const struct mystr* p_base_dir_str,
+                         const struct mystr* p_option_str,
+                         const struct mystr* p_filter_str,
+                         int is_verbose);
+static void push_dir_walk_level(struct dir_walk_level** p_p_levels,
+                                unsigned int* p_num_levels,
+                                unsigned int* p_alloc_levels,
+                                const struct mystr* p_base_dir_str,
+                                struct mystr_list* p_subdir_list);
+static unsigned int get_chunk_size(int is_send);
+static int data_write(struct vsf_session* p_sess, const char* p_buf,
+                      unsigned int len);
+static int data_read(struct vsf_session* p_sess, char* p_buf,
+                     unsigned int len);
+static int block_write(struct vsf_session* p_sess, const char* p_buf,
+                       unsigned int len, unsigned char desc);
+static int block_read_exact(struct vsf_session* p_sess, char* p_buf,
+                            unsigned int len);
+static int block_sendfile(int net_fd, int file_fd, filesize_t* p_offset,
+                          filesize_t num_send, unsigned int max_chunk);
+static void fill_block_header(char* p_header, unsigned char desc,
+                              unsigned int len);
+
+/* The MODE Z compressor for the directory listing in progress, if any */
+static struct vsf_zlib_stream* s_p_dir_zstream;
+/* MODE B receive state: what is left of the current block, and whether it is
+ * the last of the file
+ */
+static unsigned int s_block_left;
+static int s_block_is_last;
 
 void
 vsf_ftpdataio_dispose_transfer_fd(struct vsf_session* p_sess)
@@ -59,14 +144,14 @@ vsf_ftpdataio_dispose_transfer_fd(struct vsf_session* p_sess)
   {
     bug("no data descriptor in vsf_ftpdataio_dispose_transfer_fd");
   }
-  /* Reset the data connection alarm so it runs anew with the blocking close */
-  start_data_alarm(p_sess);
   vsf_sysutil_uninstall_io_handler();
   if (p_sess->p_data_ssl != 0)
   {
     ssl_data_close(p_sess);
   }
-  /* This close() blocks because we set SO_LINGER */
+  /* This close() blocks because we set SO_LINGER, for at most the data
+   * connection timeout
+   */
   retval = vsf_sysutil_close_failok(p_sess->data_fd);
   if (vsf_sysutil_retval_is_error(retval))
   {
@@ -74,10 +159,48 @@ vsf_ftpdataio_dispose_transfer_fd(struct vsf_session* p_sess)
     vsf_sysutil_deactivate_linger_failok(p_sess->data_fd);
     (void) vsf_sysutil_close_failok(p_sess->data_fd);
   }
-  vsf_sysutil_clear_alarm();
   p_sess->data_fd = -1;
 }
 
+int
+vsf_ftpdataio_finish_transfer(struct vsf_session* p_sess, int is_send,
+                              int succeeded)
+{
+  int retval = 0;
+  if (p_sess->is_block_mode && succeeded && !p_sess->abor_received)
+  {
+    if (!is_send || block_write(p_sess, 0, 0, VSF_BLOCK_DESC_EOF) == 0)
+    {
+      /* Idle until the next transfer; nothing reads or writes it meanwhile,
+       * so its timeouts can't trigger
+       */
+      vsf_sysutil_uninstall_io_handler();
+      return 0;
+    }
+    retval = -1;
+  }
+  vsf_ftpdataio_dispose_transfer_fd(p_sess);
+  return retval;
+}
+
+void
+vsf_ftpdataio_reuse_kept_fd(struct vsf_session* p_sess)
+{
+  vsf_sysutil_install_io_handler(handle_io, p_sess);
+  start_data_timeout();
+}
+
+void
+vsf_ftpdataio_close_kept_fd(struct vsf_session* p_sess)
+{
+  if (p_sess->data_fd != -1)
+  {
+    /* The dispose expects the handler a transfer leaves installed */
+    vsf_sysutil_install_io_handler(handle_io, p_sess);
+    vsf_ftpdataio_dispose_transfer_fd(p_sess);
+  }
+}
+
 int
 vsf_ftpdataio_get_pasv_fd(struct vsf_session* p_sess)
 {
@@ -169,25 +292,14 @@ vsf_ftpdataio_post_mark_connect(struct vsf_session* p_sess)
 }
 
 static void
-handle_sigalrm(void* p_private)
-{
-  struct vsf_session* p_sess = (struct vsf_session*) p_private;
-  if (!p_sess->data_progress)
-  {
-    vsf_cmdio_write_exit(p_sess, FTP_DATA_TIMEOUT,
-                         "Data timeout. Reconnect. Sorry.");
-  }
-  p_sess->data_progress = 0;
-  start_data_alarm(p_sess);
-}
-
-void
-start_data_alarm(struct vsf_session* p_sess)
+start_data_timeout(void)
 {
+  /* The data connection's own timeouts watch for a stall from here on, so
+   * the idle session alarm mustn't cut short a long transfer
+   */
   if (tunable_data_connection_timeout > 0)
   {
-    vsf_sysutil_install_sighandler(kVSFSysUtilSigALRM, handle_sigalrm, p_sess);
-    vsf_sysutil_set_alarm(tunable_data_connection_timeout);
+    vsf_sysutil_clear_alarm();
   }
 }
 
@@ -199,17 +311,118 @@ init_data_sock_params(struct vsf_session* p_sess, int sock_fd)
     bug("data descriptor still present in init_data_sock_params");
   }
   p_sess->data_fd = sock_fd;
-  p_sess->data_progress = 0;
   vsf_sysutil_activate_keepalive(sock_fd);
   /* And in the vague hope it might help... */
   vsf_sysutil_set_iptos_throughput(sock_fd);
+  size_sock_buffers(p_sess, sock_fd);
   /* Set up lingering, so that we wait for all data to transfer, and report
    * more accurate transfer rates.
    */
-  vsf_sysutil_activate_linger(sock_fd);
-  /* Start the timeout monitor */
+  vsf_sysutil_activate_linger(sock_fd, tunable_data_connection_timeout);
+  /* Start the timeout monitor. The kernel keeps the deadline: a read, write
+   * or sendfile that moves nothing for the whole timeout fails with EAGAIN,
+   * which handle_io() turns into the data timeout. A transfer that is
+   * moving costs nothing extra, with no timer to re-arm and no signal
+   * interrupting the copy.
+   */
+  vsf_sysutil_set_io_timeout(sock_fd, tunable_data_connection_timeout);
   vsf_sysutil_install_io_handler(handle_io, p_sess);
-  start_data_alarm(p_sess);
+  start_data_timeout();
+}
+
+void
+vsf_ftpdataio_size_listen_buffer(struct vsf_session* p_sess, int listen_fd)
+{
+  /* An accepted connection starts out with the listening socket's receive
+   * buffer, and the window it offers in the handshake comes from that. The
+   * data connection's round trip time isn't known yet, so go by the control
+   * connection's.
+   */
+  unsigned int size;
+  if (!tunable_sockbuf_autotune_enable)
+  {
+    return;
+  }
+  size = get_sockbuf_size(p_sess, vsf_sysutil_get_tcp_rtt(VSFTP_COMMAND_FD));
+  if (size > 0)
+  {
+    (void) set_sockbuf_if_smaller(listen_fd, 1, size);
+  }
+}
+
+static void
+size_sock_buffers(struct vsf_session* p_sess, int sock_fd)
+{
+  unsigned int rtt_usec;
+  unsigned int size;
+  int is_set;
+  if (tunable_tcp_notsent_lowat > 0)
+  {
+    vsf_sysutil_set_notsent_lowat(sock_fd, tunable_tcp_notsent_lowat);
+  }
+  if (!tunable_sockbuf_autotune_enable)
+  {
+    return;
+  }
+  rtt_usec = vsf_sysutil_get_tcp_rtt(sock_fd);
+  size = get_sockbuf_size(p_sess, rtt_usec);
+  if (size == 0)
+  {
+    vsf_stats_data_sockbuf(rtt_usec, 0);
+    return;
+  }
+  is_set = set_sockbuf_if_smaller(sock_fd, 0, size);
+  is_set |= set_sockbuf_if_smaller(sock_fd, 1, size);
+  vsf_stats_data_sockbuf(rtt_usec, is_set ? size : 0);
+}
+
+static unsigned int
+get_sockbuf_size(struct vsf_session* p_sess, unsigned int rtt_usec)
+{
+  /* Size the buffers to the bandwidth delay product of a connection, going
+   * by the round trip time its handshake measured: big enough to keep a
+   * long, fat link full, but no bigger, so that the many slow or nearby
+   * sessions on a busy box don't tie up memory they can't use.
+   */
+  filesize_t rate = tunable_sockbuf_link_rate;
+  filesize_t size;
+  if (p_sess->bw_rate_max > 0 &&
+      (rate == 0 || (filesize_t) p_sess->bw_rate_max < rate))
+  {
+    rate = p_sess->bw_rate_max;
+  }
+  if (rtt_usec == 0 || rate == 0)
+  {
+    return 0;
+  }
+  /* Twice the product leaves the congestion window room to grow */
+  size = rate * rtt_usec / 1000000 * 2;
+  if (size < VSFTP_DATA_BUFSIZE)
+  {
+    size = VSFTP_DATA_BUFSIZE;
+  }
+  if (tunable_sockbuf_max_size > 0 && size > tunable_sockbuf_max_size)
+  {
+    size = tunable_sockbuf_max_size;
+  }
+  return (unsigned int) size;
+}
+
+static int
+set_sockbuf_if_smaller(int sock_fd, int is_recv, unsigned int size)
+{
+  /* Setting a buffer size stops the kernel growing that buffer by itself,
+   * for the life of the socket. That is the point when we want less than
+   * it would give a connection, but if it might give more, leave it be.
+   * The kernel doubles what we ask for, to allow for its own overhead.
+   */
+  unsigned int autotune_max = vsf_sysutil_get_tcp_autotune_max(is_recv);
+  if (autotune_max == 0 || size >= autotune_max / 2)
+  {
+    return 0;
+  }
+  vsf_sysutil_set_sockbuf_size(sock_fd, is_recv, size);
+  return 1;
 }
 
 static void
@@ -222,13 +435,25 @@ handle_io(int retval, int fd, void* p_private)
   double pause_time;
   double rate_ratio;
   struct vsf_session* p_sess = (struct vsf_session*) p_private;
-  if (p_sess->data_fd != fd || vsf_sysutil_retval_is_error(retval) ||
-      retval == 0)
+  if (p_sess->data_fd != fd)
   {
     return;
   }
-  /* Note that the session hasn't stalled, i.e. don't time it out */
-  p_sess->data_progress = 1;
+  if (vsf_sysutil_retval_is_error(retval))
+  {
+    /* Nothing moved before the socket timeout ran out, i.e. stalled */
+    if (vsf_sysutil_get_error() == kVSFSysUtilErrAGAIN)
+    {
+      vsf_cmdio_write_exit(p_sess, FTP_DATA_TIMEOUT,
+                           "Data timeout. Reconnect. Sorry.");
+    }
+    return;
+  }
+  if (retval == 0)
+  {
+    return;
+  }
+  vsf_stats_data_progress((unsigned int) retval);
   /* Apply bandwidth quotas via a little pause, if necessary */
   if (p_sess->bw_rate_max == 0)
   {
@@ -269,8 +494,23 @@ vsf_ftpdataio_transfer_dir(struct vsf_session* p_sess, int is_control,
                            const struct mystr* p_filter_str,
                            int is_verbose)
 {
-  return transfer_dir_internal(p_sess, is_control, p_dir, p_base_dir_str,
-                               p_option_str, p_filter_str, is_verbose);
+  int retval;
+  if (!is_control && p_sess->is_deflate)
+  {
+    s_p_dir_zstream = zlib_deflate_new(p_sess->deflate_level);
+  }
+  retval = transfer_dir_internal(p_sess, is_control, p_dir, p_base_dir_str,
+                                 p_option_str, p_filter_str, is_verbose);
+  if (s_p_dir_zstream)
+  {
+    if (retval == 0 && deflate_write(p_sess, s_p_dir_zstream, 0, 0, 1) != 0)
+    {
+      retval = -1;
+    }
+    zlib_stream_free(s_p_dir_zstream);
+    s_p_dir_zstream = 0;
+  }
+  return retval;
 }
 
 static int
@@ -281,10 +521,18 @@ transfer_dir_internal(struct vsf_session* p_sess, int is_control,
                       const struct mystr* p_filter_str,
                       int is_verbose)
 {
-  struct mystr_list dir_list = INIT_STRLIST;
+  /* A recursive listing is walked iteratively. Each directory is listed,
+   * written out and its listing freed before we descend, so all we keep
+   * around is the stack of not-yet-visited subdirectory names - i.e. the
+   * frontier of the walk. The output order is exactly that of the old
+   * depth-first recursion.
+   */
+  struct dir_walk_level* p_levels = 0;
+  unsigned int num_levels = 0;
+  unsigned int alloc_levels = 0;
   struct mystr_list subdir_list = INIT_STRLIST;
-  struct mystr dir_prefix_str = INIT_MYSTR;
-  struct mystr_list* p_subdir_list = 0;
+  struct mystr sub_str = INIT_MYSTR;
+  struct mystr sep_str = INIT_MYSTR;
   struct str_locate_result loc_result = str_locate_char(p_option_str, 'R');
   int failed = 0;
   enum EVSFRWTarget target = kVSFRWData;
@@ -292,151 +540,311 @@ transfer_dir_internal(struct vsf_session* p_sess, int is_control,
   {
     target = kVSFRWControl;
   }
-  if (loc_result.found && tunable_ls_recurse_enable)
+  if (!loc_result.found || !tunable_ls_recurse_enable)
   {
-    p_subdir_list = &subdir_list;
+    return write_one_dir(p_sess, target, p_dir, 0, p_base_dir_str,
+                         p_option_str, p_filter_str, is_verbose);
+  }
+  failed = write_one_dir(p_sess, target, p_dir, &subdir_list, p_base_dir_str,
+                         p_option_str, p_filter_str, is_verbose);
+  if (!failed)
+  {
+    push_dir_walk_level(&p_levels, &num_levels, &alloc_levels,
+                        p_base_dir_str, &subdir_list);
+  }
+  str_alloc_text(&sep_str, "\r\n");
+  while (!failed && num_levels > 0)
+  {
+    struct dir_walk_level* p_level = &p_levels[num_levels - 1];
+    struct vsf_sysutil_dir* p_subdir;
+    const struct mystr* p_subdir_str;
+    if (p_level->next_index ==
+        (unsigned int) str_list_get_length(&p_level->subdir_list))
+    {
+      str_free(&p_level->base_str);
+      str_list_free(&p_level->subdir_list);
+      num_levels--;
+      continue;
+    }
+    p_subdir_str = str_list_get_pstr(&p_level->subdir_list,
+                                     p_level->next_index);
+    p_level->next_index++;
+    if (str_equal_text(p_subdir_str, ".") ||
+        str_equal_text(p_subdir_str, ".."))
+    {
+      continue;
+    }
+    str_copy(&sub_str, &p_level->base_str);
+    str_append_char(&sub_str, '/');
+    str_append_str(&sub_str, p_subdir_str);
+    p_subdir = str_opendir(&sub_str);
+    if (p_subdir == 0)
+    {
+      /* Unreadable, gone missing, etc. - no matter */
+      continue;
+    }
+    if (write_dir_str(p_sess, &sep_str, target) != 0)
+    {
+      failed = 1;
+    }
+    else
+    {
+      failed = write_one_dir(p_sess, target, p_subdir, &subdir_list, &sub_str,
+                             p_option_str, p_filter_str, is_verbose);
+    }
+    vsf_sysutil_closedir(p_subdir);
+    if (!failed)
+    {
+      /* Note - may move p_levels, so p_level is stale after this */
+      push_dir_walk_level(&p_levels, &num_levels, &alloc_levels, &sub_str,
+                          &subdir_list);
+    }
   }
+  while (num_levels > 0)
+  {
+    num_levels--;
+    str_free(&p_levels[num_levels].base_str);
+    str_list_free(&p_levels[num_levels].subdir_list);
+  }
+  if (p_levels)
+  {
+    vsf_sysutil_free(p_levels);
+  }
+  str_list_free(&subdir_list);
+  str_free(&sub_str);
+  str_free(&sep_str);
+  if (!failed)
+  {
+    return 0;
+  }
+  else
+  {
+    return -1;
+  }
+}
+
+static int
+write_one_dir(struct vsf_session* p_sess, enum EVSFRWTarget target,
+              struct vsf_sysutil_dir* p_dir,
+              struct mystr_list* p_subdir_list,
+              const struct mystr* p_base_dir_str,
+              const struct mystr* p_option_str,
+              const struct mystr* p_filter_str,
+              int is_verbose)
+{
+  /* Lists a single directory and writes it out, preceded by the "dir:"
+   * header if we are recursing (p_subdir_list != 0). The listing itself
+   * is freed before returning.
+   */
+  struct mystr_list dir_list = INIT_STRLIST;
+  int failed = 0;
   vsf_ls_populate_dir_list(&dir_list, p_subdir_list, p_dir, p_base_dir_str,
                            p_option_str, p_filter_str, is_verbose);
   if (p_subdir_list)
   {
-    int retval;
+    struct mystr dir_prefix_str = INIT_MYSTR;
     str_copy(&dir_prefix_str, p_base_dir_str);
     str_append_text(&dir_prefix_str, ":\r\n");
-    retval = ftp_write_str(p_sess, &dir_prefix_str, target);
-    if (retval != 0)
+    if (write_dir_str(p_sess, &dir_prefix_str, target) != 0)
     {
       failed = 1;
     }
+    str_free(&dir_prefix_str);
   }
   if (!failed)
   {
     failed = write_dir_list(p_sess, &dir_list, target);
   }
-  /* Recurse into the subdirectories if required... */
-  if (!failed)
-  {
-    struct mystr sub_str = INIT_MYSTR;
-    unsigned int num_subdirs = str_list_get_length(&subdir_list);
-    unsigned int subdir_index;
-    for (subdir_index = 0; subdir_index < num_subdirs; subdir_index++)
-    {
-      int retval;
-      struct vsf_sysutil_dir* p_subdir;
-      const struct mystr* p_subdir_str = 
-        str_list_get_pstr(&subdir_list, subdir_index);
-      if (str_equal_text(p_subdir_str, ".") ||
-          str_equal_text(p_subdir_str, ".."))
-      {
-        continue;
-      }
-      str_copy(&sub_str, p_base_dir_str);
-      str_append_char(&sub_str, '/');
-      str_append_str(&sub_str, p_subdir_str);
-      p_subdir = str_opendir(&sub_str);
-      if (p_subdir == 0)
-      {
-        /* Unreadable, gone missing, etc. - no matter */
-        continue;
-      }
-      str_alloc_text(&dir_prefix_str, "\r\n");
-      retval = ftp_write_str(p_sess, &dir_prefix_str, target);
-      if (retval != 0)
-      {
-        failed = 1;
-        break;
-      }
-      retval = transfer_dir_internal(p_sess, is_control, p_subdir, &sub_str,
-                                     p_option_str, p_filter_str, is_verbose);
-      vsf_sysutil_closedir(p_subdir);
-      if (retval != 0)
-      {
-        failed = 1;
-        break;
-      }
-    }
-    str_free(&sub_str);
-  }
   str_list_free(&dir_list);
-  str_list_free(&subdir_list);
-  str_free(&dir_prefix_str);
-  if (!failed)
+  return failed;
+}
+
+static void
+push_dir_walk_level(struct dir_walk_level** p_p_levels,
+                    unsigned int* p_num_levels, unsigned int* p_alloc_levels,
+                    const struct mystr* p_base_dir_str,
+                    struct mystr_list* p_subdir_list)
+{
+  /* Takes ownership of the contents of p_subdir_list, leaving it empty */
+  static struct mystr_list s_empty_list = INIT_STRLIST;
+  static struct mystr s_empty_str = INIT_MYSTR;
+  struct dir_walk_level* p_level;
+  if (str_list_get_length(p_subdir_list) == 0)
   {
-    return 0;
+    str_list_free(p_subdir_list);
+    return;
   }
-  else
+  if (*p_num_levels == *p_alloc_levels)
   {
-    return -1;
+    if (*p_alloc_levels == 0)
+    {
+      *p_alloc_levels = 8;
+      *p_p_levels = vsf_sysutil_malloc(*p_alloc_levels *
+                                       sizeof(struct dir_walk_level));
+    }
+    else
+    {
+      *p_alloc_levels *= 2;
+      *p_p_levels = vsf_sysutil_realloc(*p_p_levels,
+                                        *p_alloc_levels *
+                                        sizeof(struct dir_walk_level));
+    }
   }
+  p_level = &(*p_p_levels)[*p_num_levels];
+  p_level->base_str = s_empty_str;
+  str_copy(&p_level->base_str, p_base_dir_str);
+  p_level->subdir_list = *p_subdir_list;
+  p_level->next_index = 0;
+  *p_subdir_list = s_empty_list;
+  (*p_num_levels)++;
 }
 
-/* XXX - really, this should be refactored into a "buffered writer" object */
 static int
 write_dir_list(struct vsf_session* p_sess, struct mystr_list* p_dir_list,
                enum EVSFRWTarget target)
 {
   /* This function writes out a list of strings to the client, over the
-   * data socket. We now coalesce the strings into fewer write() syscalls,
-   * which saved 33% CPU time writing a large directory.
+   * data socket. We coalesce the strings into fewer write() syscalls, which
+   * saved 33% CPU time writing a large directory; on a plain socket the
+   * buffered writer gathers them straight from the list with writev(),
+   * rather than copying them into a buffer first.
    */
   int retval = 0;
   unsigned int dir_index_max = str_list_get_length(p_dir_list);
   unsigned int dir_index;
-  struct mystr buf_str = INIT_MYSTR;
-  str_reserve(&buf_str, VSFTP_DIR_BUFSIZE);
+  struct vsf_rwbuf rwbuf;
+  ftp_rwbuf_init(&rwbuf, p_sess, target);
+  if (target == kVSFRWData && (s_p_dir_zstream || p_sess->is_block_mode))
+  {
+    ftp_rwbuf_set_sink(&rwbuf, write_dir_sink, p_sess);
+  }
   for (dir_index = 0; dir_index < dir_index_max; dir_index++)
   {
-    str_append_str(&buf_str, str_list_get_pstr(p_dir_list, dir_index));
-    if (dir_index == dir_index_max - 1 ||
-        str_getlen(&buf_str) +
-          str_getlen(str_list_get_pstr(p_dir_list, dir_index + 1)) >
-            VSFTP_DIR_BUFSIZE)
+    if (ftp_rwbuf_add_str(&rwbuf, str_list_get_pstr(p_dir_list, dir_index))
+        != 0)
     {
-      /* Writeout needed - we're either at the end, or we filled the buffer */
-      int writeret = ftp_write_str(p_sess, &buf_str, target);
-      if (writeret != 0)
-      {
-        retval = 1;
-        break;
-      }
-      str_empty(&buf_str);
+      retval = 1;
+      break;
     }
   }
-  str_free(&buf_str);
+  if (retval == 0 && ftp_rwbuf_flush(&rwbuf) != 0)
+  {
+    retval = 1;
+  }
+  ftp_rwbuf_free(&rwbuf);
   return retval;
 }
 
+static int
+write_dir_str(struct vsf_session* p_sess, const struct mystr* p_str,
+              enum EVSFRWTarget target)
+{
+  if (target == kVSFRWData && (s_p_dir_zstream || p_sess->is_block_mode))
+  {
+    return write_dir_sink(p_sess, str_getbuf(p_str), str_getlen(p_str));
+  }
+  return ftp_write_str(p_sess, p_str, target);
+}
+
+static int
+write_dir_sink(void* p_private, const char* p_buf, unsigned int len)
+{
+  /* Listing output that has to be compressed or framed on its way */
+  struct vsf_session* p_sess = (struct vsf_session*) p_private;
+  if (s_p_dir_zstream)
+  {
+    return deflate_write(p_sess, s_p_dir_zstream, p_buf, len, 0);
+  }
+  return block_write(p_sess, p_buf, len, 0);
+}
+
+static int
+deflate_write(struct vsf_session* p_sess, struct vsf_zlib_stream* p_zstream,
+              const char* p_buf, unsigned int len, int finish)
+{
+  /* Compresses a buffer and writes whatever output it yields down the data
+   * connection. Returns 0 for success, -1 if the network write failed.
+   */
+  static char* p_zbuf;
+  if (p_zbuf == 0)
+  {
+    vsf_secbuf_alloc(&p_zbuf, VSFTP_DATA_BUFSIZE);
+  }
+  zlib_stream_set_input(p_zstream, p_buf, len);
+  while (1)
+  {
+    int retval;
+    int num_to_write = zlib_stream_run(p_zstream, p_zbuf, VSFTP_DATA_BUFSIZE,
+                                       finish);
+    if (num_to_write <= 0)
+    {
+      return 0;
+    }
+    retval = ftp_write_data(p_sess, p_zbuf, (unsigned int) num_to_write);
+    if (vsf_sysutil_retval_is_error(retval) || retval != num_to_write)
+    {
+      return -1;
+    }
+  }
+}
+
 struct vsf_transfer_ret
 vsf_ftpdataio_transfer_file(struct vsf_session* p_sess, int remote_fd,
-                            int file_fd, int is_recv, int is_ascii)
+                            int file_fd, int is_recv, int is_ascii,
+                            int deflate_level, filesize_t max_send)
 {
+  if (p_sess->is_deflate && (is_recv || deflate_level >= 0))
+  {
+    struct vsf_transfer_ret ret_struct;
+    struct vsf_zlib_stream* p_zstream;
+    if (is_recv)
+    {
+      p_zstream = zlib_inflate_new();
+      ret_struct = do_file_recv(p_sess, file_fd, is_ascii, p_zstream);
+    }
+    else
+    {
+      p_zstream = zlib_deflate_new(deflate_level);
+      ret_struct = do_file_send_rwloop(p_sess, file_fd, is_ascii, p_zstream,
+                                       max_send);
+    }
+    zlib_stream_free(p_zstream);
+    return ret_struct;
+  }
+  s_block_left = 0;
+  s_block_is_last = 0;
   if (!is_recv)
   {
     if (is_ascii || p_sess->data_use_ssl)
     {
-      return do_file_send_rwloop(p_sess, file_fd, is_ascii);
+      return do_file_send_rwloop(p_sess, file_fd, is_ascii, 0, max_send);
     }
     else
     {
       filesize_t curr_offset = vsf_sysutil_get_file_offset(file_fd);
       filesize_t num_send = calc_num_send(file_fd, curr_offset);
+      if (max_send >= 0 && num_send > max_send)
+      {
+        num_send = max_send;
+      }
       return do_file_send_sendfile(
         p_sess, remote_fd, file_fd, curr_offset, num_send);
     }
   }
   else
   {
-    return do_file_recv(p_sess, file_fd, is_ascii);
+    return do_file_recv(p_sess, file_fd, is_ascii, 0);
   }
 }
 
 static struct vsf_transfer_ret
-do_file_send_rwloop(struct vsf_session* p_sess, int file_fd, int is_ascii)
+do_file_send_rwloop(struct vsf_session* p_sess, int file_fd, int is_ascii,
+                    struct vsf_zlib_stream* p_zstream, filesize_t max_send)
 {
   static char* p_readbuf;
   static char* p_asciibuf;
   struct vsf_transfer_ret ret_struct = { 0, 0 };
-  unsigned int chunk_size = get_chunk_size();
+  unsigned int chunk_size = get_chunk_size(1);
   char* p_writefrom_buf;
   if (p_readbuf == 0)
   {
@@ -457,7 +865,16 @@ do_file_send_rwloop(struct vsf_session* p_sess, int file_fd, int is_ascii)
   while (1)
   {
     unsigned int num_to_write;
-    int retval = vsf_sysutil_read(file_fd, p_readbuf, chunk_size);
+    unsigned int num_to_read = chunk_size;
+    int retval = 0;
+    if (max_send >= 0 && (filesize_t) num_to_read > max_send)
+    {
+      num_to_read = (unsigned int) max_send;
+    }
+    if (num_to_read > 0)
+    {
+      retval = vsf_sysutil_read(file_fd, p_readbuf, num_to_read);
+    }
     if (vsf_sysutil_retval_is_error(retval))
     {
       ret_struct.retval = -1;
@@ -465,9 +882,17 @@ do_file_send_rwloop(struct vsf_session* p_sess, int file_fd, int is_ascii)
     }
     else if (retval == 0)
     {
-      /* Success - cool */
+      /* Success - cool. In MODE Z, flush out the end of the stream. */
+      if (p_zstream && deflate_write(p_sess, p_zstream, 0, 0, 1) != 0)
+      {
+        ret_struct.retval = -2;
+      }
       return ret_struct;
     }
+    if (max_send >= 0)
+    {
+      max_send -= retval;
+    }
     if (is_ascii)
     {
       num_to_write = vsf_ascii_bin_to_ascii(p_readbuf, p_asciibuf,
@@ -477,7 +902,19 @@ do_file_send_rwloop(struct vsf_session* p_sess, int file_fd, int is_ascii)
     {
       num_to_write = (unsigned int) retval;
     }
-    retval = ftp_write_data(p_sess, p_writefrom_buf, num_to_write);
+    if (p_zstream)
+    {
+      /* Note - we count the bytes before compression */
+      if (deflate_write(p_sess, p_zstream, p_writefrom_buf, num_to_write,
+                        0) != 0)
+      {
+        ret_struct.retval = -2;
+        return ret_struct;
+      }
+      ret_struct.transferred += num_to_write;
+      continue;
+    }
+    retval = data_write(p_sess, p_writefrom_buf, num_to_write);
     if (!vsf_sysutil_retval_is_error(retval))
     {
       ret_struct.transferred += (unsigned int) retval;
@@ -495,20 +932,80 @@ static struct vsf_transfer_ret
 do_file_send_sendfile(struct vsf_session* p_sess, int net_fd, int file_fd,
                       filesize_t curr_file_offset, filesize_t bytes_to_send)
 {
-  int retval;
+  int retval = 0;
   unsigned int chunk_size = 0;
   struct vsf_transfer_ret ret_struct = { 0, 0 };
   filesize_t init_file_offset = curr_file_offset;
+  filesize_t end_file_offset = curr_file_offset + bytes_to_send;
   filesize_t bytes_sent;
+  int is_stream = is_stream_download(file_fd, bytes_to_send);
   if (p_sess->bw_rate_max)
   {
-    chunk_size = get_chunk_size();
+    chunk_size = get_chunk_size(1);
+  }
+  if (is_stream)
+  {
+    vsf_sysutil_advise(file_fd, curr_file_offset, bytes_to_send,
+                       kVSFSysUtilAdviceSequential);
+  }
+  /* A streamed download goes a window at a time. Each window is read ahead
+   * while the one before it is sent, and dropped from the cache a window
+   * later, by when the network has usually let go of its pages. So the
+   * whole download only ever occupies a few windows.
+   */
+  while (curr_file_offset < end_file_offset)
+  {
+    filesize_t window_start = curr_file_offset;
+    filesize_t send_this_time = end_file_offset - curr_file_offset;
+    if (is_stream)
+    {
+      filesize_t next_len;
+      if (send_this_time > VSFTP_STREAM_WINDOW)
+      {
+        send_this_time = VSFTP_STREAM_WINDOW;
+      }
+      next_len = end_file_offset - curr_file_offset - send_this_time;
+      if (next_len > VSFTP_STREAM_WINDOW)
+      {
+        next_len = VSFTP_STREAM_WINDOW;
+      }
+      if (next_len > 0)
+      {
+        vsf_sysutil_advise(file_fd, curr_file_offset + send_this_time,
+                           next_len, kVSFSysUtilAdviceWillNeed);
+      }
+    }
+    /* Just because I can ;-) */
+    if (p_sess->is_block_mode)
+    {
+      retval = block_sendfile(net_fd, file_fd, &curr_file_offset,
+                              send_this_time, chunk_size);
+    }
+    else
+    {
+      retval = vsf_sysutil_sendfile(net_fd, file_fd, &curr_file_offset,
+                                    send_this_time, chunk_size);
+    }
+    if (is_stream && window_start > init_file_offset)
+    {
+      vsf_sysutil_advise(file_fd, window_start - VSFTP_STREAM_WINDOW,
+                         VSFTP_STREAM_WINDOW, kVSFSysUtilAdviceDontNeed);
+    }
+    if (vsf_sysutil_retval_is_error(retval) ||
+        curr_file_offset != window_start + send_this_time)
+    {
+      break;
+    }
   }
-  /* Just because I can ;-) */
-  retval = vsf_sysutil_sendfile(net_fd, file_fd, &curr_file_offset,
-                                bytes_to_send, chunk_size);
   bytes_sent = curr_file_offset - init_file_offset;
+  if (is_stream && bytes_sent > 0)
+  {
+    /* The tail, plus anything the network still held on to earlier */
+    vsf_sysutil_advise(file_fd, init_file_offset, bytes_sent,
+                       kVSFSysUtilAdviceDontNeed);
+  }
   ret_struct.transferred = bytes_sent;
+  vsf_stats_download_cache(is_stream, bytes_sent, is_stream ? bytes_sent : 0);
   if (vsf_sysutil_retval_is_error(retval))
   {
     ret_struct.retval = -2;
@@ -522,6 +1019,28 @@ do_file_send_sendfile(struct vsf_session* p_sess, int net_fd, int file_fd,
   return ret_struct; 
 }
 
+static int
+is_stream_download(int file_fd, filesize_t bytes_to_send)
+{
+  /* Only big downloads are worth keeping out of the cache. Of those, one
+   * which many sessions are fetching lately is left alone, as it is likely
+   * cached already and will be read again soon; the rest would only push
+   * out files which are used more.
+   */
+  static struct vsf_sysutil_statbuf* s_p_statbuf;
+  unsigned int count;
+  if (tunable_stream_download_size == 0 ||
+      bytes_to_send < (filesize_t) tunable_stream_download_size)
+  {
+    return 0;
+  }
+  vsf_sysutil_fstat(file_fd, &s_p_statbuf);
+  count = vsf_dlheat_note(vsf_sysutil_statbuf_get_inode(s_p_statbuf),
+                          vsf_sysutil_statbuf_get_size(s_p_statbuf),
+                          vsf_sysutil_statbuf_get_mtime(s_p_statbuf));
+  return count < VSFTP_STREAM_HOT_COUNT;
+}
+
 static filesize_t
 calc_num_send(int file_fd, filesize_t init_offset)
 {
@@ -547,13 +1066,22 @@ calc_num_send(int file_fd, filesize_t init_offset)
 }
 
 static struct vsf_transfer_ret
-do_file_recv(struct vsf_session* p_sess, int file_fd, int is_ascii)
+do_file_recv(struct vsf_session* p_sess, int file_fd, int is_ascii,
+             struct vsf_zlib_stream* p_zstream)
 {
   static char* p_recvbuf;
+  static char* p_zrecvbuf;
+  static struct vsf_sysutil_statbuf* s_p_statbuf;
   unsigned int num_to_write;
   struct vsf_transfer_ret ret_struct = { 0, 0 };
-  unsigned int chunk_size = get_chunk_size();
+  unsigned int chunk_size = get_chunk_size(0);
   int prev_cr = 0;
+  struct write_behind wb = { 0, 0, 0, 0 };
+  if (tunable_write_behind_size > 0)
+  {
+    vsf_sysutil_fstat(file_fd, &s_p_statbuf);
+    wb.enabled = vsf_sysutil_statbuf_is_regfile(s_p_statbuf);
+  }
   if (p_recvbuf == 0)
   {
     /* Now that we do ASCII conversion properly, the plus one is to cater for
@@ -563,10 +1091,64 @@ do_file_recv(struct vsf_session* p_sess, int file_fd, int is_ascii)
      */
     vsf_secbuf_alloc(&p_recvbuf, VSFTP_DATA_BUFSIZE + 1);
   }
+  if (p_zstream && p_zrecvbuf == 0)
+  {
+    vsf_secbuf_alloc(&p_zrecvbuf, VSFTP_DATA_BUFSIZE);
+  }
   while (1)
   {
-    const char* p_writebuf = p_recvbuf + 1;
-    int retval = ftp_read_data(p_sess, p_recvbuf + 1, chunk_size);
+    int retval;
+    if (p_zstream)
+    {
+      /* MODE Z: the network gives us compressed data, which we inflate into
+       * the regular receive buffer. Note - we count the bytes after
+       * decompression.
+       */
+      retval = ftp_read_data(p_sess, p_zrecvbuf, chunk_size);
+      if (vsf_sysutil_retval_is_error(retval))
+      {
+        ret_struct.retval = -2;
+        return ret_struct;
+      }
+      else if (retval == 0)
+      {
+        if (!zlib_stream_is_done(p_zstream))
+        {
+          /* The connection closed before the compressed stream ended, so
+           * what we have is truncated - blame the remote
+           */
+          ret_struct.retval = -2;
+          return ret_struct;
+        }
+        if (prev_cr && recv_store(file_fd, p_recvbuf, 0, is_ascii,
+                                  &prev_cr, &wb) != 0)
+        {
+          ret_struct.retval = -1;
+        }
+        return ret_struct;
+      }
+      zlib_stream_set_input(p_zstream, p_zrecvbuf, (unsigned int) retval);
+      while ((retval = zlib_stream_run(p_zstream, p_recvbuf + 1, chunk_size,
+                                       0)) > 0)
+      {
+        num_to_write = (unsigned int) retval;
+        ret_struct.transferred += num_to_write;
+        if (recv_store(file_fd, p_recvbuf, num_to_write, is_ascii,
+                       &prev_cr, &wb) != 0)
+        {
+          ret_struct.retval = -1;
+          return ret_struct;
+        }
+      }
+      if (retval < 0)
+      {
+        /* Corrupt compressed stream - blame the remote */
+        ret_struct.retval = -2;
+        return ret_struct;
+      }
+      continue;
+    }
+    retval = data_read(p_sess, p_recvbuf + 1, chunk_size);
     if (vsf_sysutil_retval_is_error(retval))
     {
       ret_struct.retval = -2;
@@ -579,21 +1161,8 @@ do_file_recv(struct vsf_session* p_sess, int file_fd, int is_ascii)
     }
     num_to_write = (unsigned int) retval;
     ret_struct.transferred += num_to_write;
-    if (is_ascii)
-    {
-      /* Handle ASCII conversion if we have to. Note that using the same
-       * buffer for source and destination is safe, because the ASCII ->
-       * binary transform only ever results in a smaller file.
-       */
-      struct ascii_to_bin_ret ret =
-        vsf_ascii_ascii_to_bin(p_recvbuf, num_to_write, prev_cr);
-      num_to_write = ret.stored;
-      prev_cr = ret.last_was_cr;
-      p_writebuf = ret.p_buf;
-    }
-    retval = vsf_sysutil_write_loop(file_fd, p_writebuf, num_to_write);
-    if (vsf_sysutil_retval_is_error(retval) ||
-        (unsigned int) retval != num_to_write)
+    if (recv_store(file_fd, p_recvbuf, num_to_write, is_ascii, &prev_cr,
+                   &wb) != 0)
     {
       ret_struct.retval = -1;
       return ret_struct;
@@ -601,19 +1170,253 @@ do_file_recv(struct vsf_session* p_sess, int file_fd, int is_ascii)
   }
 }
 
+static int
+recv_store(int file_fd, char* p_buf, unsigned int len, int is_ascii,
+           int* p_prev_cr, struct write_behind* p_wb)
+{
+  /* Writes out a received fragment, which starts at p_buf + 1. Returns 0 for
+   * success, -1 if the local write failed.
+   */
+  const char* p_writebuf = p_buf + 1;
+  int retval;
+  if (is_ascii)
+  {
+    /* Handle ASCII conversion if we have to. Note that using the same
+     * buffer for source and destination is safe, because the ASCII ->
+     * binary transform only ever results in a smaller file.
+     */
+    struct ascii_to_bin_ret ret = vsf_ascii_ascii_to_bin(p_buf, len,
+                                                         *p_prev_cr);
+    len = ret.stored;
+    *p_prev_cr = ret.last_was_cr;
+    p_writebuf = ret.p_buf;
+  }
+  retval = vsf_sysutil_write_loop(file_fd, p_writebuf, len);
+  if (vsf_sysutil_retval_is_error(retval) || (unsigned int) retval != len)
+  {
+    return -1;
+  }
+  if (p_wb->enabled)
+  {
+    write_behind(file_fd, p_wb, len);
+  }
+  return 0;
+}
+
+static void
+write_behind(int file_fd, struct write_behind* p_wb, unsigned int len)
+{
+  filesize_t start;
+  p_wb->pending += len;
+  if (p_wb->pending < tunable_write_behind_size)
+  {
+    return;
+  }
+  /* Work back from the file offset, which is right even for appends */
+  start = vsf_sysutil_get_file_offset(file_fd) - p_wb->pending;
+  vsf_sysutil_start_writeback(file_fd, start, p_wb->pending);
+  /* The batch before has had a whole batch's worth of time to reach the
+   * disk, so this rarely waits. Once clean, it can leave the page cache.
+   */
+  if (p_wb->prev_len > 0)
+  {
+    vsf_sysutil_finish_writeback(file_fd, p_wb->prev_start, p_wb->prev_len);
+  }
+  p_wb->prev_start = start;
+  p_wb->prev_len = p_wb->pending;
+  p_wb->pending = 0;
+}
+
 static unsigned int
-get_chunk_size()
+get_chunk_size(int is_send)
 {
   unsigned int ret = VSFTP_DATA_BUFSIZE;
   if (tunable_trans_chunk_size < VSFTP_DATA_BUFSIZE &&
       tunable_trans_chunk_size > 0)
   {
     ret = tunable_trans_chunk_size;
-    if (ret < 4096)
+  }
+  /* No point writing more at once than the kernel will queue unsent */
+  if (is_send && tunable_tcp_notsent_lowat > 0 &&
+      tunable_tcp_notsent_lowat < ret)
+  {
+    ret = tunable_tcp_notsent_lowat;
+  }
+  if (ret < 4096)
+  {
+    ret = 4096;
+  }
+  return ret;
+}
+
+static int
+data_write(struct vsf_session* p_sess, const char* p_buf, unsigned int len)
+{
+  /* As ftp_write_data(), but wrapped up in blocks in MODE B */
+  if (p_sess->is_block_mode)
+  {
+    if (block_write(p_sess, p_buf, len, 0) != 0)
     {
-      ret = 4096;
+      return -1;
     }
+    return (int) len;
   }
-  return ret;
+  return ftp_write_data(p_sess, p_buf, len);
 }
 
+static int
+data_read(struct vsf_session* p_sess, char* p_buf, unsigned int len)
+{
+  /* As ftp_read_data(), but in MODE B the blocks are unwrapped, and it is
+   * the EOF block, not the connection closing, which ends the file
+   */
+  int retval;
+  if (!p_sess->is_block_mode)
+  {
+    return ftp_read_data(p_sess, p_buf, len);
+  }
+  while (s_block_left == 0)
+  {
+    char header[VSF_BLOCK_HEADER_LEN];
+    unsigned char desc;
+    if (s_block_is_last)
+    {
+      return 0;
+    }
+    if (block_read_exact(p_sess, header, VSF_BLOCK_HEADER_LEN) != 0)
+    {
+      return -1;
+    }
+    desc = (unsigned char) header[0];
+    s_block_left = ((unsigned int) (unsigned char) header[1] << 8) |
+                   (unsigned int) (unsigned char) header[2];
+    s_block_is_last = (desc & VSF_BLOCK_DESC_EOF) != 0;
+    /* A restart marker is for the sender's own reference, not file data */
+    while ((desc & VSF_BLOCK_DESC_RESTART) && s_block_left > 0)
+    {
+      unsigned int skip_len = s_block_left;
+      if (skip_len > len)
+      {
+        skip_len = len;
+      }
+      if (block_read_exact(p_sess, p_buf, skip_len) != 0)
+      {
+        return -1;
+      }
+      s_block_left -= skip_len;
+    }
+  }
+  if (len > s_block_left)
+  {
+    len = s_block_left;
+  }
+  retval = ftp_read_data(p_sess, p_buf, len);
+  if (vsf_sysutil_retval_is_error(retval) || retval == 0)
+  {
+    /* Closing the connection part way through a file is an error here */
+    return -1;
+  }
+  s_block_left -= (unsigned int) retval;
+  return retval;
+}
+
+static int
+block_write(struct vsf_session* p_sess, const char* p_buf, unsigned int len,
+            unsigned char desc)
+{
+  /* Sends data as one or more blocks, each header together with its data in
+   * a single write; desc marks the last. Returns 0 for success, -1 if the
+   * network write failed.
+   */
+  static char* p_blockbuf;
+  if (p_blockbuf == 0)
+  {
+    vsf_secbuf_alloc(&p_blockbuf, VSF_BLOCK_HEADER_LEN + VSF_BLOCK_MAX_LEN);
+  }
+  do
+  {
+    unsigned int block_len = len;
+    unsigned char block_desc = desc;
+    int retval;
+    if (block_len > VSF_BLOCK_MAX_LEN)
+    {
+      block_len = VSF_BLOCK_MAX_LEN;
+      block_desc = 0;
+    }
+    fill_block_header(p_blockbuf, block_desc, block_len);
+    if (block_len > 0)
+    {
+      vsf_sysutil_memcpy(p_blockbuf + VSF_BLOCK_HEADER_LEN, p_buf, block_len);
+      p_buf += block_len;
+    }
+    retval = ftp_write_data(p_sess, p_blockbuf,
+                            VSF_BLOCK_HEADER_LEN + block_len);
+    if (vsf_sysutil_retval_is_error(retval) ||
+        (unsigned int) retval != VSF_BLOCK_HEADER_LEN + block_len)
+    {
+      return -1;
+    }
+    len -= block_len;
+  } while (len > 0);
+  return 0;
+}
+
+static int
+block_read_exact(struct vsf_session* p_sess, char* p_buf, unsigned int len)
+{
+  while (len > 0)
+  {
+    int retval = ftp_read_data(p_sess, p_buf, len);
+    if (vsf_sysutil_retval_is_error(retval) || retval == 0)
+    {
+      return -1;
+    }
+    p_buf += retval;
+    len -= (unsigned int) retval;
+  }
+  return 0;
+}
+
+static int
+block_sendfile(int net_fd, int file_fd, filesize_t* p_offset,
+               filesize_t num_send, unsigned int max_chunk)
+{
+  /* MODE B without copying: each block's header goes out in front of its
+   * data, which sendfile() then supplies. A file which turns out shorter than
+   * it was would leave a block short, so that is an error here.
+   */
+  while (num_send > 0)
+  {
+    char header[VSF_BLOCK_HEADER_LEN];
+    filesize_t block_start = *p_offset;
+    unsigned int block_len = VSF_BLOCK_MAX_LEN;
+    int retval;
+    if (num_send < (filesize_t) block_len)
+    {
+      block_len = (unsigned int) num_send;
+    }
+    fill_block_header(header, 0, block_len);
+    retval = vsf_sysutil_write_more(net_fd, header, VSF_BLOCK_HEADER_LEN);
+    if (retval != VSF_BLOCK_HEADER_LEN)
+    {
+      return -1;
+    }
+    retval = vsf_sysutil_sendfile(net_fd, file_fd, p_offset, block_len,
+                                  max_chunk);
+    if (vsf_sysutil_retval_is_error(retval) ||
+        *p_offset != block_start + block_len)
+    {
+      return -1;
+    }
+    num_send -= block_len;
+  }
+  return 0;
+}
+
+static void
+fill_block_header(char* p_header, unsigned char desc, unsigned int len)
+{
+  p_header[0] = (char) desc;
+  p_header[1] = (char) ((len >> 8) & 0xff);
+  p_header[2] = (char) (len & 0xff);
+}
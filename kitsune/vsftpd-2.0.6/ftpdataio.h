@@ -18,6 +18,49 @@ struct vsf_session;
  */
 void vsf_ftpdataio_dispose_transfer_fd(struct vsf_session* p_sess);
 
+/* vsf_ftpdataio_finish_transfer()
+ * PURPOSE
+ * Done with the data connection after a transfer. In MODE B, if the transfer
+ * went well, the connection is kept open for the next one, once an EOF block
+ * has ended what we sent. Otherwise it is disposed of as above.
+ * PARAMETERS
+ * p_sess       - the current FTP session object
+ * is_send      - 1 if we were sending, 0 if receiving
+ * succeeded    - 1 if the transfer went well
+ * RETURNS
+ * 0, or -1 if the EOF block could not be sent.
+ */
+int vsf_ftpdataio_finish_transfer(struct vsf_session* p_sess, int is_send,
+                                  int succeeded);
+
+/* vsf_ftpdataio_reuse_kept_fd()
+ * PURPOSE
+ * Start another transfer over a data connection kept open in MODE B.
+ * PARAMETERS
+ * p_sess       - the current FTP session object
+ */
+void vsf_ftpdataio_reuse_kept_fd(struct vsf_session* p_sess);
+
+/* vsf_ftpdataio_close_kept_fd()
+ * PURPOSE
+ * Close the data connection kept open in MODE B, if there is one, e.g. when
+ * the client asks for a new one or changes mode.
+ * PARAMETERS
+ * p_sess       - the current FTP session object
+ */
+void vsf_ftpdataio_close_kept_fd(struct vsf_session* p_sess);
+
+/* vsf_ftpdataio_size_listen_buffer()
+ * PURPOSE
+ * Size the receive buffer of a PASV listening socket, before anything
+ * connects to it, if sockbuf_autotune_enable is set.
+ * PARAMETERS
+ * p_sess       - the current FTP session object
+ * listen_fd    - the listening socket
+ */
+void vsf_ftpdataio_size_listen_buffer(struct vsf_session* p_sess,
+                                      int listen_fd);
+
 /* vsf_ftpdataio_get_pasv_fd()
  * PURPOSE
  * Return a connection data file descriptor obtained by the PASV connection
@@ -54,17 +97,24 @@ int vsf_ftpdataio_post_mark_connect(struct vsf_session* p_sess);
 /* vsf_ftpdataio_transfer_file()
  * PURPOSE
  * Send data between the network and a local file. Send and receive are
- * supported, as well as ASCII mangling.
+ * supported, as well as ASCII mangling and MODE Z compression.
  * PARAMETERS
  * remote_fd    - the file descriptor of the remote data connection
  * file_fd      - the file descriptor of the local file
  * is_recv      - 0 for sending to the remote, otherwise receive
  * is_ascii     - non zero for ASCII mangling
+ * deflate_level - for sends in MODE Z, the compression level to use, or -1
+ *                 if the file is already zlib compressed and should be sent
+ *                 as-is. Ignored otherwise.
+ * max_send     - for sends, the most bytes of the file to send (from its
+ *                current offset), or -1 to send up to the end of file.
+ *                Ignored for receives.
  * RETURNS
  * A structure, containing
  * retval       - 0 for success, failure otherwise
  *                (-1 = local problem -2 = remote problem)
- * transferred  - number of bytes transferred
+ * transferred  - number of bytes transferred (before compression, in
+ *                MODE Z)
  */
 struct vsf_transfer_ret
 {
@@ -73,7 +123,8 @@ struct vsf_transfer_ret
 };
 struct vsf_transfer_ret vsf_ftpdataio_transfer_file(
   struct vsf_session* p_sess,
-  int remote_fd, int file_fd, int is_recv, int is_ascii);
+  int remote_fd, int file_fd, int is_recv, int is_ascii, int deflate_level,
+  filesize_t max_send);
 
 /* vsf_ftpdataio_transfer_dir()
  * PURPOSE
@@ -0,0 +1,234 @@
+/*
+ * Part of Very Secure FTPd
+ * Licence: GPL v2
+ * Author: Chris Evans
+ * hashsvc.c
+ *
+ * The checksum cache: one process, forked by the standalone listener, which
+ * remembers whole file checksums for HASH and the X* checksum commands, so
+ * that verifying a big file again doesn't mean reading it all again.
+ *
+ * The cache lives only in this process's memory. Sessions, which may be
+ * running as the owner of any file, never supply a checksum: they pass the
+ * open file, and the worker stats and reads it itself. An entry is only
+ * used while the file's device, inode, size, modification time (to the
+ * nanosecond) and change time all match those it was computed with.
+ *
+ * A request is a datagram carrying one end of a fresh socketpair: one byte
+ * for the algorithm, then the file size the session expects. The file is
+ * already queued on the socketpair, and the worker writes back the checksum
+ * over it, or nothing if it can't.
+ */
+
+#include "hashsvc.h"
+#include "sysutil.h"
+#include "sysdeputil.h"
+#include "str.h"
+#include "tunables.h"
+#include "defs.h"
+#include "utility.h"
+
+#define VSF_HASHSVC_REQ_LEN   (1 + sizeof(filesize_t))
+/* A SHA-256 in hex */
+#define VSF_HASHSVC_HEX_MAX   64
+
+struct vsf_hashsvc_entry
+{
+  /* kVSFChecksumNone means the entry is free */
+  enum EVSFChecksumType type;
+  filesize_t dev;
+  filesize_t inode;
+  filesize_t size;
+  long mtime;
+  long mtime_nsec;
+  long ctime;
+  unsigned int hex_len;
+  char hex[VSF_HASHSVC_HEX_MAX];
+};
+
+/* Session side state */
+static int s_sock = -1;
+
+/* Worker side state */
+static struct vsf_hashsvc_entry* s_p_entries;
+
+static int take_file_fd(int reply_fd);
+static void fill_entry(struct vsf_hashsvc_entry* p_entry,
+                       enum EVSFChecksumType type,
+                       const struct vsf_sysutil_statbuf* p_statbuf);
+static int entries_match(const struct vsf_hashsvc_entry* p_entry1,
+                         const struct vsf_hashsvc_entry* p_entry2);
+
+void
+vsf_hashsvc_attach(int sock)
+{
+  s_sock = sock;
+}
+
+int
+vsf_hashsvc_checksum(enum EVSFChecksumType type, int fd, filesize_t size,
+                     struct mystr* p_hex_str)
+{
+  unsigned char req_buf[VSF_HASHSVC_REQ_LEN];
+  char hex_buf[VSF_HASHSVC_HEX_MAX + 1];
+  struct vsf_sysutil_socketpair_retval sockets;
+  int retval;
+  if (s_sock == -1)
+  {
+    return -1;
+  }
+  req_buf[0] = (unsigned char) type;
+  vsf_sysutil_memcpy(req_buf + 1, &size, sizeof(size));
+  sockets = vsf_sysutil_unix_stream_socketpair();
+  /* Queue the file first, so the worker never waits on us for it */
+  retval = vsf_sysutil_send_msg(sockets.socket_one, "F", 1, fd);
+  if (!vsf_sysutil_retval_is_error(retval))
+  {
+    retval = vsf_sysutil_send_msg(s_sock, req_buf, sizeof(req_buf),
+                                  sockets.socket_two);
+  }
+  vsf_sysutil_close(sockets.socket_two);
+  if (!vsf_sysutil_retval_is_error(retval))
+  {
+    /* A failure, or a worker dying on us, shows up as EOF */
+    retval = vsf_sysutil_read_loop(sockets.socket_one, hex_buf,
+                                   VSF_HASHSVC_HEX_MAX);
+  }
+  vsf_sysutil_close(sockets.socket_one);
+  if (vsf_sysutil_retval_is_error(retval) || retval == 0)
+  {
+    return -1;
+  }
+  hex_buf[retval] = '\0';
+  str_alloc_text(p_hex_str, hex_buf);
+  return 0;
+}
+
+void
+vsf_hashsvc_worker(int sock)
+{
+  static struct mystr s_hex_str;
+  static struct vsf_sysutil_statbuf* s_p_statbuf;
+  unsigned int alloc_len =
+    VSFTP_CHECKSUM_CACHE_SIZE * sizeof(struct vsf_hashsvc_entry);
+  vsf_sysutil_exit_with_parent();
+  vsf_sysutil_install_null_sighandler(kVSFSysUtilSigHUP);
+  vsf_sysutil_unblock_sig(kVSFSysUtilSigHUP);
+  if (tunable_setproctitle_enable)
+  {
+    vsf_sysutil_setproctitle("CHECKSUM CACHE");
+  }
+  s_p_entries = vsf_sysutil_malloc(alloc_len);
+  vsf_sysutil_memclr(s_p_entries, alloc_len);
+  while (1)
+  {
+    unsigned char req_buf[VSF_HASHSVC_REQ_LEN];
+    struct vsf_hashsvc_entry wanted;
+    struct vsf_hashsvc_entry* p_entry;
+    filesize_t size;
+    int reply_fd;
+    int file_fd;
+    int retval = vsf_sysutil_recv_msg(sock, req_buf, sizeof(req_buf),
+                                      &reply_fd);
+    if (vsf_sysutil_retval_is_error(retval))
+    {
+      die("recvmsg in checksum cache");
+    }
+    if (reply_fd == -1)
+    {
+      continue;
+    }
+    file_fd = take_file_fd(reply_fd);
+    if (file_fd == -1 || retval != (int) sizeof(req_buf) ||
+        req_buf[0] < kVSFChecksumCRC32 || req_buf[0] > kVSFChecksumSHA256)
+    {
+      goto close_out;
+    }
+    vsf_sysutil_memcpy(&size, req_buf + 1, sizeof(size));
+    vsf_sysutil_fstat(file_fd, &s_p_statbuf);
+    if (!vsf_sysutil_statbuf_is_regfile(s_p_statbuf) ||
+        vsf_sysutil_statbuf_get_size(s_p_statbuf) != size)
+    {
+      goto close_out;
+    }
+    fill_entry(&wanted, (enum EVSFChecksumType) req_buf[0], s_p_statbuf);
+    p_entry = &s_p_entries[(unsigned int) (wanted.inode * 31 + wanted.dev +
+                                           wanted.type) %
+                           VSFTP_CHECKSUM_CACHE_SIZE];
+    if (!entries_match(p_entry, &wanted))
+    {
+      retval = vsf_checksum_file(wanted.type, file_fd, 0, size, &s_hex_str);
+      if (retval != 0 || str_getlen(&s_hex_str) > VSF_HASHSVC_HEX_MAX)
+      {
+        goto close_out;
+      }
+      wanted.hex_len = str_getlen(&s_hex_str);
+      vsf_sysutil_memcpy(wanted.hex, str_getbuf(&s_hex_str), wanted.hex_len);
+      *p_entry = wanted;
+      /* Only keep it if the file held still while we read it */
+      vsf_sysutil_fstat(file_fd, &s_p_statbuf);
+      fill_entry(&wanted, wanted.type, s_p_statbuf);
+      if (!entries_match(p_entry, &wanted))
+      {
+        p_entry->type = kVSFChecksumNone;
+      }
+    }
+    /* The session may have given up on us; no matter */
+    (void) vsf_sysutil_write_loop(reply_fd, p_entry->hex, p_entry->hex_len);
+close_out:
+    if (file_fd != -1)
+    {
+      vsf_sysutil_close_failok(file_fd);
+    }
+    vsf_sysutil_close_failok(reply_fd);
+  }
+}
+
+static int
+take_file_fd(int reply_fd)
+{
+  /* The file was queued before the request was sent, so this won't block */
+  char cmd;
+  int file_fd;
+  int retval;
+  vsf_sysutil_activate_noblock(reply_fd);
+  retval = vsf_sysutil_recv_msg(reply_fd, &cmd, 1, &file_fd);
+  vsf_sysutil_deactivate_noblock(reply_fd);
+  if (retval != 1)
+  {
+    if (file_fd != -1)
+    {
+      vsf_sysutil_close_failok(file_fd);
+    }
+    return -1;
+  }
+  return file_fd;
+}
+
+static void
+fill_entry(struct vsf_hashsvc_entry* p_entry, enum EVSFChecksumType type,
+           const struct vsf_sysutil_statbuf* p_statbuf)
+{
+  p_entry->type = type;
+  p_entry->dev = vsf_sysutil_statbuf_get_dev(p_statbuf);
+  p_entry->inode = vsf_sysutil_statbuf_get_inode(p_statbuf);
+  p_entry->size = vsf_sysutil_statbuf_get_size(p_statbuf);
+  p_entry->mtime = vsf_sysutil_statbuf_get_mtime(p_statbuf);
+  p_entry->mtime_nsec = vsf_sysutil_statbuf_get_mtime_nsec(p_statbuf);
+  p_entry->ctime = vsf_sysutil_statbuf_get_ctime(p_statbuf);
+  p_entry->hex_len = 0;
+}
+
+static int
+entries_match(const struct vsf_hashsvc_entry* p_entry1,
+              const struct vsf_hashsvc_entry* p_entry2)
+{
+  return p_entry1->type != kVSFChecksumNone &&
+         p_entry1->type == p_entry2->type &&
+         p_entry1->dev == p_entry2->dev &&
+         p_entry1->inode == p_entry2->inode &&
+         p_entry1->size == p_entry2->size &&
+         p_entry1->mtime == p_entry2->mtime &&
+         p_entry1->mtime_nsec == p_entry2->mtime_nsec &&
+         p_entry1->ctime == p_entry2->ctime;
+}
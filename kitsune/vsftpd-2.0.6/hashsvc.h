@@ -0,0 +1,51 @@
+#ifndef VSF_HASHSVC_H
+#define VSF_HASHSVC_H
+
+#ifndef VSF_FILESIZE_H
+#include "filesize.h"
+#endif
+
+#include "checksum.h"
+
+struct mystr;
+
+/* vsf_hashsvc_worker()
+ * PURPOSE
+ * Run the checksum cache, as forked by the standalone listener when
+ * checksum_cache_enable is set. Sessions hand it open files; it checksums
+ * each itself, and remembers the result while the file's inode, size and
+ * times stay the same. Nothing is written to the files, and a session can
+ * only ask, never tell, what a file's checksum is.
+ * PARAMETERS
+ * sock         - the worker's end of the request socket
+ * RETURNS
+ * Never returns.
+ */
+void vsf_hashsvc_worker(int sock);
+
+/* vsf_hashsvc_attach()
+ * PURPOSE
+ * Tell a session where the checksum cache is.
+ * PARAMETERS
+ * sock         - the sessions' end of the request socket
+ */
+void vsf_hashsvc_attach(int sock);
+
+/* vsf_hashsvc_checksum()
+ * PURPOSE
+ * Get the checksum of a whole file from the checksum cache, which works it
+ * out first if it has to. Requests are served one at a time.
+ * PARAMETERS
+ * type         - the algorithm to use
+ * fd           - the file descriptor of the file; its offset may change
+ * size         - the size of the file, as the caller saw it
+ * p_hex_str    - where to store the checksum, in lower case hex
+ * RETURNS
+ * 0 on success, or -1 if there is no cache, or it couldn't read the file,
+ * or the file is no longer of that size; the caller should then checksum
+ * the file itself.
+ */
+int vsf_hashsvc_checksum(enum EVSFChecksumType type, int fd, filesize_t size,
+                         struct mystr* p_hex_str);
+
+#endif /* VSF_HASHSVC_H */
@@ -0,0 +1,295 @@
+/*
+ * Part of Very Secure FTPd
+ * Licence: GPL v2
+ * Author: Chris Evans
+ * lineidx.c
+ *
+ * Hashed indexes of line based list files (user_list, banned e-mails etc),
+ * replacing a linear str_contains_line() scan of the whole file with a hash
+ * lookup. An index is one block of pages: a header, then the start of each
+ * bucket, then the entries sorted by bucket, then a copy of the text. Once
+ * built it is made read only, so the copy a session inherits from the
+ * listener stays shared with it and cannot be scribbled on.
+ */
+
+#include "lineidx.h"
+#include "str.h"
+#include "filestr.h"
+#include "sysutil.h"
+#include "sysdeputil.h"
+#include "defs.h"
+#include "utility.h"
+
+#define VSF_LINEIDX_MAX_FILES   4
+
+struct vsf_lineidx
+{
+  unsigned int map_size;
+  unsigned int num_buckets;
+  unsigned int num_lines;
+  unsigned int text_len;
+  /* Followed by unsigned int bucket_start[num_buckets + 1],
+   * struct vsf_lineidx_entry entries[num_lines] and char text[text_len]
+   */
+};
+
+struct vsf_lineidx_entry
+{
+  unsigned int hash;
+  unsigned int offset;
+  unsigned int len;
+};
+
+struct vsf_lineidx_file
+{
+  char* p_filename;
+  long mtime;
+  filesize_t size;
+  filesize_t inode;
+  struct vsf_lineidx* p_idx;
+};
+
+static struct vsf_lineidx_file s_files[VSF_LINEIDX_MAX_FILES];
+
+static unsigned int*
+get_buckets(const struct vsf_lineidx* p_idx)
+{
+  return (unsigned int*) (p_idx + 1);
+}
+
+static struct vsf_lineidx_entry*
+get_entries(const struct vsf_lineidx* p_idx)
+{
+  return (struct vsf_lineidx_entry*) (get_buckets(p_idx) +
+                                      p_idx->num_buckets + 1);
+}
+
+static char*
+get_text(const struct vsf_lineidx* p_idx)
+{
+  return (char*) (get_entries(p_idx) + p_idx->num_lines);
+}
+
+static unsigned int
+hash_line(const char* p_buf, unsigned int len)
+{
+  unsigned int val = 2166136261U;
+  unsigned int i;
+  for (i = 0; i < len; ++i)
+  {
+    val ^= (unsigned char) p_buf[i];
+    val *= 16777619U;
+  }
+  return val;
+}
+
+/* Same splitting as str_getline(): a final line need not end in \n */
+static int
+next_line(const char* p_buf, unsigned int buf_len, unsigned int* p_pos,
+          unsigned int* p_start, unsigned int* p_len)
+{
+  unsigned int curr_pos = *p_pos;
+  if (curr_pos >= buf_len)
+  {
+    return 0;
+  }
+  *p_start = curr_pos;
+  while (curr_pos < buf_len && p_buf[curr_pos] != '\n')
+  {
+    curr_pos++;
+  }
+  *p_len = curr_pos - *p_start;
+  if (curr_pos < buf_len)
+  {
+    curr_pos++;
+  }
+  *p_pos = curr_pos;
+  return 1;
+}
+
+struct vsf_lineidx*
+vsf_lineidx_from_str(const struct mystr* p_str)
+{
+  const char* p_buf = str_getbuf(p_str);
+  unsigned int buf_len = str_getlen(p_str);
+  unsigned int num_lines = 0;
+  unsigned int num_buckets;
+  unsigned int map_size;
+  unsigned int page_size = vsf_sysutil_getpagesize();
+  unsigned int pos = 0;
+  unsigned int start;
+  unsigned int len;
+  unsigned int i;
+  unsigned int* p_buckets;
+  struct vsf_lineidx_entry* p_entries;
+  struct vsf_lineidx* p_idx;
+  while (next_line(p_buf, buf_len, &pos, &start, &len))
+  {
+    ++num_lines;
+  }
+  /* About one entry per bucket; odd so the modulo mixes a little */
+  num_buckets = num_lines | 1;
+  map_size = sizeof(struct vsf_lineidx) +
+             (num_buckets + 1) * sizeof(unsigned int) +
+             num_lines * sizeof(struct vsf_lineidx_entry) + buf_len;
+  map_size = (map_size + page_size - 1) / page_size * page_size;
+  p_idx = vsf_sysutil_map_anon_pages(map_size);
+  p_idx->map_size = map_size;
+  p_idx->num_buckets = num_buckets;
+  p_idx->num_lines = num_lines;
+  p_idx->text_len = buf_len;
+  p_buckets = get_buckets(p_idx);
+  p_entries = get_entries(p_idx);
+  vsf_sysutil_memcpy(get_text(p_idx), p_buf, buf_len);
+  /* Count the entries in each bucket, then turn the counts into starting
+   * positions, then drop each entry into place.
+   */
+  pos = 0;
+  while (next_line(p_buf, buf_len, &pos, &start, &len))
+  {
+    p_buckets[hash_line(p_buf + start, len) % num_buckets + 1]++;
+  }
+  for (i = 0; i < num_buckets; ++i)
+  {
+    p_buckets[i + 1] += p_buckets[i];
+  }
+  pos = 0;
+  while (next_line(p_buf, buf_len, &pos, &start, &len))
+  {
+    unsigned int hash = hash_line(p_buf + start, len);
+    /* bucket_start[b] is the fill pointer for bucket b, and ends up as the
+     * start of b + 1 once all of b is placed
+     */
+    unsigned int* p_fill = &p_buckets[hash % num_buckets];
+    struct vsf_lineidx_entry* p_entry = &p_entries[*p_fill];
+    p_entry->hash = hash;
+    p_entry->offset = start;
+    p_entry->len = len;
+    (*p_fill)++;
+  }
+  /* Shift the fill pointers back down into starting positions */
+  for (i = num_buckets; i > 0; --i)
+  {
+    p_buckets[i] = p_buckets[i - 1];
+  }
+  p_buckets[0] = 0;
+  vsf_sysutil_memprotect(p_idx, map_size, kVSFSysUtilMapProtReadOnly);
+  return p_idx;
+}
+
+void
+vsf_lineidx_free(struct vsf_lineidx* p_idx)
+{
+  vsf_sysutil_memunmap(p_idx, p_idx->map_size);
+}
+
+const struct vsf_lineidx*
+vsf_lineidx_load_file(const char* p_filename)
+{
+  static struct vsf_sysutil_statbuf* s_p_statbuf;
+  struct mystr file_str = INIT_MYSTR;
+  struct vsf_lineidx_file* p_file = 0;
+  int retval;
+  unsigned int i;
+  retval = vsf_sysutil_stat(p_filename, &s_p_statbuf);
+  if (vsf_sysutil_retval_is_error(retval))
+  {
+    return 0;
+  }
+  for (i = 0; i < VSF_LINEIDX_MAX_FILES; ++i)
+  {
+    if (s_files[i].p_filename &&
+        vsf_sysutil_strcmp(s_files[i].p_filename, p_filename) == 0)
+    {
+      p_file = &s_files[i];
+      break;
+    }
+  }
+  if (p_file &&
+      p_file->mtime == vsf_sysutil_statbuf_get_mtime(s_p_statbuf) &&
+      p_file->size == vsf_sysutil_statbuf_get_size(s_p_statbuf) &&
+      p_file->inode == vsf_sysutil_statbuf_get_inode(s_p_statbuf))
+  {
+    return p_file->p_idx;
+  }
+  retval = str_fileread(&file_str, p_filename, VSFTP_LIST_FILE_MAX);
+  if (vsf_sysutil_retval_is_error(retval))
+  {
+    return 0;
+  }
+  if (p_file == 0)
+  {
+    /* Take a free slot, or else recycle the last one */
+    for (i = 0; i < VSF_LINEIDX_MAX_FILES - 1; ++i)
+    {
+      if (s_files[i].p_filename == 0)
+      {
+        break;
+      }
+    }
+    p_file = &s_files[i];
+    if (p_file->p_filename)
+    {
+      vsf_sysutil_free(p_file->p_filename);
+    }
+    p_file->p_filename = vsf_sysutil_strdup(p_filename);
+  }
+  if (p_file->p_idx)
+  {
+    vsf_lineidx_free(p_file->p_idx);
+  }
+  p_file->p_idx = vsf_lineidx_from_str(&file_str);
+  str_free(&file_str);
+  p_file->mtime = vsf_sysutil_statbuf_get_mtime(s_p_statbuf);
+  p_file->size = vsf_sysutil_statbuf_get_size(s_p_statbuf);
+  p_file->inode = vsf_sysutil_statbuf_get_inode(s_p_statbuf);
+  /* A file written this very second may change again without its mtime
+   * moving; make sure we look at it properly next time.
+   */
+  vsf_sysutil_update_cached_time();
+  if (p_file->mtime >= vsf_sysutil_get_cached_time_sec())
+  {
+    p_file->mtime = -1;
+  }
+  return p_file->p_idx;
+}
+
+int
+vsf_lineidx_contains(const struct vsf_lineidx* p_idx,
+                     const struct mystr* p_line_str)
+{
+  const char* p_line = str_getbuf(p_line_str);
+  unsigned int len = str_getlen(p_line_str);
+  unsigned int hash;
+  unsigned int bucket;
+  unsigned int i;
+  const unsigned int* p_buckets;
+  const struct vsf_lineidx_entry* p_entries;
+  const char* p_text;
+  if (p_idx == 0 || p_idx->num_lines == 0)
+  {
+    return 0;
+  }
+  hash = hash_line(p_line, len);
+  bucket = hash % p_idx->num_buckets;
+  p_buckets = get_buckets(p_idx);
+  p_entries = get_entries(p_idx);
+  p_text = get_text(p_idx);
+  for (i = p_buckets[bucket]; i < p_buckets[bucket + 1]; ++i)
+  {
+    const struct vsf_lineidx_entry* p_entry = &p_entries[i];
+    if (p_entry->hash == hash && p_entry->len == len &&
+        vsf_sysutil_memcmp(p_text + p_entry->offset, p_line, len) == 0)
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int
+vsf_lineidx_is_empty(const struct vsf_lineidx* p_idx)
+{
+  return p_idx == 0 || p_idx->text_len == 0;
+}
+
@@ -0,0 +1,64 @@
+#ifndef VSF_LINEIDX_H
+#define VSF_LINEIDX_H
+
+struct mystr;
+struct vsf_lineidx;
+
+/* vsf_lineidx_from_str()
+ * PURPOSE
+ * Build a hashed index of the lines of a buffer, so that membership tests
+ * take constant time however long the list. The index lives in its own
+ * pages, which are made read only once built.
+ * PARAMETERS
+ * p_str        - the buffer, one entry per line
+ * RETURNS
+ * The new index.
+ */
+struct vsf_lineidx* vsf_lineidx_from_str(const struct mystr* p_str);
+
+/* vsf_lineidx_free()
+ * PURPOSE
+ * Free an index made by vsf_lineidx_from_str().
+ * PARAMETERS
+ * p_idx        - the index to free
+ */
+void vsf_lineidx_free(struct vsf_lineidx* p_idx);
+
+/* vsf_lineidx_load_file()
+ * PURPOSE
+ * Get an index of the lines of a file. Indexes are kept per file name, and
+ * only rebuilt when the file's modification time, size or inode changes, so
+ * a process forked after the first load (e.g. a session forked by the
+ * standalone listener) normally pays only for a stat().
+ * PARAMETERS
+ * p_filename   - the file to index
+ * RETURNS
+ * The index, owned by this module; or 0 if the file cannot be read.
+ */
+const struct vsf_lineidx* vsf_lineidx_load_file(const char* p_filename);
+
+/* vsf_lineidx_contains()
+ * PURPOSE
+ * Check whether a line appears in an index, as str_contains_line() would on
+ * the original buffer.
+ * PARAMETERS
+ * p_idx        - the index, or null for an empty one
+ * p_line_str   - the line to look for
+ * RETURNS
+ * 1 if found, 0 if not.
+ */
+int vsf_lineidx_contains(const struct vsf_lineidx* p_idx,
+                         const struct mystr* p_line_str);
+
+/* vsf_lineidx_is_empty()
+ * PURPOSE
+ * Check whether the buffer an index was built from was empty.
+ * PARAMETERS
+ * p_idx        - the index, or null
+ * RETURNS
+ * 1 if the buffer was empty (or p_idx is null), 0 otherwise.
+ */
+int vsf_lineidx_is_empty(const struct vsf_lineidx* p_idx);
+
+#endif /* VSF_LINEIDX_H */
+
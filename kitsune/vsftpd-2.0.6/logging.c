@@ -13,6 +13,7 @@
 #include "sysutil.h"
 #include "sysstr.h"
 #include "session.h"
+#include "stats.h"
 
 /* File local functions */
 static int vsf_log_type_is_transfer(enum EVSFLogEntryType type);
@@ -114,6 +115,17 @@ vsf_log_clear_entry(struct vsf_session* p_sess)
 void
 vsf_log_do_log(struct vsf_session* p_sess, int succeeded)
 {
+  enum EVSFLogEntryType what = (enum EVSFLogEntryType) p_sess->log_type;
+  if (vsf_log_type_is_transfer(what))
+  {
+    filesize_t usec;
+    vsf_sysutil_update_cached_time();
+    usec = vsf_sysutil_get_cached_time_sec() - p_sess->log_start_sec;
+    usec *= 1000000;
+    usec += vsf_sysutil_get_cached_time_usec() - p_sess->log_start_usec;
+    vsf_stats_transfer(what == kVSFLogEntryUpload, succeeded,
+                       p_sess->transfer_size, usec);
+  }
   vsf_log_common(p_sess, succeeded, (enum EVSFLogEntryType) p_sess->log_type,
                  &p_sess->log_str);
   p_sess->log_type = 0;
@@ -314,6 +326,9 @@ vsf_log_do_log_vsftpd_format(struct vsf_session* p_sess, struct mystr* p_str,
     case kVSFLogEntryChmod:
       str_append_text(p_str, "CHMOD");
       break;
+    case kVSFLogEntryCopy:
+      str_append_text(p_str, "COPY");
+      break;
     case kVSFLogEntryDebug:
       str_append_text(p_str, "DEBUG");
       break;
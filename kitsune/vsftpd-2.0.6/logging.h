@@ -19,6 +19,7 @@ enum EVSFLogEntryType
   kVSFLogEntryRename,
   kVSFLogEntryRmdir,
   kVSFLogEntryChmod,
+  kVSFLogEntryCopy,
   kVSFLogEntryDebug,
 };
 
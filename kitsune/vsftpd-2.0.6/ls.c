@@ -9,6 +9,7 @@
 
 #include "ls.h"
 #include "access.h"
+#include "filter.h"
 #include "str.h"
 #include "strlist.h"
 #include "sysstr.h"
@@ -30,6 +31,7 @@ vsf_ls_populate_dir_list(struct mystr_list* p_list,
 {
   struct mystr dirline_str = INIT_MYSTR;
   struct mystr normalised_base_dir_str = INIT_MYSTR;
+  struct vsf_filter* p_filter = 0;
   struct str_locate_result loc_result;
   int a_option;
   int r_option;
@@ -78,6 +80,11 @@ vsf_ls_populate_dir_list(struct mystr_list* p_list,
       str_append_char(&normalised_base_dir_str, '/');
     }
   }
+  /* The filter is tried against every entry, so parse it just the once */
+  if (!str_isempty(p_filter_str))
+  {
+    p_filter = vsf_filter_compile(p_filter_str);
+  }
   /* If we're going to need to do time comparisions, cache the local time */
   if (is_verbose)
   {
@@ -114,9 +121,9 @@ vsf_ls_populate_dir_list(struct mystr_list* p_list,
       continue;
     }
     /* If we have an ls option which is a filter, apply it */
-    if (!str_isempty(p_filter_str))
+    if (p_filter != 0)
     {
-      if (!vsf_filename_passes_filter(&s_next_filename_str, p_filter_str))
+      if (!vsf_filter_matches(p_filter, &s_next_filename_str))
       {
         continue;
       }
@@ -211,6 +218,7 @@ vsf_ls_populate_dir_list(struct mystr_list* p_list,
   }
   str_free(&dirline_str);
   str_free(&normalised_base_dir_str);
+  vsf_filter_free(p_filter);
 }
 
 int
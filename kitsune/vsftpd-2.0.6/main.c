@@ -22,6 +22,10 @@
 #include "tcpwrap.h"
 #include "vsftpver.h"
 #include "ssl.h"
+#include "checksum.h"
+#include "stats.h"
+#include "lineidx.h"
+#include "secbuf.h"
 
 /* Kitsune */
 #include <unistd.h>
@@ -52,17 +56,17 @@ main(int argc, const char* argv[]) E_NOTELOCALS
     /* Control connection */
     0, 0, 0,
     /* Data connection */
-    -1, 0, -1, 0, 0, 0, 0,
+    -1, 0, -1, 0, 0, 0,
     /* Login */
     1, 0, INIT_MYSTR, INIT_MYSTR,
     /* Protocol state */
-    0, 1, INIT_MYSTR, 0, 0,
+    0, -1, 0, 1, INIT_MYSTR, INIT_MYSTR, 0, 0, 0, 0, -1, kVSFChecksumSHA256,
     /* Session state */
     0,
     /* Userids */
     -1, -1, -1,
     /* Pre-chroot() cache */
-    INIT_MYSTR, INIT_MYSTR, INIT_MYSTR, INIT_MYSTR, 1,
+    0, 0, 0, INIT_MYSTR, 1,
     /* Logging */
     -1, -1, INIT_MYSTR, 0, 0, 0, INIT_MYSTR, 0,
     /* Buffers */
@@ -79,10 +83,19 @@ main(int argc, const char* argv[]) E_NOTELOCALS
     0
   };
   int config_specified = 0;
+  int show_status = 0;
+  int sock_opts_inherited = 0;
   const char* p_config_name = VSFTP_DEFAULT_CONFIG;
   /* Zero or one argument supported. If one argument is passed, it is the
-   * path to the config file
+   * path to the config file. The exception is "--status", which may be
+   * followed by the config file of the server to query.
    */
+  if (argc > 1 && !vsf_sysutil_strcmp(argv[1], "--status"))
+  {
+    show_status = 1;
+    --argc;
+    ++argv;
+  }
   if (argc > 2)
   {
     die("vsftpd: too many arguments (I take an optional config file only)");
@@ -109,6 +122,8 @@ main(int argc, const char* argv[]) E_NOTELOCALS
    * anonymous pages
    */
   vsf_sysutil_map_anon_pages_init();
+  /* Sessions inherit the secure buffer pool, so set it up just the once */
+  vsf_secbuf_pool_init();
   /* Parse config file if it's there */
   {
     struct vsf_sysutil_statbuf* p_statbuf = 0;
@@ -123,6 +138,14 @@ main(int argc, const char* argv[]) E_NOTELOCALS
     }
     vsf_sysutil_free(p_statbuf);
   }
+  if (show_status)
+  {
+    if (!tunable_scoreboard_file)
+    {
+      die("vsftpd: --status needs scoreboard_file to be set");
+    }
+    vsf_stats_print_status(tunable_scoreboard_file);
+  }
   /* Resolve pasv_address if required */
   if (tunable_pasv_address && tunable_pasv_addr_resolve)
   {
@@ -158,6 +181,7 @@ main(int argc, const char* argv[]) E_NOTELOCALS
     struct vsf_client_launch ret = vsf_standalone_main();
     the_session.num_clients = ret.num_children;
     the_session.num_this_ip = ret.num_this_ip;
+    sock_opts_inherited = ret.sock_opts_inherited;
   }
   if (tunable_tcp_wrappers)
   {
@@ -167,7 +191,21 @@ main(int argc, const char* argv[]) E_NOTELOCALS
     const char* p_load_conf = vsf_sysutil_getenv("VSFTPD_LOAD_CONF");
     if (p_load_conf)
     {
-      vsf_parseconf_load_file(p_load_conf, 1);
+      struct vsf_sysutil_statbuf* p_statbuf = 0;
+      if (vsf_sysutil_retval_is_error(vsf_sysutil_stat(p_load_conf,
+                                                       &p_statbuf)))
+      {
+        /* Dies with the usual message */
+        vsf_parseconf_load_file(p_load_conf, 1);
+      }
+      else
+      {
+        vsf_parseconf_load_file_cached(p_load_conf, p_statbuf);
+      }
+      if (p_statbuf)
+      {
+        vsf_sysutil_free(p_statbuf);
+      }
     }
   }
   /* Sanity checks - exit with a graceful error message if our STDIN is not
@@ -185,7 +223,11 @@ main(int argc, const char* argv[]) E_NOTELOCALS
   str_alloc_text(&the_session.remote_ip_str,
                  vsf_sysutil_inet_ntop(the_session.p_remote_addr));
   /* Set up options on the command socket */
-  vsf_cmdio_sock_setup();
+  if (!sock_opts_inherited)
+  {
+    vsf_cmdio_sock_setup();
+  }
+  vsf_stats_set_remote(&the_session.remote_ip_str);
   if (tunable_setproctitle_enable)
   {
     vsf_sysutil_set_proctitle_prefix(&the_session.remote_ip_str);
@@ -194,6 +236,10 @@ main(int argc, const char* argv[]) E_NOTELOCALS
   /* We might chroot() very soon (one process model), so we need to open
    * any required config files here.
    */
+  if (tunable_sockbuf_autotune_enable)
+  {
+    vsf_sysutil_load_tcp_autotune_max();
+  }
   /* SSL may have been enabled by a per-IP configuration.. */
   if (tunable_ssl_enable)
   {
@@ -201,9 +247,9 @@ main(int argc, const char* argv[]) E_NOTELOCALS
   }
   if (tunable_deny_email_enable)
   {
-    int retval = str_fileread(&the_session.banned_email_str,
-                              tunable_banned_email_file, VSFTP_CONF_FILE_MAX);
-    if (vsf_sysutil_retval_is_error(retval))
+    the_session.p_banned_email_idx =
+      vsf_lineidx_load_file(tunable_banned_email_file);
+    if (!the_session.p_banned_email_idx)
     {
       die2("cannot open anon e-mail list file:", tunable_banned_email_file);
     }
@@ -219,10 +265,9 @@ main(int argc, const char* argv[]) E_NOTELOCALS
   }
   if (tunable_secure_email_list_enable)
   {
-    int retval = str_fileread(&the_session.email_passwords_str,
-                              tunable_email_password_file,
-                              VSFTP_CONF_FILE_MAX);
-    if (vsf_sysutil_retval_is_error(retval))
+    the_session.p_email_passwords_idx =
+      vsf_lineidx_load_file(tunable_email_password_file);
+    if (!the_session.p_email_passwords_idx)
     {
       die2("cannot open email passwords file:", tunable_email_password_file);
     }
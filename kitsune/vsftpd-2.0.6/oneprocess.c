@@ -12,6 +12,7 @@
  * pain of two processes per session.
  */
 
+#include "authsvc.h"
 #include "prelogin.h"
 #include "postlogin.h"
 #include "privops.h"
@@ -27,6 +28,11 @@ void
 vsf_one_process_start(struct vsf_session* p_sess)
 {
   unsigned int caps = 0;
+  /* Only anonymous logins here, so never a password for the auth_workers
+   * to check; left open, their socket would be a password oracle with no
+   * delay_failed_login or max_login_fails.
+   */
+  vsf_authsvc_close();
   if (tunable_chown_uploads)
   {
     caps |= kCapabilityCAP_CHOWN;
@@ -10,6 +10,12 @@
 #include "ftpcodes.h"
 #include "ftpcmdio.h"
 #include "session.h"
+#include "tunables.h"
+#include "checksum.h"
+
+static int parse_deflate_level(const struct mystr* p_arg_str);
+static int is_opts_hash(const struct mystr* p_arg_str);
+static void handle_opts_hash(struct vsf_session* p_sess);
 
 void
 handle_opts(struct vsf_session* p_sess)
@@ -19,9 +25,80 @@ handle_opts(struct vsf_session* p_sess)
   {
     vsf_cmdio_write(p_sess, FTP_OPTSOK, "Always in UTF8 mode.");
   }
+  else if (tunable_download_enable && is_opts_hash(&p_sess->ftp_arg_str))
+  {
+    handle_opts_hash(p_sess);
+  }
+  else if (tunable_deflate_enable &&
+           parse_deflate_level(&p_sess->ftp_arg_str) >= 0)
+  {
+    p_sess->deflate_level = parse_deflate_level(&p_sess->ftp_arg_str);
+    vsf_cmdio_write(p_sess, FTP_OPTSOK, "MODE Z options set.");
+  }
   else
   {
     vsf_cmdio_write(p_sess, FTP_BADOPTS, "Option not understood.");
   }
 }
 
+static int
+is_opts_hash(const struct mystr* p_arg_str)
+{
+  struct str_locate_result loc_result;
+  if (str_equal_text(p_arg_str, "HASH"))
+  {
+    return 1;
+  }
+  loc_result = str_locate_text(p_arg_str, "HASH ");
+  return loc_result.found && loc_result.index == 0;
+}
+
+static int
+parse_deflate_level(const struct mystr* p_arg_str)
+{
+  /* Accepts "MODE Z LEVEL <n>" (draft-preston-ftpext-deflate), n from 0 to 9.
+   * Returns the level, or -1 if the argument isn't of that form.
+   */
+  static struct mystr s_level_str;
+  static const char s_prefix[] = "MODE Z LEVEL ";
+  struct str_locate_result loc_result = str_locate_text(p_arg_str, s_prefix);
+  char the_char;
+  if (!loc_result.found || loc_result.index != 0)
+  {
+    return -1;
+  }
+  str_mid_to_end(p_arg_str, &s_level_str, sizeof(s_prefix) - 1);
+  if (str_getlen(&s_level_str) != 1)
+  {
+    return -1;
+  }
+  the_char = str_get_char_at(&s_level_str, 0);
+  if (the_char < '0' || the_char > '9')
+  {
+    return -1;
+  }
+  return the_char - '0';
+}
+
+static void
+handle_opts_hash(struct vsf_session* p_sess)
+{
+  /* "OPTS HASH" queries the current algorithm, "OPTS HASH <name>" sets it */
+  static struct mystr s_opt_str;
+  static struct mystr s_name_str;
+  str_copy(&s_opt_str, &p_sess->ftp_arg_str);
+  str_split_char(&s_opt_str, &s_name_str, ' ');
+  if (!str_isempty(&s_name_str))
+  {
+    enum EVSFChecksumType type = vsf_checksum_parse_name(&s_name_str);
+    if (type == kVSFChecksumNone)
+    {
+      vsf_cmdio_write(p_sess, FTP_BADOPTS, "Unknown algorithm.");
+      return;
+    }
+    p_sess->hash_type = (int) type;
+  }
+  vsf_cmdio_write(p_sess, FTP_OPTSOK,
+                  vsf_checksum_get_name(
+                    (enum EVSFChecksumType) p_sess->hash_type));
+}
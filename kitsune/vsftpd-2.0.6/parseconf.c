@@ -14,17 +14,55 @@
 #include "filestr.h"
 #include "defs.h"
 #include "sysutil.h"
+#include "sysstr.h"
 #include "utility.h"
 
+enum EVSFParseconfType
+{
+  kVSFParseconfBool = 1,
+  kVSFParseconfUint,
+  kVSFParseconfStr
+};
+
+/* One line of a config file, resolved against the tables below */
+struct parseconf_setting
+{
+  enum EVSFParseconfType type;
+  unsigned int index;
+  unsigned int uint_val;
+  char* p_str_val;
+};
+
+/* A config file compiled down to its settings. Applying it again is just a
+ * walk over them, with no file reading or name lookups.
+ */
+struct parseconf_snapshot
+{
+  struct parseconf_snapshot* p_next;
+  char* p_filename;
+  long mtime;
+  filesize_t size;
+  filesize_t inode;
+  unsigned int num_settings;
+  unsigned int alloc_settings;
+  struct parseconf_setting* p_settings;
+};
+
 static const char* s_p_saved_filename;
 static int s_strings_copied;
+static struct parseconf_snapshot* s_p_cache[VSFTP_CONF_CACHE_BUCKETS];
 
 /* File local functions */
-static void handle_config_setting(struct mystr* p_setting_str,
-                                  struct mystr* p_value_str,
-                                  int errs_fatal);
-
+static int parse_file(const char* p_filename, int errs_fatal,
+                      struct parseconf_snapshot* p_snap);
+static int compile_setting(struct mystr* p_setting_str,
+                           struct mystr* p_value_str, int errs_fatal,
+                           struct parseconf_setting* p_setting);
+static void apply_setting(const struct parseconf_setting* p_setting);
 static void copy_string_settings(void);
+static unsigned int hash_filename(const char* p_filename);
+static void free_snapshot(struct parseconf_snapshot* p_snap);
+static void free_cache(void);
 
 /* Tables mapping setting names to runtime variables */
 /* Boolean settings */
@@ -102,6 +140,14 @@ parseconf_bool_array[] =
   { "debug_ssl", &tunable_debug_ssl },
   { "require_cert", &tunable_require_cert },
   { "validate_cert", &tunable_validate_cert },
+  { "deflate_enable", &tunable_deflate_enable },
+  { "block_mode_enable", &tunable_block_mode_enable },
+  { "deflate_sidecar_enable", &tunable_deflate_sidecar_enable },
+  { "checksum_cache_enable", &tunable_checksum_cache_enable },
+  { "allo_prealloc_enable", &tunable_allo_prealloc_enable },
+  { "atomic_upload_enable", &tunable_atomic_upload_enable },
+  { "upload_sync_enable", &tunable_upload_sync_enable },
+  { "sockbuf_autotune_enable", &tunable_sockbuf_autotune_enable },
   { 0, 0 }
 };
 
@@ -124,6 +170,7 @@ parseconf_uint_array[] =
   { "anon_max_rate", &tunable_anon_max_rate },
   { "local_max_rate", &tunable_local_max_rate },
   { "listen_port", &tunable_listen_port },
+  { "listen_shards", &tunable_listen_shards },
   { "max_clients", &tunable_max_clients },
   { "file_open_mode", &tunable_file_open_mode },
   { "max_per_ip", &tunable_max_per_ip },
@@ -132,6 +179,16 @@ parseconf_uint_array[] =
   { "delay_successful_login", &tunable_delay_successful_login },
   { "max_login_fails", &tunable_max_login_fails },
   { "chown_upload_mode", &tunable_chown_upload_mode },
+  { "deflate_level", &tunable_deflate_level },
+  { "tcp_fastopen", &tunable_tcp_fastopen },
+  { "auth_workers", &tunable_auth_workers },
+  { "auth_cache_ttl", &tunable_auth_cache_ttl },
+  { "write_behind_size", &tunable_write_behind_size },
+  { "stream_download_size", &tunable_stream_download_size },
+  { "sockbuf_link_rate", &tunable_sockbuf_link_rate },
+  { "sockbuf_max_size", &tunable_sockbuf_max_size },
+  { "tcp_notsent_lowat", &tunable_tcp_notsent_lowat },
+  { "allo_max_size", &tunable_allo_max_size },
   { 0, 0 }
 };
 
@@ -173,17 +230,15 @@ parseconf_str_array[] =
   { "rsa_private_key_file", &tunable_rsa_private_key_file },
   { "dsa_private_key_file", &tunable_dsa_private_key_file },
   { "ca_certs_file", &tunable_ca_certs_file },
+  { "deflate_exclude_file", &tunable_deflate_exclude_file },
+  { "stats_socket", &tunable_stats_socket },
+  { "scoreboard_file", &tunable_scoreboard_file },
   { 0, 0 }
 };
 
 void
 vsf_parseconf_load_file(const char* p_filename, int errs_fatal)
 {
-  struct mystr config_file_str = INIT_MYSTR;
-  struct mystr config_setting_str = INIT_MYSTR;
-  struct mystr config_value_str = INIT_MYSTR;
-  unsigned int str_pos = 0;
-  int retval;
   if (!p_filename)
   {
     p_filename = s_p_saved_filename;
@@ -200,15 +255,118 @@ vsf_parseconf_load_file(const char* p_filename, int errs_fatal)
   {
     bug("null filename in vsf_parseconf_load_file");
   }
-  if (!s_strings_copied)
+  copy_string_settings();
+  (void) parse_file(p_filename, errs_fatal, 0);
+}
+
+void
+vsf_parseconf_cache_dir(const char* p_dirname)
+{
+  struct mystr filename_str = INIT_MYSTR;
+  struct vsf_sysutil_statbuf* p_statbuf = 0;
+  struct vsf_sysutil_dir* p_dir;
+  long now_sec;
+  free_cache();
+  p_dir = vsf_sysutil_opendir(p_dirname);
+  if (p_dir == 0)
+  {
+    return;
+  }
+  vsf_sysutil_update_cached_time();
+  now_sec = vsf_sysutil_get_cached_time_sec();
+  while (1)
   {
-    s_strings_copied = 1;
-    /* A minor hack to make sure all strings are malloc()'ed so we can free
-     * them at some later date. Specifically handles strings embedded in the
-     * binary.
+    struct parseconf_snapshot* p_snap;
+    unsigned int bucket;
+    int retval;
+    const char* p_name = vsf_sysutil_next_dirent(p_dir);
+    if (p_name == 0)
+    {
+      break;
+    }
+    if (p_name[0] == '.')
+    {
+      continue;
+    }
+    str_alloc_text(&filename_str, p_dirname);
+    str_append_char(&filename_str, '/');
+    str_append_text(&filename_str, p_name);
+    retval = str_stat(&filename_str, &p_statbuf);
+    /* Only files a session would load; see handle_per_user_config(). A file
+     * changed this very second might change again without its mtime moving,
+     * so leave that to be parsed at login.
      */
+    if (vsf_sysutil_retval_is_error(retval) ||
+        !vsf_sysutil_statbuf_is_regfile(p_statbuf) ||
+        vsf_sysutil_statbuf_get_uid(p_statbuf) != VSFTP_ROOT_UID ||
+        vsf_sysutil_statbuf_get_mtime(p_statbuf) >= now_sec)
+    {
+      continue;
+    }
+    p_snap = vsf_sysutil_malloc(sizeof(*p_snap));
+    vsf_sysutil_memclr(p_snap, sizeof(*p_snap));
+    if (parse_file(str_getbuf(&filename_str), 0, p_snap) != 1)
+    {
+      /* Can't read it, or it has errors which the session must report */
+      free_snapshot(p_snap);
+      continue;
+    }
+    p_snap->p_filename = (char*) str_strdup(&filename_str);
+    p_snap->mtime = vsf_sysutil_statbuf_get_mtime(p_statbuf);
+    p_snap->size = vsf_sysutil_statbuf_get_size(p_statbuf);
+    p_snap->inode = vsf_sysutil_statbuf_get_inode(p_statbuf);
+    bucket = hash_filename(p_snap->p_filename);
+    p_snap->p_next = s_p_cache[bucket];
+    s_p_cache[bucket] = p_snap;
+  }
+  vsf_sysutil_closedir(p_dir);
+  str_free(&filename_str);
+  if (p_statbuf)
+  {
+    vsf_sysutil_free(p_statbuf);
+  }
+}
+
+void
+vsf_parseconf_load_file_cached(const char* p_filename,
+                               const struct vsf_sysutil_statbuf* p_statbuf)
+{
+  const struct parseconf_snapshot* p_snap =
+    s_p_cache[hash_filename(p_filename)];
+  while (p_snap != 0)
+  {
+    if (vsf_sysutil_strcmp(p_snap->p_filename, p_filename) == 0)
+    {
+      break;
+    }
+    p_snap = p_snap->p_next;
+  }
+  if (p_snap != 0 &&
+      p_snap->mtime == vsf_sysutil_statbuf_get_mtime(p_statbuf) &&
+      p_snap->size == vsf_sysutil_statbuf_get_size(p_statbuf) &&
+      p_snap->inode == vsf_sysutil_statbuf_get_inode(p_statbuf))
+  {
+    unsigned int i;
     copy_string_settings();
+    for (i = 0; i < p_snap->num_settings; ++i)
+    {
+      apply_setting(&p_snap->p_settings[i]);
+    }
+    return;
   }
+  vsf_parseconf_load_file(p_filename, 1);
+}
+
+static int
+parse_file(const char* p_filename, int errs_fatal,
+           struct parseconf_snapshot* p_snap)
+{
+  struct mystr config_file_str = INIT_MYSTR;
+  struct mystr config_setting_str = INIT_MYSTR;
+  struct mystr config_value_str = INIT_MYSTR;
+  unsigned int str_pos = 0;
+  int clean = 1;
+  int retval;
   retval = str_fileread(&config_file_str, p_filename, VSFTP_CONF_FILE_MAX);
   if (vsf_sysutil_retval_is_error(retval))
   {
@@ -218,11 +376,12 @@ vsf_parseconf_load_file(const char* p_filename, int errs_fatal)
     }
     else
     {
-      return;
+      return -1;
     }
   }
   while (str_getline(&config_file_str, &config_setting_str, &str_pos))
   {
+    struct parseconf_setting setting;
     if (str_isempty(&config_setting_str) ||
         str_get_char_at(&config_setting_str, 0) == '#')
     {
@@ -230,17 +389,42 @@ vsf_parseconf_load_file(const char* p_filename, int errs_fatal)
     }
     /* Split into name=value pair */
     str_split_char(&config_setting_str, &config_value_str, '=');
-    handle_config_setting(&config_setting_str, &config_value_str, errs_fatal);
+    if (!compile_setting(&config_setting_str, &config_value_str, errs_fatal,
+                         &setting))
+    {
+      clean = 0;
+      continue;
+    }
+    if (!p_snap)
+    {
+      apply_setting(&setting);
+      if (setting.p_str_val)
+      {
+        vsf_sysutil_free(setting.p_str_val);
+      }
+      continue;
+    }
+    if (p_snap->num_settings == p_snap->alloc_settings)
+    {
+      p_snap->alloc_settings = p_snap->alloc_settings * 2 + 8;
+      p_snap->p_settings = vsf_sysutil_realloc(
+        p_snap->p_settings,
+        p_snap->alloc_settings * sizeof(struct parseconf_setting));
+    }
+    p_snap->p_settings[p_snap->num_settings++] = setting;
   }
   str_free(&config_file_str);
   str_free(&config_setting_str);
   str_free(&config_value_str);
+  return clean;
 }
 
-static void
-handle_config_setting(struct mystr* p_setting_str, struct mystr* p_value_str,
-                      int errs_fatal)
+static int
+compile_setting(struct mystr* p_setting_str, struct mystr* p_value_str,
+                int errs_fatal, struct parseconf_setting* p_setting)
 {
+  p_setting->uint_val = 0;
+  p_setting->p_str_val = 0;
   /* Is it a string setting? */
   {
     const struct parseconf_str_setting* p_str_setting = parseconf_str_array;
@@ -249,20 +433,13 @@ handle_config_setting(struct mystr* p_setting_str, struct mystr* p_value_str,
       if (str_equal_text(p_setting_str, p_str_setting->p_setting_name))
       {
         /* Got it */
-        const char** p_curr_setting = p_str_setting->p_variable;
-        if (*p_curr_setting)
-        {
-          vsf_sysutil_free((char*)*p_curr_setting);
-        }
-        if (str_isempty(p_value_str))
-        {
-          *p_curr_setting = 0;
-        }
-        else
+        p_setting->type = kVSFParseconfStr;
+        p_setting->index = p_str_setting - parseconf_str_array;
+        if (!str_isempty(p_value_str))
         {
-          *p_curr_setting = str_strdup(p_value_str);
+          p_setting->p_str_val = (char*) str_strdup(p_value_str);
         }
-        return;
+        return 1;
       }
       p_str_setting++;
     }
@@ -275,7 +452,7 @@ handle_config_setting(struct mystr* p_setting_str, struct mystr* p_value_str,
     }
     else
     {
-      return;
+      return 0;
     }
   }
   /* Is it a boolean value? */
@@ -286,25 +463,31 @@ handle_config_setting(struct mystr* p_setting_str, struct mystr* p_value_str,
       if (str_equal_text(p_setting_str, p_bool_setting->p_setting_name))
       {
         /* Got it */
+        p_setting->type = kVSFParseconfBool;
+        p_setting->index = p_bool_setting - parseconf_bool_array;
         str_upper(p_value_str);
         if (str_equal_text(p_value_str, "YES") ||
             str_equal_text(p_value_str, "TRUE") ||
             str_equal_text(p_value_str, "1"))
         {
-          *(p_bool_setting->p_variable) = 1;
+          p_setting->uint_val = 1;
         }
         else if (str_equal_text(p_value_str, "NO") ||
                  str_equal_text(p_value_str, "FALSE") ||
                  str_equal_text(p_value_str, "0"))
         {
-          *(p_bool_setting->p_variable) = 0;
+          p_setting->uint_val = 0;
         }
         else if (errs_fatal)
         {
           die2("bad bool value in config file for: ",
                str_getbuf(p_setting_str));
         }
-        return;
+        else
+        {
+          return 0;
+        }
+        return 1;
       }
       p_bool_setting++;
     }
@@ -317,17 +500,19 @@ handle_config_setting(struct mystr* p_setting_str, struct mystr* p_value_str,
       if (str_equal_text(p_setting_str, p_uint_setting->p_setting_name))
       {
         /* Got it */
+        p_setting->type = kVSFParseconfUint;
+        p_setting->index = p_uint_setting - parseconf_uint_array;
         /* If the value starts with 0, assume it's an octal value */
         if (!str_isempty(p_value_str) &&
             str_get_char_at(p_value_str, 0) == '0')
         {
-          *(p_uint_setting->p_variable) = str_octal_to_uint(p_value_str);
+          p_setting->uint_val = str_octal_to_uint(p_value_str);
         }
         else
         {
-          *(p_uint_setting->p_variable) = str_atoi(p_value_str);
+          p_setting->uint_val = str_atoi(p_value_str);
         }
-        return;
+        return 1;
       }
       p_uint_setting++;
     }
@@ -336,12 +521,56 @@ handle_config_setting(struct mystr* p_setting_str, struct mystr* p_value_str,
   {
     die2("unrecognised variable in config file: ", str_getbuf(p_setting_str));
   }
+  return 0;
+}
+
+static void
+apply_setting(const struct parseconf_setting* p_setting)
+{
+  switch (p_setting->type)
+  {
+    case kVSFParseconfBool:
+      *(parseconf_bool_array[p_setting->index].p_variable) =
+        (int) p_setting->uint_val;
+      break;
+    case kVSFParseconfUint:
+      *(parseconf_uint_array[p_setting->index].p_variable) =
+        p_setting->uint_val;
+      break;
+    case kVSFParseconfStr:
+      {
+        const char** p_curr_setting =
+          parseconf_str_array[p_setting->index].p_variable;
+        if (*p_curr_setting)
+        {
+          vsf_sysutil_free((char*)*p_curr_setting);
+        }
+        *p_curr_setting = 0;
+        if (p_setting->p_str_val)
+        {
+          *p_curr_setting = vsf_sysutil_strdup(p_setting->p_str_val);
+        }
+      }
+      break;
+    default:
+      bug("bad setting type in apply_setting");
+      break;
+  }
 }
 
 static void
 copy_string_settings(void)
 {
   const struct parseconf_str_setting* p_str_setting = parseconf_str_array;
+  if (s_strings_copied)
+  {
+    return;
+  }
+  s_strings_copied = 1;
+  /* A minor hack to make sure all strings are malloc()'ed so we can free
+   * them at some later date. Specifically handles strings embedded in the
+   * binary.
+   */
   while (p_str_setting->p_setting_name != 0)
   {
     if (*p_str_setting->p_variable != 0)
@@ -353,3 +582,50 @@ copy_string_settings(void)
   }
 }
 
+static unsigned int
+hash_filename(const char* p_filename)
+{
+  unsigned int val = 0;
+  while (*p_filename)
+  {
+    val = val * 31 + (unsigned char) *p_filename++;
+  }
+  return val % VSFTP_CONF_CACHE_BUCKETS;
+}
+
+static void
+free_cache(void)
+{
+  unsigned int i;
+  for (i = 0; i < VSFTP_CONF_CACHE_BUCKETS; ++i)
+  {
+    while (s_p_cache[i] != 0)
+    {
+      struct parseconf_snapshot* p_snap = s_p_cache[i];
+      s_p_cache[i] = p_snap->p_next;
+      free_snapshot(p_snap);
+    }
+  }
+}
+
+static void
+free_snapshot(struct parseconf_snapshot* p_snap)
+{
+  unsigned int i;
+  for (i = 0; i < p_snap->num_settings; ++i)
+  {
+    if (p_snap->p_settings[i].p_str_val)
+    {
+      vsf_sysutil_free(p_snap->p_settings[i].p_str_val);
+    }
+  }
+  if (p_snap->p_settings)
+  {
+    vsf_sysutil_free(p_snap->p_settings);
+  }
+  if (p_snap->p_filename)
+  {
+    vsf_sysutil_free(p_snap->p_filename);
+  }
+  vsf_sysutil_free(p_snap);
+}
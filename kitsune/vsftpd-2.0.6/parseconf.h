@@ -1,6 +1,8 @@
 #ifndef VSF_PARSECONF_H
 #define VSF_PARSECONF_H
 
+struct vsf_sysutil_statbuf;
+
 /* vsf_parseconf_load_file()
  * PURPOSE
  * Parse the given file as a vsftpd config file. If the file cannot be
@@ -17,5 +19,28 @@
  */
 void vsf_parseconf_load_file(const char* p_filename, int errs_fatal);
 
+/* vsf_parseconf_cache_dir()
+ * PURPOSE
+ * Compile every root owned config file in a directory (e.g. user_config_dir)
+ * into a list of settings, and keep them, replacing any earlier cache. The
+ * standalone listener does this so that the sessions it forks get the cache
+ * for free. Files which do not parse cleanly are left out.
+ * PARAMETERS
+ * p_dirname      - the directory to read
+ */
+void vsf_parseconf_cache_dir(const char* p_dirname);
+
+/* vsf_parseconf_load_file_cached()
+ * PURPOSE
+ * As vsf_parseconf_load_file() with fatal errors, except that if the file
+ * was cached by vsf_parseconf_cache_dir() and has not changed since, the
+ * cached settings are applied without reading the file at all.
+ * PARAMETERS
+ * p_filename     - the name of the config file to load
+ * p_statbuf      - the result of stat()ing p_filename just now
+ */
+void vsf_parseconf_load_file_cached(
+  const char* p_filename, const struct vsf_sysutil_statbuf* p_statbuf);
+
 #endif /* VSF_PARSECONF_H */
 
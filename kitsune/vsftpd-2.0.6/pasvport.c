@@ -0,0 +1,215 @@
+/*
+ * Part of Very Secure FTPd
+ * Licence: GPL v2
+ * Author: Chris Evans
+ * pasvport.c
+ *
+ * A bitmap of passive mode ports in use, shared between the standalone
+ * listener and its sessions. A session looking for a port starts at a random
+ * word of the map, so ports stay hard to predict, and takes a clear bit. The
+ * owner of each bit is recorded so that the listener can free the ports of a
+ * session which dies without giving them back.
+ *
+ * There is no locking. Two sessions racing for the same word may both think
+ * they got a port, or lose each other's updates; the loser of the bind()
+ * just tries again, so the map only ever costs us a retry.
+ *
+ * Only the bits and owners are shared. The size of the map lives in the
+ * listener's own memory, so that a session scribbling over the shared pages
+ * can't make the listener read or write past them.
+ */
+
+#include "pasvport.h"
+#include "str.h"
+#include "sysutil.h"
+#include "sysdeputil.h"
+#include "tunables.h"
+
+#define VSF_PASVPORT_WORD_BITS  (sizeof(unsigned int) * 8)
+
+struct vsf_pasvport
+{
+  unsigned int min_port;
+  unsigned int num_ports;
+  unsigned int num_words;
+  /* Shared: bits[num_words] then owners[num_ports] */
+  unsigned int* p_bits;
+  int* p_owners;
+};
+
+/* Session side state */
+static struct vsf_pasvport* s_p_map;
+static int s_owner_pid;
+static unsigned int s_held_index;
+static int s_holding;
+
+void
+vsf_pasvport_range(unsigned short* p_min_port, unsigned short* p_max_port)
+{
+  /* IPPORT_RESERVED */
+  unsigned short min_port = 1024;
+  unsigned short max_port = 65535;
+  if (tunable_pasv_min_port > min_port && tunable_pasv_min_port <= max_port)
+  {
+    min_port = tunable_pasv_min_port;
+  }
+  if (tunable_pasv_max_port >= min_port && tunable_pasv_max_port < max_port)
+  {
+    max_port = tunable_pasv_max_port;
+  }
+  *p_min_port = min_port;
+  *p_max_port = max_port;
+}
+
+struct vsf_pasvport*
+vsf_pasvport_alloc(unsigned short min_port, unsigned short max_port)
+{
+  struct vsf_pasvport* p_map;
+  unsigned int num_ports = (unsigned int) max_port - min_port + 1;
+  unsigned int num_words = (num_ports + VSF_PASVPORT_WORD_BITS - 1) /
+                           VSF_PASVPORT_WORD_BITS;
+  unsigned int* p_bits;
+  unsigned int i;
+  p_bits = vsf_sysutil_map_shared_pages(num_words * sizeof(unsigned int) +
+                                        num_ports * sizeof(int));
+  p_map = vsf_sysutil_malloc(sizeof(*p_map));
+  p_map->min_port = min_port;
+  p_map->num_ports = num_ports;
+  p_map->num_words = num_words;
+  p_map->p_bits = p_bits;
+  p_map->p_owners = (int*) (p_bits + num_words);
+  /* Bits past the end of the range are permanently "in use" */
+  for (i = num_ports; i < num_words * VSF_PASVPORT_WORD_BITS; ++i)
+  {
+    p_bits[i / VSF_PASVPORT_WORD_BITS] |= 1U << (i % VSF_PASVPORT_WORD_BITS);
+  }
+  return p_map;
+}
+
+void
+vsf_pasvport_release_pid(struct vsf_pasvport* p_map, int pid)
+{
+  unsigned int* p_bits = p_map->p_bits;
+  int* p_owners = p_map->p_owners;
+  unsigned int i;
+  for (i = 0; i < p_map->num_ports; ++i)
+  {
+    unsigned int word = i / VSF_PASVPORT_WORD_BITS;
+    unsigned int mask = 1U << (i % VSF_PASVPORT_WORD_BITS);
+    if (p_bits[word] == 0)
+    {
+      /* Skip the rest of an empty word */
+      i += VSF_PASVPORT_WORD_BITS - 1 - (i % VSF_PASVPORT_WORD_BITS);
+      continue;
+    }
+    if ((p_bits[word] & mask) && p_owners[i] == pid)
+    {
+      p_owners[i] = 0;
+      p_bits[word] &= ~mask;
+    }
+  }
+}
+
+void
+vsf_pasvport_attach(struct vsf_pasvport* p_map)
+{
+  s_p_map = p_map;
+  /* Any process the session forks later records this pid too, which is the
+   * one the listener reaps.
+   */
+  s_owner_pid = (int) vsf_sysutil_getpid();
+}
+
+unsigned short
+vsf_pasvport_get(unsigned short min_port, unsigned short max_port)
+{
+  unsigned int* p_bits;
+  unsigned int start_word;
+  unsigned int start_bit;
+  unsigned int i;
+  unsigned int j;
+  if (s_p_map == 0 || min_port != s_p_map->min_port ||
+      (unsigned int) max_port - min_port + 1 != s_p_map->num_ports)
+  {
+    /* e.g. a per-user config set a different range */
+    return 0;
+  }
+  p_bits = s_p_map->p_bits;
+  start_word = vsf_sysutil_get_random_byte();
+  start_word <<= 8;
+  start_word |= vsf_sysutil_get_random_byte();
+  start_word %= s_p_map->num_words;
+  start_bit = vsf_sysutil_get_random_byte() % VSF_PASVPORT_WORD_BITS;
+  for (i = 0; i < s_p_map->num_words; ++i)
+  {
+    unsigned int word = (start_word + i) % s_p_map->num_words;
+    if (p_bits[word] == ~0U)
+    {
+      continue;
+    }
+    for (j = 0; j < VSF_PASVPORT_WORD_BITS; ++j)
+    {
+      unsigned int bit = (start_bit + j) % VSF_PASVPORT_WORD_BITS;
+      unsigned int mask = 1U << bit;
+      if (!(p_bits[word] & mask))
+      {
+        p_bits[word] |= mask;
+        s_held_index = word * VSF_PASVPORT_WORD_BITS + bit;
+        s_holding = 1;
+        s_p_map->p_owners[s_held_index] = s_owner_pid;
+        return (unsigned short) (s_p_map->min_port + s_held_index);
+      }
+    }
+  }
+  return 0;
+}
+
+void
+vsf_pasvport_put(void)
+{
+  int* p_owners;
+  if (s_p_map == 0 || !s_holding)
+  {
+    return;
+  }
+  s_holding = 0;
+  p_owners = s_p_map->p_owners;
+  if (p_owners[s_held_index] == s_owner_pid)
+  {
+    p_owners[s_held_index] = 0;
+    s_p_map->p_bits[s_held_index / VSF_PASVPORT_WORD_BITS] &=
+      ~(1U << (s_held_index % VSF_PASVPORT_WORD_BITS));
+  }
+}
+
+void
+vsf_pasvport_keep(void)
+{
+  s_holding = 0;
+}
+
+void
+vsf_pasvport_dump(const struct vsf_pasvport* p_map, struct mystr* p_str)
+{
+  const unsigned int* p_bits = p_map->p_bits;
+  unsigned int in_use = 0;
+  unsigned int i;
+  for (i = 0; i < p_map->num_ports; ++i)
+  {
+    if (p_bits[i / VSF_PASVPORT_WORD_BITS] &
+        (1U << (i % VSF_PASVPORT_WORD_BITS)))
+    {
+      ++in_use;
+    }
+  }
+  str_append_text(p_str, "# HELP vsftpd_pasv_ports "
+                         "Ports in the passive mode range.\n");
+  str_append_text(p_str, "# TYPE vsftpd_pasv_ports gauge\n");
+  str_append_text(p_str, "vsftpd_pasv_ports{state=\"in_use\"} ");
+  str_append_ulong(p_str, in_use);
+  str_append_char(p_str, '\n');
+  str_append_text(p_str, "vsftpd_pasv_ports{state=\"free\"} ");
+  str_append_ulong(p_str, p_map->num_ports - in_use);
+  str_append_char(p_str, '\n');
+}
+
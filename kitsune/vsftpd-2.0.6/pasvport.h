@@ -0,0 +1,89 @@
+#ifndef VSF_PASVPORT_H
+#define VSF_PASVPORT_H
+
+struct mystr;
+struct vsf_pasvport;
+
+/* vsf_pasvport_range()
+ * PURPOSE
+ * Work out the range of ports passive mode may use, from pasv_min_port and
+ * pasv_max_port.
+ * PARAMETERS
+ * p_min_port   - where to store the lowest usable port
+ * p_max_port   - where to store the highest usable port
+ */
+void vsf_pasvport_range(unsigned short* p_min_port,
+                        unsigned short* p_max_port);
+
+/* vsf_pasvport_alloc()
+ * PURPOSE
+ * Allocate the map of passive ports in use. This is called by the standalone
+ * listener, and the memory is shared with every session it launches, so that
+ * sessions stop picking ports another session already has. The map is only
+ * a hint; bind() still has the final say.
+ * PARAMETERS
+ * min_port     - the lowest port in the map
+ * max_port     - the highest port in the map
+ * RETURNS
+ * A handle to the port map.
+ */
+struct vsf_pasvport* vsf_pasvport_alloc(unsigned short min_port,
+                                        unsigned short max_port);
+
+/* vsf_pasvport_release_pid()
+ * PURPOSE
+ * Free every port still marked as used by a session which has exited.
+ * PARAMETERS
+ * p_map        - the port map
+ * pid          - the process ID of the session which has exited
+ */
+void vsf_pasvport_release_pid(struct vsf_pasvport* p_map, int pid);
+
+/* vsf_pasvport_attach()
+ * PURPOSE
+ * Called in a newly launched session so that it allocates ports from the
+ * map. Until this is called, vsf_pasvport_get() always returns 0.
+ * PARAMETERS
+ * p_map        - the port map, or null for none
+ */
+void vsf_pasvport_attach(struct vsf_pasvport* p_map);
+
+/* vsf_pasvport_get()
+ * PURPOSE
+ * Pick a port which no other session is using, at a random place in the
+ * map, and mark it as ours. The port stays marked until
+ * vsf_pasvport_put() or vsf_pasvport_keep(), or until the session exits.
+ * PARAMETERS
+ * min_port     - the lowest port the session may use
+ * max_port     - the highest port the session may use
+ * RETURNS
+ * The port, or 0 if there is no map for this range or it is full.
+ */
+unsigned short vsf_pasvport_get(unsigned short min_port,
+                                unsigned short max_port);
+
+/* vsf_pasvport_put()
+ * PURPOSE
+ * Give back the port last returned by vsf_pasvport_get(), if any.
+ */
+void vsf_pasvport_put(void);
+
+/* vsf_pasvport_keep()
+ * PURPOSE
+ * Forget the port last returned by vsf_pasvport_get() without giving it
+ * back. Used for a port which turned out to be busy anyway (e.g. used by
+ * another program), so that no session picks it again while we run.
+ */
+void vsf_pasvport_keep(void);
+
+/* vsf_pasvport_dump()
+ * PURPOSE
+ * Append port map utilisation, in the Prometheus text exposition format.
+ * PARAMETERS
+ * p_map        - the port map
+ * p_str        - the string to append to
+ */
+void vsf_pasvport_dump(const struct vsf_pasvport* p_map, struct mystr* p_str);
+
+#endif /* VSF_PASVPORT_H */
+
@@ -27,6 +27,12 @@
 #include "ssl.h"
 #include "vsftpver.h"
 #include "opts.h"
+#include "ls.h"
+#include "checksum.h"
+#include "hashsvc.h"
+#include "stats.h"
+#include "pasvport.h"
+#include "syncsvc.h"
 
 /* Private local functions */
 static void handle_pwd(struct vsf_session* p_sess);
@@ -42,6 +48,8 @@ static void handle_mkd(struct vsf_session* p_sess);
 static void handle_rmd(struct vsf_session* p_sess);
 static void handle_dele(struct vsf_session* p_sess);
 static void handle_rest(struct vsf_session* p_sess);
+static void handle_rang(struct vsf_session* p_sess);
+static void handle_allo(struct vsf_session* p_sess);
 static void handle_rnfr(struct vsf_session* p_sess);
 static void handle_rnto(struct vsf_session* p_sess);
 static void handle_nlst(struct vsf_session* p_sess);
@@ -51,6 +59,10 @@ static void handle_appe(struct vsf_session* p_sess);
 static void handle_mdtm(struct vsf_session* p_sess);
 static void handle_site_chmod(struct vsf_session* p_sess,
                               struct mystr* p_arg_str);
+static void handle_site_cpfr(struct vsf_session* p_sess,
+                             struct mystr* p_arg_str);
+static void handle_site_cpto(struct vsf_session* p_sess,
+                             struct mystr* p_arg_str);
 static void handle_site_umask(struct vsf_session* p_sess,
                               struct mystr* p_arg_str);
 static void handle_eprt(struct vsf_session* p_sess);
@@ -76,8 +88,36 @@ static void handle_upload_common(struct vsf_session* p_sess, int is_append,
                                  int is_unique);
 static void get_unique_filename(struct mystr* p_outstr,
                                 const struct mystr* p_base);
+static void get_upload_temp_filename(struct mystr* p_outstr,
+                                     const struct mystr* p_filename_str);
+static void begin_upload_temp(const struct mystr* p_temp_str);
+static void end_upload_temp(void);
+static void remove_upload_temp(void);
+static int commit_upload(const struct mystr* p_temp_str,
+                         const struct mystr* p_filename_str,
+                         int may_overwrite);
+static int sync_upload_dir(const struct mystr* p_filename_str);
+static void prepare_upload_fd(struct vsf_session* p_sess, int fd);
 static int data_transfer_checks_ok(struct vsf_session* p_sess);
 static void resolve_tilde(struct mystr* p_str, struct vsf_session* p_sess);
+static void handle_hash(struct vsf_session* p_sess);
+static void handle_xchecksum(struct vsf_session* p_sess,
+                             enum EVSFChecksumType type);
+static void handle_checksum_common(struct vsf_session* p_sess,
+                                   enum EVSFChecksumType type,
+                                   struct mystr* p_filename_str,
+                                   filesize_t start, filesize_t end,
+                                   int is_hash);
+static int get_deflate_level(struct vsf_session* p_sess,
+                             const struct mystr* p_filename_str);
+static int open_deflate_sidecar(
+  struct vsf_session* p_sess, const struct mystr* p_filename_str,
+  const struct vsf_sysutil_statbuf* p_file_statbuf,
+  filesize_t* p_sidecar_size);
+static int is_byte_pos(const struct mystr* p_str);
+
+/* The temp file of the upload or copy in progress, if any */
+static struct mystr s_upload_temp_str;
 
 void
 process_post_login(struct vsf_session* p_sess)
@@ -98,6 +138,7 @@ process_post_login(struct vsf_session* p_sess)
     vsf_sysutil_install_sighandler(kVSFSysUtilSigURG, handle_sigurg, p_sess);
     vsf_sysutil_activate_sigurg(VSFTP_COMMAND_FD);
   }
+  vsf_stats_set_user(&p_sess->user_str);
   
 	/* Kitsune */
   vsf_sysutil_kitsune_set_update_point("postlogin.c");
@@ -202,6 +243,31 @@ process_post_login(struct vsf_session* p_sess)
     {
       handle_retr(p_sess);
     }
+    else if (tunable_download_enable &&
+             str_equal_text(&p_sess->ftp_cmd_str, "HASH"))
+    {
+      handle_hash(p_sess);
+    }
+    else if (tunable_download_enable &&
+             str_equal_text(&p_sess->ftp_cmd_str, "XCRC"))
+    {
+      handle_xchecksum(p_sess, kVSFChecksumCRC32);
+    }
+    else if (tunable_download_enable &&
+             str_equal_text(&p_sess->ftp_cmd_str, "XMD5"))
+    {
+      handle_xchecksum(p_sess, kVSFChecksumMD5);
+    }
+    else if (tunable_download_enable &&
+             str_equal_text(&p_sess->ftp_cmd_str, "XSHA1"))
+    {
+      handle_xchecksum(p_sess, kVSFChecksumSHA1);
+    }
+    else if (tunable_download_enable &&
+             str_equal_text(&p_sess->ftp_cmd_str, "XSHA256"))
+    {
+      handle_xchecksum(p_sess, kVSFChecksumSHA256);
+    }
     else if (str_equal_text(&p_sess->ftp_cmd_str, "NOOP"))
     {
       vsf_cmdio_write(p_sess, FTP_NOOPOK, "NOOP ok.");
@@ -259,6 +325,10 @@ process_post_login(struct vsf_session* p_sess)
     {
       handle_rest(p_sess);
     }
+    else if (str_equal_text(&p_sess->ftp_cmd_str, "RANG"))
+    {
+      handle_rang(p_sess);
+    }
     else if (tunable_write_enable &&
              (tunable_anon_other_write_enable || !p_sess->is_anonymous) &&
              str_equal_text(&p_sess->ftp_cmd_str, "RNFR"))
@@ -291,6 +361,7 @@ process_post_login(struct vsf_session* p_sess)
     else if (str_equal_text(&p_sess->ftp_cmd_str, "ABOR") ||
              str_equal_text(&p_sess->ftp_cmd_str, "\377\364\377\362ABOR"))
     {
+      vsf_ftpdataio_close_kept_fd(p_sess);
       vsf_cmdio_write(p_sess, FTP_ABOR_NOCONN, "No transfer to ABOR.");
     }
     else if (tunable_write_enable &&
@@ -325,8 +396,30 @@ process_post_login(struct vsf_session* p_sess)
       str_upper(&p_sess->ftp_arg_str);
       if (str_equal_text(&p_sess->ftp_arg_str, "S"))
       {
+        p_sess->is_deflate = 0;
+        p_sess->is_block_mode = 0;
+        vsf_ftpdataio_close_kept_fd(p_sess);
         vsf_cmdio_write(p_sess, FTP_MODEOK, "Mode set to S.");
       }
+      else if (tunable_block_mode_enable &&
+               str_equal_text(&p_sess->ftp_arg_str, "B"))
+      {
+        p_sess->is_deflate = 0;
+        p_sess->is_block_mode = 1;
+        vsf_cmdio_write(p_sess, FTP_MODEOK, "Mode set to B.");
+      }
+      else if (tunable_deflate_enable &&
+               str_equal_text(&p_sess->ftp_arg_str, "Z"))
+      {
+        p_sess->is_deflate = 1;
+        p_sess->is_block_mode = 0;
+        vsf_ftpdataio_close_kept_fd(p_sess);
+        if (p_sess->deflate_level < 0)
+        {
+          p_sess->deflate_level = (int) tunable_deflate_level;
+        }
+        vsf_cmdio_write(p_sess, FTP_MODEOK, "Mode set to Z.");
+      }
       else
       {
         vsf_cmdio_write(p_sess, FTP_BADMODE, "Bad MODE command.");
@@ -338,7 +431,7 @@ process_post_login(struct vsf_session* p_sess)
     }
     else if (str_equal_text(&p_sess->ftp_cmd_str, "ALLO"))
     {
-      vsf_cmdio_write(p_sess, FTP_ALLOOK, "ALLO command ignored.");
+      handle_allo(p_sess);
     }
     else if (str_equal_text(&p_sess->ftp_cmd_str, "REIN"))
     {
@@ -376,6 +469,8 @@ process_post_login(struct vsf_session* p_sess)
     }
     else if (tunable_ssl_enable && str_equal_text(&p_sess->ftp_cmd_str, "PROT"))
     {
+      /* A kept MODE B connection can't change its protection level */
+      vsf_ftpdataio_close_kept_fd(p_sess);
       handle_prot(p_sess);
     }
     else if (str_equal_text(&p_sess->ftp_cmd_str, "USER"))
@@ -401,6 +496,11 @@ process_post_login(struct vsf_session* p_sess)
              str_equal_text(&p_sess->ftp_cmd_str, "EPSV") ||
              str_equal_text(&p_sess->ftp_cmd_str, "EPRT") ||
              str_equal_text(&p_sess->ftp_cmd_str, "RETR") ||
+             str_equal_text(&p_sess->ftp_cmd_str, "HASH") ||
+             str_equal_text(&p_sess->ftp_cmd_str, "XCRC") ||
+             str_equal_text(&p_sess->ftp_cmd_str, "XMD5") ||
+             str_equal_text(&p_sess->ftp_cmd_str, "XSHA1") ||
+             str_equal_text(&p_sess->ftp_cmd_str, "XSHA256") ||
              str_equal_text(&p_sess->ftp_cmd_str, "LIST") ||
              str_equal_text(&p_sess->ftp_cmd_str, "NLST") ||
              str_equal_text(&p_sess->ftp_cmd_str, "STOU") ||
@@ -516,6 +616,7 @@ pasv_cleanup(struct vsf_session* p_sess)
     vsf_sysutil_close(p_sess->pasv_listen_fd);
     p_sess->pasv_listen_fd = -1;
   }
+  vsf_pasvport_put();
 }
 
 static void
@@ -524,10 +625,11 @@ handle_pasv(struct vsf_session* p_sess, int is_epsv)
   static struct mystr s_pasv_res_str;
   static struct vsf_sysutil_sockaddr* s_p_sockaddr;
   int bind_retries = 10;
+  unsigned int collisions = 0;
+  int from_map = 0;
   unsigned short the_port = 0;
-  /* IPPORT_RESERVED */
-  unsigned short min_port = 1024;
-  unsigned short max_port = 65535;
+  unsigned short min_port;
+  unsigned short max_port;
   int is_ipv6 = vsf_sysutil_sockaddr_is_ipv6(p_sess->p_local_addr);
   if (is_epsv && !str_isempty(&p_sess->ftp_arg_str))
   {
@@ -546,6 +648,7 @@ handle_pasv(struct vsf_session* p_sess, int is_epsv)
       return;
     }
   }
+  vsf_ftpdataio_close_kept_fd(p_sess);
   pasv_cleanup(p_sess);
   port_cleanup(p_sess);
   if (is_ipv6)
@@ -558,26 +661,26 @@ handle_pasv(struct vsf_session* p_sess, int is_epsv)
   }
   vsf_sysutil_activate_reuseaddr(p_sess->pasv_listen_fd);
 
-  if (tunable_pasv_min_port > min_port && tunable_pasv_min_port <= max_port)
-  {
-    min_port = tunable_pasv_min_port;
-  }
-  if (tunable_pasv_max_port >= min_port && tunable_pasv_max_port < max_port)
-  {
-    max_port = tunable_pasv_max_port;
-  }
-
+  vsf_pasvport_range(&min_port, &max_port);
   while (--bind_retries)
   {
     int retval;
-    double scaled_port;
-    the_port = vsf_sysutil_get_random_byte();
-    the_port <<= 8;
-    the_port |= vsf_sysutil_get_random_byte();
-    scaled_port = (double) min_port;
-    scaled_port += ((double) the_port / (double) 65536) *
-                   ((double) max_port - min_port + 1);
-    the_port = (unsigned short) scaled_port;
+    /* Prefer a port no other session of ours has; if the shared map is
+     * unavailable or full, fall back to a random guess.
+     */
+    the_port = vsf_pasvport_get(min_port, max_port);
+    from_map = (the_port != 0);
+    if (!from_map)
+    {
+      double scaled_port;
+      the_port = vsf_sysutil_get_random_byte();
+      the_port <<= 8;
+      the_port |= vsf_sysutil_get_random_byte();
+      scaled_port = (double) min_port;
+      scaled_port += ((double) the_port / (double) 65536) *
+                     ((double) max_port - min_port + 1);
+      the_port = (unsigned short) scaled_port;
+    }
     vsf_sysutil_sockaddr_clone(&s_p_sockaddr, p_sess->p_local_addr);
     vsf_sysutil_sockaddr_set_port(s_p_sockaddr, the_port);
     retval = vsf_sysutil_bind(p_sess->pasv_listen_fd, s_p_sockaddr);
@@ -587,14 +690,31 @@ handle_pasv(struct vsf_session* p_sess, int is_epsv)
     }
     if (vsf_sysutil_get_error() == kVSFSysUtilErrADDRINUSE)
     {
+      /* Leave a port from the map marked as ours until we exit, so that
+       * nobody picks it again while something else is sitting on it.
+       */
+      if (from_map)
+      {
+        vsf_pasvport_keep();
+      }
+      ++collisions;
       continue;
     }
     die("vsf_sysutil_bind");
   }
+  vsf_stats_pasv(from_map, collisions, bind_retries != 0);
   if (!bind_retries)
   {
-    die("vsf_sysutil_bind");
+    pasv_cleanup(p_sess);
+    vsf_cmdio_write(p_sess, FTP_BADSENDCONN,
+                    "Could not find a free passive port.");
+    return;
   }
+  if (tunable_tcp_fastopen)
+  {
+    vsf_sysutil_set_fastopen(p_sess->pasv_listen_fd, tunable_tcp_fastopen);
+  }
+  vsf_ftpdataio_size_listen_buffer(p_sess, p_sess->pasv_listen_fd);
   vsf_sysutil_listen(p_sess->pasv_listen_fd, 1);
   if (is_epsv)
   {
@@ -646,9 +766,18 @@ handle_retr(struct vsf_session* p_sess)
   struct vsf_transfer_ret trans_ret;
   int remote_fd;
   int opened_file;
+  int send_fd;
   int is_ascii = 0;
+  int deflate_level = 0;
+  filesize_t sidecar_size = 0;
   filesize_t offset = p_sess->restart_pos;
+  filesize_t max_send = -1;
+  if (p_sess->range_end_pos >= 0)
+  {
+    max_send = p_sess->range_end_pos - offset;
+  }
   p_sess->restart_pos = 0;
+  p_sess->range_end_pos = -1;
   if (!data_transfer_checks_ok(p_sess))
   {
     return;
@@ -710,6 +839,7 @@ handle_retr(struct vsf_session* p_sess)
   {
     vsf_sysutil_lseek_to(opened_file, offset);
   }
+  send_fd = opened_file;
   str_alloc_text(&s_mark_str, "Opening ");
   if (tunable_ascii_download_enable && p_sess->is_ascii)
   {
@@ -720,6 +850,22 @@ handle_retr(struct vsf_session* p_sess)
   {
     str_append_text(&s_mark_str, "BINARY");
   }
+  if (p_sess->is_deflate)
+  {
+    deflate_level = get_deflate_level(p_sess, &p_sess->ftp_arg_str);
+    /* Use a precompressed copy if there is one and we can send it as-is */
+    if (tunable_deflate_sidecar_enable && offset == 0 && max_send < 0 &&
+        !is_ascii)
+    {
+      int sidecar_fd = open_deflate_sidecar(p_sess, &p_sess->ftp_arg_str,
+                                            s_p_statbuf, &sidecar_size);
+      if (!vsf_sysutil_retval_is_error(sidecar_fd))
+      {
+        send_fd = sidecar_fd;
+        deflate_level = -1;
+      }
+    }
+  }
   str_append_text(&s_mark_str, " mode data connection for ");
   str_append_str(&s_mark_str, &p_sess->ftp_arg_str);
   str_append_text(&s_mark_str, " (");
@@ -731,10 +877,29 @@ handle_retr(struct vsf_session* p_sess)
   {
     goto port_pasv_cleanup_out;
   }
-  trans_ret = vsf_ftpdataio_transfer_file(p_sess, remote_fd,
-                                          opened_file, 0, is_ascii);
-  vsf_ftpdataio_dispose_transfer_fd(p_sess);
+  trans_ret = vsf_ftpdataio_transfer_file(p_sess, remote_fd, send_fd, 0,
+                                          is_ascii, deflate_level, max_send);
+  if (vsf_ftpdataio_finish_transfer(p_sess, 1, trans_ret.retval == 0) != 0)
+  {
+    trans_ret.retval = -2;
+  }
   p_sess->transfer_size = trans_ret.transferred;
+  if (send_fd != opened_file)
+  {
+    /* Count the bytes before compression, as the deflate path does. We can
+     * only estimate that for part of the sidecar.
+     */
+    filesize_t file_size = vsf_sysutil_statbuf_get_size(s_p_statbuf);
+    if (trans_ret.transferred < sidecar_size)
+    {
+      p_sess->transfer_size = (filesize_t) ((double) file_size *
+        (double) trans_ret.transferred / (double) sidecar_size);
+    }
+    else
+    {
+      p_sess->transfer_size = file_size;
+    }
+  }
   /* Log _after_ the blocking dispose call, so we get transfer times right */
   if (trans_ret.retval == 0)
   {
@@ -759,6 +924,234 @@ handle_retr(struct vsf_session* p_sess)
 port_pasv_cleanup_out:
   port_cleanup(p_sess);
   pasv_cleanup(p_sess);
+  if (send_fd != opened_file)
+  {
+    vsf_sysutil_close(send_fd);
+  }
+file_close_out:
+  vsf_sysutil_close(opened_file);
+}
+
+static int
+get_deflate_level(struct vsf_session* p_sess,
+                  const struct mystr* p_filename_str)
+{
+  static struct mystr s_exclude_str;
+  /* Already compressed data is still sent in MODE Z - the client expects
+   * that - but there's no point in burning CPU trying to shrink it.
+   */
+  if (tunable_deflate_exclude_file)
+  {
+    if (str_isempty(&s_exclude_str))
+    {
+      str_alloc_text(&s_exclude_str, tunable_deflate_exclude_file);
+    }
+    if (vsf_filename_passes_filter(p_filename_str, &s_exclude_str))
+    {
+      return 0;
+    }
+  }
+  return p_sess->deflate_level;
+}
+
+static int
+open_deflate_sidecar(struct vsf_session* p_sess,
+                     const struct mystr* p_filename_str,
+                     const struct vsf_sysutil_statbuf* p_file_statbuf,
+                     filesize_t* p_sidecar_size)
+{
+  static struct mystr s_sidecar_str;
+  static struct vsf_sysutil_statbuf* s_p_statbuf;
+  long sidecar_sec;
+  long file_sec;
+  int fd;
+  str_copy(&s_sidecar_str, p_filename_str);
+  str_append_text(&s_sidecar_str, ".zz");
+  if (!vsf_access_check_file(&s_sidecar_str))
+  {
+    return -1;
+  }
+  fd = str_open(&s_sidecar_str, kVSFSysStrOpenReadOnly);
+  if (vsf_sysutil_retval_is_error(fd))
+  {
+    return fd;
+  }
+  vsf_sysutil_fstat(fd, &s_p_statbuf);
+  /* It must be strictly newer than the file. With a tie we can't tell which
+   * was written last, as timestamps are only as fine as the clock tick (or
+   * a whole second where the system has nothing finer).
+   */
+  sidecar_sec = vsf_sysutil_statbuf_get_mtime(s_p_statbuf);
+  file_sec = vsf_sysutil_statbuf_get_mtime(p_file_statbuf);
+  if (sidecar_sec < file_sec ||
+      (sidecar_sec == file_sec &&
+       vsf_sysutil_statbuf_get_mtime_nsec(s_p_statbuf) <=
+         vsf_sysutil_statbuf_get_mtime_nsec(p_file_statbuf)))
+  {
+    vsf_sysutil_close(fd);
+    return -1;
+  }
+  /* Ignore anything we wouldn't serve directly */
+  if (!vsf_sysutil_statbuf_is_regfile(s_p_statbuf) ||
+      (p_sess->is_anonymous && tunable_anon_world_readable_only &&
+       !vsf_sysutil_statbuf_is_readable_other(s_p_statbuf)))
+  {
+    vsf_sysutil_close(fd);
+    return -1;
+  }
+  vsf_sysutil_deactivate_noblock(fd);
+  *p_sidecar_size = vsf_sysutil_statbuf_get_size(s_p_statbuf);
+  return fd;
+}
+
+static void
+handle_hash(struct vsf_session* p_sess)
+{
+  /* draft-bryan-ftpext-hash. The algorithm is picked with OPTS HASH, and
+   * the range comes from REST or RANG.
+   */
+  filesize_t offset = p_sess->restart_pos;
+  filesize_t end = p_sess->range_end_pos;
+  p_sess->restart_pos = 0;
+  p_sess->range_end_pos = -1;
+  handle_checksum_common(p_sess, (enum EVSFChecksumType) p_sess->hash_type,
+                         &p_sess->ftp_arg_str, offset, end, 1);
+}
+
+static void
+handle_xchecksum(struct vsf_session* p_sess, enum EVSFChecksumType type)
+{
+  /* Format is XCRC <filename> or XCRC "<filename>" [<start> [<end>]]. We
+   * only look for a range after a quoted filename, otherwise we would
+   * mangle filenames containing spaces.
+   */
+  static struct mystr s_filename_str;
+  static struct mystr s_range_str;
+  static struct mystr s_end_str;
+  filesize_t start = 0;
+  filesize_t end = -1;
+  str_copy(&s_filename_str, &p_sess->ftp_arg_str);
+  if (str_getlen(&s_filename_str) > 1 &&
+      str_get_char_at(&s_filename_str, 0) == '"')
+  {
+    struct str_locate_result loc_result;
+    str_mid_to_end(&p_sess->ftp_arg_str, &s_filename_str, 1);
+    loc_result = str_locate_char(&s_filename_str, '"');
+    if (!loc_result.found)
+    {
+      vsf_cmdio_write(p_sess, FTP_BADOPTS, "Bad filename quoting.");
+      return;
+    }
+    str_split_char(&s_filename_str, &s_range_str, '"');
+    /* Chop off the leading space */
+    str_mid_to_end(&s_range_str, &s_end_str, 1);
+    str_copy(&s_range_str, &s_end_str);
+    str_split_char(&s_range_str, &s_end_str, ' ');
+    if (!str_isempty(&s_range_str))
+    {
+      start = str_a_to_filesize_t(&s_range_str);
+    }
+    if (!str_isempty(&s_end_str))
+    {
+      end = str_a_to_filesize_t(&s_end_str);
+    }
+    if (start < 0 || (!str_isempty(&s_end_str) && end < start))
+    {
+      vsf_cmdio_write(p_sess, FTP_BADOPTS, "Invalid range.");
+      return;
+    }
+  }
+  handle_checksum_common(p_sess, type, &s_filename_str, start, end, 0);
+}
+
+static void
+handle_checksum_common(struct vsf_session* p_sess, enum EVSFChecksumType type,
+                       struct mystr* p_filename_str, filesize_t start,
+                       filesize_t end, int is_hash)
+{
+  static struct mystr s_hex_str;
+  static struct mystr s_res_str;
+  static struct vsf_sysutil_statbuf* s_p_statbuf;
+  filesize_t file_size;
+  int opened_file;
+  int retval;
+  resolve_tilde(p_filename_str, p_sess);
+  if (!vsf_access_check_file(p_filename_str))
+  {
+    vsf_cmdio_write(p_sess, FTP_NOPERM, "Permission denied.");
+    return;
+  }
+  opened_file = str_open(p_filename_str, kVSFSysStrOpenReadOnly);
+  if (vsf_sysutil_retval_is_error(opened_file))
+  {
+    vsf_cmdio_write(p_sess, FTP_FILEFAIL, "Failed to open file.");
+    return;
+  }
+  vsf_sysutil_fstat(opened_file, &s_p_statbuf);
+  /* Same rules as for RETR */
+  if (!vsf_sysutil_statbuf_is_regfile(s_p_statbuf) ||
+      (p_sess->is_anonymous && tunable_anon_world_readable_only &&
+       !vsf_sysutil_statbuf_is_readable_other(s_p_statbuf)))
+  {
+    vsf_cmdio_write(p_sess, FTP_FILEFAIL, "Failed to open file.");
+    goto file_close_out;
+  }
+  vsf_sysutil_deactivate_noblock(opened_file);
+  file_size = vsf_sysutil_statbuf_get_size(s_p_statbuf);
+  if (end < 0 || end > file_size)
+  {
+    end = file_size;
+  }
+  if (start > end)
+  {
+    vsf_cmdio_write(p_sess, FTP_BADOPTS, "Invalid range.");
+    goto file_close_out;
+  }
+  if (tunable_lock_upload_files)
+  {
+    vsf_sysutil_lock_file_read(opened_file);
+  }
+  if (tunable_setproctitle_enable)
+  {
+    vsf_sysutil_setproctitle("HASH");
+  }
+  /* Checksumming a big file can take a while; don't let the idle timeout
+   * fire underneath us. The next command read rearms it.
+   */
+  vsf_sysutil_clear_alarm();
+  retval = -1;
+  if (tunable_checksum_cache_enable && start == 0 && end == file_size)
+  {
+    retval = vsf_hashsvc_checksum(type, opened_file, file_size, &s_hex_str);
+  }
+  if (retval != 0)
+  {
+    retval = vsf_checksum_file(type, opened_file, start, end, &s_hex_str);
+  }
+  if (retval != 0)
+  {
+    vsf_cmdio_write(p_sess, FTP_BADSENDFILE, "Failure reading local file.");
+    goto file_close_out;
+  }
+  if (is_hash)
+  {
+    str_alloc_text(&s_res_str, vsf_checksum_get_name(type));
+    str_append_char(&s_res_str, ' ');
+    str_append_filesize_t(&s_res_str, start);
+    str_append_char(&s_res_str, '-');
+    /* The range is given inclusive, as RANG takes it */
+    str_append_filesize_t(&s_res_str, end > start ? end - 1 : end);
+    str_append_char(&s_res_str, ' ');
+    str_append_str(&s_res_str, &s_hex_str);
+    str_append_char(&s_res_str, ' ');
+    str_append_str(&s_res_str, p_filename_str);
+    vsf_cmdio_write_str(p_sess, FTP_HASHOK, &s_res_str);
+  }
+  else
+  {
+    str_upper(&s_hex_str);
+    vsf_cmdio_write_str(p_sess, FTP_CHECKSUMOK, &s_hex_str);
+  }
 file_close_out:
   vsf_sysutil_close(opened_file);
 }
@@ -876,9 +1269,10 @@ handle_dir_common(struct vsf_session* p_sess, int full_details, int stat_cmd)
                                         &s_dir_name_str, &s_option_str,
                                         &s_filter_str, full_details);
   }
-  if (!stat_cmd)
+  if (!stat_cmd &&
+      vsf_ftpdataio_finish_transfer(p_sess, 1, retval == 0) != 0)
   {
-    vsf_ftpdataio_dispose_transfer_fd(p_sess);
+    retval = -1;
   }
   if (stat_cmd)
   {
@@ -939,6 +1333,7 @@ handle_port(struct vsf_session* p_sess)
   unsigned short the_port;
   unsigned char vals[6];
   const unsigned char* p_raw;
+  vsf_ftpdataio_close_kept_fd(p_sess);
   pasv_cleanup(p_sess);
   port_cleanup(p_sess);
   p_raw = vsf_sysutil_parse_uchar_string_sep(&p_sess->ftp_arg_str, ',', vals,
@@ -983,12 +1378,21 @@ handle_upload_common(struct vsf_session* p_sess, int is_append, int is_unique)
 {
   static struct vsf_sysutil_statbuf* s_p_statbuf;
   static struct mystr s_filename;
+  static struct mystr s_temp_filename;
   struct mystr* p_filename;
   struct vsf_transfer_ret trans_ret;
   int new_file_fd;
   int remote_fd;
   filesize_t offset = p_sess->restart_pos;
+  filesize_t allo_size = p_sess->allo_size;
+  int may_overwrite =
+    !is_unique && (!p_sess->is_anonymous || tunable_anon_other_write_enable);
+  /* Only a whole new file can be built up on the side */
+  int is_atomic = tunable_atomic_upload_enable && !is_append && offset == 0;
+  int do_sync = tunable_upload_sync_enable;
   p_sess->restart_pos = 0;
+  p_sess->range_end_pos = -1;
+  p_sess->allo_size = 0;
   if (!data_transfer_checks_ok(p_sess))
   {
     return;
@@ -1012,7 +1416,29 @@ handle_upload_common(struct vsf_session* p_sess, int is_append, int is_unique)
   /* XXX - do we care about race between create and chown() of anonymous
    * upload?
    */
-  if (is_unique || (p_sess->is_anonymous && !tunable_anon_other_write_enable))
+  if (is_atomic)
+  {
+    /* Fail now rather than after the whole upload, if we may not replace an
+     * existing file
+     */
+    if (!may_overwrite &&
+        !vsf_sysutil_retval_is_error(str_lstat(p_filename, &s_p_statbuf)))
+    {
+      vsf_cmdio_write(p_sess, FTP_UPLOADFAIL, "Could not create file.");
+      return;
+    }
+    get_upload_temp_filename(&s_temp_filename, p_filename);
+    /* Only ever left behind by an earlier process with our pid, which was
+     * killed outright
+     */
+    (void) str_unlink(&s_temp_filename);
+    new_file_fd = str_create(&s_temp_filename);
+    if (!vsf_sysutil_retval_is_error(new_file_fd))
+    {
+      begin_upload_temp(&s_temp_filename);
+    }
+  }
+  else if (!may_overwrite)
   {
     new_file_fd = str_create(p_filename);
   }
@@ -1041,24 +1467,12 @@ handle_upload_common(struct vsf_session* p_sess, int is_append, int is_unique)
      */
     vsf_sysutil_deactivate_noblock(new_file_fd);
   }
-  /* Are we required to chown() this file for security? */
-  if (p_sess->is_anonymous && tunable_chown_uploads)
-  {
-    vsf_sysutil_fchmod(new_file_fd, tunable_chown_upload_mode);
-    if (tunable_one_process_model)
-    {
-      vsf_one_process_chown_upload(p_sess, new_file_fd);
-    }
-    else
-    {
-      vsf_two_process_chown_upload(p_sess, new_file_fd);
-    }
-  }
-  /* Are we required to lock this file? */
-  if (tunable_lock_upload_files)
+  else
   {
-    vsf_sysutil_lock_file_write(new_file_fd);
+    allo_size = 0;
+    do_sync = 0;
   }
+  prepare_upload_fd(p_sess, new_file_fd);
   if (!is_append && offset != 0)
   {
     /* XXX - warning, allows seek past end of file! Check for seek > size? */
@@ -1080,18 +1494,48 @@ handle_upload_common(struct vsf_session* p_sess, int is_append, int is_unique)
   {
     goto port_pasv_cleanup_out;
   }
+  if (allo_size > 0)
+  {
+    /* Reserve the space from wherever this upload will start writing */
+    filesize_t alloc_start = offset;
+    if (is_append)
+    {
+      alloc_start = vsf_sysutil_statbuf_get_size(s_p_statbuf);
+    }
+    vsf_sysutil_preallocate(new_file_fd, alloc_start, allo_size);
+  }
   if (tunable_ascii_upload_enable && p_sess->is_ascii)
   {
     trans_ret = vsf_ftpdataio_transfer_file(p_sess, remote_fd,
-                                            new_file_fd, 1, 1);
+                                            new_file_fd, 1, 1, 0, -1);
   }
   else
   {
     trans_ret = vsf_ftpdataio_transfer_file(p_sess, remote_fd,
-                                            new_file_fd, 1, 0);
+                                            new_file_fd, 1, 0, 0, -1);
   }
-  vsf_ftpdataio_dispose_transfer_fd(p_sess);
+  (void) vsf_ftpdataio_finish_transfer(p_sess, 0, trans_ret.retval == 0);
   p_sess->transfer_size = trans_ret.transferred;
+  if (allo_size > 0)
+  {
+    /* Give back any of the reservation left beyond the end of the file, e.g.
+     * if the client sent less than it said, or gave up part way
+     */
+    vsf_sysutil_fstat(new_file_fd, &s_p_statbuf);
+    (void) vsf_sysutil_ftruncate(new_file_fd,
+                                 vsf_sysutil_statbuf_get_size(s_p_statbuf));
+  }
+  /* Only now is the upload done: on disk, if asked, and under its name */
+  if (trans_ret.retval == 0 && do_sync &&
+      vsf_syncsvc_sync(new_file_fd) != 0)
+  {
+    trans_ret.retval = -1;
+  }
+  if (trans_ret.retval == 0 && is_atomic &&
+      !commit_upload(&s_temp_filename, p_filename, may_overwrite))
+  {
+    trans_ret.retval = -1;
+  }
   /* XXX - handle failure, delete file? */
   if (trans_ret.retval == 0)
   {
@@ -1113,6 +1557,12 @@ handle_upload_common(struct vsf_session* p_sess, int is_append, int is_unique)
 port_pasv_cleanup_out:
   port_cleanup(p_sess);
   pasv_cleanup(p_sess);
+  if (is_atomic)
+  {
+    /* Gone already if the upload made it */
+    (void) str_unlink(&s_temp_filename);
+    end_upload_temp();
+  }
   vsf_sysutil_close(new_file_fd);
 }
 
@@ -1215,12 +1665,106 @@ handle_rest(struct vsf_session* p_sess)
     val = 0;
   }
   p_sess->restart_pos = val;
+  p_sess->range_end_pos = -1;
   str_alloc_text(&s_rest_str, "Restart position accepted (");
   str_append_filesize_t(&s_rest_str, val);
   str_append_text(&s_rest_str, ").");
   vsf_cmdio_write_str(p_sess, FTP_RESTOK, &s_rest_str);
 }
 
+static void
+handle_rang(struct vsf_session* p_sess)
+{
+  /* draft-bryan-ftp-range: "RANG <start> <end>", both inclusive byte
+   * positions, bounds what the next RETR (or HASH) sends. Like REST, which
+   * it replaces, it applies once. "RANG 1 0" clears it again.
+   */
+  static struct mystr s_start_str;
+  static struct mystr s_end_str;
+  static struct mystr s_rang_str;
+  filesize_t start;
+  filesize_t end;
+  str_copy(&s_start_str, &p_sess->ftp_arg_str);
+  str_split_char(&s_start_str, &s_end_str, ' ');
+  start = str_a_to_filesize_t(&s_start_str);
+  end = str_a_to_filesize_t(&s_end_str);
+  if (!is_byte_pos(&s_start_str) || !is_byte_pos(&s_end_str))
+  {
+    vsf_cmdio_write(p_sess, FTP_BADOPTS, "Bad RANG command.");
+    return;
+  }
+  if (start == 1 && end == 0)
+  {
+    p_sess->restart_pos = 0;
+    p_sess->range_end_pos = -1;
+    vsf_cmdio_write(p_sess, FTP_RESTOK, "Byte range reset.");
+    return;
+  }
+  if (end < start)
+  {
+    vsf_cmdio_write(p_sess, FTP_BADOPTS, "Invalid range.");
+    return;
+  }
+  p_sess->restart_pos = start;
+  p_sess->range_end_pos = end + 1;
+  str_alloc_text(&s_rang_str, "Restarting at ");
+  str_append_filesize_t(&s_rang_str, start);
+  str_append_text(&s_rang_str, ". End byte range at ");
+  str_append_filesize_t(&s_rang_str, end);
+  str_append_text(&s_rang_str, ".");
+  vsf_cmdio_write_str(p_sess, FTP_RESTOK, &s_rang_str);
+}
+
+static int
+is_byte_pos(const struct mystr* p_str)
+{
+  /* Digits only, and no more than str_a_to_filesize_t() takes; it returns 0
+   * for anything else, such as "-1", "x" or a huge number.
+   */
+  unsigned int i;
+  if (str_isempty(p_str) || str_getlen(p_str) > 15)
+  {
+    return 0;
+  }
+  for (i = 0; i < str_getlen(p_str); i++)
+  {
+    if (!vsf_sysutil_isdigit(str_get_char_at(p_str, i)))
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void
+handle_allo(struct vsf_session* p_sess)
+{
+  static struct mystr s_size_str;
+  static struct mystr s_record_str;
+  filesize_t val = 0;
+  /* Anonymous users don't get to tie up disk space beyond what they send */
+  if (tunable_allo_prealloc_enable && !p_sess->is_anonymous)
+  {
+    /* "ALLO size [R record-size]" - record sizes mean nothing to us */
+    str_copy(&s_size_str, &p_sess->ftp_arg_str);
+    str_split_char(&s_size_str, &s_record_str, ' ');
+    val = str_a_to_filesize_t(&s_size_str);
+  }
+  if (val <= 0)
+  {
+    p_sess->allo_size = 0;
+    vsf_cmdio_write(p_sess, FTP_ALLOOK, "ALLO command ignored.");
+    return;
+  }
+  if (val > tunable_allo_max_size)
+  {
+    val = tunable_allo_max_size;
+  }
+  /* Taken up by the next upload */
+  p_sess->allo_size = val;
+  vsf_cmdio_write(p_sess, FTP_ALLOSPACEOK, "ALLO size noted.");
+}
+
 static void
 handle_rnfr(struct vsf_session* p_sess)
 {
@@ -1338,8 +1882,10 @@ handle_sigurg(void* p_private)
   {
     return;
   }
-  /* Get the async command - blocks (use data timeout alarm) */
+  /* Get the async command - blocks (use idle timeout alarm) */
+  vsf_cmdio_set_alarm(p_sess);
   vsf_cmdio_get_cmd_and_arg(p_sess, &async_cmd_str, &async_arg_str, 0);
+  vsf_sysutil_clear_alarm();
   /* Chop off first four characters; they are telnet characters. The client
    * should have sent the first two normally and the second two as urgent
    * data.
@@ -1372,11 +1918,18 @@ static int
 get_remote_transfer_fd(struct vsf_session* p_sess, const char* p_status_msg)
 {
   int remote_fd;
+  p_sess->abor_received = 0;
+  /* MODE B: carry on with the connection the last transfer left open */
+  if (p_sess->data_fd != -1)
+  {
+    vsf_ftpdataio_reuse_kept_fd(p_sess);
+    vsf_cmdio_write(p_sess, FTP_DATACONN_OPEN, p_status_msg);
+    return p_sess->data_fd;
+  }
   if (!pasv_active(p_sess) && !port_active(p_sess))
   {
     bug("neither PORT nor PASV active in get_remote_transfer_fd");
   }
-  p_sess->abor_received = 0;
   if (pasv_active(p_sess))
   {
     remote_fd = vsf_ftpdataio_get_pasv_fd(p_sess);
@@ -1452,13 +2005,25 @@ handle_site(struct vsf_session* p_sess)
   {
     handle_site_chmod(p_sess, &s_site_args_str);
   }
+  else if (tunable_write_enable &&
+           tunable_download_enable &&
+           str_equal_text(&p_sess->ftp_arg_str, "CPFR"))
+  {
+    handle_site_cpfr(p_sess, &s_site_args_str);
+  }
+  else if (tunable_write_enable &&
+           tunable_download_enable &&
+           str_equal_text(&p_sess->ftp_arg_str, "CPTO"))
+  {
+    handle_site_cpto(p_sess, &s_site_args_str);
+  }
   else if (str_equal_text(&p_sess->ftp_arg_str, "UMASK"))
   {
     handle_site_umask(p_sess, &s_site_args_str);
   }
   else if (str_equal_text(&p_sess->ftp_arg_str, "HELP"))
   {
-    vsf_cmdio_write(p_sess, FTP_SITEHELP, "CHMOD UMASK HELP");
+    vsf_cmdio_write(p_sess, FTP_SITEHELP, "CHMOD CPFR CPTO UMASK HELP");
   }
   else
   {
@@ -1508,6 +2073,200 @@ handle_site_chmod(struct vsf_session* p_sess, struct mystr* p_arg_str)
   }
 }
 
+static void
+handle_site_cpfr(struct vsf_session* p_sess, struct mystr* p_arg_str)
+{
+  static struct vsf_sysutil_statbuf* s_p_statbuf;
+  int retval;
+  /* Clear old value */
+  str_free(&p_sess->cpfr_filename_str);
+  if (str_isempty(p_arg_str))
+  {
+    vsf_cmdio_write(p_sess, FTP_BADCMD, "SITE CPFR needs an argument.");
+    return;
+  }
+  resolve_tilde(p_arg_str, p_sess);
+  if (!vsf_access_check_file(p_arg_str))
+  {
+    vsf_log_start_entry(p_sess, kVSFLogEntryCopy);
+    str_copy(&p_sess->log_str, p_arg_str);
+    prepend_path_to_filename(&p_sess->log_str);
+    vsf_cmdio_write(p_sess, FTP_NOPERM, "Permission denied.");
+    return;
+  }
+  /* Only plain files may be copied */
+  retval = str_stat(p_arg_str, &s_p_statbuf);
+  if (retval == 0 && vsf_sysutil_statbuf_is_regfile(s_p_statbuf))
+  {
+    str_copy(&p_sess->cpfr_filename_str, p_arg_str);
+    vsf_cmdio_write(p_sess, FTP_CPFROK, "Ready for SITE CPTO.");
+  }
+  else
+  {
+    vsf_log_start_entry(p_sess, kVSFLogEntryCopy);
+    str_copy(&p_sess->log_str, p_arg_str);
+    prepend_path_to_filename(&p_sess->log_str);
+    vsf_cmdio_write(p_sess, FTP_FILEFAIL, "SITE CPFR command failed.");
+  }
+}
+
+static void
+handle_site_cpto(struct vsf_session* p_sess, struct mystr* p_arg_str)
+{
+  static struct vsf_sysutil_statbuf* s_p_statbuf;
+  static struct mystr s_from_str;
+  static struct mystr s_temp_filename;
+  static struct mystr s_tmp_str;
+  int may_overwrite =
+    !p_sess->is_anonymous || tunable_anon_other_write_enable;
+  int is_atomic = tunable_atomic_upload_enable;
+  filesize_t src_dev;
+  filesize_t src_ino;
+  int src_fd;
+  int dst_fd;
+  int retval;
+  /* If we didn't get a CPFR, throw a wobbly */
+  if (str_isempty(&p_sess->cpfr_filename_str))
+  {
+    vsf_cmdio_write(p_sess, FTP_NEEDCPFR, "SITE CPFR required first.");
+    return;
+  }
+  if (str_isempty(p_arg_str))
+  {
+    vsf_cmdio_write(p_sess, FTP_BADCMD, "SITE CPTO needs an argument.");
+    return;
+  }
+  /* Clear the CPFR filename; start the two stage process again! */
+  str_copy(&s_from_str, &p_sess->cpfr_filename_str);
+  str_free(&p_sess->cpfr_filename_str);
+  resolve_tilde(p_arg_str, p_sess);
+  vsf_log_start_entry(p_sess, kVSFLogEntryCopy);
+  str_copy(&p_sess->log_str, &s_from_str);
+  prepend_path_to_filename(&p_sess->log_str);
+  str_append_char(&p_sess->log_str, ' ');
+  str_copy(&s_tmp_str, p_arg_str);
+  prepend_path_to_filename(&s_tmp_str);
+  str_append_str(&p_sess->log_str, &s_tmp_str);
+  if (!vsf_access_check_file(p_arg_str))
+  {
+    vsf_cmdio_write(p_sess, FTP_NOPERM, "Permission denied.");
+    return;
+  }
+  src_fd = str_open(&s_from_str, kVSFSysStrOpenReadOnly);
+  if (vsf_sysutil_retval_is_error(src_fd))
+  {
+    vsf_cmdio_write(p_sess, FTP_FILEFAIL, "Copy failed.");
+    return;
+  }
+  vsf_sysutil_fstat(src_fd, &s_p_statbuf);
+  if (!vsf_sysutil_statbuf_is_regfile(s_p_statbuf))
+  {
+    vsf_sysutil_close(src_fd);
+    vsf_cmdio_write(p_sess, FTP_FILEFAIL, "Copy failed.");
+    return;
+  }
+  vsf_sysutil_deactivate_noblock(src_fd);
+  p_sess->transfer_size = vsf_sysutil_statbuf_get_size(s_p_statbuf);
+  src_dev = vsf_sysutil_statbuf_get_dev(s_p_statbuf);
+  src_ino = vsf_sysutil_statbuf_get_inode(s_p_statbuf);
+  /* Copying a file onto itself (or a link to it) would truncate it before
+   * a single byte was read
+   */
+  if (!vsf_sysutil_retval_is_error(str_stat(p_arg_str, &s_p_statbuf)) &&
+      vsf_sysutil_statbuf_get_dev(s_p_statbuf) == src_dev &&
+      vsf_sysutil_statbuf_get_inode(s_p_statbuf) == src_ino)
+  {
+    vsf_sysutil_close(src_fd);
+    vsf_cmdio_write(p_sess, FTP_FILEFAIL,
+                    "Source and destination are the same file.");
+    return;
+  }
+  /* The new file is made just as an upload would make it */
+  if (is_atomic)
+  {
+    if (!may_overwrite &&
+        !vsf_sysutil_retval_is_error(str_lstat(p_arg_str, &s_p_statbuf)))
+    {
+      vsf_sysutil_close(src_fd);
+      vsf_cmdio_write(p_sess, FTP_UPLOADFAIL, "Could not create file.");
+      return;
+    }
+    get_upload_temp_filename(&s_temp_filename, p_arg_str);
+    (void) str_unlink(&s_temp_filename);
+    dst_fd = str_create(&s_temp_filename);
+    if (!vsf_sysutil_retval_is_error(dst_fd))
+    {
+      begin_upload_temp(&s_temp_filename);
+    }
+  }
+  else if (!may_overwrite)
+  {
+    dst_fd = str_create(p_arg_str);
+  }
+  else
+  {
+    /* Not truncated until we know it isn't the source after all, in case
+     * it was swapped in since the check above
+     */
+    dst_fd = str_create_append(p_arg_str);
+  }
+  if (vsf_sysutil_retval_is_error(dst_fd))
+  {
+    vsf_sysutil_close(src_fd);
+    vsf_cmdio_write(p_sess, FTP_UPLOADFAIL, "Could not create file.");
+    return;
+  }
+  vsf_sysutil_fstat(dst_fd, &s_p_statbuf);
+  if (!vsf_sysutil_statbuf_is_regfile(s_p_statbuf))
+  {
+    /* e.g. an existing FIFO we were asked to overwrite */
+    retval = -1;
+  }
+  else if (vsf_sysutil_statbuf_get_dev(s_p_statbuf) == src_dev &&
+           vsf_sysutil_statbuf_get_inode(s_p_statbuf) == src_ino)
+  {
+    retval = -1;
+  }
+  else if (!is_atomic && may_overwrite &&
+           vsf_sysutil_retval_is_error(vsf_sysutil_ftruncate(dst_fd, 0)))
+  {
+    retval = -1;
+  }
+  else
+  {
+    vsf_sysutil_deactivate_noblock(dst_fd);
+    prepare_upload_fd(p_sess, dst_fd);
+    retval = vsf_sysutil_copy_file(src_fd, dst_fd);
+  }
+  vsf_sysutil_close(src_fd);
+  if (retval == 0 && tunable_upload_sync_enable &&
+      vsf_syncsvc_sync(dst_fd) != 0)
+  {
+    retval = -1;
+  }
+  if (retval == 0 && is_atomic &&
+      !commit_upload(&s_temp_filename, p_arg_str, may_overwrite))
+  {
+    retval = -1;
+  }
+  if (is_atomic)
+  {
+    /* Gone already if the copy made it */
+    (void) str_unlink(&s_temp_filename);
+    end_upload_temp();
+  }
+  vsf_sysutil_close(dst_fd);
+  if (retval == 0)
+  {
+    vsf_log_do_log(p_sess, 1);
+    vsf_cmdio_write(p_sess, FTP_COPYOK, "Copy successful.");
+  }
+  else
+  {
+    vsf_cmdio_write(p_sess, FTP_FILEFAIL, "Copy failed.");
+  }
+}
+
 static void
 handle_site_umask(struct vsf_session* p_sess, struct mystr* p_arg_str)
 {
@@ -1619,6 +2378,7 @@ handle_eprt(struct vsf_session* p_sess)
   int port;
   const unsigned char* p_raw_addr;
   int is_ipv6 = vsf_sysutil_sockaddr_is_ipv6(p_sess->p_local_addr);
+  vsf_ftpdataio_close_kept_fd(p_sess);
   port_cleanup(p_sess);
   pasv_cleanup(p_sess);
   str_copy(&s_part1_str, &p_sess->ftp_arg_str);
@@ -1699,13 +2459,13 @@ handle_help(struct vsf_session* p_sess)
   vsf_cmdio_write_hyphen(p_sess, FTP_HELP,
                          "The following commands are recognized.");
   vsf_cmdio_write_raw(p_sess,
-" ABOR ACCT ALLO APPE CDUP CWD  DELE EPRT EPSV FEAT HELP LIST MDTM MKD\r\n");
+" ABOR ACCT ALLO APPE CDUP CWD  DELE EPRT EPSV FEAT HASH HELP LIST MDTM\r\n");
   vsf_cmdio_write_raw(p_sess,
-" MODE NLST NOOP OPTS PASS PASV PORT PWD  QUIT REIN REST RETR RMD  RNFR\r\n");
+" MKD  MODE NLST NOOP OPTS PASS PASV PORT PWD  QUIT RANG REIN REST RETR\r\n");
   vsf_cmdio_write_raw(p_sess,
-" RNTO SITE SIZE SMNT STAT STOR STOU STRU SYST TYPE USER XCUP XCWD XMKD\r\n");
+" RMD  RNFR RNTO SITE SIZE SMNT STAT STOR STOU STRU SYST TYPE USER XCRC\r\n");
   vsf_cmdio_write_raw(p_sess,
-" XPWD XRMD\r\n");
+" XCUP XCWD XMD5 XMKD XPWD XRMD XSHA1 XSHA256\r\n");
   vsf_cmdio_write(p_sess, FTP_HELP, "Help OK.");
 }
 
@@ -1738,6 +2498,140 @@ get_unique_filename(struct mystr* p_outstr, const struct mystr* p_base_str)
   }
 }
 
+static void
+get_upload_temp_filename(struct mystr* p_outstr,
+                         const struct mystr* p_filename_str)
+{
+  /* In the same directory, so that the final rename() can't cross into
+   * another filesystem. The pid keeps concurrent uploads of one name apart.
+   */
+  static struct mystr s_base_str;
+  struct str_locate_result loc_res =
+    str_locate_text_reverse(p_filename_str, "/");
+  if (loc_res.found)
+  {
+    str_left(p_filename_str, p_outstr, loc_res.index + 1);
+    str_mid_to_end(p_filename_str, &s_base_str, loc_res.index + 1);
+  }
+  else
+  {
+    str_empty(p_outstr);
+    str_copy(&s_base_str, p_filename_str);
+  }
+  str_append_text(p_outstr, VSFTP_UPLOAD_TEMP_PREFIX);
+  str_append_str(p_outstr, &s_base_str);
+  str_append_char(p_outstr, '.');
+  str_append_ulong(p_outstr, vsf_sysutil_getpid());
+}
+
+static void
+begin_upload_temp(const struct mystr* p_temp_str)
+{
+  /* However the session ends from here on - a data timeout, a control
+   * connection gone away, die() - the partial file must go with it. Only a
+   * fatal signal can leave it behind now. A session process has no other
+   * exit function.
+   */
+  str_copy(&s_upload_temp_str, p_temp_str);
+  vsf_sysutil_set_exit_func(remove_upload_temp);
+}
+
+static void
+end_upload_temp(void)
+{
+  vsf_sysutil_set_exit_func(0);
+  str_empty(&s_upload_temp_str);
+}
+
+static void
+remove_upload_temp(void)
+{
+  (void) str_unlink(&s_upload_temp_str);
+}
+
+static int
+commit_upload(const struct mystr* p_temp_str,
+              const struct mystr* p_filename_str, int may_overwrite)
+{
+  int retval;
+  if (may_overwrite)
+  {
+    retval = str_rename(p_temp_str, p_filename_str);
+  }
+  else
+  {
+    /* link() fails rather than replace a file which turned up meanwhile */
+    retval = str_link(p_temp_str, p_filename_str);
+    if (retval == 0)
+    {
+      (void) str_unlink(p_temp_str);
+    }
+  }
+  if (retval != 0)
+  {
+    return 0;
+  }
+  /* The new name must reach the disk too */
+  if (tunable_upload_sync_enable && sync_upload_dir(p_filename_str) != 0)
+  {
+    return 0;
+  }
+  return 1;
+}
+
+static void
+prepare_upload_fd(struct vsf_session* p_sess, int fd)
+{
+  /* Are we required to chown() this file for security? */
+  if (p_sess->is_anonymous && tunable_chown_uploads)
+  {
+    vsf_sysutil_fchmod(fd, tunable_chown_upload_mode);
+    if (tunable_one_process_model)
+    {
+      vsf_one_process_chown_upload(p_sess, fd);
+    }
+    else
+    {
+      vsf_two_process_chown_upload(p_sess, fd);
+    }
+  }
+  /* Are we required to lock this file? */
+  if (tunable_lock_upload_files)
+  {
+    vsf_sysutil_lock_file_write(fd);
+  }
+}
+
+static int
+sync_upload_dir(const struct mystr* p_filename_str)
+{
+  static struct mystr s_dir_str;
+  int dir_fd;
+  int retval;
+  struct str_locate_result loc_res =
+    str_locate_text_reverse(p_filename_str, "/");
+  if (!loc_res.found)
+  {
+    str_alloc_text(&s_dir_str, ".");
+  }
+  else if (loc_res.index == 0)
+  {
+    str_alloc_text(&s_dir_str, "/");
+  }
+  else
+  {
+    str_left(p_filename_str, &s_dir_str, loc_res.index);
+  }
+  dir_fd = str_open(&s_dir_str, kVSFSysStrOpenReadOnly);
+  if (vsf_sysutil_retval_is_error(dir_fd))
+  {
+    return -1;
+  }
+  retval = vsf_syncsvc_sync(dir_fd);
+  vsf_sysutil_close(dir_fd);
+  return retval;
+}
+
 static void
 handle_stat(struct vsf_session* p_sess)
 {
@@ -1814,7 +2708,7 @@ handle_stat_file(struct vsf_session* p_sess)
 static int
 data_transfer_checks_ok(struct vsf_session* p_sess)
 {
-  if (!pasv_active(p_sess) && !port_active(p_sess))
+  if (!pasv_active(p_sess) && !port_active(p_sess) && p_sess->data_fd == -1)
   {
     vsf_cmdio_write(p_sess, FTP_BADSENDCONN, "Use PORT or PASV first.");
     return 0;
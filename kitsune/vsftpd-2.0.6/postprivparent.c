@@ -60,7 +60,7 @@ process_post_login_req(struct vsf_session* p_sess)
   vsf_sysutil_unblock_sig(kVSFSysUtilSigCHLD);
   vsf_sysutil_kitsune_set_update_point(NULL);   /* Kitsune */  
   /* Blocks */
-  cmd = priv_sock_get_cmd(p_sess->parent_fd);
+  cmd = priv_sock_msg_recv(p_sess->parent_fd);
   vsf_sysutil_block_sig(kVSFSysUtilSigCHLD);
   if (tunable_chown_uploads && cmd == PRIV_SOCK_CHOWN)
   {
@@ -92,8 +92,12 @@ minimize_privilege(struct vsf_session* p_sess)
      * Need to keep privs to do this. */
     return;
   }
+  /* The listener frees a session's stats slot when it reaps us, so we
+   * can't leave early while the session is still writing to it.
+   */
   if (!tunable_chown_uploads && !tunable_connect_from_port_20 &&
-      !tunable_max_per_ip && !tunable_max_clients)
+      !tunable_max_per_ip && !tunable_max_clients &&
+      !tunable_stats_socket && !tunable_scoreboard_file)
   {
     /* Cool. We're outta here. */
     vsf_sysutil_exit(0);
@@ -122,7 +126,7 @@ minimize_privilege(struct vsf_session* p_sess)
 static void
 cmd_process_chown(struct vsf_session* p_sess)
 {
-  int the_fd = priv_sock_recv_fd(p_sess->parent_fd);
+  int the_fd = priv_sock_msg_get_fd();
   vsf_privop_do_file_chown(p_sess, the_fd);
   vsf_sysutil_close(the_fd);
   priv_sock_send_result(p_sess->parent_fd, PRIV_SOCK_RESULT_OK);
@@ -132,8 +136,9 @@ static void
 cmd_process_get_data_sock(struct vsf_session* p_sess)
 {
   int sock_fd = vsf_privop_get_ftp_port_sock(p_sess);
-  priv_sock_send_result(p_sess->parent_fd, PRIV_SOCK_RESULT_OK);
-  priv_sock_send_fd(p_sess->parent_fd, sock_fd);
+  priv_sock_msg_start(PRIV_SOCK_RESULT_OK);
+  priv_sock_msg_add_fd(sock_fd);
+  priv_sock_msg_send(p_sess->parent_fd);
   vsf_sysutil_close(sock_fd);
 }
 
@@ -24,6 +24,7 @@
 #include "features.h"
 #include "defs.h"
 #include "opts.h"
+#include "lineidx.h"
 
 /* Functions used */
 static void emit_greeting(struct vsf_session* p_sess);
@@ -198,7 +199,8 @@ handle_user_command(struct vsf_session* p_sess)
   }
   if (tunable_userlist_enable)
   {
-    int located = str_contains_line(&p_sess->userlist_str, &p_sess->user_str);
+    int located = vsf_lineidx_contains(p_sess->p_userlist_idx,
+                                       &p_sess->user_str);
     if ((located && tunable_userlist_deny) ||
         (!located && !tunable_userlist_deny))
     {
@@ -18,6 +18,8 @@
 #include "tunables.h"
 #include "defs.h"
 #include "logging.h"
+#include "lineidx.h"
+#include "authsvc.h"
 
 /* File private functions */
 static enum EVSFPrivopLoginResult handle_anonymous_login(
@@ -182,13 +184,12 @@ static enum EVSFPrivopLoginResult
 handle_anonymous_login(struct vsf_session* p_sess,
                        const struct mystr* p_pass_str)
 {
-  if (!str_isempty(&p_sess->banned_email_str) &&
-      str_contains_line(&p_sess->banned_email_str, p_pass_str))
+  if (vsf_lineidx_contains(p_sess->p_banned_email_idx, p_pass_str))
   {
     return kVSFLoginFail;
   }
-  if (!str_isempty(&p_sess->email_passwords_str) &&
-      (!str_contains_line(&p_sess->email_passwords_str, p_pass_str) ||
+  if (!vsf_lineidx_is_empty(p_sess->p_email_passwords_idx) &&
+      (!vsf_lineidx_contains(p_sess->p_email_passwords_idx, p_pass_str) ||
        str_isempty(p_pass_str)))
   {
     return kVSFLoginFail;
@@ -208,8 +209,8 @@ handle_anonymous_login(struct vsf_session* p_sess,
     setup_username_globals(p_sess, &ftp_username_str);
     str_free(&ftp_username_str);
   }
-  str_free(&p_sess->banned_email_str);
-  str_free(&p_sess->email_passwords_str);
+  p_sess->p_banned_email_idx = 0;
+  p_sess->p_email_passwords_idx = 0;
   return kVSFLoginAnon;
 }
 
@@ -218,7 +219,18 @@ handle_local_login(struct vsf_session* p_sess,
                    const struct mystr* p_user_str,
                    const struct mystr* p_pass_str)
 {
-  if (!vsf_sysdep_check_auth(p_user_str, p_pass_str, &p_sess->remote_ip_str))
+  int retval = vsf_authsvc_check(p_user_str, p_pass_str,
+                                 &p_sess->remote_ip_str);
+  if (retval == -1)
+  {
+    retval = vsf_sysdep_check_auth(p_user_str, p_pass_str,
+                                   &p_sess->remote_ip_str);
+  }
+  else if (retval == 1)
+  {
+    retval = vsf_sysdep_open_auth_session(p_user_str, &p_sess->remote_ip_str);
+  }
+  if (!retval)
   {
     return kVSFLoginFail;
   }
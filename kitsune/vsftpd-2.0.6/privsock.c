@@ -10,12 +10,14 @@
  * heavy distrust of messages on the side of more privilege.
  */
 
+#define VSFTP_STRING_HELPER
 #include "privsock.h"
 
 #include "utility.h"
 #include "defs.h"
 #include "str.h"
 #include "netstr.h"
+#include "sysstr.h"
 #include "sysutil.h"
 #include "sysdeputil.h"
 #include "session.h"
@@ -40,26 +42,40 @@ priv_sock_send_cmd(int fd, char cmd)
 }
 
 void
-priv_sock_send_str(int fd, const struct mystr* p_str)
+priv_sock_send_cmd_str(int fd, char cmd, const struct mystr* p_str)
 {
-  unsigned int len = str_getlen(p_str);
-  priv_sock_send_int(fd, (int) len);
-  if (len > 0)
+  /* Frame the command, length and payload into one write, so the other side
+   * gets the whole message at once and we make a single system call.
+   */
+  static struct mystr s_msg_str;
+  int len = (int) str_getlen(p_str);
+  const char* p_len = (const char*) &len;
+  unsigned int i;
+  int retval;
+  str_empty(&s_msg_str);
+  str_append_char(&s_msg_str, cmd);
+  for (i = 0; i < sizeof(len); i++)
   {
-    str_netfd_write(p_str, fd);
+    str_append_char(&s_msg_str, p_len[i]);
+  }
+  str_append_str(&s_msg_str, p_str);
+  retval = str_write_loop(&s_msg_str, fd);
+  if (vsf_sysutil_retval_is_error(retval) ||
+      (unsigned int) retval != str_getlen(&s_msg_str))
+  {
+    die("priv_sock_send_cmd_str");
   }
 }
 
-char
-priv_sock_get_result(int fd)
+void
+priv_sock_send_str(int fd, const struct mystr* p_str)
 {
-  char res;
-  int retval = vsf_sysutil_read_loop(fd, &res, sizeof(res));
-  if (retval != sizeof(res))
+  unsigned int len = str_getlen(p_str);
+  priv_sock_send_int(fd, (int) len);
+  if (len > 0)
   {
-    die("priv_sock_get_result");
+    str_netfd_write(p_str, fd);
   }
-  return res;
 }
 
 char
@@ -94,46 +110,237 @@ priv_sock_get_str(int fd, struct mystr* p_dest)
 }
 
 void
-priv_sock_send_result(int fd, char res)
+priv_sock_send_int(int fd, int the_int)
 {
-  int retval = vsf_sysutil_write_loop(fd, &res, sizeof(res));
-  if (retval != sizeof(res))
+  int retval = vsf_sysutil_write_loop(fd, &the_int, sizeof(the_int));
+  if (retval != sizeof(the_int))
   {
-    die("priv_sock_send_result");
+    die("priv_sock_send_int");
+  }
+}
+
+int
+priv_sock_get_int(int fd)
+{
+  int the_int;
+  int retval = vsf_sysutil_read_loop(fd, &the_int, sizeof(the_int));
+  if (retval != sizeof(the_int))
+  {
+    die("priv_sock_get_int");
+  }
+  return the_int;
+}
+
+/* Framed messages on the privileged channel. The wire format is the body
+ * length, then the body: the command byte followed by type tagged fields. Any
+ * file descriptor travels in the same sendmsg() as the bytes.
+ */
+#define PRIV_SOCK_FIELD_INT   1
+#define PRIV_SOCK_FIELD_STR   2
+
+static char s_out_buf[VSFTP_PRIVSOCK_MAXMSG];
+static unsigned int s_out_len;
+static int s_out_fd = -1;
+static char s_in_buf[VSFTP_PRIVSOCK_MAXMSG];
+static unsigned int s_in_len;
+static unsigned int s_in_pos;
+static int s_in_fd = -1;
+
+static void
+msg_append(const void* p_src, unsigned int len)
+{
+  if (len > sizeof(s_out_buf) - s_out_len)
+  {
+    bug("priv_sock message too big");
+  }
+  vsf_sysutil_memcpy(s_out_buf + s_out_len, p_src, len);
+  s_out_len += len;
+}
+
+static void
+msg_consume(void* p_dest, unsigned int len)
+{
+  if (len > s_in_len - s_in_pos)
+  {
+    die("priv_sock message too short");
+  }
+  vsf_sysutil_memcpy(p_dest, s_in_buf + s_in_pos, len);
+  s_in_pos += len;
+}
+
+static void
+msg_consume_type(char type)
+{
+  char sent_type;
+  msg_consume(&sent_type, sizeof(sent_type));
+  if (sent_type != type)
+  {
+    die("priv_sock message field mismatch");
+  }
+}
+
+static void
+msg_read_rest(int fd, unsigned int got, unsigned int want)
+{
+  int retval = vsf_sysutil_read_loop(fd, s_in_buf + got, want - got);
+  if (retval < 0 || (unsigned int) retval != want - got)
+  {
+    die("priv_sock_msg_recv: read error");
   }
 }
 
 void
-priv_sock_send_fd(int fd, int send_fd)
+priv_sock_msg_start(char cmd)
 {
-  vsf_sysutil_send_fd(fd, send_fd);
+  s_out_len = sizeof(unsigned int);
+  s_out_fd = -1;
+  msg_append(&cmd, sizeof(cmd));
 }
 
-int
-priv_sock_recv_fd(int fd)
+void
+priv_sock_msg_add_int(int the_int)
 {
-  return vsf_sysutil_recv_fd(fd);
+  char type = PRIV_SOCK_FIELD_INT;
+  msg_append(&type, sizeof(type));
+  msg_append(&the_int, sizeof(the_int));
 }
 
 void
-priv_sock_send_int(int fd, int the_int)
+priv_sock_msg_add_str(const struct mystr* p_str)
 {
-  int retval = vsf_sysutil_write_loop(fd, &the_int, sizeof(the_int));
-  if (retval != sizeof(the_int))
+  char type = PRIV_SOCK_FIELD_STR;
+  unsigned int len = str_getlen(p_str);
+  if (len > VSFTP_PRIVSOCK_MAXSTR)
   {
-    die("priv_sock_send_int");
+    bug("priv_sock_msg_add_str: too big");
+  }
+  msg_append(&type, sizeof(type));
+  msg_append(&len, sizeof(len));
+  msg_append(str_getbuf(p_str), len);
+}
+
+void
+priv_sock_msg_add_fd(int send_fd)
+{
+  if (s_out_fd != -1)
+  {
+    bug("priv_sock_msg_add_fd: already have one");
+  }
+  s_out_fd = send_fd;
+}
+
+void
+priv_sock_msg_send(int fd)
+{
+  unsigned int body_len = s_out_len - sizeof(body_len);
+  int retval;
+  vsf_sysutil_memcpy(s_out_buf, &body_len, sizeof(body_len));
+  retval = vsf_sysutil_send_msg(fd, s_out_buf, s_out_len, s_out_fd);
+  if (retval <= 0)
+  {
+    die("priv_sock_msg_send");
+  }
+  /* A stream socket may take a big message in pieces; the descriptor went
+   * with the first.
+   */
+  if ((unsigned int) retval < s_out_len)
+  {
+    unsigned int rest = s_out_len - (unsigned int) retval;
+    if (vsf_sysutil_write_loop(fd, s_out_buf + retval, rest) != (int) rest)
+    {
+      die("priv_sock_msg_send");
+    }
+  }
+  s_out_fd = -1;
+}
+
+char
+priv_sock_msg_recv(int fd)
+{
+  unsigned int got;
+  unsigned int body_len;
+  char cmd;
+  int retval;
+  if (s_in_fd != -1)
+  {
+    vsf_sysutil_close(s_in_fd);
+    s_in_fd = -1;
+  }
+  retval = vsf_sysutil_recv_msg(fd, s_in_buf, sizeof(s_in_buf), &s_in_fd);
+  if (retval <= 0)
+  {
+    die("priv_sock_msg_recv");
+  }
+  got = (unsigned int) retval;
+  if (got < sizeof(body_len))
+  {
+    msg_read_rest(fd, got, sizeof(body_len));
+    got = sizeof(body_len);
   }
+  vsf_sysutil_memcpy(&body_len, s_in_buf, sizeof(body_len));
+  if (body_len == 0 || body_len > sizeof(s_in_buf) - sizeof(body_len))
+  {
+    die("priv_sock_msg_recv: bad length");
+  }
+  s_in_len = sizeof(body_len) + body_len;
+  /* The channel is strictly request / response, so nothing may follow */
+  if (got > s_in_len)
+  {
+    die("priv_sock_msg_recv: unexpected data");
+  }
+  if (got < s_in_len)
+  {
+    msg_read_rest(fd, got, s_in_len);
+  }
+  s_in_pos = sizeof(body_len);
+  msg_consume(&cmd, sizeof(cmd));
+  return cmd;
 }
 
 int
-priv_sock_get_int(int fd)
+priv_sock_msg_get_int(void)
 {
   int the_int;
-  int retval = vsf_sysutil_read_loop(fd, &the_int, sizeof(the_int));
-  if (retval != sizeof(the_int))
+  msg_consume_type(PRIV_SOCK_FIELD_INT);
+  msg_consume(&the_int, sizeof(the_int));
+  return the_int;
+}
+
+void
+priv_sock_msg_get_str(struct mystr* p_dest)
+{
+  unsigned int len;
+  msg_consume_type(PRIV_SOCK_FIELD_STR);
+  msg_consume(&len, sizeof(len));
+  if (len > VSFTP_PRIVSOCK_MAXSTR || len > s_in_len - s_in_pos)
   {
-    die("priv_sock_get_int");
+    die("priv_sock_msg_get_str: too big");
   }
-  return the_int;
+  str_alloc_memchunk(p_dest, s_in_buf + s_in_pos, len);
+  s_in_pos += len;
 }
 
+int
+priv_sock_msg_get_fd(void)
+{
+  int the_fd = s_in_fd;
+  if (the_fd == -1)
+  {
+    die("no passed fd");
+  }
+  s_in_fd = -1;
+  return the_fd;
+}
+
+void
+priv_sock_send_result(int fd, char res)
+{
+  priv_sock_msg_start(res);
+  priv_sock_msg_send(fd);
+}
+
+char
+priv_sock_get_result(int fd)
+{
+  return priv_sock_msg_recv(fd);
+}
@@ -12,15 +12,31 @@ struct vsf_session;
  */
 void priv_sock_init(struct vsf_session* p_sess);
 
+/* The calls below, up to priv_sock_get_int(), exchange unframed data. They
+ * are used on the SSL slave channel, where requests are pipelined. The
+ * privileged channel uses the framed messages which follow.
+ */
+
 /* priv_sock_send_cmd()
  * PURPOSE
- * Sends a command, typically to the privileged side of the channel.
+ * Sends a command to the other side of the channel.
  * PARAMETERS
  * fd           - the fd on which to send the command
  * cmd          - the command to send
  */
 void priv_sock_send_cmd(int fd, char cmd);
 
+/* priv_sock_send_cmd_str()
+ * PURPOSE
+ * Sends a command followed by a string argument, in a single write. The other
+ * side reads it with priv_sock_get_cmd() followed by priv_sock_get_str().
+ * PARAMETERS
+ * fd           - the fd on which to send the command
+ * cmd          - the command to send
+ * p_str        - the string to send
+ */
+void priv_sock_send_cmd_str(int fd, char cmd, const struct mystr* p_str);
+
 /* priv_sock_send_str()
  * PURPOSE
  * Sends a string to the other side of the channel.
@@ -30,19 +46,18 @@ void priv_sock_send_cmd(int fd, char cmd);
  */
 void priv_sock_send_str(int fd, const struct mystr* p_str);
 
-/* priv_sock_get_result()
+/* priv_sock_send_int()
  * PURPOSE
- * Receives a response, typically from the privileged side of the channel.
+ * Sends an integer to the other side of the channel.
  * PARAMETERS
- * fd           - the fd on which to receive the response
- * RETURNS
- * The response code.
+ * fd           - the fd on which to send the integer
+ * the_int      - the integer to send
  */
-char priv_sock_get_result(int fd);
+void priv_sock_send_int(int fd, int the_int);
 
 /* priv_sock_get_cmd()
  * PURPOSE
- * Receives a command, typically on the privileged side of the channel.
+ * Receives a command from the other side of the channel.
  * PARAMETERS
  * fd           - the fd on which to receive the command.
  * RETURNS
@@ -59,52 +74,117 @@ char priv_sock_get_cmd(int fd);
  */
 void priv_sock_get_str(int fd, struct mystr* p_dest);
 
-/* priv_sock_send_result()
+/* priv_sock_get_int()
  * PURPOSE
- * Sends a command result, typically to the unprivileged side of the channel.
+ * Receives an integer from the other side of the channel.
  * PARAMETERS
- * fd           - the fd on which to send the result
- * res          - the result to send
+ * fd           - the fd on which to receive the integer
+ * RETURNS
+ * The integer that was sent.
  */
-void priv_sock_send_result(int fd, char res);
+int priv_sock_get_int(int fd);
 
-/* priv_sock_send_fd()
+/* priv_sock_msg_start()
  * PURPOSE
- * Sends a file descriptor to the other side of the channel.
+ * Start building a framed message for the privileged channel. Fields are
+ * added with the priv_sock_msg_add_*() calls, and the whole message, with
+ * any file descriptor, then goes out in one go with priv_sock_msg_send().
  * PARAMETERS
- * fd           - the fd on which to send the descriptor 
- * send_fd      - the descriptor to send
+ * cmd          - the command or result the message carries
  */
-void priv_sock_send_fd(int fd, int send_fd);
+void priv_sock_msg_start(char cmd);
 
-/* priv_sock_recv_fd()
+/* priv_sock_msg_add_int()
  * PURPOSE
- * Receives a file descriptor from the other side of the channel.
+ * Append an integer field to the message being built.
  * PARAMETERS
- * fd           - the fd on which to receive the descriptor
- * RETURNS
- * The received file descriptor
+ * the_int      - the integer to add
  */
-int priv_sock_recv_fd(int fd);
+void priv_sock_msg_add_int(int the_int);
 
-/* priv_sock_send_int()
+/* priv_sock_msg_add_str()
  * PURPOSE
- * Sends an integer to the other side of the channel.
+ * Append a string field to the message being built.
  * PARAMETERS
- * fd           - the fd on which to send the integer
- * the_int      - the integer to send
+ * p_str        - the string to add
  */
-void priv_sock_send_int(int fd, int the_int);
+void priv_sock_msg_add_str(const struct mystr* p_str);
 
-/* priv_sock_get_int()
+/* priv_sock_msg_add_fd()
  * PURPOSE
- * Receives an integer from the other side of the channel.
+ * Attach a file descriptor to the message being built. At most one may be
+ * attached. The caller keeps its own copy of the descriptor.
  * PARAMETERS
- * fd           - the fd on which to receive the integer
+ * send_fd      - the descriptor to pass
+ */
+void priv_sock_msg_add_fd(int send_fd);
+
+/* priv_sock_msg_send()
+ * PURPOSE
+ * Send the message that has been built.
+ * PARAMETERS
+ * fd           - the fd on which to send the message
+ */
+void priv_sock_msg_send(int fd);
+
+/* priv_sock_msg_recv()
+ * PURPOSE
+ * Receive a framed message. The fields are then read, in the order they were
+ * added, with the priv_sock_msg_get_*() calls. Any mismatch between what is
+ * asked for and what was sent is fatal.
+ * PARAMETERS
+ * fd           - the fd on which to receive the message
+ * RETURNS
+ * The command or result the message carries.
+ */
+char priv_sock_msg_recv(int fd);
+
+/* priv_sock_msg_get_int()
+ * PURPOSE
+ * Read the next field of the received message, which must be an integer.
  * RETURNS
  * The integer that was sent.
  */
-int priv_sock_get_int(int fd);
+int priv_sock_msg_get_int(void);
+
+/* priv_sock_msg_get_str()
+ * PURPOSE
+ * Read the next field of the received message, which must be a string.
+ * PARAMETERS
+ * p_dest       - where to copy the received string
+ */
+void priv_sock_msg_get_str(struct mystr* p_dest);
+
+/* priv_sock_msg_get_fd()
+ * PURPOSE
+ * Take the file descriptor attached to the received message. It is fatal if
+ * there is none. A descriptor which is not taken is closed when the next
+ * message is received.
+ * RETURNS
+ * The received file descriptor, which the caller must close.
+ */
+int priv_sock_msg_get_fd(void);
+
+/* priv_sock_send_result()
+ * PURPOSE
+ * Sends a command result, typically to the unprivileged side of the channel.
+ * This is a framed message with no fields.
+ * PARAMETERS
+ * fd           - the fd on which to send the result
+ * res          - the result to send
+ */
+void priv_sock_send_result(int fd, char res);
+
+/* priv_sock_get_result()
+ * PURPOSE
+ * Receives a response, typically from the privileged side of the channel.
+ * This is a framed message with no fields.
+ * PARAMETERS
+ * fd           - the fd on which to receive the response
+ * RETURNS
+ * The response code.
+ */
+char priv_sock_get_result(int fd);
 
 #define PRIV_SOCK_LOGIN             1
 #define PRIV_SOCK_CHOWN             2
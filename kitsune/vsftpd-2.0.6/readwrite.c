@@ -16,36 +16,178 @@
 #include "defs.h"
 #include "sysutil.h"
 
+static int get_plain_fd(const struct vsf_session* p_sess,
+                        enum EVSFRWTarget target);
+static int write_str_ssl(const struct vsf_session* p_sess,
+                         const struct mystr* p_str, enum EVSFRWTarget target);
+
 int
 ftp_write_str(const struct vsf_session* p_sess, const struct mystr* p_str,
               enum EVSFRWTarget target)
 {
-  if (target == kVSFRWData)
+  struct vsf_rwbuf rwbuf;
+  int retval;
+  ftp_rwbuf_init(&rwbuf, p_sess, target);
+  retval = ftp_rwbuf_add_str(&rwbuf, p_str);
+  if (retval == 0)
   {
-    if (p_sess->data_use_ssl)
+    retval = ftp_rwbuf_flush(&rwbuf);
+  }
+  ftp_rwbuf_free(&rwbuf);
+  return retval;
+}
+
+void
+ftp_rwbuf_init(struct vsf_rwbuf* p_rwbuf, const struct vsf_session* p_sess,
+               enum EVSFRWTarget target)
+{
+  static struct mystr s_empty_str = INIT_MYSTR;
+  p_rwbuf->p_sess = p_sess;
+  p_rwbuf->target = target;
+  p_rwbuf->p_sink = 0;
+  p_rwbuf->p_sink_private = 0;
+  p_rwbuf->num_strs = 0;
+  p_rwbuf->num_bytes = 0;
+  p_rwbuf->buf_str = s_empty_str;
+}
+
+void
+ftp_rwbuf_set_sink(struct vsf_rwbuf* p_rwbuf,
+                   int (*p_sink)(void*, const char*, unsigned int),
+                   void* p_private)
+{
+  p_rwbuf->p_sink = p_sink;
+  p_rwbuf->p_sink_private = p_private;
+}
+
+int
+ftp_rwbuf_add_str(struct vsf_rwbuf* p_rwbuf, const struct mystr* p_str)
+{
+  unsigned int len = str_getlen(p_str);
+  if (p_rwbuf->num_strs == VSF_RWBUF_MAX_STRS ||
+      (p_rwbuf->num_strs > 0 &&
+       p_rwbuf->num_bytes + len > VSFTP_DIR_BUFSIZE))
+  {
+    if (ftp_rwbuf_flush(p_rwbuf) != 0)
     {
-      return ssl_write_str(p_sess->p_data_ssl, p_str);
+      return -1;
+    }
+  }
+  p_rwbuf->p_strs[p_rwbuf->num_strs++] = p_str;
+  p_rwbuf->num_bytes += len;
+  return 0;
+}
+
+int
+ftp_rwbuf_flush(struct vsf_rwbuf* p_rwbuf)
+{
+  const struct mystr* p_str;
+  unsigned int i;
+  int retval = 0;
+  int fd = -1;
+  if (p_rwbuf->num_strs == 0)
+  {
+    return 0;
+  }
+  if (p_rwbuf->p_sink == 0)
+  {
+    fd = get_plain_fd(p_rwbuf->p_sess, p_rwbuf->target);
+  }
+  if (fd != -1)
+  {
+    struct vsf_sysutil_iovec iov[VSF_RWBUF_MAX_STRS];
+    for (i = 0; i < p_rwbuf->num_strs; i++)
+    {
+      iov[i].p_base = str_getbuf(p_rwbuf->p_strs[i]);
+      iov[i].len = str_getlen(p_rwbuf->p_strs[i]);
+    }
+    retval = vsf_sysutil_writev_loop(fd, iov, p_rwbuf->num_strs);
+    if (vsf_sysutil_retval_is_error(retval) ||
+        (unsigned int) retval != p_rwbuf->num_bytes)
+    {
+      retval = -1;
     }
     else
     {
-      return str_netfd_write(p_str, p_sess->data_fd);
+      retval = 0;
     }
   }
   else
   {
-    if (p_sess->control_use_ssl && p_sess->ssl_slave_active)
+    /* One record or message for the lot, rather than one per string */
+    p_str = p_rwbuf->p_strs[0];
+    if (p_rwbuf->num_strs > 1)
     {
-      priv_sock_send_cmd(p_sess->ssl_consumer_fd, PRIV_SOCK_WRITE_USER_RESP);
-      priv_sock_send_str(p_sess->ssl_consumer_fd, p_str);
-      return priv_sock_get_int(p_sess->ssl_consumer_fd);
+      str_empty(&p_rwbuf->buf_str);
+      for (i = 0; i < p_rwbuf->num_strs; i++)
+      {
+        str_append_str(&p_rwbuf->buf_str, p_rwbuf->p_strs[i]);
+      }
+      p_str = &p_rwbuf->buf_str;
     }
-    else if (p_sess->control_use_ssl)
+    if (p_rwbuf->p_sink != 0)
     {
-      return ssl_write_str(p_sess->p_control_ssl, p_str);
+      retval = (*p_rwbuf->p_sink)(p_rwbuf->p_sink_private, str_getbuf(p_str),
+                                  str_getlen(p_str));
     }
     else
     {
-      return str_netfd_write(p_str, VSFTP_COMMAND_FD);
+      retval = write_str_ssl(p_rwbuf->p_sess, p_str, p_rwbuf->target);
+    }
+  }
+  p_rwbuf->num_strs = 0;
+  p_rwbuf->num_bytes = 0;
+  return retval;
+}
+
+void
+ftp_rwbuf_free(struct vsf_rwbuf* p_rwbuf)
+{
+  str_free(&p_rwbuf->buf_str);
+}
+
+static int
+get_plain_fd(const struct vsf_session* p_sess, enum EVSFRWTarget target)
+{
+  /* The socket to writev() to, or -1 if SSL is in the way */
+  if (target == kVSFRWData)
+  {
+    if (p_sess->data_use_ssl)
+    {
+      return -1;
+    }
+    return p_sess->data_fd;
+  }
+  if (p_sess->control_use_ssl)
+  {
+    return -1;
+  }
+  return VSFTP_COMMAND_FD;
+}
+
+static int
+write_str_ssl(const struct vsf_session* p_sess, const struct mystr* p_str,
+              enum EVSFRWTarget target)
+{
+  if (target == kVSFRWData)
+  {
+    return ssl_write_str(p_sess->p_data_ssl, p_str);
+  }
+  else
+  {
+    if (p_sess->control_use_ssl && p_sess->ssl_slave_active)
+    {
+      /* No acknowledgement: the SSL slave exits if it cannot write to the
+       * client, and we then notice on our next use of the channel. Replies
+       * stay in order because the slave handles requests one at a time.
+       */
+      priv_sock_send_cmd_str(p_sess->ssl_consumer_fd,
+                             PRIV_SOCK_WRITE_USER_RESP, p_str);
+      return 0;
+    }
+    else
+    {
+      return ssl_write_str(p_sess->p_control_ssl, p_str);
     }
   }
 }
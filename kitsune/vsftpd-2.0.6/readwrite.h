@@ -1,8 +1,11 @@
 #ifndef VSF_READWRITE_H
 #define VSF_READWRITE_H
 
+#ifndef VSFTP_STR_H
+#include "str.h"
+#endif
+
 struct vsf_session;
-struct mystr;
 
 enum EVSFRWTarget
 {
@@ -10,6 +13,41 @@ enum EVSFRWTarget
   kVSFRWData
 };
 
+/* Most strings a buffered writer holds before it writes them out */
+#define VSF_RWBUF_MAX_STRS    64
+
+/* A buffered writer. Strings added to it are written out together, in one
+ * go per VSFTP_DIR_BUFSIZE or so. On a plain socket they are gathered
+ * straight from where they are with writev(); SSL, and anything given a
+ * sink, gets them copied into one buffer. The strings are not copied when
+ * added, so they must stay as they are until written out.
+ */
+struct vsf_rwbuf
+{
+  const struct vsf_session* p_sess;
+  enum EVSFRWTarget target;
+  int (*p_sink)(void* p_private, const char* p_buf, unsigned int len);
+  void* p_sink_private;
+  const struct mystr* p_strs[VSF_RWBUF_MAX_STRS];
+  unsigned int num_strs;
+  unsigned int num_bytes;
+  struct mystr buf_str;
+};
+
+void ftp_rwbuf_init(struct vsf_rwbuf* p_rwbuf,
+                    const struct vsf_session* p_sess,
+                    enum EVSFRWTarget target);
+/* Hands each batch to p_sink instead, e.g. to compress it; p_sink returns
+ * 0 for success
+ */
+void ftp_rwbuf_set_sink(struct vsf_rwbuf* p_rwbuf,
+                        int (*p_sink)(void*, const char*, unsigned int),
+                        void* p_private);
+/* These return 0 for success, -1 if a write failed */
+int ftp_rwbuf_add_str(struct vsf_rwbuf* p_rwbuf, const struct mystr* p_str);
+int ftp_rwbuf_flush(struct vsf_rwbuf* p_rwbuf);
+void ftp_rwbuf_free(struct vsf_rwbuf* p_rwbuf);
+
 int ftp_write_str(const struct vsf_session* p_sess, const struct mystr* p_str,
                   enum EVSFRWTarget target);
 int ftp_read_data(const struct vsf_session* p_sess, char* p_buf,
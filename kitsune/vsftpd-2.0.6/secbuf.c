@@ -7,15 +7,214 @@
  * Here are some routines providing the (possibly silly) concept of a secure
  * buffer. A secure buffer may not be overflowed. A single byte overflow
  * will cause the program to safely terminate.
+ *
+ * Buffers up to VSFTP_SECBUF_POOL_MAX come out of a pool: one arena of
+ * slots, each a power of two pages, with an inaccessible page between
+ * neighbours. A slot is made accessible once, when first carved out, and
+ * goes back on a free list when its buffer is freed, so allocation usually
+ * costs no system calls at all. Bigger buffers get a mapping of their own.
  */
 
 #include "secbuf.h"
 #include "utility.h"
 #include "sysutil.h"
 #include "sysdeputil.h"
+#include "defs.h"
+
+#define VSF_SECBUF_NUM_CLASSES  8
+#define VSF_SECBUF_MAX_SLOTS    256
+
+struct vsf_secbuf_slot
+{
+  char* p_start;
+  unsigned int num_pages;
+  int in_use;
+  /* Index + 1 of the next free slot of this size, or 0 */
+  unsigned int next_free;
+};
+
+static char* s_p_arena;
+static unsigned int s_arena_used;
+static struct vsf_secbuf_slot s_slots[VSF_SECBUF_MAX_SLOTS];
+static unsigned int s_num_slots;
+/* Index + 1 of the first free slot of each size, or 0 */
+static unsigned int s_free_head[VSF_SECBUF_NUM_CLASSES];
+
+static unsigned int get_num_pages(unsigned int size);
+static unsigned int get_class(unsigned int num_pages);
+static int take_slot(unsigned int class_num);
+static int carve_slot(unsigned int class_num);
+static void map_own_buf(char** p_ptr, unsigned int size);
+static void unmap_own_buf(char* p_buf);
+
+void
+vsf_secbuf_pool_init(void)
+{
+  unsigned int page_size = vsf_sysutil_getpagesize();
+  unsigned int class_num;
+  unsigned int i;
+  if (s_p_arena != 0)
+  {
+    return;
+  }
+  /* Reserve the lot inaccessible; slots are opened up as they are carved */
+  s_p_arena = vsf_sysutil_map_anon_pages(VSFTP_SECBUF_ARENA_SIZE);
+  vsf_sysutil_memprotect(s_p_arena, VSFTP_SECBUF_ARENA_SIZE,
+                         kVSFSysUtilMapProtNone);
+  /* The first page guards the first slot */
+  s_arena_used = page_size;
+  /* Ready made slots for the usual buffers: the control line, paths, and
+   * transfers. Processes forked after this inherit them.
+   */
+  class_num = get_class(get_num_pages(VSFTP_PATH_MAX));
+  for (i = 0; i < 3; ++i)
+  {
+    (void) carve_slot(class_num);
+  }
+  class_num = get_class(get_num_pages(VSFTP_DATA_BUFSIZE));
+  for (i = 0; i < 4; ++i)
+  {
+    (void) carve_slot(class_num);
+  }
+  class_num = get_class(get_num_pages(VSFTP_DATA_BUFSIZE * 2));
+  for (i = 0; i < 2; ++i)
+  {
+    (void) carve_slot(class_num);
+  }
+}
 
 void
 vsf_secbuf_alloc(char** p_ptr, unsigned int size)
+{
+  unsigned int page_size = vsf_sysutil_getpagesize();
+  /* Free any previous buffer */
+  vsf_secbuf_free(p_ptr);
+  if (size <= VSFTP_SECBUF_POOL_MAX)
+  {
+    int slot;
+    vsf_secbuf_pool_init();
+    slot = take_slot(get_class(get_num_pages(size)));
+    if (slot != -1)
+    {
+      /* Put the end of the buffer hard against the next inaccessible page */
+      struct vsf_secbuf_slot* p_slot = &s_slots[slot];
+      p_slot->in_use = 1;
+      *p_ptr = p_slot->p_start + p_slot->num_pages * page_size - size;
+      return;
+    }
+  }
+  /* Too big, or the pool is full */
+  map_own_buf(p_ptr, size);
+}
+
+void
+vsf_secbuf_free(char** p_ptr)
+{
+  char* p_buf = *p_ptr;
+  unsigned int page_size = vsf_sysutil_getpagesize();
+  if (p_buf == 0)
+  {
+    return;
+  }
+  *p_ptr = 0;
+  if (s_p_arena != 0 && p_buf >= s_p_arena &&
+      p_buf < s_p_arena + VSFTP_SECBUF_ARENA_SIZE)
+  {
+    unsigned int i;
+    for (i = 0; i < s_num_slots; ++i)
+    {
+      struct vsf_secbuf_slot* p_slot = &s_slots[i];
+      /* A zero sized buffer sits right at the end of its slot */
+      if (p_buf >= p_slot->p_start &&
+          p_buf <= p_slot->p_start + p_slot->num_pages * page_size)
+      {
+        unsigned int class_num = get_class(p_slot->num_pages);
+        if (!p_slot->in_use)
+        {
+          bug("vsf_secbuf_free: not in use");
+        }
+        p_slot->in_use = 0;
+        p_slot->next_free = s_free_head[class_num];
+        s_free_head[class_num] = i + 1;
+        return;
+      }
+    }
+    bug("vsf_secbuf_free");
+  }
+  unmap_own_buf(p_buf);
+}
+
+static unsigned int
+get_num_pages(unsigned int size)
+{
+  unsigned int page_size = vsf_sysutil_getpagesize();
+  unsigned int num_pages = (size + page_size - 1) / page_size;
+  if (num_pages == 0)
+  {
+    num_pages = 1;
+  }
+  return num_pages;
+}
+
+static unsigned int
+get_class(unsigned int num_pages)
+{
+  unsigned int class_num = 0;
+  while ((1U << class_num) < num_pages)
+  {
+    class_num++;
+  }
+  if (class_num >= VSF_SECBUF_NUM_CLASSES)
+  {
+    bug("secbuf class too big");
+  }
+  return class_num;
+}
+
+static int
+take_slot(unsigned int class_num)
+{
+  unsigned int slot = s_free_head[class_num];
+  if (slot == 0)
+  {
+    if (carve_slot(class_num) == -1)
+    {
+      return -1;
+    }
+    slot = s_free_head[class_num];
+  }
+  s_free_head[class_num] = s_slots[slot - 1].next_free;
+  s_slots[slot - 1].next_free = 0;
+  return (int) slot - 1;
+}
+
+static int
+carve_slot(unsigned int class_num)
+{
+  unsigned int page_size = vsf_sysutil_getpagesize();
+  unsigned int num_pages = 1U << class_num;
+  unsigned int slot_size = num_pages * page_size;
+  struct vsf_secbuf_slot* p_slot;
+  /* Room for the slot and the inaccessible page after it? */
+  if (s_num_slots == VSF_SECBUF_MAX_SLOTS ||
+      s_arena_used + slot_size + page_size > VSFTP_SECBUF_ARENA_SIZE)
+  {
+    return -1;
+  }
+  p_slot = &s_slots[s_num_slots];
+  p_slot->p_start = s_p_arena + s_arena_used;
+  p_slot->num_pages = num_pages;
+  p_slot->in_use = 0;
+  vsf_sysutil_memprotect(p_slot->p_start, slot_size,
+                         kVSFSysUtilMapProtReadWrite);
+  s_arena_used += slot_size + page_size;
+  p_slot->next_free = s_free_head[class_num];
+  s_free_head[class_num] = s_num_slots + 1;
+  return (int) s_num_slots++;
+}
+
+static void
+map_own_buf(char** p_ptr, unsigned int size)
 {
   unsigned int page_offset;
   unsigned int round_up;
@@ -23,8 +222,6 @@ vsf_secbuf_alloc(char** p_ptr, unsigned int size)
   char* p_no_access_page;
   unsigned int page_size = vsf_sysutil_getpagesize();
 
-  /* Free any previous buffer */
-  vsf_secbuf_free(p_ptr);
   /* Round up to next page size */
   page_offset = size % page_size;
   if (page_offset)
@@ -61,17 +258,13 @@ vsf_secbuf_alloc(char** p_ptr, unsigned int size)
   *p_ptr = p_mmap;
 }
 
-void
-vsf_secbuf_free(char** p_ptr)
+static void
+unmap_own_buf(char* p_buf)
 {
   unsigned int map_size;
   unsigned long page_offset;
-  char* p_mmap = *p_ptr;
+  char* p_mmap = p_buf;
   unsigned int page_size = vsf_sysutil_getpagesize();
-  if (p_mmap == 0)
-  {
-    return;
-  }
   /* Calculate the actual start of the mmap region */
   page_offset = (unsigned long) p_mmap % page_size;
   if (page_offset)
@@ -86,4 +279,3 @@ vsf_secbuf_free(char** p_ptr)
   /* Lose the mapping */
   vsf_sysutil_memunmap(p_mmap, map_size);
 }
-
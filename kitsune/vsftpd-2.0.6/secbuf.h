@@ -1,12 +1,24 @@
 #ifndef VSF_SECBUF_H
 #define VSF_SECBUF_H
 
+/* vsf_secbuf_pool_init()
+ * PURPOSE
+ * Set up the pool that small secure buffers come from, with slots ready for
+ * the buffers every session needs. Call it before forking sessions, so
+ * they inherit it rather than each building their own. Optional; the pool
+ * is otherwise set up on first use.
+ */
+void vsf_secbuf_pool_init(void);
+
 /* vsf_secbuf_alloc()
  * PURPOSE
  * Allocate a "secure buffer". A secure buffer is one which will attempt to
  * catch out of bounds accesses by crashing the program (rather than
  * corrupting memory). It works by using UNIX memory protection. It isn't
- * foolproof.
+ * foolproof. The end of the buffer always abuts an inaccessible page; the
+ * start of a small buffer may be some way after one, as small buffers come
+ * from pool slots of a power of two pages. The contents of a recycled buffer
+ * are not cleared.
  * PARAMETERS
  * p_ptr        - pointer to a pointer which is to contain the secure buffer.
  *                Any previous buffer pointed to is freed.
@@ -11,6 +11,7 @@
 
 struct vsf_sysutil_sockaddr;
 struct mystr_list;
+struct vsf_lineidx;
 
 /* This struct contains variables specific to the state of the current FTP
  * session
@@ -26,7 +27,6 @@ struct vsf_session
   int pasv_listen_fd;
   struct vsf_sysutil_sockaddr* p_port_sockaddr;
   int data_fd;
-  int data_progress;
   unsigned int bw_rate_max;
   long bw_send_start_sec;
   long bw_send_start_usec;
@@ -39,10 +39,17 @@ struct vsf_session
 
   /* Details of the FTP protocol state */
   filesize_t restart_pos;
+  filesize_t range_end_pos;
+  filesize_t allo_size;
   int is_ascii;
   struct mystr rnfr_filename_str;
+  struct mystr cpfr_filename_str;
   int abor_received;
   int epsv_all;
+  int is_deflate;
+  int is_block_mode;
+  int deflate_level;
+  int hash_type;
 
   /* Details of FTP session state */
   struct mystr_list* p_visited_dir_list;
@@ -53,9 +60,9 @@ struct vsf_session
   int anon_upload_chown_uid;
 
   /* Things we need to cache before we chroot() */
-  struct mystr banned_email_str;
-  struct mystr email_passwords_str;
-  struct mystr userlist_str;
+  const struct vsf_lineidx* p_banned_email_idx;
+  const struct vsf_lineidx* p_email_passwords_idx;
+  const struct vsf_lineidx* p_userlist_idx;
   struct mystr banner_str;
   int tcp_wrapper_ok;
 
@@ -21,6 +21,8 @@
 #include "utility.h"
 #include "builddefs.h"
 #include "logging.h"
+#include "sysdeputil.h"
+#include "sslcache.h"
 
 #ifdef VSF_BUILD_SSL
 
@@ -38,6 +40,16 @@ static long bio_callback(
 static int ssl_verify_callback(int verify_ok, X509_STORE_CTX* p_ctx);
 static int ssl_cert_digest(
   SSL* p_ssl, struct vsf_session* p_sess, struct mystr* p_str);
+static void ssl_cache_init(SSL_CTX* p_ctx);
+static int ssl_cache_new_cb(SSL* p_ssl, SSL_SESSION* p_session);
+static void ssl_cache_remove_cb(SSL_CTX* p_ctx, SSL_SESSION* p_session);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+static SSL_SESSION* ssl_cache_get_cb(SSL* p_ssl, const unsigned char* p_id,
+                                     int id_len, int* p_copy);
+#else
+static SSL_SESSION* ssl_cache_get_cb(SSL* p_ssl, unsigned char* p_id,
+                                     int id_len, int* p_copy);
+#endif
 
 static int ssl_inited;
 static struct mystr debug_str;
@@ -124,6 +136,17 @@ ssl_init(struct vsf_session* p_sess)
         die("SSL: could not load verify file");
       }
     }
+    /* OpenSSL refuses to resume any session when peer verification is on
+     * unless we name a session ID context.
+     */
+    if (!SSL_CTX_set_session_id_context(p_ctx, (unsigned char*) "vsftpd", 6))
+    {
+      die("SSL: could not set session id context");
+    }
+    /* Session ticket keys are generated by SSL_CTX_new(), so every process
+     * forked from here shares them; only stateful sessions need help.
+     */
+    ssl_cache_init(p_ctx);
     p_sess->p_ssl_ctx = p_ctx;
     ssl_inited = 1;
   }
@@ -284,6 +307,14 @@ ssl_data_close(struct vsf_session* p_sess)
 {
   if (p_sess->p_data_ssl)
   {
+    /* Freed without a close_notify, OpenSSL would count the session as
+     * broken and drop it from the cache, so the next data connection could
+     * not resume it. We don't wait for the client's close_notify.
+     */
+    if (SSL_is_init_finished(p_sess->p_data_ssl))
+    {
+      (void) SSL_shutdown(p_sess->p_data_ssl);
+    }
     SSL_free(p_sess->p_data_ssl);
     p_sess->p_data_ssl = NULL;
   }
@@ -465,6 +496,85 @@ ssl_cert_digest(SSL* p_ssl, struct vsf_session* p_sess, struct mystr* p_str)
   return 1;
 }
 
+static void
+ssl_cache_init(SSL_CTX* p_ctx)
+{
+  /* Stateful sessions also go to the SSL cache process, if the listener
+   * started one, so that the data connection (handled in a different process
+   * to the control connection) and reconnecting clients can resume instead
+   * of doing a full handshake. The sessions' master secrets are only ever
+   * held there and in the process using them.
+   */
+  SSL_CTX_set_session_cache_mode(p_ctx, SSL_SESS_CACHE_SERVER);
+  SSL_CTX_sess_set_new_cb(p_ctx, ssl_cache_new_cb);
+  SSL_CTX_sess_set_get_cb(p_ctx, ssl_cache_get_cb);
+  SSL_CTX_sess_set_remove_cb(p_ctx, ssl_cache_remove_cb);
+}
+
+static int
+ssl_cache_new_cb(SSL* p_ssl, SSL_SESSION* p_session)
+{
+  static unsigned char s_der_buf[VSFTP_SSL_SESSION_MAX];
+  const unsigned char* p_id;
+  unsigned char* p_der = s_der_buf;
+  unsigned int id_len = 0;
+  int der_len;
+  (void) p_ssl;
+  p_id = SSL_SESSION_get_id(p_session, &id_len);
+  der_len = i2d_SSL_SESSION(p_session, NULL);
+  if (id_len == 0 || id_len > SSL_MAX_SSL_SESSION_ID_LENGTH ||
+      der_len <= 0 || der_len > VSFTP_SSL_SESSION_MAX)
+  {
+    return 0;
+  }
+  (void) i2d_SSL_SESSION(p_session, &p_der);
+  vsf_sslcache_store(p_id, id_len, s_der_buf, (unsigned int) der_len);
+  vsf_sysutil_memclr(s_der_buf, (unsigned int) der_len);
+  /* We didn't keep a reference */
+  return 0;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+static SSL_SESSION*
+ssl_cache_get_cb(SSL* p_ssl, const unsigned char* p_id, int id_len,
+                 int* p_copy)
+#else
+static SSL_SESSION*
+ssl_cache_get_cb(SSL* p_ssl, unsigned char* p_id, int id_len, int* p_copy)
+#endif
+{
+  static unsigned char s_der_buf[VSFTP_SSL_SESSION_MAX];
+  const unsigned char* p_der = s_der_buf;
+  SSL_SESSION* p_session;
+  unsigned int der_len;
+  (void) p_ssl;
+  *p_copy = 0;
+  if (id_len <= 0 || id_len > SSL_MAX_SSL_SESSION_ID_LENGTH)
+  {
+    return NULL;
+  }
+  der_len = vsf_sslcache_fetch(p_id, (unsigned int) id_len, s_der_buf,
+                               sizeof(s_der_buf));
+  if (der_len == 0)
+  {
+    return NULL;
+  }
+  /* OpenSSL checks the session timeout for us */
+  p_session = d2i_SSL_SESSION(NULL, &p_der, (long) der_len);
+  vsf_sysutil_memclr(s_der_buf, der_len);
+  return p_session;
+}
+
+static void
+ssl_cache_remove_cb(SSL_CTX* p_ctx, SSL_SESSION* p_session)
+{
+  const unsigned char* p_id;
+  unsigned int id_len = 0;
+  (void) p_ctx;
+  p_id = SSL_SESSION_get_id(p_session, &id_len);
+  vsf_sslcache_remove(p_id, id_len);
+}
+
 static char*
 get_ssl_error()
 {
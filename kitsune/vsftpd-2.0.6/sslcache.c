@@ -0,0 +1,373 @@
+/*
+ * Part of Very Secure FTPd
+ * Licence: GPL v2
+ * Author: Chris Evans
+ * sslcache.c
+ *
+ * The SSL session cache: one process, forked by the standalone listener,
+ * which remembers SSL sessions so that the data connection (handled in a
+ * different process to the control connection) and reconnecting clients can
+ * resume instead of doing a full handshake.
+ *
+ * A cached session includes its master secret, so the cache is kept out of
+ * reach of the sessions, which may be running as any user. It stays root,
+ * so that nothing running as nopriv_user can ptrace it either.
+ *
+ * Session IDs go over the wire in the clear, so an ID alone must not get
+ * a session back. Every request carries the session's control connection.
+ * The worker checks that it was accepted on listen_port, which no session
+ * can fake, and files each SSL session under a keyed hash of the address on
+ * the other end and the session ID. A session process can therefore only
+ * reach the SSL sessions of the client it serves: it cannot fetch another
+ * client's secrets, overwrite or remove its sessions, or even pick which
+ * slot an entry of its own lands in.
+ *
+ * A request is a datagram: one byte saying what to do, the length of the
+ * session ID, the ID, and for a store, the DER encoded session. A store or
+ * remove carries the control connection itself. A fetch carries one end of
+ * a fresh socketpair instead, with the control connection already queued on
+ * it; the worker writes back the encoded session over it, or nothing if it
+ * has no such session.
+ */
+
+#include "sslcache.h"
+#include "sysutil.h"
+#include "sysdeputil.h"
+#include "checksum.h"
+#include "str.h"
+#include "tunables.h"
+#include "defs.h"
+#include "utility.h"
+
+/* The longest session ID any SSL or TLS version uses */
+#define VSF_SSLCACHE_ID_MAX   32
+#define VSF_SSLCACHE_REQ_MAX  (2 + VSF_SSLCACHE_ID_MAX + VSFTP_SSL_SESSION_MAX)
+#define VSF_SSLCACHE_SALT_LEN 16
+/* A SHA-256 in hex */
+#define VSF_SSLCACHE_KEY_LEN  64
+
+struct vsf_sslcache_entry
+{
+  char key[VSF_SSLCACHE_KEY_LEN];
+  unsigned int der_len;
+  unsigned char der[VSFTP_SSL_SESSION_MAX];
+};
+
+/* Session side state */
+static int s_sock = -1;
+
+/* Worker side state */
+static char s_salt[VSF_SSLCACHE_SALT_LEN];
+static struct vsf_sslcache_entry* s_p_entries;
+
+static unsigned int build_request(unsigned char* p_buf, char op,
+                                  const unsigned char* p_id,
+                                  unsigned int id_len);
+static struct vsf_sslcache_entry* lookup_entry(const unsigned char* p_req,
+                                               unsigned int req_len,
+                                               int client_fd,
+                                               struct mystr* p_key_str);
+static int get_client_addr(int client_fd, unsigned char* p_addr);
+static int take_client_fd(int reply_fd);
+static void init_salt(void);
+
+void
+vsf_sslcache_attach(int sock)
+{
+  s_sock = sock;
+}
+
+void
+vsf_sslcache_store(const unsigned char* p_id, unsigned int id_len,
+                   const unsigned char* p_der, unsigned int der_len)
+{
+  unsigned char req_buf[VSF_SSLCACHE_REQ_MAX];
+  unsigned int req_len;
+  if (s_sock == -1 || der_len == 0 || der_len > VSFTP_SSL_SESSION_MAX)
+  {
+    return;
+  }
+  req_len = build_request(req_buf, 'S', p_id, id_len);
+  if (req_len == 0)
+  {
+    return;
+  }
+  vsf_sysutil_memcpy(req_buf + req_len, p_der, der_len);
+  req_len += der_len;
+  /* Nothing to wait for; if it is lost, we just miss later */
+  (void) vsf_sysutil_send_msg(s_sock, req_buf, req_len, VSFTP_COMMAND_FD);
+  vsf_sysutil_memclr(req_buf, sizeof(req_buf));
+}
+
+unsigned int
+vsf_sslcache_fetch(const unsigned char* p_id, unsigned int id_len,
+                   unsigned char* p_buf, unsigned int buf_len)
+{
+  unsigned char req_buf[2 + VSF_SSLCACHE_ID_MAX];
+  struct vsf_sysutil_socketpair_retval sockets;
+  unsigned int req_len;
+  int retval;
+  if (s_sock == -1)
+  {
+    return 0;
+  }
+  req_len = build_request(req_buf, 'G', p_id, id_len);
+  if (req_len == 0)
+  {
+    return 0;
+  }
+  sockets = vsf_sysutil_unix_stream_socketpair();
+  /* Queue the control connection first, so the worker never waits on us */
+  retval = vsf_sysutil_send_msg(sockets.socket_one, "C", 1,
+                                VSFTP_COMMAND_FD);
+  if (!vsf_sysutil_retval_is_error(retval))
+  {
+    retval = vsf_sysutil_send_msg(s_sock, req_buf, req_len,
+                                  sockets.socket_two);
+  }
+  vsf_sysutil_close(sockets.socket_two);
+  if (vsf_sysutil_retval_is_error(retval))
+  {
+    vsf_sysutil_close(sockets.socket_one);
+    return 0;
+  }
+  /* A miss, or a worker dying on us, shows up as EOF */
+  retval = vsf_sysutil_read_loop(sockets.socket_one, p_buf, buf_len);
+  vsf_sysutil_close(sockets.socket_one);
+  if (vsf_sysutil_retval_is_error(retval))
+  {
+    return 0;
+  }
+  return (unsigned int) retval;
+}
+
+void
+vsf_sslcache_remove(const unsigned char* p_id, unsigned int id_len)
+{
+  unsigned char req_buf[2 + VSF_SSLCACHE_ID_MAX];
+  unsigned int req_len;
+  if (s_sock == -1)
+  {
+    return;
+  }
+  req_len = build_request(req_buf, 'R', p_id, id_len);
+  if (req_len != 0)
+  {
+    (void) vsf_sysutil_send_msg(s_sock, req_buf, req_len,
+                                VSFTP_COMMAND_FD);
+  }
+}
+
+void
+vsf_sslcache_worker(int sock)
+{
+  static struct mystr s_key_str;
+  unsigned int alloc_len =
+    VSFTP_SSL_SESSION_CACHE_SIZE * sizeof(struct vsf_sslcache_entry);
+  unsigned char* p_req_buf = vsf_sysutil_malloc(VSF_SSLCACHE_REQ_MAX);
+  vsf_sysutil_exit_with_parent();
+  vsf_sysutil_install_null_sighandler(kVSFSysUtilSigHUP);
+  vsf_sysutil_unblock_sig(kVSFSysUtilSigHUP);
+  if (tunable_setproctitle_enable)
+  {
+    vsf_sysutil_setproctitle("SSL CACHE");
+  }
+  init_salt();
+  s_p_entries = vsf_sysutil_malloc(alloc_len);
+  vsf_sysutil_memclr(s_p_entries, alloc_len);
+  while (1)
+  {
+    struct vsf_sslcache_entry* p_entry = 0;
+    unsigned int req_len;
+    int recv_fd;
+    int reply_fd = -1;
+    int client_fd;
+    int retval = vsf_sysutil_recv_msg(sock, p_req_buf, VSF_SSLCACHE_REQ_MAX,
+                                      &recv_fd);
+    if (vsf_sysutil_retval_is_error(retval))
+    {
+      die("recvmsg in SSL cache");
+    }
+    req_len = (unsigned int) retval;
+    client_fd = recv_fd;
+    if (req_len > 0 && p_req_buf[0] == 'G' && recv_fd != -1)
+    {
+      reply_fd = recv_fd;
+      client_fd = take_client_fd(reply_fd);
+    }
+    if (client_fd != -1)
+    {
+      p_entry = lookup_entry(p_req_buf, req_len, client_fd, &s_key_str);
+    }
+    if (p_entry == 0)
+    {
+      /* Malformed, or not a control connection; an asker sees a miss */
+    }
+    else if (p_req_buf[0] == 'S')
+    {
+      unsigned int der_len = req_len - 2 - p_req_buf[1];
+      if (der_len > 0 && der_len <= VSFTP_SSL_SESSION_MAX)
+      {
+        vsf_sysutil_memcpy(p_entry->key, str_getbuf(&s_key_str),
+                           VSF_SSLCACHE_KEY_LEN);
+        p_entry->der_len = der_len;
+        vsf_sysutil_memcpy(p_entry->der, p_req_buf + 2 + p_req_buf[1],
+                           der_len);
+      }
+    }
+    else if (p_entry->der_len != 0 &&
+             !vsf_sysutil_memcmp(p_entry->key, str_getbuf(&s_key_str),
+                                 VSF_SSLCACHE_KEY_LEN))
+    {
+      if (p_req_buf[0] == 'G' && reply_fd != -1)
+      {
+        /* The session may have given up on us; no matter */
+        (void) vsf_sysutil_write_loop(reply_fd, p_entry->der,
+                                      p_entry->der_len);
+      }
+      else if (p_req_buf[0] == 'R')
+      {
+        vsf_sysutil_memclr(p_entry, sizeof(*p_entry));
+      }
+    }
+    vsf_sysutil_memclr(p_req_buf, req_len);
+    if (client_fd != -1)
+    {
+      vsf_sysutil_close_failok(client_fd);
+    }
+    if (reply_fd != -1)
+    {
+      vsf_sysutil_close_failok(reply_fd);
+    }
+  }
+}
+
+static unsigned int
+build_request(unsigned char* p_buf, char op, const unsigned char* p_id,
+              unsigned int id_len)
+{
+  if (id_len == 0 || id_len > VSF_SSLCACHE_ID_MAX)
+  {
+    return 0;
+  }
+  p_buf[0] = (unsigned char) op;
+  p_buf[1] = (unsigned char) id_len;
+  vsf_sysutil_memcpy(p_buf + 2, p_id, id_len);
+  return 2 + id_len;
+}
+
+static struct vsf_sslcache_entry*
+lookup_entry(const unsigned char* p_req, unsigned int req_len, int client_fd,
+             struct mystr* p_key_str)
+{
+  /* The salt, the address (with its length first) and the ID */
+  unsigned char key_buf[VSF_SSLCACHE_SALT_LEN + 1 + 16 + VSF_SSLCACHE_ID_MAX];
+  unsigned int key_len = VSF_SSLCACHE_SALT_LEN;
+  unsigned int id_len;
+  int addr_len;
+  unsigned int hash = 0;
+  unsigned int i;
+  if (req_len < 2)
+  {
+    return 0;
+  }
+  id_len = p_req[1];
+  if (id_len == 0 || id_len > VSF_SSLCACHE_ID_MAX || req_len < 2 + id_len)
+  {
+    return 0;
+  }
+  addr_len = get_client_addr(client_fd, key_buf + key_len + 1);
+  if (addr_len <= 0)
+  {
+    return 0;
+  }
+  /* The salt keeps anyone else from knowing which slot an entry lands in */
+  vsf_sysutil_memcpy(key_buf, s_salt, VSF_SSLCACHE_SALT_LEN);
+  key_buf[key_len] = (unsigned char) addr_len;
+  key_len += 1 + (unsigned int) addr_len;
+  vsf_sysutil_memcpy(key_buf + key_len, p_req + 2, id_len);
+  key_len += id_len;
+  vsf_checksum_buf(kVSFChecksumSHA256, key_buf, key_len, p_key_str);
+  vsf_sysutil_memclr(key_buf, sizeof(key_buf));
+  if (str_getlen(p_key_str) != VSF_SSLCACHE_KEY_LEN)
+  {
+    return 0;
+  }
+  for (i = 0; i < 8; ++i)
+  {
+    char c = str_get_char_at(p_key_str, i);
+    hash = (hash << 4) |
+           (unsigned int) (c >= 'a' ? c - 'a' + 10 : c - '0');
+  }
+  return &s_p_entries[hash % VSFTP_SSL_SESSION_CACHE_SIZE];
+}
+
+static int
+get_client_addr(int client_fd, unsigned char* p_addr)
+{
+  /* Anyone can connect a socket to wherever they like, but only the
+   * listener can accept connections on listen_port, so such a connection
+   * really is from the client at the other end
+   */
+  static struct vsf_sysutil_sockaddr* s_p_local_addr;
+  static struct vsf_sysutil_sockaddr* s_p_remote_addr;
+  int addr_len = 4;
+  if (vsf_sysutil_getpeername_failok(client_fd, &s_p_remote_addr) != 0)
+  {
+    return -1;
+  }
+  vsf_sysutil_getsockname(client_fd, &s_p_local_addr);
+  if (vsf_sysutil_sockaddr_get_port(s_p_local_addr) != tunable_listen_port)
+  {
+    return -1;
+  }
+  if (vsf_sysutil_sockaddr_is_ipv6(s_p_remote_addr))
+  {
+    addr_len = 16;
+  }
+  vsf_sysutil_memcpy(p_addr, vsf_sysutil_sockaddr_get_raw_addr(
+                               s_p_remote_addr), (unsigned int) addr_len);
+  return addr_len;
+}
+
+static int
+take_client_fd(int reply_fd)
+{
+  /* Never block on a session: the client connection is already queued on
+   * the reply socket, or the fetch is just a miss
+   */
+  char cmd;
+  int client_fd;
+  int retval;
+  vsf_sysutil_activate_noblock(reply_fd);
+  retval = vsf_sysutil_recv_msg(reply_fd, &cmd, 1, &client_fd);
+  if (retval != 1)
+  {
+    if (client_fd != -1)
+    {
+      vsf_sysutil_close_failok(client_fd);
+    }
+    return -1;
+  }
+  return client_fd;
+}
+
+static void
+init_salt(void)
+{
+  int retval = -1;
+  int fd = vsf_sysutil_open_file("/dev/urandom", kVSFSysUtilOpenReadOnly);
+  if (!vsf_sysutil_retval_is_error(fd))
+  {
+    retval = vsf_sysutil_read_loop(fd, s_salt, sizeof(s_salt));
+    vsf_sysutil_close(fd);
+  }
+  if (retval != (int) sizeof(s_salt))
+  {
+    unsigned int i;
+    for (i = 0; i < sizeof(s_salt); ++i)
+    {
+      s_salt[i] = (char) vsf_sysutil_get_random_byte();
+    }
+  }
+}
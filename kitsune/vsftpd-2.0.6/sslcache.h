@@ -0,0 +1,69 @@
+#ifndef VSF_SSLCACHE_H
+#define VSF_SSLCACHE_H
+
+/* vsf_sslcache_worker()
+ * PURPOSE
+ * Run the SSL session cache, as forked by the standalone listener when
+ * ssl_enable is set. The cached sessions, master secrets and all, live only
+ * in this process's memory. Each is filed under its session ID and the
+ * address of the client it was made for, as read by the worker from the
+ * session's own control connection. A session can only store, fetch or
+ * remove the sessions of the client it is serving.
+ * PARAMETERS
+ * sock         - the worker's end of the request socket
+ * RETURNS
+ * Never returns.
+ */
+void vsf_sslcache_worker(int sock);
+
+/* vsf_sslcache_attach()
+ * PURPOSE
+ * Tell a session where the SSL session cache is.
+ * PARAMETERS
+ * sock         - the sessions' end of the request socket
+ */
+void vsf_sslcache_attach(int sock);
+
+/* vsf_sslcache_store()
+ * PURPOSE
+ * Hand a DER encoded SSL session, made for this session's client, to the
+ * cache. It may push out another session. Without a cache to talk to, this
+ * does nothing.
+ * PARAMETERS
+ * p_id         - the session ID
+ * id_len       - its length
+ * p_der        - the encoded session
+ * der_len      - its length
+ */
+void vsf_sslcache_store(const unsigned char* p_id, unsigned int id_len,
+                        const unsigned char* p_der, unsigned int der_len);
+
+/* vsf_sslcache_fetch()
+ * PURPOSE
+ * Ask the cache for the DER encoded SSL session with a given ID, made for
+ * this session's client.
+ * PARAMETERS
+ * p_id         - the session ID
+ * id_len       - its length
+ * p_buf        - where to put the encoded session
+ * buf_len      - the size of p_buf
+ * RETURNS
+ * The length of the encoded session, or 0 if it is not cached or there is
+ * no cache to ask.
+ */
+unsigned int vsf_sslcache_fetch(const unsigned char* p_id,
+                                unsigned int id_len, unsigned char* p_buf,
+                                unsigned int buf_len);
+
+/* vsf_sslcache_remove()
+ * PURPOSE
+ * Drop the SSL session with a given ID, made for this session's client,
+ * from the cache, if it is there.
+ * PARAMETERS
+ * p_id         - the session ID
+ * id_len       - its length
+ */
+void vsf_sslcache_remove(const unsigned char* p_id, unsigned int id_len);
+
+#endif /* VSF_SSLCACHE_H */
+
@@ -18,17 +18,64 @@
 #include "hash.h"
 #include "str.h"
 #include "ipaddrparse.h"
+#include "sysstr.h"
+#include "stats.h"
+#include "pasvport.h"
+#include "connlimit.h"
+#include "dlheat.h"
+#include "lineidx.h"
+#include "authsvc.h"
+#include "syncsvc.h"
+#include "sslcache.h"
+#include "hashsvc.h"
 
 static unsigned int s_children;
 static struct hash* s_p_ip_count_hash;
 static struct hash* s_p_pid_ip_hash;
 static unsigned int s_ipaddr_size;
+static struct vsf_stats* s_p_stats;
+static int s_stats_sock = -1;
+static struct vsf_pasvport* s_p_pasvport;
+static struct vsf_connlimit* s_p_connlimit;
+static struct vsf_dlheat* s_p_dlheat;
+static int* s_p_shard_pids;
+static unsigned int s_shard;
+static unsigned int s_num_shards = 1;
+static long s_lists_checked_sec;
+static int s_auth_sock = -1;
+static int s_auth_worker_sock = -1;
+static int* s_p_auth_pids;
+static unsigned int s_num_auth_workers;
+static int s_sync_sock = -1;
+static int s_sync_worker_sock = -1;
+static int s_sync_pid;
+static int s_sslcache_sock = -1;
+static int s_sslcache_worker_sock = -1;
+static int s_sslcache_pid;
+static int s_hashsvc_sock = -1;
+static int s_hashsvc_worker_sock = -1;
+static int s_hashsvc_pid;
 
 static void handle_sigchld(int duff);
 static void handle_sighup(int duff);
 static void prepare_child(int sockfd);
 static unsigned int handle_ip_count(void* p_raw_addr);
 static void drop_ip_count(void* p_raw_addr);
+static void handle_stats_client(void);
+static int get_listen_sock(void);
+static int start_shards(int listen_sock);
+static int spawn_shard(unsigned int shard, int listen_sock);
+static int reap_shard_pid(int pid);
+static void load_list_files(void);
+static void start_auth_workers(int listen_sock);
+static void spawn_auth_workers(int listen_sock);
+static int reap_auth_pid(int pid);
+static void start_sync_worker(int listen_sock);
+static void spawn_sync_worker(int listen_sock);
+static void start_sslcache_worker(int listen_sock);
+static void spawn_sslcache_worker(int listen_sock);
+static void start_hashsvc_worker(int listen_sock);
+static void spawn_hashsvc_worker(int listen_sock);
 
 static unsigned int hash_ip(unsigned int buckets, void* p_key);
 static unsigned int hash_pid(unsigned int buckets, void* p_key);
@@ -38,7 +85,6 @@ vsf_standalone_main(void) E_NOTELOCALS
 {
   struct vsf_sysutil_sockaddr* p_accept_addr = 0;
   int listen_sock = -1;
-  int retval;
   s_ipaddr_size = vsf_sysutil_get_ipaddr_size();
   if (tunable_listen && tunable_listen_ipv6)
   {
@@ -58,15 +104,6 @@ vsf_standalone_main(void) E_NOTELOCALS
     vsf_sysutil_close_failok(2);
     vsf_sysutil_make_session_leader();
   }
-  if (tunable_listen)
-  {
-    listen_sock = vsf_sysutil_get_ipv4_sock();
-  }
-  else
-  {
-    listen_sock = vsf_sysutil_get_ipv6_sock();
-  }
-  vsf_sysutil_activate_reuseaddr(listen_sock);
 
   /* Kitsune */
   if (!kitsune_is_updating()) { 
@@ -89,63 +126,96 @@ vsf_standalone_main(void) E_NOTELOCALS
 	MIGRATE_STATIC(s_p_ip_count_hash); /* identity xform */
   hash_set_func(s_p_ip_count_hash, hash_ip);
 	MIGRATE_LOCAL(listen_sock); /* identity xform */
+	MIGRATE_STATIC(s_p_stats); /* identity xform */
+	MIGRATE_STATIC(s_stats_sock); /* identity xform */
+	MIGRATE_STATIC(s_p_pasvport); /* identity xform */
+	MIGRATE_STATIC(s_p_connlimit); /* identity xform */
+	MIGRATE_STATIC(s_p_dlheat); /* identity xform */
+	MIGRATE_STATIC(s_p_shard_pids); /* identity xform */
+	MIGRATE_STATIC(s_shard); /* identity xform */
+	MIGRATE_STATIC(s_num_shards); /* identity xform */
+	MIGRATE_STATIC(s_auth_sock); /* identity xform */
+	MIGRATE_STATIC(s_auth_worker_sock); /* identity xform */
+	MIGRATE_STATIC(s_p_auth_pids); /* identity xform */
+	MIGRATE_STATIC(s_num_auth_workers); /* identity xform */
+	MIGRATE_STATIC(s_sync_sock); /* identity xform */
+	MIGRATE_STATIC(s_sync_worker_sock); /* identity xform */
+	MIGRATE_STATIC(s_sync_pid); /* identity xform */
+	MIGRATE_STATIC(s_sslcache_sock); /* identity xform */
+	MIGRATE_STATIC(s_sslcache_worker_sock); /* identity xform */
+	MIGRATE_STATIC(s_sslcache_pid); /* identity xform */
+	MIGRATE_STATIC(s_hashsvc_sock); /* identity xform */
+	MIGRATE_STATIC(s_hashsvc_worker_sock); /* identity xform */
+	MIGRATE_STATIC(s_hashsvc_pid); /* identity xform */
 
   /* Kitsune: don't reinitialize if updating */
   if(!kitsune_is_updating()) {
     
-    if (tunable_listen)
+    listen_sock = get_listen_sock();
+    if (tunable_stats_socket || tunable_scoreboard_file)
     {
-      struct vsf_sysutil_sockaddr* p_sockaddr = 0;
-      vsf_sysutil_sockaddr_alloc_ipv4(&p_sockaddr);
-      vsf_sysutil_sockaddr_set_port(p_sockaddr, tunable_listen_port);
-      if (!tunable_listen_address)
+      unsigned int num_slots = tunable_max_clients;
+      if (num_slots == 0)
       {
-        vsf_sysutil_sockaddr_set_any(p_sockaddr);
-      }
-      else
-      {
-        if (!vsf_sysutil_inet_aton(tunable_listen_address, p_sockaddr))
-        {
-          die2("bad listen_address: ", tunable_listen_address);
-        }
-      }
-      retval = vsf_sysutil_bind(listen_sock, p_sockaddr);
-      vsf_sysutil_free(p_sockaddr);
-      if (vsf_sysutil_retval_is_error(retval))
-      {
-        die("could not bind listening IPv4 socket");
+        num_slots = VSFTP_DEFAULT_STATS_SLOTS;
       }
+      s_p_stats = vsf_stats_alloc(num_slots, tunable_scoreboard_file);
     }
-    else
+    if (tunable_stats_socket)
     {
-      struct vsf_sysutil_sockaddr* p_sockaddr = 0;
-      vsf_sysutil_sockaddr_alloc_ipv6(&p_sockaddr);
-      vsf_sysutil_sockaddr_set_port(p_sockaddr, tunable_listen_port);
-      if (!tunable_listen_address6)
-      {
-        vsf_sysutil_sockaddr_set_any(p_sockaddr);
-      }
-      else
-      {
-        struct mystr addr_str = INIT_MYSTR;
-        const unsigned char* p_raw_addr;
-        str_alloc_text(&addr_str, tunable_listen_address6);
-        p_raw_addr = vsf_sysutil_parse_ipv6(&addr_str);
-        str_free(&addr_str);
-        if (!p_raw_addr)
-        {
-          die2("bad listen_address6: ", tunable_listen_address6);
-        }
-        vsf_sysutil_sockaddr_set_ipv6addr(p_sockaddr, p_raw_addr);
-      }
-      retval = vsf_sysutil_bind(listen_sock, p_sockaddr);
-      vsf_sysutil_free(p_sockaddr);
-      if (vsf_sysutil_retval_is_error(retval))
-      {
-        die("could not bind listening IPv6 socket");
-      }
+      s_stats_sock = vsf_sysutil_get_unix_listen_sock(tunable_stats_socket,
+                                                      VSFTP_LISTEN_BACKLOG);
+      vsf_sysutil_activate_noblock(s_stats_sock);
+    }
+    if (tunable_pasv_enable)
+    {
+      unsigned short min_port;
+      unsigned short max_port;
+      vsf_pasvport_range(&min_port, &max_port);
+      s_p_pasvport = vsf_pasvport_alloc(min_port, max_port);
+    }
+    if (tunable_stream_download_size)
+    {
+      s_p_dlheat = vsf_dlheat_alloc();
+    }
+    /* Before the shards, so that their sessions can reach the workers too */
+    if (tunable_auth_workers && tunable_local_enable)
+    {
+      start_auth_workers(listen_sock);
+    }
+    if (tunable_upload_sync_enable)
+    {
+      start_sync_worker(listen_sock);
+    }
+    if (tunable_ssl_enable)
+    {
+      start_sslcache_worker(listen_sock);
+    }
+    if (tunable_checksum_cache_enable)
+    {
+      start_hashsvc_worker(listen_sock);
+    }
+    if (tunable_listen_shards > 1)
+    {
+      listen_sock = start_shards(listen_sock);
     }
-    vsf_sysutil_listen(listen_sock, VSFTP_LISTEN_BACKLOG);
+  }
+  /* Sessions inherit this cache when we fork them. Rebuilt after an update,
+   * as it is not carried over.
+   */
+  if (tunable_user_config_dir)
+  {
+    vsf_parseconf_cache_dir(tunable_user_config_dir);
+  }
+  load_list_files();
+  /* Listener side shard numbers are not carried over an update; say again */
+  if (s_p_stats)
+  {
+    vsf_stats_set_shard(s_shard, s_num_shards);
+  }
+  if (s_p_connlimit)
+  {
+    vsf_connlimit_set_shard(s_p_connlimit, s_shard);
   }
   
   /* Kitsune: memleak */
@@ -157,12 +227,51 @@ vsf_standalone_main(void) E_NOTELOCALS
     void* p_raw_addr;
     int new_child;
     int new_client_sock;    
+    int stats_slot = -1;
+    long now_sec;
+    unsigned int i;
     
     /* Kitsune update point */
     kitsune_update("standalone.c"); 
 
+    /* Replace any authentication workers which have died or been told to
+     * restart
+     */
+    if (s_p_auth_pids)
+    {
+      spawn_auth_workers(listen_sock);
+    }
+    if (s_sync_worker_sock != -1 && s_sync_pid == 0)
+    {
+      spawn_sync_worker(listen_sock);
+    }
+    if (s_sslcache_worker_sock != -1 && s_sslcache_pid == 0)
+    {
+      spawn_sslcache_worker(listen_sock);
+    }
+    if (s_hashsvc_worker_sock != -1 && s_hashsvc_pid == 0)
+    {
+      spawn_hashsvc_worker(listen_sock);
+    }
+    for (i = 1; s_p_shard_pids && i < s_num_shards && s_shard == 0; ++i)
+    {
+      if (s_p_shard_pids[i] == 0)
+      {
+        listen_sock = spawn_shard(i, listen_sock);
+      }
+    }
+
     vsf_sysutil_unblock_sig(kVSFSysUtilSigCHLD);
     vsf_sysutil_unblock_sig(kVSFSysUtilSigHUP);
+    if (s_stats_sock != -1 &&
+        vsf_sysutil_wait_readable(listen_sock, s_stats_sock) != listen_sock)
+    {
+      /* Either a stats request, or a signal interrupted us */
+      vsf_sysutil_block_sig(kVSFSysUtilSigCHLD);
+      vsf_sysutil_block_sig(kVSFSysUtilSigHUP);
+      handle_stats_client();
+      continue;
+    }
     new_client_sock = vsf_sysutil_accept_timeout(
         listen_sock, p_accept_addr, 0);
     vsf_sysutil_block_sig(kVSFSysUtilSigCHLD);
@@ -171,19 +280,47 @@ vsf_standalone_main(void) E_NOTELOCALS
     {
       continue;
     }
+    /* Pick up list file edits, at most once a second, so that sessions
+     * don't each find the inherited index stale and rebuild it.
+     */
+    vsf_sysutil_update_cached_time();
+    now_sec = vsf_sysutil_get_cached_time_sec();
+    if (now_sec != s_lists_checked_sec)
+    {
+      s_lists_checked_sec = now_sec;
+      load_list_files();
+    }
     ++s_children;
     child_info.num_children = s_children;
     child_info.num_this_ip = 0;
+    child_info.sock_opts_inherited = 1;
     p_raw_addr = vsf_sysutil_sockaddr_get_raw_addr(p_accept_addr);
     child_info.num_this_ip = handle_ip_count(p_raw_addr);
+    if (s_p_connlimit)
+    {
+      /* Counted after handle_ip_count(), so it includes this session */
+      child_info.num_children = vsf_connlimit_get_sessions(s_p_connlimit);
+    }
+    if (s_p_stats)
+    {
+      stats_slot = vsf_stats_claim_slot(s_p_stats);
+    }
     new_child = vsf_sysutil_fork_failok();
     if (new_child != 0)
     {
       /* Parent context */
       vsf_sysutil_close(new_client_sock);
+      if (s_p_stats)
+      {
+        vsf_stats_set_slot_pid(s_p_stats, stats_slot, new_child);
+      }
       if (new_child > 0)
       {
         hash_add_entry(s_p_pid_ip_hash, (void*)&new_child, p_raw_addr);
+        if (s_p_connlimit)
+        {
+          vsf_connlimit_add_pid(s_p_connlimit, new_child);
+        }
       }
       else
       {
@@ -197,6 +334,51 @@ vsf_standalone_main(void) E_NOTELOCALS
     {
       /* Child context */
       vsf_sysutil_close(listen_sock);
+      if (s_stats_sock != -1)
+      {
+        vsf_sysutil_close(s_stats_sock);
+      }
+      if (s_auth_sock != -1)
+      {
+        if (s_auth_worker_sock != -1)
+        {
+          vsf_sysutil_close(s_auth_worker_sock);
+        }
+        vsf_authsvc_attach(s_auth_sock);
+      }
+      if (s_sync_sock != -1)
+      {
+        if (s_sync_worker_sock != -1)
+        {
+          vsf_sysutil_close(s_sync_worker_sock);
+        }
+        vsf_syncsvc_attach(s_sync_sock);
+      }
+      if (s_sslcache_sock != -1)
+      {
+        /* Never the worker's end: whoever holds that sees every session */
+        if (s_sslcache_worker_sock != -1)
+        {
+          vsf_sysutil_close(s_sslcache_worker_sock);
+        }
+        vsf_sslcache_attach(s_sslcache_sock);
+      }
+      if (s_hashsvc_sock != -1)
+      {
+        if (s_hashsvc_worker_sock != -1)
+        {
+          vsf_sysutil_close(s_hashsvc_worker_sock);
+        }
+        vsf_hashsvc_attach(s_hashsvc_sock);
+      }
+      if (s_p_connlimit)
+      {
+        vsf_connlimit_detach(s_p_connlimit);
+        s_p_connlimit = 0;
+      }
+      vsf_stats_attach(s_p_stats, stats_slot);
+      vsf_pasvport_attach(s_p_pasvport);
+      vsf_dlheat_attach(s_p_dlheat);
       prepare_child(new_client_sock);
       /* By returning here we "launch" the child process with the same
        * contract as xinetd would provide.
@@ -219,12 +401,473 @@ prepare_child(int new_client_sock)
   }
 }
 
+static int
+get_listen_sock(void)
+{
+  int sockfd;
+  int retval;
+  if (tunable_listen)
+  {
+    sockfd = vsf_sysutil_get_ipv4_sock();
+  }
+  else
+  {
+    sockfd = vsf_sysutil_get_ipv6_sock();
+  }
+  vsf_sysutil_activate_reuseaddr(sockfd);
+  if (tunable_listen_shards > 1)
+  {
+    vsf_sysutil_activate_reuseport(sockfd);
+  }
+  /* Accepted sockets inherit these, which saves each new session setting
+   * them itself (see vsf_cmdio_sock_setup())
+   */
+  vsf_sysutil_activate_keepalive(sockfd);
+  vsf_sysutil_set_nodelay(sockfd);
+  vsf_sysutil_activate_oobinline(sockfd);
+  if (tunable_tcp_fastopen)
+  {
+    vsf_sysutil_set_fastopen(sockfd, tunable_tcp_fastopen);
+  }
+  if (tunable_listen)
+  {
+    struct vsf_sysutil_sockaddr* p_sockaddr = 0;
+    vsf_sysutil_sockaddr_alloc_ipv4(&p_sockaddr);
+    vsf_sysutil_sockaddr_set_port(p_sockaddr, tunable_listen_port);
+    if (!tunable_listen_address)
+    {
+      vsf_sysutil_sockaddr_set_any(p_sockaddr);
+    }
+    else
+    {
+      if (!vsf_sysutil_inet_aton(tunable_listen_address, p_sockaddr))
+      {
+        die2("bad listen_address: ", tunable_listen_address);
+      }
+    }
+    retval = vsf_sysutil_bind(sockfd, p_sockaddr);
+    vsf_sysutil_free(p_sockaddr);
+    if (vsf_sysutil_retval_is_error(retval))
+    {
+      die("could not bind listening IPv4 socket");
+    }
+  }
+  else
+  {
+    struct vsf_sysutil_sockaddr* p_sockaddr = 0;
+    vsf_sysutil_sockaddr_alloc_ipv6(&p_sockaddr);
+    vsf_sysutil_sockaddr_set_port(p_sockaddr, tunable_listen_port);
+    if (!tunable_listen_address6)
+    {
+      vsf_sysutil_sockaddr_set_any(p_sockaddr);
+    }
+    else
+    {
+      struct mystr addr_str = INIT_MYSTR;
+      const unsigned char* p_raw_addr;
+      str_alloc_text(&addr_str, tunable_listen_address6);
+      p_raw_addr = vsf_sysutil_parse_ipv6(&addr_str);
+      str_free(&addr_str);
+      if (!p_raw_addr)
+      {
+        die2("bad listen_address6: ", tunable_listen_address6);
+      }
+      vsf_sysutil_sockaddr_set_ipv6addr(p_sockaddr, p_raw_addr);
+    }
+    retval = vsf_sysutil_bind(sockfd, p_sockaddr);
+    vsf_sysutil_free(p_sockaddr);
+    if (vsf_sysutil_retval_is_error(retval))
+    {
+      die("could not bind listening IPv6 socket");
+    }
+  }
+  vsf_sysutil_listen(sockfd, VSFTP_LISTEN_BACKLOG);
+  return sockfd;
+}
+
+static int
+start_shards(int listen_sock)
+{
+  unsigned int max_addrs = tunable_max_clients;
+  unsigned int i;
+  if (max_addrs == 0)
+  {
+    max_addrs = VSFTP_DEFAULT_STATS_SLOTS;
+  }
+  s_num_shards = tunable_listen_shards;
+  s_p_connlimit = vsf_connlimit_alloc(s_num_shards, s_ipaddr_size, max_addrs);
+  s_p_shard_pids = vsf_sysutil_malloc(s_num_shards * sizeof(int));
+  vsf_sysutil_memclr(s_p_shard_pids, s_num_shards * sizeof(int));
+  vsf_sysutil_set_cpu_affinity(0);
+  /* We are shard 0. Every other shard gets its own socket bound to the same
+   * port, and the kernel spreads new connections between them.
+   */
+  for (i = 1; i < s_num_shards && s_shard == 0; ++i)
+  {
+    listen_sock = spawn_shard(i, listen_sock);
+  }
+  return listen_sock;
+}
+
+static int
+spawn_shard(unsigned int shard, int listen_sock)
+{
+  /* On failure, try again next time round */
+  int retval = vsf_sysutil_fork_failok();
+  if (retval != 0)
+  {
+    if (retval > 0)
+    {
+      s_p_shard_pids[shard] = retval;
+    }
+    return listen_sock;
+  }
+  vsf_sysutil_exit_with_parent();
+  vsf_sysutil_free(s_p_shard_pids);
+  s_p_shard_pids = 0;
+  vsf_sysutil_close(listen_sock);
+  /* Shard 0 alone answers stats requests */
+  if (s_stats_sock != -1)
+  {
+    vsf_sysutil_close(s_stats_sock);
+    s_stats_sock = -1;
+  }
+  /* The workers are children of shard 0; only it manages them */
+  if (s_p_auth_pids)
+  {
+    vsf_sysutil_close(s_auth_worker_sock);
+    s_auth_worker_sock = -1;
+    vsf_sysutil_free(s_p_auth_pids);
+    s_p_auth_pids = 0;
+  }
+  if (s_sync_worker_sock != -1)
+  {
+    vsf_sysutil_close(s_sync_worker_sock);
+    s_sync_worker_sock = -1;
+    s_sync_pid = 0;
+  }
+  if (s_sslcache_worker_sock != -1)
+  {
+    vsf_sysutil_close(s_sslcache_worker_sock);
+    s_sslcache_worker_sock = -1;
+    s_sslcache_pid = 0;
+  }
+  if (s_hashsvc_worker_sock != -1)
+  {
+    vsf_sysutil_close(s_hashsvc_worker_sock);
+    s_hashsvc_worker_sock = -1;
+    s_hashsvc_pid = 0;
+  }
+  /* A replacement shard is forked from a running shard 0, whose sessions
+   * are none of our business.
+   */
+  s_children = 0;
+  s_p_pid_ip_hash = hash_alloc(256, sizeof(int), s_ipaddr_size, hash_pid);
+  s_shard = shard;
+  if (s_p_stats)
+  {
+    vsf_stats_set_shard(s_shard, s_num_shards);
+  }
+  vsf_connlimit_set_shard(s_p_connlimit, s_shard);
+  vsf_sysutil_set_cpu_affinity(s_shard % vsf_sysutil_get_num_cpus());
+  return get_listen_sock();
+}
+
+static int
+reap_shard_pid(int pid)
+{
+  unsigned int i;
+  if (!s_p_shard_pids)
+  {
+    return 0;
+  }
+  for (i = 1; i < s_num_shards; ++i)
+  {
+    if (s_p_shard_pids[i] == pid)
+    {
+      int session_pid;
+      /* It only exits if it died. Nobody else can account for its sessions
+       * so they go too, and a new shard is started at the top of the accept
+       * loop.
+       */
+      s_p_shard_pids[i] = 0;
+      while ((session_pid = vsf_connlimit_take_pid(s_p_connlimit, i)) != 0)
+      {
+        vsf_sysutil_send_sig(session_pid, kVSFSysUtilSigTERM);
+        if (s_p_pasvport)
+        {
+          vsf_pasvport_release_pid(s_p_pasvport, session_pid);
+        }
+      }
+      vsf_connlimit_clear_shard(s_p_connlimit, i);
+      if (s_p_stats)
+      {
+        vsf_stats_release_shard(s_p_stats, i);
+      }
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void
+start_auth_workers(int listen_sock)
+{
+  struct vsf_sysutil_socketpair_retval sockets =
+    vsf_sysutil_unix_dgram_socketpair();
+  s_auth_sock = sockets.socket_one;
+  s_auth_worker_sock = sockets.socket_two;
+  s_num_auth_workers = tunable_auth_workers;
+  s_p_auth_pids = vsf_sysutil_malloc(s_num_auth_workers * sizeof(int));
+  vsf_sysutil_memclr(s_p_auth_pids, s_num_auth_workers * sizeof(int));
+  spawn_auth_workers(listen_sock);
+}
+
+static void
+spawn_auth_workers(int listen_sock)
+{
+  unsigned int i;
+  for (i = 0; i < s_num_auth_workers; ++i)
+  {
+    int retval;
+    if (s_p_auth_pids[i] != 0)
+    {
+      continue;
+    }
+    /* On failure, try again next time round */
+    retval = vsf_sysutil_fork_failok();
+    if (retval == 0)
+    {
+      vsf_sysutil_close(listen_sock);
+      if (s_stats_sock != -1)
+      {
+        vsf_sysutil_close(s_stats_sock);
+      }
+      if (s_sync_worker_sock != -1)
+      {
+        vsf_sysutil_close(s_sync_sock);
+        vsf_sysutil_close(s_sync_worker_sock);
+      }
+      if (s_sslcache_worker_sock != -1)
+      {
+        vsf_sysutil_close(s_sslcache_sock);
+        vsf_sysutil_close(s_sslcache_worker_sock);
+      }
+      if (s_hashsvc_worker_sock != -1)
+      {
+        vsf_sysutil_close(s_hashsvc_sock);
+        vsf_sysutil_close(s_hashsvc_worker_sock);
+      }
+      vsf_sysutil_close(s_auth_sock);
+      vsf_authsvc_worker(s_auth_worker_sock);
+      /* NOTREACHED */
+    }
+    if (retval > 0)
+    {
+      s_p_auth_pids[i] = retval;
+    }
+  }
+}
+
+static int
+reap_auth_pid(int pid)
+{
+  unsigned int i;
+  if (!s_p_auth_pids)
+  {
+    return 0;
+  }
+  for (i = 0; i < s_num_auth_workers; ++i)
+  {
+    if (s_p_auth_pids[i] == pid)
+    {
+      /* Replaced at the top of the accept loop */
+      s_p_auth_pids[i] = 0;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void
+start_sync_worker(int listen_sock)
+{
+  struct vsf_sysutil_socketpair_retval sockets =
+    vsf_sysutil_unix_dgram_socketpair();
+  s_sync_sock = sockets.socket_one;
+  s_sync_worker_sock = sockets.socket_two;
+  spawn_sync_worker(listen_sock);
+}
+
+static void
+spawn_sync_worker(int listen_sock)
+{
+  /* On failure, try again next time round; sessions flush for themselves
+   * meanwhile
+   */
+  int retval = vsf_sysutil_fork_failok();
+  if (retval == 0)
+  {
+    vsf_sysutil_close(listen_sock);
+    if (s_stats_sock != -1)
+    {
+      vsf_sysutil_close(s_stats_sock);
+    }
+    if (s_auth_sock != -1)
+    {
+      vsf_sysutil_close(s_auth_sock);
+      vsf_sysutil_close(s_auth_worker_sock);
+    }
+    if (s_sslcache_worker_sock != -1)
+    {
+      vsf_sysutil_close(s_sslcache_sock);
+      vsf_sysutil_close(s_sslcache_worker_sock);
+    }
+    if (s_hashsvc_worker_sock != -1)
+    {
+      vsf_sysutil_close(s_hashsvc_sock);
+      vsf_sysutil_close(s_hashsvc_worker_sock);
+    }
+    vsf_sysutil_close(s_sync_sock);
+    vsf_syncsvc_worker(s_sync_worker_sock);
+    /* NOTREACHED */
+  }
+  if (retval > 0)
+  {
+    s_sync_pid = retval;
+  }
+}
+
+static void
+start_sslcache_worker(int listen_sock)
+{
+  struct vsf_sysutil_socketpair_retval sockets =
+    vsf_sysutil_unix_dgram_socketpair();
+  s_sslcache_sock = sockets.socket_one;
+  s_sslcache_worker_sock = sockets.socket_two;
+  spawn_sslcache_worker(listen_sock);
+}
+
+static void
+spawn_sslcache_worker(int listen_sock)
+{
+  /* On failure, try again next time round; sessions just miss meanwhile */
+  int retval = vsf_sysutil_fork_failok();
+  if (retval == 0)
+  {
+    vsf_sysutil_close(listen_sock);
+    if (s_stats_sock != -1)
+    {
+      vsf_sysutil_close(s_stats_sock);
+    }
+    if (s_auth_sock != -1)
+    {
+      vsf_sysutil_close(s_auth_sock);
+      vsf_sysutil_close(s_auth_worker_sock);
+    }
+    if (s_sync_worker_sock != -1)
+    {
+      vsf_sysutil_close(s_sync_sock);
+      vsf_sysutil_close(s_sync_worker_sock);
+    }
+    if (s_hashsvc_worker_sock != -1)
+    {
+      vsf_sysutil_close(s_hashsvc_sock);
+      vsf_sysutil_close(s_hashsvc_worker_sock);
+    }
+    vsf_sysutil_close(s_sslcache_sock);
+    vsf_sslcache_worker(s_sslcache_worker_sock);
+    /* NOTREACHED */
+  }
+  if (retval > 0)
+  {
+    s_sslcache_pid = retval;
+  }
+}
+
+static void
+start_hashsvc_worker(int listen_sock)
+{
+  struct vsf_sysutil_socketpair_retval sockets =
+    vsf_sysutil_unix_dgram_socketpair();
+  s_hashsvc_sock = sockets.socket_one;
+  s_hashsvc_worker_sock = sockets.socket_two;
+  spawn_hashsvc_worker(listen_sock);
+}
+
+static void
+spawn_hashsvc_worker(int listen_sock)
+{
+  /* On failure, try again next time round; sessions checksum for
+   * themselves meanwhile
+   */
+  int retval = vsf_sysutil_fork_failok();
+  if (retval == 0)
+  {
+    vsf_sysutil_close(listen_sock);
+    if (s_stats_sock != -1)
+    {
+      vsf_sysutil_close(s_stats_sock);
+    }
+    if (s_auth_sock != -1)
+    {
+      vsf_sysutil_close(s_auth_sock);
+      vsf_sysutil_close(s_auth_worker_sock);
+    }
+    if (s_sync_worker_sock != -1)
+    {
+      vsf_sysutil_close(s_sync_sock);
+      vsf_sysutil_close(s_sync_worker_sock);
+    }
+    if (s_sslcache_worker_sock != -1)
+    {
+      vsf_sysutil_close(s_sslcache_sock);
+      vsf_sysutil_close(s_sslcache_worker_sock);
+    }
+    vsf_sysutil_close(s_hashsvc_sock);
+    vsf_hashsvc_worker(s_hashsvc_worker_sock);
+    /* NOTREACHED */
+  }
+  if (retval > 0)
+  {
+    s_hashsvc_pid = retval;
+  }
+}
+
+static void
+handle_stats_client(void)
+{
+  static struct mystr s_dump_str;
+  int client_fd = vsf_sysutil_accept_unix(s_stats_sock);
+  if (vsf_sysutil_retval_is_error(client_fd))
+  {
+    /* Spurious wakeup, or just a signal */
+    return;
+  }
+  vsf_stats_dump(s_p_stats, &s_dump_str);
+  if (s_p_pasvport)
+  {
+    vsf_pasvport_dump(s_p_pasvport, &s_dump_str);
+  }
+  /* Never let a stuck reader block the listener; the dump fits in the
+   * socket buffer, so a single non-blocking write is enough.
+   */
+  vsf_sysutil_activate_noblock(client_fd);
+  (void) str_write_loop(&s_dump_str, client_fd);
+  vsf_sysutil_close(client_fd);
+}
+
 static void
 drop_ip_count(void* p_raw_addr)
 {
   unsigned int count;
-  unsigned int* p_count =
-    (unsigned int*)hash_lookup_entry(s_p_ip_count_hash, p_raw_addr);
+  unsigned int* p_count;
+  if (s_p_connlimit)
+  {
+    vsf_connlimit_drop(s_p_connlimit, p_raw_addr);
+    return;
+  }
+  p_count = (unsigned int*)hash_lookup_entry(s_p_ip_count_hash, p_raw_addr);
   if (!p_count)
   {
     bug("IP address missing from hash");
@@ -242,6 +885,25 @@ drop_ip_count(void* p_raw_addr)
   }
 }
 
+static void
+load_list_files(void)
+{
+  /* Failures are for the session to report */
+  if (tunable_local_enable && tunable_userlist_enable &&
+      tunable_userlist_file)
+  {
+    (void) vsf_lineidx_load_file(tunable_userlist_file);
+  }
+  if (tunable_deny_email_enable && tunable_banned_email_file)
+  {
+    (void) vsf_lineidx_load_file(tunable_banned_email_file);
+  }
+  if (tunable_secure_email_list_enable && tunable_email_password_file)
+  {
+    (void) vsf_lineidx_load_file(tunable_email_password_file);
+  }
+}
+
 static void
 handle_sigchld(int duff)
 {
@@ -250,11 +912,47 @@ handle_sigchld(int duff)
   while (reap_one)
   {
     reap_one = (unsigned int)vsf_sysutil_wait_reap_one();
+    if (reap_one && reap_shard_pid((int) reap_one))
+    {
+      continue;
+    }
+    if (reap_one && reap_auth_pid((int) reap_one))
+    {
+      continue;
+    }
+    if (reap_one && s_sync_pid != 0 && (int) reap_one == s_sync_pid)
+    {
+      /* Replaced at the top of the accept loop */
+      s_sync_pid = 0;
+      continue;
+    }
+    if (reap_one && s_sslcache_pid != 0 && (int) reap_one == s_sslcache_pid)
+    {
+      s_sslcache_pid = 0;
+      continue;
+    }
+    if (reap_one && s_hashsvc_pid != 0 && (int) reap_one == s_hashsvc_pid)
+    {
+      s_hashsvc_pid = 0;
+      continue;
+    }
     if (reap_one)
     {
       struct vsf_sysutil_ipaddr* p_ip;
       /* Account total number of instances */
       --s_children;
+      if (s_p_stats)
+      {
+        vsf_stats_release_pid(s_p_stats, (int) reap_one);
+      }
+      if (s_p_pasvport)
+      {
+        vsf_pasvport_release_pid(s_p_pasvport, (int) reap_one);
+      }
+      if (s_p_connlimit)
+      {
+        vsf_connlimit_drop_pid(s_p_connlimit, (int) reap_one);
+      }
       /* Account per-IP limit */
       p_ip = (struct vsf_sysutil_ipaddr*)
         hash_lookup_entry(s_p_pid_ip_hash, (void*)&reap_one);
@@ -270,9 +968,33 @@ handle_sigchld(int duff)
 static void
 handle_sighup(int duff)
 {
+  unsigned int i;
   (void) duff;
   /* We don't crash the out the listener if an invalid config was added */
   vsf_parseconf_load_file(0, 0);
+  if (tunable_user_config_dir)
+  {
+    vsf_parseconf_cache_dir(tunable_user_config_dir);
+  }
+  load_list_files();
+  /* Pass it on, so all the shards agree on the config */
+  for (i = 1; s_p_shard_pids && i < s_num_shards; ++i)
+  {
+    if (s_p_shard_pids[i] != 0)
+    {
+      vsf_sysutil_send_sig(s_p_shard_pids[i], kVSFSysUtilSigHUP);
+    }
+  }
+  /* Restart the authentication workers, so they pick up the new config and
+   * forget any cached logins
+   */
+  for (i = 0; s_p_auth_pids && i < s_num_auth_workers; ++i)
+  {
+    if (s_p_auth_pids[i] != 0)
+    {
+      vsf_sysutil_send_sig(s_p_auth_pids[i], kVSFSysUtilSigTERM);
+    }
+  }
 }
 
 static unsigned int
@@ -304,9 +1026,13 @@ hash_pid(unsigned int buckets, void* p_key)
 static unsigned int
 handle_ip_count(void* p_ipaddr)
 {
-  unsigned int* p_count =
-    (unsigned int*)hash_lookup_entry(s_p_ip_count_hash, p_ipaddr);
+  unsigned int* p_count;
   unsigned int count;
+  if (s_p_connlimit)
+  {
+    return vsf_connlimit_add(s_p_connlimit, p_ipaddr);
+  }
+  p_count = (unsigned int*)hash_lookup_entry(s_p_ip_count_hash, p_ipaddr);
   if (!p_count)
   {
     count = 1;
@@ -5,6 +5,8 @@ struct vsf_client_launch
 {
   unsigned int num_children;
   unsigned int num_this_ip;
+  /* The control socket already has the options vsf_cmdio_sock_setup() sets */
+  int sock_opts_inherited;
 };
 
 /* vsf_standalone_main()
@@ -0,0 +1,895 @@
+/*
+ * Part of Very Secure FTPd
+ * Licence: GPL v2
+ * Author: Chris Evans
+ * stats.c
+ *
+ * Per-command latency histograms and transfer counters, kept in memory
+ * shared between the standalone listener and its sessions. Every session
+ * writes only to its own slot, and the listener sums the slots up when
+ * asked, so there is no locking anywhere. A reader may catch a slot half
+ * way through an update; for monitoring purposes we don't care.
+ *
+ * Sessions can write anywhere in the segment, though, so the listener never
+ * takes anything from it which decides where it reads or writes: the number
+ * of slots and which process owns which slot are kept in the listener's own
+ * memory.
+ *
+ * Each slot also holds a scoreboard entry with the live state of its
+ * session. If the segment is backed by a file, "vsftpd --status" reads it.
+ */
+
+#include "stats.h"
+#include "str.h"
+#include "sysutil.h"
+#include "sysdeputil.h"
+#include "utility.h"
+#include "sysstr.h"
+#include "defs.h"
+
+/* Commands we keep separate histograms for. Anything else is "other". */
+static const char* s_cmd_names[] =
+{
+  "USER", "PASS", "CWD", "CDUP", "PWD", "LIST", "NLST", "RETR", "STOR",
+  "APPE", "STOU", "DELE", "RNFR", "RNTO", "MKD", "RMD", "SIZE", "MDTM",
+  "PASV", "EPSV", "PORT", "EPRT", "TYPE", "MODE", "REST", "FEAT", "OPTS",
+  "SITE", "STAT", "HASH", "NOOP"
+};
+#define VSF_STATS_NUM_CMDS \
+  (sizeof(s_cmd_names) / sizeof(s_cmd_names[0]) + 1)
+#define VSF_STATS_CMD_OTHER (VSF_STATS_NUM_CMDS - 1)
+
+/* Histogram bucket upper bounds, in microseconds, with a final +Inf bucket */
+static const long s_bucket_usec[] =
+{
+  1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000, 30000000
+};
+static const char* s_bucket_names[] =
+{
+  "0.001", "0.005", "0.01", "0.05", "0.1", "0.5", "1", "5", "30", "+Inf"
+};
+#define VSF_STATS_NUM_BUCKETS \
+  (sizeof(s_bucket_usec) / sizeof(s_bucket_usec[0]) + 1)
+
+struct vsf_stats_cmd
+{
+  unsigned long count;
+  filesize_t usec_sum;
+  unsigned long buckets[VSF_STATS_NUM_BUCKETS];
+};
+
+struct vsf_stats_xfer
+{
+  unsigned long num_ok;
+  unsigned long num_failed;
+  filesize_t bytes;
+  filesize_t usec;
+};
+
+enum EVSFStatsState
+{
+  kVSFStatsStateStarting = 0,
+  kVSFStatsStateLogin,
+  kVSFStatsStateIdle,
+  kVSFStatsStateBusy
+};
+static const char* s_state_names[] =
+{
+  "starting", "login", "idle", "busy"
+};
+
+#define VSF_STATS_IP_LEN        48
+#define VSF_STATS_USER_LEN      (VSFTP_USERNAME_MAX + 1)
+#define VSF_STATS_CMDLINE_LEN   64
+
+struct vsf_stats_slot
+{
+  /* For the scoreboard only: a copy of the owner, written by the listener */
+  int owner_pid;
+  struct vsf_stats_cmd cmds[VSF_STATS_NUM_CMDS];
+  /* Indexed by is_upload */
+  struct vsf_stats_xfer xfers[2];
+  /* Passive ports: allocations indexed by from_map, then bind collisions
+   * and PASV commands which found no port at all
+   */
+  unsigned long pasv_allocs[2];
+  unsigned long pasv_collisions;
+  unsigned long pasv_failures;
+  /* Downloads sent straight from the page cache, indexed by is_stream: how
+   * many, how much they read through the cache, and how much of that they
+   * released again once sent
+   */
+  unsigned long cache_xfers[2];
+  filesize_t cache_bytes[2];
+  filesize_t cache_released[2];
+  /* Data connections whose socket buffers we sized, the sum of the sizes
+   * and of the round trip times they were sized for
+   */
+  unsigned long sockbuf_tuned;
+  filesize_t sockbuf_bytes;
+  filesize_t sockbuf_rtt_usec;
+  /* Scoreboard; reset by the listener on claim, then written by the owner */
+  int state;
+  long start_sec;
+  long cmd_start_sec;
+  filesize_t data_bytes;
+  unsigned int data_rtt_usec;
+  unsigned int data_sockbuf;
+  char remote_ip[VSF_STATS_IP_LEN];
+  char user[VSF_STATS_USER_LEN];
+  char cmdline[VSF_STATS_CMDLINE_LEN];
+};
+
+/* Bump the version whenever the layout changes, so that --status from a
+ * different build refuses to misread a scoreboard file.
+ */
+#define VSF_STATS_MAGIC         0x76736235
+
+struct vsf_stats_segment
+{
+  unsigned int magic;
+  unsigned int slot_size;
+  unsigned int num_slots;
+  struct vsf_stats_slot slots[1];
+};
+
+/* The listener's handle, in its own memory. Sessions get a copy at fork. */
+struct vsf_stats
+{
+  struct vsf_stats_segment* p_segment;
+  unsigned int num_slots;
+  /* 0 is free, -1 is claimed but not forked */
+  int* p_owner_pids;
+};
+
+/* Listener side state. With several listener shards, each claims only the
+ * slots congruent to its shard number, so that no two shards race for one.
+ */
+static unsigned int s_shard;
+static unsigned int s_num_shards = 1;
+static unsigned int s_next_slot;
+
+/* Session side state */
+static struct vsf_stats_slot* s_p_slot;
+static int s_cmd_index = -1;
+static int s_rest_state = kVSFStatsStateLogin;
+static long s_cmd_start_sec;
+static long s_cmd_start_usec;
+
+static void append_seconds(struct mystr* p_str, filesize_t usec);
+static void append_xfer_labels(struct mystr* p_str, const char* p_metric,
+                               int is_upload, const char* p_extra);
+static void append_cache_labels(struct mystr* p_str, const char* p_metric,
+                                int is_stream);
+static void append_padded(struct mystr* p_str, const char* p_text,
+                          unsigned int width);
+static void append_slot_text(struct mystr* p_str, const char* p_text,
+                             unsigned int width);
+static void set_slot_text(char* p_dest, unsigned int size,
+                          const struct mystr* p_str1,
+                          const struct mystr* p_str2);
+
+struct vsf_stats*
+vsf_stats_alloc(unsigned int num_slots, const char* p_filename)
+{
+  struct vsf_stats* p_stats;
+  struct vsf_stats_segment* p_segment;
+  unsigned int size;
+  if (num_slots == 0)
+  {
+    bug("zero num_slots in vsf_stats_alloc");
+  }
+  size = sizeof(struct vsf_stats_segment) +
+         (num_slots - 1) * sizeof(struct vsf_stats_slot);
+  /* Either way, the pages come zero filled, so every slot starts with zero
+   * counters
+   */
+  if (p_filename)
+  {
+    /* -rw-------, it shows who is logged in from where */
+    p_segment = vsf_sysutil_map_new_shared_file(p_filename, size, 0600);
+  }
+  else
+  {
+    p_segment = vsf_sysutil_map_shared_pages(size);
+  }
+  p_segment->slot_size = sizeof(struct vsf_stats_slot);
+  p_segment->num_slots = num_slots;
+  p_segment->magic = VSF_STATS_MAGIC;
+  p_stats = vsf_sysutil_malloc(sizeof(*p_stats));
+  p_stats->p_segment = p_segment;
+  p_stats->num_slots = num_slots;
+  p_stats->p_owner_pids = vsf_sysutil_malloc(num_slots * sizeof(int));
+  vsf_sysutil_memclr(p_stats->p_owner_pids, num_slots * sizeof(int));
+  return p_stats;
+}
+
+int
+vsf_stats_claim_slot(struct vsf_stats* p_stats)
+{
+  unsigned int i;
+  for (i = 0; i < p_stats->num_slots; ++i)
+  {
+    unsigned int slot = (s_next_slot + i) % p_stats->num_slots;
+    struct vsf_stats_slot* p_slot = &p_stats->p_segment->slots[slot];
+    if (slot % s_num_shards != s_shard)
+    {
+      continue;
+    }
+    if (p_stats->p_owner_pids[slot] == 0)
+    {
+      /* Clear out the scoreboard entry of the previous owner */
+      p_slot->state = kVSFStatsStateStarting;
+      p_slot->data_bytes = 0;
+      p_slot->data_rtt_usec = 0;
+      p_slot->data_sockbuf = 0;
+      p_slot->remote_ip[0] = '\0';
+      p_slot->user[0] = '\0';
+      p_slot->cmdline[0] = '\0';
+      p_slot->owner_pid = 0;
+      p_stats->p_owner_pids[slot] = -1;
+      s_next_slot = (slot + 1) % p_stats->num_slots;
+      return (int) slot;
+    }
+  }
+  return -1;
+}
+
+void
+vsf_stats_set_shard(unsigned int shard, unsigned int num_shards)
+{
+  if (num_shards == 0 || shard >= num_shards)
+  {
+    bug("bad shard in vsf_stats_set_shard");
+  }
+  s_shard = shard;
+  s_num_shards = num_shards;
+  s_next_slot = shard;
+}
+
+void
+vsf_stats_set_slot_pid(struct vsf_stats* p_stats, int slot, int pid)
+{
+  if (slot < 0)
+  {
+    return;
+  }
+  if ((unsigned int) slot >= p_stats->num_slots)
+  {
+    bug("slot out of range in vsf_stats_set_slot_pid");
+  }
+  if (pid <= 0)
+  {
+    pid = 0;
+  }
+  p_stats->p_owner_pids[slot] = pid;
+  p_stats->p_segment->slots[slot].owner_pid = pid;
+}
+
+void
+vsf_stats_release_pid(struct vsf_stats* p_stats, int pid)
+{
+  /* Warning: called from the SIGCHLD handler */
+  unsigned int i;
+  for (i = 0; i < p_stats->num_slots; ++i)
+  {
+    if (p_stats->p_owner_pids[i] == pid)
+    {
+      p_stats->p_owner_pids[i] = 0;
+      p_stats->p_segment->slots[i].owner_pid = 0;
+      return;
+    }
+  }
+}
+
+void
+vsf_stats_release_shard(struct vsf_stats* p_stats, unsigned int shard)
+{
+  /* Warning: called from the SIGCHLD handler */
+  unsigned int i;
+  for (i = shard; i < p_stats->num_slots; i += s_num_shards)
+  {
+    p_stats->p_owner_pids[i] = 0;
+    p_stats->p_segment->slots[i].owner_pid = 0;
+  }
+}
+
+void
+vsf_stats_attach(struct vsf_stats* p_stats, int slot)
+{
+  if (p_stats == 0 || slot < 0)
+  {
+    s_p_slot = 0;
+    return;
+  }
+  if ((unsigned int) slot >= p_stats->num_slots)
+  {
+    bug("slot out of range in vsf_stats_attach");
+  }
+  s_p_slot = &p_stats->p_segment->slots[slot];
+  vsf_sysutil_update_cached_time();
+  s_p_slot->start_sec = vsf_sysutil_get_cached_time_sec();
+  s_p_slot->cmd_start_sec = s_p_slot->start_sec;
+  s_p_slot->state = kVSFStatsStateLogin;
+}
+
+void
+vsf_stats_set_remote(const struct mystr* p_ip_str)
+{
+  if (s_p_slot == 0)
+  {
+    return;
+  }
+  set_slot_text(s_p_slot->remote_ip, sizeof(s_p_slot->remote_ip),
+                p_ip_str, 0);
+}
+
+void
+vsf_stats_set_user(const struct mystr* p_user_str)
+{
+  s_rest_state = kVSFStatsStateIdle;
+  if (s_p_slot == 0)
+  {
+    return;
+  }
+  set_slot_text(s_p_slot->user, sizeof(s_p_slot->user), p_user_str, 0);
+  if (s_cmd_index < 0)
+  {
+    s_p_slot->state = s_rest_state;
+  }
+}
+
+void
+vsf_stats_cmd_start(const struct mystr* p_cmd_str,
+                    const struct mystr* p_arg_str)
+{
+  unsigned int i;
+  if (s_p_slot == 0)
+  {
+    return;
+  }
+  if (str_equal_text(p_cmd_str, "PASS"))
+  {
+    p_arg_str = 0;
+  }
+  set_slot_text(s_p_slot->cmdline, sizeof(s_p_slot->cmdline), p_cmd_str,
+                p_arg_str);
+  s_cmd_index = VSF_STATS_CMD_OTHER;
+  for (i = 0; i < VSF_STATS_CMD_OTHER; ++i)
+  {
+    if (str_equal_text(p_cmd_str, s_cmd_names[i]))
+    {
+      s_cmd_index = (int) i;
+      break;
+    }
+  }
+  vsf_sysutil_update_cached_time();
+  s_cmd_start_sec = vsf_sysutil_get_cached_time_sec();
+  s_cmd_start_usec = vsf_sysutil_get_cached_time_usec();
+  s_p_slot->cmd_start_sec = s_cmd_start_sec;
+  s_p_slot->data_bytes = 0;
+  s_p_slot->state = kVSFStatsStateBusy;
+}
+
+void
+vsf_stats_cmd_end(void)
+{
+  struct vsf_stats_cmd* p_cmd;
+  long usec;
+  unsigned int bucket = 0;
+  if (s_p_slot == 0 || s_cmd_index < 0)
+  {
+    return;
+  }
+  vsf_sysutil_update_cached_time();
+  usec = (vsf_sysutil_get_cached_time_sec() - s_cmd_start_sec) * 1000000;
+  usec += vsf_sysutil_get_cached_time_usec() - s_cmd_start_usec;
+  if (usec < 0)
+  {
+    /* Clock stepped backwards */
+    usec = 0;
+  }
+  while (bucket < VSF_STATS_NUM_BUCKETS - 1 && usec > s_bucket_usec[bucket])
+  {
+    ++bucket;
+  }
+  p_cmd = &s_p_slot->cmds[s_cmd_index];
+  p_cmd->buckets[bucket]++;
+  p_cmd->usec_sum += usec;
+  /* Count last, so a reader rarely sees a count without its bucket */
+  p_cmd->count++;
+  s_cmd_index = -1;
+  s_p_slot->cmd_start_sec = vsf_sysutil_get_cached_time_sec();
+  s_p_slot->state = s_rest_state;
+}
+
+void
+vsf_stats_data_progress(unsigned int bytes)
+{
+  if (s_p_slot == 0)
+  {
+    return;
+  }
+  s_p_slot->data_bytes += bytes;
+}
+
+void
+vsf_stats_transfer(int is_upload, int succeeded, filesize_t bytes,
+                   filesize_t usec)
+{
+  struct vsf_stats_xfer* p_xfer;
+  if (s_p_slot == 0)
+  {
+    return;
+  }
+  p_xfer = &s_p_slot->xfers[is_upload ? 1 : 0];
+  p_xfer->bytes += bytes;
+  if (usec > 0)
+  {
+    p_xfer->usec += usec;
+  }
+  if (succeeded)
+  {
+    p_xfer->num_ok++;
+  }
+  else
+  {
+    p_xfer->num_failed++;
+  }
+}
+
+void
+vsf_stats_pasv(int from_map, unsigned int collisions, int succeeded)
+{
+  if (s_p_slot == 0)
+  {
+    return;
+  }
+  s_p_slot->pasv_collisions += collisions;
+  if (succeeded)
+  {
+    s_p_slot->pasv_allocs[from_map ? 1 : 0]++;
+  }
+  else
+  {
+    s_p_slot->pasv_failures++;
+  }
+}
+
+void
+vsf_stats_download_cache(int is_stream, filesize_t bytes,
+                         filesize_t released)
+{
+  int mode = is_stream ? 1 : 0;
+  if (s_p_slot == 0)
+  {
+    return;
+  }
+  s_p_slot->cache_xfers[mode]++;
+  s_p_slot->cache_bytes[mode] += bytes;
+  s_p_slot->cache_released[mode] += released;
+}
+
+void
+vsf_stats_data_sockbuf(unsigned int rtt_usec, unsigned int size)
+{
+  if (s_p_slot == 0)
+  {
+    return;
+  }
+  s_p_slot->data_rtt_usec = rtt_usec;
+  s_p_slot->data_sockbuf = size;
+  if (size > 0)
+  {
+    s_p_slot->sockbuf_tuned++;
+    s_p_slot->sockbuf_bytes += size;
+    s_p_slot->sockbuf_rtt_usec += rtt_usec;
+  }
+}
+
+void
+vsf_stats_dump(const struct vsf_stats* p_stats, struct mystr* p_str)
+{
+  static struct vsf_stats_cmd s_cmd_totals[VSF_STATS_NUM_CMDS];
+  static struct vsf_stats_xfer s_xfer_totals[2];
+  unsigned long pasv_allocs[2] = { 0, 0 };
+  unsigned long pasv_collisions = 0;
+  unsigned long pasv_failures = 0;
+  unsigned long cache_xfers[2] = { 0, 0 };
+  filesize_t cache_bytes[2] = { 0, 0 };
+  filesize_t cache_released[2] = { 0, 0 };
+  unsigned long sockbuf_tuned = 0;
+  filesize_t sockbuf_bytes = 0;
+  filesize_t sockbuf_rtt_usec = 0;
+  unsigned int num_sessions = 0;
+  unsigned int i;
+  unsigned int j;
+  unsigned int k;
+  vsf_sysutil_memclr(s_cmd_totals, sizeof(s_cmd_totals));
+  vsf_sysutil_memclr(s_xfer_totals, sizeof(s_xfer_totals));
+  for (i = 0; i < p_stats->num_slots; ++i)
+  {
+    const struct vsf_stats_slot* p_slot = &p_stats->p_segment->slots[i];
+    /* Other shards' sessions are only in the segment's copy. It is only
+     * counted, so a session lying about it just skews the number.
+     */
+    if (p_slot->owner_pid > 0)
+    {
+      ++num_sessions;
+    }
+    for (j = 0; j < VSF_STATS_NUM_CMDS; ++j)
+    {
+      s_cmd_totals[j].count += p_slot->cmds[j].count;
+      s_cmd_totals[j].usec_sum += p_slot->cmds[j].usec_sum;
+      for (k = 0; k < VSF_STATS_NUM_BUCKETS; ++k)
+      {
+        s_cmd_totals[j].buckets[k] += p_slot->cmds[j].buckets[k];
+      }
+    }
+    for (j = 0; j < 2; ++j)
+    {
+      s_xfer_totals[j].num_ok += p_slot->xfers[j].num_ok;
+      s_xfer_totals[j].num_failed += p_slot->xfers[j].num_failed;
+      s_xfer_totals[j].bytes += p_slot->xfers[j].bytes;
+      s_xfer_totals[j].usec += p_slot->xfers[j].usec;
+      pasv_allocs[j] += p_slot->pasv_allocs[j];
+      cache_xfers[j] += p_slot->cache_xfers[j];
+      cache_bytes[j] += p_slot->cache_bytes[j];
+      cache_released[j] += p_slot->cache_released[j];
+    }
+    pasv_collisions += p_slot->pasv_collisions;
+    pasv_failures += p_slot->pasv_failures;
+    sockbuf_tuned += p_slot->sockbuf_tuned;
+    sockbuf_bytes += p_slot->sockbuf_bytes;
+    sockbuf_rtt_usec += p_slot->sockbuf_rtt_usec;
+  }
+  str_alloc_text(p_str,
+                 "# HELP vsftpd_sessions Sessions currently running.\n");
+  str_append_text(p_str, "# TYPE vsftpd_sessions gauge\n");
+  str_append_text(p_str, "vsftpd_sessions ");
+  str_append_ulong(p_str, num_sessions);
+  str_append_char(p_str, '\n');
+
+  str_append_text(p_str, "# HELP vsftpd_command_duration_seconds "
+                         "Time taken to process FTP commands.\n");
+  str_append_text(p_str,
+                  "# TYPE vsftpd_command_duration_seconds histogram\n");
+  for (j = 0; j < VSF_STATS_NUM_CMDS; ++j)
+  {
+    const char* p_name = "other";
+    unsigned long cumulative = 0;
+    if (j != VSF_STATS_CMD_OTHER)
+    {
+      p_name = s_cmd_names[j];
+    }
+    for (k = 0; k < VSF_STATS_NUM_BUCKETS; ++k)
+    {
+      cumulative += s_cmd_totals[j].buckets[k];
+      str_append_text(p_str,
+                      "vsftpd_command_duration_seconds_bucket{command=\"");
+      str_append_text(p_str, p_name);
+      str_append_text(p_str, "\",le=\"");
+      str_append_text(p_str, s_bucket_names[k]);
+      str_append_text(p_str, "\"} ");
+      str_append_ulong(p_str, cumulative);
+      str_append_char(p_str, '\n');
+    }
+    str_append_text(p_str, "vsftpd_command_duration_seconds_sum{command=\"");
+    str_append_text(p_str, p_name);
+    str_append_text(p_str, "\"} ");
+    append_seconds(p_str, s_cmd_totals[j].usec_sum);
+    str_append_char(p_str, '\n');
+    str_append_text(p_str,
+                    "vsftpd_command_duration_seconds_count{command=\"");
+    str_append_text(p_str, p_name);
+    str_append_text(p_str, "\"} ");
+    str_append_ulong(p_str, s_cmd_totals[j].count);
+    str_append_char(p_str, '\n');
+  }
+
+  str_append_text(p_str, "# HELP vsftpd_transfers_total "
+                         "File transfers finished.\n");
+  str_append_text(p_str, "# TYPE vsftpd_transfers_total counter\n");
+  for (j = 0; j < 2; ++j)
+  {
+    append_xfer_labels(p_str, "vsftpd_transfers_total", j, ",result=\"ok\"");
+    str_append_ulong(p_str, s_xfer_totals[j].num_ok);
+    str_append_char(p_str, '\n');
+    append_xfer_labels(p_str, "vsftpd_transfers_total", j,
+                       ",result=\"failed\"");
+    str_append_ulong(p_str, s_xfer_totals[j].num_failed);
+    str_append_char(p_str, '\n');
+  }
+  str_append_text(p_str, "# HELP vsftpd_transfer_bytes_total "
+                         "Bytes of file data transferred.\n");
+  str_append_text(p_str, "# TYPE vsftpd_transfer_bytes_total counter\n");
+  for (j = 0; j < 2; ++j)
+  {
+    append_xfer_labels(p_str, "vsftpd_transfer_bytes_total", j, "");
+    str_append_filesize_t(p_str, s_xfer_totals[j].bytes);
+    str_append_char(p_str, '\n');
+  }
+  /* Throughput is vsftpd_transfer_bytes_total / vsftpd_transfer_seconds_total */
+  str_append_text(p_str, "# HELP vsftpd_transfer_seconds_total "
+                         "Time spent transferring file data.\n");
+  str_append_text(p_str, "# TYPE vsftpd_transfer_seconds_total counter\n");
+  for (j = 0; j < 2; ++j)
+  {
+    append_xfer_labels(p_str, "vsftpd_transfer_seconds_total", j, "");
+    append_seconds(p_str, s_xfer_totals[j].usec);
+    str_append_char(p_str, '\n');
+  }
+
+  str_append_text(p_str, "# HELP vsftpd_pasv_allocations_total "
+                         "Passive ports bound, by how they were picked.\n");
+  str_append_text(p_str, "# TYPE vsftpd_pasv_allocations_total counter\n");
+  str_append_text(p_str, "vsftpd_pasv_allocations_total{method=\"map\"} ");
+  str_append_ulong(p_str, pasv_allocs[1]);
+  str_append_char(p_str, '\n');
+  str_append_text(p_str,
+                  "vsftpd_pasv_allocations_total{method=\"random\"} ");
+  str_append_ulong(p_str, pasv_allocs[0]);
+  str_append_char(p_str, '\n');
+  str_append_text(p_str, "# HELP vsftpd_pasv_collisions_total "
+                         "Passive port binds which found the port in use.\n");
+  str_append_text(p_str, "# TYPE vsftpd_pasv_collisions_total counter\n");
+  str_append_text(p_str, "vsftpd_pasv_collisions_total ");
+  str_append_ulong(p_str, pasv_collisions);
+  str_append_char(p_str, '\n');
+  str_append_text(p_str, "# HELP vsftpd_pasv_failures_total "
+                         "PASV / EPSV commands refused for lack of a port.\n");
+  str_append_text(p_str, "# TYPE vsftpd_pasv_failures_total counter\n");
+  str_append_text(p_str, "vsftpd_pasv_failures_total ");
+  str_append_ulong(p_str, pasv_failures);
+  str_append_char(p_str, '\n');
+
+  /* Cache held by a mode is vsftpd_download_cache_bytes_total less
+   * vsftpd_download_cache_released_bytes_total
+   */
+  str_append_text(p_str, "# HELP vsftpd_download_cache_transfers_total "
+                         "Downloads sent from the page cache, by mode.\n");
+  str_append_text(p_str,
+                  "# TYPE vsftpd_download_cache_transfers_total counter\n");
+  for (j = 0; j < 2; ++j)
+  {
+    append_cache_labels(p_str, "vsftpd_download_cache_transfers_total", j);
+    str_append_ulong(p_str, cache_xfers[j]);
+    str_append_char(p_str, '\n');
+  }
+  str_append_text(p_str, "# HELP vsftpd_download_cache_bytes_total "
+                         "Bytes read through the page cache, by mode.\n");
+  str_append_text(p_str,
+                  "# TYPE vsftpd_download_cache_bytes_total counter\n");
+  for (j = 0; j < 2; ++j)
+  {
+    append_cache_labels(p_str, "vsftpd_download_cache_bytes_total", j);
+    str_append_filesize_t(p_str, cache_bytes[j]);
+    str_append_char(p_str, '\n');
+  }
+  str_append_text(p_str, "# HELP vsftpd_download_cache_released_bytes_total "
+                         "Bytes dropped from the page cache once sent.\n");
+  str_append_text(p_str,
+                  "# TYPE vsftpd_download_cache_released_bytes_total "
+                  "counter\n");
+  for (j = 0; j < 2; ++j)
+  {
+    append_cache_labels(p_str, "vsftpd_download_cache_released_bytes_total",
+                        j);
+    str_append_filesize_t(p_str, cache_released[j]);
+    str_append_char(p_str, '\n');
+  }
+
+  /* Average buffer size and round trip time are these divided by
+   * vsftpd_data_sockbuf_tuned_total
+   */
+  str_append_text(p_str, "# HELP vsftpd_data_sockbuf_tuned_total "
+                         "Data connections with sized socket buffers.\n");
+  str_append_text(p_str, "# TYPE vsftpd_data_sockbuf_tuned_total counter\n");
+  str_append_text(p_str, "vsftpd_data_sockbuf_tuned_total ");
+  str_append_ulong(p_str, sockbuf_tuned);
+  str_append_char(p_str, '\n');
+  str_append_text(p_str, "# HELP vsftpd_data_sockbuf_bytes_total "
+                         "Sum of the socket buffer sizes picked.\n");
+  str_append_text(p_str, "# TYPE vsftpd_data_sockbuf_bytes_total counter\n");
+  str_append_text(p_str, "vsftpd_data_sockbuf_bytes_total ");
+  str_append_filesize_t(p_str, sockbuf_bytes);
+  str_append_char(p_str, '\n');
+  str_append_text(p_str, "# HELP vsftpd_data_sockbuf_rtt_seconds_total "
+                         "Sum of the round trip times sized for.\n");
+  str_append_text(p_str,
+                  "# TYPE vsftpd_data_sockbuf_rtt_seconds_total counter\n");
+  str_append_text(p_str, "vsftpd_data_sockbuf_rtt_seconds_total ");
+  append_seconds(p_str, sockbuf_rtt_usec);
+  str_append_char(p_str, '\n');
+}
+
+static void
+append_cache_labels(struct mystr* p_str, const char* p_metric, int is_stream)
+{
+  str_append_text(p_str, p_metric);
+  if (is_stream)
+  {
+    str_append_text(p_str, "{mode=\"stream\"} ");
+  }
+  else
+  {
+    str_append_text(p_str, "{mode=\"normal\"} ");
+  }
+}
+
+static void
+append_xfer_labels(struct mystr* p_str, const char* p_metric, int is_upload,
+                   const char* p_extra)
+{
+  str_append_text(p_str, p_metric);
+  if (is_upload)
+  {
+    str_append_text(p_str, "{direction=\"upload\"");
+  }
+  else
+  {
+    str_append_text(p_str, "{direction=\"download\"");
+  }
+  str_append_text(p_str, p_extra);
+  str_append_text(p_str, "} ");
+}
+
+static void
+append_seconds(struct mystr* p_str, filesize_t usec)
+{
+  filesize_t frac = usec % 1000000;
+  filesize_t digit = 100000;
+  str_append_filesize_t(p_str, usec / 1000000);
+  str_append_char(p_str, '.');
+  while (digit > 0)
+  {
+    str_append_char(p_str, (char) ('0' + (frac / digit) % 10));
+    digit /= 10;
+  }
+}
+
+void
+vsf_stats_print_status(const char* p_filename)
+{
+  static struct mystr s_out_str;
+  const struct vsf_stats_segment* p_stats;
+  unsigned int length = 0;
+  unsigned int num_sessions = 0;
+  unsigned int i;
+  long now_sec;
+  p_stats = vsf_sysutil_map_file_readonly(p_filename, &length);
+  if (p_stats == 0)
+  {
+    die2("vsftpd: cannot read scoreboard file: ", p_filename);
+  }
+  if (length < sizeof(struct vsf_stats_segment) ||
+      p_stats->magic != VSF_STATS_MAGIC ||
+      p_stats->slot_size != sizeof(struct vsf_stats_slot) ||
+      p_stats->num_slots == 0 ||
+      (length - sizeof(struct vsf_stats_segment)) / sizeof(struct vsf_stats_slot) <
+        p_stats->num_slots - 1)
+  {
+    die2("vsftpd: not a scoreboard from this vsftpd version: ", p_filename);
+  }
+  vsf_sysutil_update_cached_time();
+  now_sec = vsf_sysutil_get_cached_time_sec();
+  str_alloc_text(&s_out_str, "");
+  append_padded(&s_out_str, "PID", 8);
+  append_padded(&s_out_str, "STATE", 10);
+  append_padded(&s_out_str, "AGE", 8);
+  append_padded(&s_out_str, "CMDAGE", 8);
+  append_padded(&s_out_str, "BYTES", 14);
+  append_padded(&s_out_str, "RTTUS", 8);
+  append_padded(&s_out_str, "SOCKBUF", 10);
+  append_padded(&s_out_str, "REMOTE", 18);
+  append_padded(&s_out_str, "USER", 12);
+  str_append_text(&s_out_str, "COMMAND\n");
+  for (i = 0; i < p_stats->num_slots; ++i)
+  {
+    /* Take a copy; the owner may be writing to the live slot */
+    struct vsf_stats_slot slot = p_stats->slots[i];
+    unsigned int state = (unsigned int) slot.state;
+    if (slot.owner_pid <= 0)
+    {
+      continue;
+    }
+    ++num_sessions;
+    slot.remote_ip[sizeof(slot.remote_ip) - 1] = '\0';
+    slot.user[sizeof(slot.user) - 1] = '\0';
+    slot.cmdline[sizeof(slot.cmdline) - 1] = '\0';
+    if (state >= sizeof(s_state_names) / sizeof(s_state_names[0]))
+    {
+      state = kVSFStatsStateStarting;
+    }
+    append_padded(&s_out_str, vsf_sysutil_ulong_to_str(slot.owner_pid), 8);
+    append_padded(&s_out_str, s_state_names[state], 10);
+    append_padded(&s_out_str,
+                  vsf_sysutil_ulong_to_str(now_sec - slot.start_sec), 8);
+    append_padded(&s_out_str,
+                  vsf_sysutil_ulong_to_str(now_sec - slot.cmd_start_sec), 8);
+    append_padded(&s_out_str,
+                  vsf_sysutil_filesize_t_to_str(slot.data_bytes), 14);
+    if (slot.data_rtt_usec > 0)
+    {
+      append_padded(&s_out_str,
+                    vsf_sysutil_ulong_to_str(slot.data_rtt_usec), 8);
+    }
+    else
+    {
+      append_padded(&s_out_str, "-", 8);
+    }
+    if (slot.data_sockbuf > 0)
+    {
+      append_padded(&s_out_str,
+                    vsf_sysutil_ulong_to_str(slot.data_sockbuf), 10);
+    }
+    else
+    {
+      append_padded(&s_out_str, "-", 10);
+    }
+    append_slot_text(&s_out_str, slot.remote_ip, 18);
+    append_slot_text(&s_out_str, slot.user, 12);
+    append_slot_text(&s_out_str, slot.cmdline, 0);
+    str_append_char(&s_out_str, '\n');
+  }
+  str_append_ulong(&s_out_str, num_sessions);
+  str_append_text(&s_out_str, " of ");
+  str_append_ulong(&s_out_str, p_stats->num_slots);
+  str_append_text(&s_out_str, " slots in use\n");
+  (void) str_write_loop(&s_out_str, 1);
+  vsf_sysutil_exit(0);
+}
+
+static void
+append_padded(struct mystr* p_str, const char* p_text, unsigned int width)
+{
+  unsigned int len = vsf_sysutil_strlen(p_text);
+  str_append_text(p_str, p_text);
+  do
+  {
+    str_append_char(p_str, ' ');
+  } while (++len < width);
+}
+
+static void
+append_slot_text(struct mystr* p_str, const char* p_text, unsigned int width)
+{
+  /* Any session can write its slot, so whatever is there may be meant for
+   * the terminal of whoever runs --status. Clean it up again here.
+   */
+  static struct mystr s_text_str;
+  str_alloc_text(&s_text_str, p_text);
+  str_replace_unprintable(&s_text_str, '?');
+  if (width == 0)
+  {
+    str_append_str(p_str, &s_text_str);
+    return;
+  }
+  append_padded(p_str, str_getbuf(&s_text_str), width);
+}
+
+static void
+set_slot_text(char* p_dest, unsigned int size, const struct mystr* p_str1,
+              const struct mystr* p_str2)
+{
+  /* Copy "str1 str2" into a fixed size scoreboard field. The last byte is
+   * always a terminator, so a reader never runs off the end.
+   */
+  static struct mystr s_text_str;
+  unsigned int len;
+  str_copy(&s_text_str, p_str1);
+  if (p_str2 != 0 && !str_isempty(p_str2))
+  {
+    str_append_char(&s_text_str, ' ');
+    str_append_str(&s_text_str, p_str2);
+  }
+  str_replace_unprintable(&s_text_str, '?');
+  len = str_getlen(&s_text_str);
+  if (len > size - 1)
+  {
+    len = size - 1;
+  }
+  p_dest[size - 1] = '\0';
+  vsf_sysutil_memcpy(p_dest, str_getbuf(&s_text_str), len);
+  p_dest[len] = '\0';
+}
@@ -0,0 +1,199 @@
+#ifndef VSF_STATS_H
+#define VSF_STATS_H
+
+#ifndef VSF_FILESIZE_H
+#include "filesize.h"
+#endif
+
+struct mystr;
+struct vsf_stats;
+
+/* vsf_stats_alloc()
+ * PURPOSE
+ * Allocate the statistics segment. This is called by the standalone
+ * listener, and the memory is shared with every session it launches. Each
+ * session owns one slot and is the only writer to it, so recording needs no
+ * locking. Besides the counters, each slot carries a scoreboard entry
+ * describing what the session is doing right now.
+ * PARAMETERS
+ * num_slots    - the maximum number of sessions which can record at once
+ * p_filename   - if not null, back the segment with this file so that other
+ *                processes can read the scoreboard
+ * RETURNS
+ * A handle to the statistics segment.
+ */
+struct vsf_stats* vsf_stats_alloc(unsigned int num_slots,
+                                  const char* p_filename);
+
+/* vsf_stats_claim_slot()
+ * PURPOSE
+ * Reserve a free slot for a session which is about to be launched. Called
+ * by the listener before it forks.
+ * PARAMETERS
+ * p_stats      - the statistics segment
+ * RETURNS
+ * The slot number, or -1 if all slots are in use.
+ */
+int vsf_stats_claim_slot(struct vsf_stats* p_stats);
+
+/* vsf_stats_set_shard()
+ * PURPOSE
+ * Called by each listener shard so that it only claims its own share of the
+ * slots; shards never compete for a slot and so need no locking either.
+ * PARAMETERS
+ * shard        - this listener's shard number, from 0
+ * num_shards   - the total number of listener shards
+ */
+void vsf_stats_set_shard(unsigned int shard, unsigned int num_shards);
+
+/* vsf_stats_set_slot_pid()
+ * PURPOSE
+ * Record which process owns a claimed slot. Called by the listener after it
+ * forks. A pid which is not positive (i.e. the fork failed) frees the slot.
+ * PARAMETERS
+ * p_stats      - the statistics segment
+ * slot         - the slot returned by vsf_stats_claim_slot()
+ * pid          - the process ID of the new session
+ */
+void vsf_stats_set_slot_pid(struct vsf_stats* p_stats, int slot, int pid);
+
+/* vsf_stats_release_pid()
+ * PURPOSE
+ * Free the slot owned by a process which has exited. The counters recorded
+ * in the slot are kept; the next session to use it adds to them.
+ * PARAMETERS
+ * p_stats      - the statistics segment
+ * pid          - the process ID which has exited
+ */
+void vsf_stats_release_pid(struct vsf_stats* p_stats, int pid);
+
+/* vsf_stats_release_shard()
+ * PURPOSE
+ * Free every slot of a listener shard which has died, along with its
+ * sessions. Called by shard 0, before it starts a new shard in its place.
+ * PARAMETERS
+ * p_stats      - the statistics segment
+ * shard        - the dead shard's number
+ */
+void vsf_stats_release_shard(struct vsf_stats* p_stats, unsigned int shard);
+
+/* vsf_stats_attach()
+ * PURPOSE
+ * Called in a newly launched session to start recording into its slot.
+ * Until this is called, all the recording functions below do nothing.
+ * PARAMETERS
+ * p_stats      - the statistics segment
+ * slot         - the slot reserved for us, or -1 for none
+ */
+void vsf_stats_attach(struct vsf_stats* p_stats, int slot);
+
+/* vsf_stats_set_remote()
+ * PURPOSE
+ * Publish the remote address of this session in the scoreboard.
+ * PARAMETERS
+ * p_ip_str     - the remote IP address, as text
+ */
+void vsf_stats_set_remote(const struct mystr* p_ip_str);
+
+/* vsf_stats_set_user()
+ * PURPOSE
+ * Publish the user this session has logged in as in the scoreboard. From
+ * now on, the session is shown as idle between commands.
+ * PARAMETERS
+ * p_user_str   - the user name
+ */
+void vsf_stats_set_user(const struct mystr* p_user_str);
+
+/* vsf_stats_cmd_start()
+ * PURPOSE
+ * Note that we have just read an FTP command and are about to process it.
+ * PARAMETERS
+ * p_cmd_str    - the command name, in upper case
+ * p_arg_str    - the command argument; not shown for PASS
+ */
+void vsf_stats_cmd_start(const struct mystr* p_cmd_str,
+                         const struct mystr* p_arg_str);
+
+/* vsf_stats_cmd_end()
+ * PURPOSE
+ * Note that processing of the current FTP command (if any) has finished,
+ * and record how long it took.
+ */
+void vsf_stats_cmd_end(void);
+
+/* vsf_stats_data_progress()
+ * PURPOSE
+ * Note that some data moved over the data connection during the current
+ * command.
+ * PARAMETERS
+ * bytes        - the number of bytes read or written
+ */
+void vsf_stats_data_progress(unsigned int bytes);
+
+/* vsf_stats_transfer()
+ * PURPOSE
+ * Record a completed file transfer.
+ * PARAMETERS
+ * is_upload    - non-zero for an upload, zero for a download
+ * succeeded    - non-zero if the transfer completed successfully
+ * bytes        - the number of bytes transferred
+ * usec         - how long the transfer took, in microseconds
+ */
+void vsf_stats_transfer(int is_upload, int succeeded, filesize_t bytes,
+                        filesize_t usec);
+
+/* vsf_stats_pasv()
+ * PURPOSE
+ * Record the outcome of looking for a passive mode port.
+ * PARAMETERS
+ * from_map     - non-zero if the port came from the shared port map
+ * collisions   - how many binds failed because the port was in use
+ * succeeded    - non-zero if a port was bound in the end
+ */
+void vsf_stats_pasv(int from_map, unsigned int collisions, int succeeded);
+
+/* vsf_stats_download_cache()
+ * PURPOSE
+ * Record a download sent straight from the page cache (i.e. by sendfile()),
+ * and how it used the cache.
+ * PARAMETERS
+ * is_stream    - non-zero if the download was streamed (see
+ *                stream_download_size), zero for normal caching
+ * bytes        - the number of bytes sent
+ * released     - how many of them were dropped from the cache once sent
+ */
+void vsf_stats_download_cache(int is_stream, filesize_t bytes,
+                              filesize_t released);
+
+/* vsf_stats_data_sockbuf()
+ * PURPOSE
+ * Record how the socket buffers of a new data connection were sized (see
+ * sockbuf_autotune_enable), and show it in the scoreboard.
+ * PARAMETERS
+ * rtt_usec     - the round trip time measured, in microseconds, or 0 if
+ *                unknown
+ * size         - the buffer size set, or 0 if left to the kernel
+ */
+void vsf_stats_data_sockbuf(unsigned int rtt_usec, unsigned int size);
+
+/* vsf_stats_dump()
+ * PURPOSE
+ * Sum up all slots and format the result in the Prometheus text exposition
+ * format.
+ * PARAMETERS
+ * p_stats      - the statistics segment
+ * p_str        - where to put the result
+ */
+void vsf_stats_dump(const struct vsf_stats* p_stats, struct mystr* p_str);
+
+/* vsf_stats_print_status()
+ * PURPOSE
+ * Map a scoreboard file written by a running listener, and print a table
+ * of all active sessions to standard output. Does not return.
+ * PARAMETERS
+ * p_filename   - the scoreboard file
+ */
+void vsf_stats_print_status(const char* p_filename);
+
+#endif /* VSF_STATS_H */
+
@@ -0,0 +1,165 @@
+/*
+ * Part of Very Secure FTPd
+ * Licence: GPL v2
+ * Author: Chris Evans
+ * syncsvc.c
+ *
+ * The sync worker: one process, forked by the standalone listener, which
+ * makes uploads durable in batches ("group commit"). While it is busy
+ * flushing, requests pile up; it then takes them all and flushes each
+ * filesystem they are on just once, so the number of flushes follows the
+ * number of batches, not the number of uploads.
+ *
+ * A request is a one byte datagram carrying one end of a fresh socketpair.
+ * The file to flush is already queued on that socketpair, and the worker
+ * writes back '1' or '0' over it once the file is on disk.
+ */
+
+#include "syncsvc.h"
+#include "sysutil.h"
+#include "sysdeputil.h"
+#include "tunables.h"
+#include "defs.h"
+#include "utility.h"
+
+struct vsf_syncsvc_req
+{
+  int reply_fd;
+  int file_fd;
+  filesize_t dev;
+  int result;
+};
+
+/* Session side state */
+static int s_sock = -1;
+
+static int take_request(int sock, struct vsf_syncsvc_req* p_req);
+
+void
+vsf_syncsvc_attach(int sock)
+{
+  s_sock = sock;
+}
+
+int
+vsf_syncsvc_sync(int fd)
+{
+  struct vsf_sysutil_socketpair_retval sockets;
+  char result = '0';
+  int retval;
+  if (s_sock == -1)
+  {
+    return vsf_sysutil_fsync(fd);
+  }
+  sockets = vsf_sysutil_unix_stream_socketpair();
+  /* Queue the file first, so the worker never waits on us for it */
+  retval = vsf_sysutil_send_msg(sockets.socket_one, "F", 1, fd);
+  if (!vsf_sysutil_retval_is_error(retval))
+  {
+    retval = vsf_sysutil_send_msg(s_sock, "S", 1, sockets.socket_two);
+  }
+  vsf_sysutil_close(sockets.socket_two);
+  if (!vsf_sysutil_retval_is_error(retval))
+  {
+    /* A worker dying on us shows up as EOF */
+    retval = vsf_sysutil_read_loop(sockets.socket_one, &result, 1);
+  }
+  vsf_sysutil_close(sockets.socket_one);
+  if (retval != 1)
+  {
+    return vsf_sysutil_fsync(fd);
+  }
+  return result == '1' ? 0 : -1;
+}
+
+void
+vsf_syncsvc_worker(int sock)
+{
+  static struct vsf_syncsvc_req s_reqs[VSFTP_SYNC_BATCH_MAX];
+  vsf_sysutil_exit_with_parent();
+  vsf_sysutil_install_null_sighandler(kVSFSysUtilSigHUP);
+  vsf_sysutil_unblock_sig(kVSFSysUtilSigHUP);
+  if (tunable_setproctitle_enable)
+  {
+    vsf_sysutil_setproctitle("SYNC WORKER");
+  }
+  while (1)
+  {
+    unsigned int num_reqs = 0;
+    unsigned int i;
+    unsigned int j;
+    /* Wait for one request, then sweep up whatever else is waiting */
+    if (take_request(sock, &s_reqs[num_reqs]))
+    {
+      ++num_reqs;
+    }
+    vsf_sysutil_activate_noblock(sock);
+    while (num_reqs < VSFTP_SYNC_BATCH_MAX)
+    {
+      int retval = take_request(sock, &s_reqs[num_reqs]);
+      if (retval == -1)
+      {
+        break;
+      }
+      if (retval == 1)
+      {
+        ++num_reqs;
+      }
+    }
+    vsf_sysutil_deactivate_noblock(sock);
+    for (i = 0; i < num_reqs; ++i)
+    {
+      struct vsf_syncsvc_req* p_req = &s_reqs[i];
+      /* Already covered by an earlier flush of the same filesystem? */
+      for (j = 0; j < i; ++j)
+      {
+        if (s_reqs[j].dev == p_req->dev)
+        {
+          p_req->result = s_reqs[j].result;
+          break;
+        }
+      }
+      if (j == i)
+      {
+        p_req->result = (vsf_sysutil_syncfs(p_req->file_fd) == 0);
+      }
+    }
+    for (i = 0; i < num_reqs; ++i)
+    {
+      char result = s_reqs[i].result ? '1' : '0';
+      /* The session may have given up on us; no matter */
+      (void) vsf_sysutil_write_loop(s_reqs[i].reply_fd, &result, 1);
+      vsf_sysutil_close_failok(s_reqs[i].reply_fd);
+      vsf_sysutil_close_failok(s_reqs[i].file_fd);
+    }
+  }
+}
+
+static int
+take_request(int sock, struct vsf_syncsvc_req* p_req)
+{
+  /* Returns 1 for a request, 0 for a bad one and -1 if there are none */
+  static struct vsf_sysutil_statbuf* s_p_statbuf;
+  char buf;
+  int retval = vsf_sysutil_recv_msg(sock, &buf, 1, &p_req->reply_fd);
+  if (vsf_sysutil_retval_is_error(retval))
+  {
+    return -1;
+  }
+  if (p_req->reply_fd == -1)
+  {
+    return 0;
+  }
+  /* The file was queued before the request was sent, so this won't block */
+  vsf_sysutil_activate_noblock(p_req->reply_fd);
+  retval = vsf_sysutil_recv_msg(p_req->reply_fd, &buf, 1, &p_req->file_fd);
+  vsf_sysutil_deactivate_noblock(p_req->reply_fd);
+  if (vsf_sysutil_retval_is_error(retval) || p_req->file_fd == -1)
+  {
+    vsf_sysutil_close_failok(p_req->reply_fd);
+    return 0;
+  }
+  vsf_sysutil_fstat(p_req->file_fd, &s_p_statbuf);
+  p_req->dev = vsf_sysutil_statbuf_get_dev(s_p_statbuf);
+  return 1;
+}
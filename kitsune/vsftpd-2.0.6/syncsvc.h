@@ -0,0 +1,37 @@
+#ifndef VSF_SYNCSVC_H
+#define VSF_SYNCSVC_H
+
+/* vsf_syncsvc_worker()
+ * PURPOSE
+ * Run the sync worker, as forked by the standalone listener when
+ * upload_sync_enable is set. Sessions hand it files to flush to disk. It
+ * takes every request waiting at once and flushes each filesystem involved
+ * in one go, so many concurrent uploads share the cost of one flush.
+ * PARAMETERS
+ * sock         - the worker's end of the request socket
+ * RETURNS
+ * Never returns.
+ */
+void vsf_syncsvc_worker(int sock);
+
+/* vsf_syncsvc_attach()
+ * PURPOSE
+ * Tell a session where the sync worker is.
+ * PARAMETERS
+ * sock         - the sessions' end of the request socket
+ */
+void vsf_syncsvc_attach(int sock);
+
+/* vsf_syncsvc_sync()
+ * PURPOSE
+ * Make sure a file (or directory) is on disk, by asking the sync worker or,
+ * if there is none or it does not answer, by flushing it ourselves.
+ * PARAMETERS
+ * fd           - the open file
+ * RETURNS
+ * 0 on success, -1 on failure.
+ */
+int vsf_syncsvc_sync(int fd);
+
+#endif /* VSF_SYNCSVC_H */
+
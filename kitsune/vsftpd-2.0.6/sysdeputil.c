@@ -46,6 +46,14 @@
 #undef VSF_SYSDEP_TRY_LINUX_SETPROCTITLE_HACK
 #undef VSF_SYSDEP_HAVE_HPUX_SETPROCTITLE
 #undef VSF_SYSDEP_HAVE_MAP_ANON
+#undef VSF_SYSDEP_HAVE_STAT_NSEC
+#undef VSF_SYSDEP_HAVE_SCHED_AFFINITY
+#undef VSF_SYSDEP_HAVE_PDEATHSIG
+#undef VSF_SYSDEP_HAVE_FALLOCATE
+#undef VSF_SYSDEP_HAVE_SYNC_FILE_RANGE
+#undef VSF_SYSDEP_HAVE_SYNCFS
+#undef VSF_SYSDEP_HAVE_FICLONE
+#undef VSF_SYSDEP_HAVE_COPY_FILE_RANGE
 #undef VSF_SYSDEP_NEED_OLD_FD_PASSING
 #ifdef VSF_BUILD_PAM
   #define VSF_SYSDEP_HAVE_PAM
@@ -66,10 +74,50 @@
     #if (LINUX_VERSION_CODE >= KERNEL_VERSION(2,2,0))
       #define VSF_SYSDEP_HAVE_CAPABILITIES
       #define VSF_SYSDEP_HAVE_LINUX_SENDFILE
+      #define VSF_SYSDEP_HAVE_STAT_NSEC
       #include <sys/prctl.h>
       #ifdef PR_SET_KEEPCAPS
         #define VSF_SYSDEP_HAVE_SETKEEPCAPS
       #endif
+      #ifdef PR_SET_PDEATHSIG
+        #define VSF_SYSDEP_HAVE_PDEATHSIG
+      #endif
+      #include <sched.h>
+      #ifdef CPU_SET
+        #define VSF_SYSDEP_HAVE_SCHED_AFFINITY
+      #endif
+      #include <fcntl.h>
+      #ifdef FALLOC_FL_KEEP_SIZE
+        #define VSF_SYSDEP_HAVE_FALLOCATE
+        #include <sys/statvfs.h>
+      #endif
+      #ifdef SYNC_FILE_RANGE_WRITE
+        #define VSF_SYSDEP_HAVE_SYNC_FILE_RANGE
+      #endif
+      #if (LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,39)) && \
+          defined(__GLIBC__) && \
+          (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 14))
+        #define VSF_SYSDEP_HAVE_SYNCFS
+      #endif
+      #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,5,0))
+        #include <sys/ioctl.h>
+        #include <linux/fs.h>
+        #ifdef FICLONE
+          #define VSF_SYSDEP_HAVE_FICLONE
+        #endif
+        #if defined(__GLIBC__) && \
+            (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+          #define VSF_SYSDEP_HAVE_COPY_FILE_RANGE
+        #endif
+      #endif
+      #include <netinet/in.h>
+      #include <netinet/tcp.h>
+      #ifdef TCP_INFO
+        #define VSF_SYSDEP_HAVE_TCP_INFO
+      #endif
+      #ifdef TCP_NOTSENT_LOWAT
+        #define VSF_SYSDEP_HAVE_NOTSENT_LOWAT
+      #endif
     #endif
   #endif
 #endif
@@ -182,6 +230,18 @@ int capset(cap_user_header_t header, const cap_user_data_t data){ return syscall
 #include <unistd.h>
 #endif
 
+#ifdef VSF_SYSDEP_HAVE_PDEATHSIG
+#include <signal.h>
+#endif
+
+#ifdef VSF_SYSDEP_HAVE_STAT_NSEC
+#include <sys/stat.h>
+#endif
+
+/* For preallocation and posix_fadvise() */
+#include <sys/types.h>
+#include <fcntl.h>
+
 #ifdef VSF_SYSDEP_TRY_LINUX_SETPROCTITLE_HACK
 extern char** environ;
 static unsigned int s_proctitle_space = 0;
@@ -273,13 +333,49 @@ vsf_sysdep_check_auth(const struct mystr* p_user_str,
   return 0;
 }
 
+int
+vsf_sysdep_open_auth_session(const struct mystr* p_user_str,
+                             const struct mystr* p_remote_host)
+{
+  /* Nothing to set up without PAM */
+  (void) p_user_str;
+  (void) p_remote_host;
+  return 1;
+}
+
+void
+vsf_sysdep_init_verify_auth(void)
+{
+}
+
+int
+vsf_sysdep_verify_auth(const struct mystr* p_user_str,
+                       const struct mystr* p_pass_str,
+                       const struct mystr* p_remote_host)
+{
+  return vsf_sysdep_check_auth(p_user_str, p_pass_str, p_remote_host);
+}
+
 #else /* VSF_SYSDEP_HAVE_PAM */
 
 static pam_handle_t* s_pamh;
+static pam_handle_t* s_preload_pamh;
 static struct mystr s_pword_str;
 static int pam_conv_func(int nmsg, const struct pam_message** p_msg,
                          struct pam_response** p_reply, void* p_addata);
 static void vsf_auth_shutdown(void);
+static int set_pam_items(pam_handle_t* p_pamh,
+                         const struct mystr* p_user_str,
+                         const struct mystr* p_remote_host);
+static int start_pam(const struct mystr* p_user_str,
+                     const struct mystr* p_remote_host);
+static int establish_pam_session(const struct mystr* p_user_str,
+                                 const struct mystr* p_remote_host);
+static struct pam_conv s_the_conv =
+{
+  &pam_conv_func,
+  0
+};
 
 int
 vsf_sysdep_check_auth(const struct mystr* p_user_str,
@@ -287,65 +383,150 @@ vsf_sysdep_check_auth(const struct mystr* p_user_str,
                       const struct mystr* p_remote_host)
 {
   int retval;
-  struct pam_conv the_conv =
-  {
-    &pam_conv_func,
-    0
-  };
-  if (s_pamh != 0)
+  str_copy(&s_pword_str, p_pass_str);
+  if (!start_pam(p_user_str, p_remote_host))
   {
-    bug("vsf_sysdep_check_auth");
+    return 0;
   }
-  str_copy(&s_pword_str, p_pass_str);
-  retval = pam_start(tunable_pam_service_name,
-                     str_getbuf(p_user_str), &the_conv, &s_pamh);
+  retval = pam_authenticate(s_pamh, 0);
   if (retval != PAM_SUCCESS)
   {
+    (void) pam_end(s_pamh, 0);
     s_pamh = 0;
     return 0;
   }
-#ifdef PAM_RHOST
-  retval = pam_set_item(s_pamh, PAM_RHOST, str_getbuf(p_remote_host));
+  retval = pam_acct_mgmt(s_pamh, 0);
   if (retval != PAM_SUCCESS)
   {
     (void) pam_end(s_pamh, 0);
     s_pamh = 0;
     return 0;
   }
+  return establish_pam_session(p_user_str, p_remote_host);
+}
+
+int
+vsf_sysdep_open_auth_session(const struct mystr* p_user_str,
+                             const struct mystr* p_remote_host)
+{
+  if (!start_pam(p_user_str, p_remote_host))
+  {
+    return 0;
+  }
+  return establish_pam_session(p_user_str, p_remote_host);
+}
+
+void
+vsf_sysdep_init_verify_auth(void)
+{
+  if (s_preload_pamh != 0)
+  {
+    return;
+  }
+  /* Never used to authenticate anyone. It just holds the modules loaded, so
+   * that the handle started for each request finds them already there.
+   */
+  if (pam_start(tunable_pam_service_name, 0, &s_the_conv, &s_preload_pamh) !=
+      PAM_SUCCESS)
+  {
+    s_preload_pamh = 0;
+  }
+}
+
+int
+vsf_sysdep_verify_auth(const struct mystr* p_user_str,
+                       const struct mystr* p_pass_str,
+                       const struct mystr* p_remote_host)
+{
+  /* A fresh handle every time: modules hang per-user state (failure counts,
+   * cached credentials, PAM_AUTHTOK) off the handle, and none of it may
+   * carry over to the next user.
+   */
+  pam_handle_t* p_pamh = 0;
+  int retval;
+  vsf_sysdep_init_verify_auth();
+  retval = pam_start(tunable_pam_service_name, str_getbuf(p_user_str),
+                     &s_the_conv, &p_pamh);
+  if (retval != PAM_SUCCESS)
+  {
+    return 0;
+  }
+  str_copy(&s_pword_str, p_pass_str);
+  if (!set_pam_items(p_pamh, p_user_str, p_remote_host))
+  {
+    retval = PAM_ABORT;
+  }
+  else
+  {
+    retval = pam_authenticate(p_pamh, 0);
+    if (retval == PAM_SUCCESS)
+    {
+      retval = pam_acct_mgmt(p_pamh, 0);
+    }
+  }
+  str_empty(&s_pword_str);
+  (void) pam_end(p_pamh, retval);
+  return retval == PAM_SUCCESS;
+}
+
+static int
+set_pam_items(pam_handle_t* p_pamh, const struct mystr* p_user_str,
+              const struct mystr* p_remote_host)
+{
+  int retval;
+#ifdef PAM_RHOST
+  retval = pam_set_item(p_pamh, PAM_RHOST, str_getbuf(p_remote_host));
+  if (retval != PAM_SUCCESS)
+  {
+    return 0;
+  }
 #endif
 #ifdef PAM_TTY
-  retval = pam_set_item(s_pamh, PAM_TTY, "ftp");
+  retval = pam_set_item(p_pamh, PAM_TTY, "ftp");
   if (retval != PAM_SUCCESS)
   {
-    (void) pam_end(s_pamh, 0);
-    s_pamh = 0;
     return 0;
   }
 #endif
 #ifdef PAM_RUSER
-  retval = pam_set_item(s_pamh, PAM_RUSER, str_getbuf(p_user_str));
+  retval = pam_set_item(p_pamh, PAM_RUSER, str_getbuf(p_user_str));
   if (retval != PAM_SUCCESS)
   {
-    (void) pam_end(s_pamh, 0);
-    s_pamh = 0;
     return 0;
   }
 #endif
-  retval = pam_authenticate(s_pamh, 0);
+  return 1;
+}
+
+static int
+start_pam(const struct mystr* p_user_str, const struct mystr* p_remote_host)
+{
+  int retval;
+  if (s_pamh != 0)
+  {
+    bug("vsf_sysdep_check_auth");
+  }
+  retval = pam_start(tunable_pam_service_name,
+                     str_getbuf(p_user_str), &s_the_conv, &s_pamh);
   if (retval != PAM_SUCCESS)
   {
-    (void) pam_end(s_pamh, 0);
     s_pamh = 0;
     return 0;
   }
-  retval = pam_acct_mgmt(s_pamh, 0);
-  if (retval != PAM_SUCCESS)
+  if (!set_pam_items(s_pamh, p_user_str, p_remote_host))
   {
     (void) pam_end(s_pamh, 0);
     s_pamh = 0;
     return 0;
   }
-  retval = pam_setcred(s_pamh, PAM_ESTABLISH_CRED);
+  return 1;
+}
+
+static int
+establish_pam_session(const struct mystr* p_user_str,
+                      const struct mystr* p_remote_host)
+{
+  int retval = pam_setcred(s_pamh, PAM_ESTABLISH_CRED);
   if (retval != PAM_SUCCESS)
   {
     (void) pam_end(s_pamh, 0);
@@ -941,6 +1122,18 @@ vsf_sysutil_map_anon_pages(unsigned int length)
   }
   return retval;
 }
+
+void*
+vsf_sysutil_map_shared_pages(unsigned int length)
+{
+  char* retval = mmap(0, length, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANON, -1, 0);
+  if (retval == MAP_FAILED)
+  {
+    die("mmap");
+  }
+  return retval;
+}
 #else /* VSF_SYSDEP_HAVE_MAP_ANON */
 void
 vsf_sysutil_map_anon_pages_init(void)
@@ -967,59 +1160,79 @@ vsf_sysutil_map_anon_pages(unsigned int length)
   }
   return retval;
 }
+
+void*
+vsf_sysutil_map_shared_pages(unsigned int length)
+{
+  /* A shared mapping of /dev/zero is shared with children after fork() */
+  char* retval = mmap(0, length, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, s_zero_fd, 0);
+  if (retval == MAP_FAILED)
+  {
+    die("mmap");
+  }
+  return retval;
+}
 #endif /* VSF_SYSDEP_HAVE_MAP_ANON */
 
 #ifndef VSF_SYSDEP_NEED_OLD_FD_PASSING
 
-void
-vsf_sysutil_send_fd(int sock_fd, int send_fd)
+int
+vsf_sysutil_send_msg(int sock_fd, const void* p_buf, unsigned int len,
+                     int send_fd)
 {
-  int retval;
   struct msghdr msg;
-  struct cmsghdr* p_cmsg;
   struct iovec vec;
   char cmsgbuf[CMSG_SPACE(sizeof(send_fd))];
-  int* p_fds;
-  char sendchar = 0;
-  msg.msg_control = cmsgbuf;
-  msg.msg_controllen = sizeof(cmsgbuf);
-  p_cmsg = CMSG_FIRSTHDR(&msg);
-  p_cmsg->cmsg_level = SOL_SOCKET;
-  p_cmsg->cmsg_type = SCM_RIGHTS;
-  p_cmsg->cmsg_len = CMSG_LEN(sizeof(send_fd));
-  p_fds = (int*)CMSG_DATA(p_cmsg);
-  *p_fds = send_fd;
-  msg.msg_controllen = p_cmsg->cmsg_len;
+  vec.iov_base = (void*) p_buf;
+  vec.iov_len = len;
   msg.msg_name = NULL;
   msg.msg_namelen = 0;
   msg.msg_iov = &vec;
   msg.msg_iovlen = 1;
+  msg.msg_control = NULL;
+  msg.msg_controllen = 0;
   msg.msg_flags = 0;
-  /* "To pass file descriptors or credentials you need to send/read at
-   * least on byte" (man 7 unix)
-   */
-  vec.iov_base = &sendchar;
-  vec.iov_len = sizeof(sendchar);
-  retval = sendmsg(sock_fd, &msg, 0);
-  if (retval != 1)
+  if (send_fd != -1)
+  {
+    struct cmsghdr* p_cmsg;
+    int* p_fds;
+    msg.msg_control = cmsgbuf;
+    msg.msg_controllen = sizeof(cmsgbuf);
+    p_cmsg = CMSG_FIRSTHDR(&msg);
+    p_cmsg->cmsg_level = SOL_SOCKET;
+    p_cmsg->cmsg_type = SCM_RIGHTS;
+    p_cmsg->cmsg_len = CMSG_LEN(sizeof(send_fd));
+    p_fds = (int*)CMSG_DATA(p_cmsg);
+    *p_fds = send_fd;
+    msg.msg_controllen = p_cmsg->cmsg_len;
+  }
+  while (1)
   {
-    die("sendmsg");
+    int retval = sendmsg(sock_fd, &msg, 0);
+    int saved_errno = errno;
+    vsf_sysutil_check_pending_actions(kVSFSysUtilIO, retval, sock_fd);
+    if (retval < 0 && saved_errno == EINTR)
+    {
+      continue;
+    }
+    return retval;
   }
 }
 
 int
-vsf_sysutil_recv_fd(const int sock_fd)
+vsf_sysutil_recv_msg(int sock_fd, void* p_buf, unsigned int len,
+                     int* p_recv_fd)
 {
   int retval;
   struct msghdr msg;
-  char recvchar;
   struct iovec vec;
-  int recv_fd;
-  char cmsgbuf[CMSG_SPACE(sizeof(recv_fd))];
+  char cmsgbuf[CMSG_SPACE(sizeof(int))];
   struct cmsghdr* p_cmsg;
   int* p_fd;
-  vec.iov_base = &recvchar;
-  vec.iov_len = sizeof(recvchar);
+  *p_recv_fd = -1;
+  vec.iov_base = p_buf;
+  vec.iov_len = len;
   msg.msg_name = NULL;
   msg.msg_namelen = 0;
   msg.msg_iov = &vec;
@@ -1029,79 +1242,96 @@ vsf_sysutil_recv_fd(const int sock_fd)
   msg.msg_flags = 0;
   /* In case something goes wrong, set the fd to -1 before the syscall */
   p_fd = (int*)CMSG_DATA(CMSG_FIRSTHDR(&msg));
-  *p_fd = -1;  
-  retval = recvmsg(sock_fd, &msg, 0);
-  if (retval != 1)
+  *p_fd = -1;
+  while (1)
   {
-    die("recvmsg");
+    int saved_errno;
+    retval = recvmsg(sock_fd, &msg, 0);
+    saved_errno = errno;
+    vsf_sysutil_check_pending_actions(kVSFSysUtilIO, retval, sock_fd);
+    if (retval < 0 && saved_errno == EINTR)
+    {
+      continue;
+    }
+    break;
   }
-  p_cmsg = CMSG_FIRSTHDR(&msg);
-  if (p_cmsg == NULL)
+  if (retval <= 0)
   {
-    die("no passed fd");
+    return retval;
   }
-  /* We used to verify the returned cmsg_level, cmsg_type and cmsg_len here,
-   * but Linux 2.0 totally uselessly fails to fill these in.
-   */
-  p_fd = (int*)CMSG_DATA(p_cmsg);
-  recv_fd = *p_fd;
-  if (recv_fd == -1)
+  p_cmsg = CMSG_FIRSTHDR(&msg);
+  if (p_cmsg != NULL)
   {
-    die("no passed fd");
+    /* We used to verify the returned cmsg_level, cmsg_type and cmsg_len here,
+     * but Linux 2.0 totally uselessly fails to fill these in.
+     */
+    p_fd = (int*)CMSG_DATA(p_cmsg);
+    *p_recv_fd = *p_fd;
   }
-  return recv_fd;
+  return retval;
 }
 
 #else /* !VSF_SYSDEP_NEED_OLD_FD_PASSING */
 
-void
-vsf_sysutil_send_fd(int sock_fd, int send_fd)
+int
+vsf_sysutil_send_msg(int sock_fd, const void* p_buf, unsigned int len,
+                     int send_fd)
 {
-  int retval;
-  char send_char = 0;
   struct msghdr msg;
   struct iovec vec;
-  vec.iov_base = &send_char;
-  vec.iov_len = 1;
+  vec.iov_base = (caddr_t) p_buf;
+  vec.iov_len = len;
   msg.msg_name = NULL;
   msg.msg_namelen = 0;
   msg.msg_iov = &vec;
   msg.msg_iovlen = 1;
-  msg.msg_accrights = (caddr_t) &send_fd;
-  msg.msg_accrightslen = sizeof(send_fd);
-  retval = sendmsg(sock_fd, &msg, 0);
-  if (retval != 1)
+  msg.msg_accrights = NULL;
+  msg.msg_accrightslen = 0;
+  if (send_fd != -1)
+  {
+    msg.msg_accrights = (caddr_t) &send_fd;
+    msg.msg_accrightslen = sizeof(send_fd);
+  }
+  while (1)
   {
-    die("sendmsg");
+    int retval = sendmsg(sock_fd, &msg, 0);
+    int saved_errno = errno;
+    vsf_sysutil_check_pending_actions(kVSFSysUtilIO, retval, sock_fd);
+    if (retval < 0 && saved_errno == EINTR)
+    {
+      continue;
+    }
+    return retval;
   }
 }
 
 int
-vsf_sysutil_recv_fd(int sock_fd)
+vsf_sysutil_recv_msg(int sock_fd, void* p_buf, unsigned int len,
+                     int* p_recv_fd)
 {
-  int retval;
   struct msghdr msg;
   struct iovec vec;
-  char recv_char;
   int recv_fd = -1;
-  vec.iov_base = &recv_char;
-  vec.iov_len = 1;
+  vec.iov_base = (caddr_t) p_buf;
+  vec.iov_len = len;
   msg.msg_name = NULL;
   msg.msg_namelen = 0;
   msg.msg_iov = &vec;
   msg.msg_iovlen = 1;
   msg.msg_accrights = (caddr_t) &recv_fd;
   msg.msg_accrightslen = sizeof(recv_fd);
-  retval = recvmsg(sock_fd, &msg, 0);
-  if (retval != 1)
-  {
-    die("recvmsg");
-  }
-  if (recv_fd == -1)
+  while (1)
   {
-    die("no passed fd");
+    int retval = recvmsg(sock_fd, &msg, 0);
+    int saved_errno = errno;
+    vsf_sysutil_check_pending_actions(kVSFSysUtilIO, retval, sock_fd);
+    if (retval < 0 && saved_errno == EINTR)
+    {
+      continue;
+    }
+    *p_recv_fd = recv_fd;
+    return retval;
   }
-  return recv_fd;
 }
 
 #endif /* !VSF_SYSDEP_NEED_OLD_FD_PASSING */
@@ -1190,3 +1420,344 @@ vsf_remove_uwtmp(void)
 
 #endif /* !VSF_SYSDEP_HAVE_UTMPX */
 
+long
+vsf_sysutil_statbuf_get_mtime_nsec(
+  const struct vsf_sysutil_statbuf* p_statbuf)
+{
+#ifdef VSF_SYSDEP_HAVE_STAT_NSEC
+  const struct stat* p_stat = (const struct stat*) p_statbuf;
+  return (long) p_stat->st_mtim.tv_nsec;
+#else
+  (void) p_statbuf;
+  return 0;
+#endif
+}
+
+void
+vsf_sysutil_set_cpu_affinity(unsigned int cpu)
+{
+#ifdef VSF_SYSDEP_HAVE_SCHED_AFFINITY
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  /* Just a performance hint, e.g. the CPU may be offline or not ours */
+  (void) sched_setaffinity(0, sizeof(cpus), &cpus);
+#else
+  (void) cpu;
+#endif
+}
+
+void
+vsf_sysutil_exit_with_parent(void)
+{
+#ifdef VSF_SYSDEP_HAVE_PDEATHSIG
+  int retval = prctl(PR_SET_PDEATHSIG, SIGTERM, 0, 0, 0);
+  if (retval != 0)
+  {
+    die("prctl");
+  }
+#endif
+}
+
+/* The upload hints below only ever help; a failure, or an offset too big
+ * for a 32-bit off_t, just means doing without.
+ */
+static int
+offsets_fit(filesize_t offset, filesize_t len)
+{
+  filesize_t end = offset + len;
+  return offset >= 0 && len > 0 && (filesize_t) (off_t) end == end;
+}
+
+void
+vsf_sysutil_preallocate(int fd, filesize_t offset, filesize_t len)
+{
+#ifdef VSF_SYSDEP_HAVE_FALLOCATE
+  /* Never reserve more than is free, so that a reservation can't fill the
+   * disk. A quota is enforced by fallocate() itself.
+   */
+  struct statvfs fs_stat;
+  if (fstatvfs(fd, &fs_stat) != 0)
+  {
+    return;
+  }
+  if (fs_stat.f_frsize > 0 &&
+      (filesize_t) fs_stat.f_bavail < len / (filesize_t) fs_stat.f_frsize)
+  {
+    len = (filesize_t) fs_stat.f_bavail * fs_stat.f_frsize;
+  }
+  /* KEEP_SIZE, so that the file only grows as data actually arrives */
+  if (offsets_fit(offset, len))
+  {
+    (void) fallocate(fd, FALLOC_FL_KEEP_SIZE, (off_t) offset, (off_t) len);
+  }
+#else
+  (void) fd;
+  (void) offset;
+  (void) len;
+#endif
+}
+
+void
+vsf_sysutil_start_writeback(int fd, filesize_t offset, filesize_t len)
+{
+#ifdef VSF_SYSDEP_HAVE_SYNC_FILE_RANGE
+  if (offsets_fit(offset, len))
+  {
+    (void) sync_file_range(fd, offset, len, SYNC_FILE_RANGE_WRITE);
+  }
+#else
+  (void) fd;
+  (void) offset;
+  (void) len;
+#endif
+}
+
+void
+vsf_sysutil_finish_writeback(int fd, filesize_t offset, filesize_t len)
+{
+  if (!offsets_fit(offset, len))
+  {
+    return;
+  }
+#ifdef VSF_SYSDEP_HAVE_SYNC_FILE_RANGE
+  (void) sync_file_range(fd, offset, len, SYNC_FILE_RANGE_WAIT_BEFORE |
+                                          SYNC_FILE_RANGE_WRITE |
+                                          SYNC_FILE_RANGE_WAIT_AFTER);
+#endif
+  /* Clean now, so the pages can really go */
+  vsf_sysutil_advise(fd, offset, len, kVSFSysUtilAdviceDontNeed);
+}
+
+void
+vsf_sysutil_advise(int fd, filesize_t offset, filesize_t len,
+                   enum EVSFSysUtilAdvice advice)
+{
+#if defined(POSIX_FADV_SEQUENTIAL) && defined(POSIX_FADV_WILLNEED) && \
+    defined(POSIX_FADV_DONTNEED)
+  int how = 0;
+  if (!offsets_fit(offset, len))
+  {
+    return;
+  }
+  switch (advice)
+  {
+    case kVSFSysUtilAdviceSequential:
+      how = POSIX_FADV_SEQUENTIAL;
+      break;
+    case kVSFSysUtilAdviceWillNeed:
+      how = POSIX_FADV_WILLNEED;
+      break;
+    case kVSFSysUtilAdviceDontNeed:
+      how = POSIX_FADV_DONTNEED;
+      break;
+    default:
+      bug("unknown advice in vsf_sysutil_advise");
+      break;
+  }
+  (void) posix_fadvise(fd, (off_t) offset, (off_t) len, how);
+#else
+  (void) fd;
+  (void) offset;
+  (void) len;
+  (void) advice;
+#endif
+}
+
+int
+vsf_sysutil_syncfs(int fd)
+{
+#ifdef VSF_SYSDEP_HAVE_SYNCFS
+  if (syncfs(fd) == 0)
+  {
+    return 0;
+  }
+#endif
+  return vsf_sysutil_fsync(fd);
+}
+
+int
+vsf_sysutil_copy_file(int src_fd, int dst_fd)
+{
+  static char* s_p_buf;
+  int flags;
+  /* Our files are created O_APPEND, which rules out both cloning and copying
+   * in the kernel. The copy writes from the start anyway.
+   */
+  flags = fcntl(dst_fd, F_GETFL);
+  if (flags < 0 || fcntl(dst_fd, F_SETFL, flags & ~O_APPEND) != 0)
+  {
+    return -1;
+  }
+#ifdef VSF_SYSDEP_HAVE_FICLONE
+  /* Sharing the blocks, where the filesystem can, costs no I/O at all */
+  if (ioctl(dst_fd, FICLONE, src_fd) == 0)
+  {
+    return 0;
+  }
+#endif
+#ifdef VSF_SYSDEP_HAVE_COPY_FILE_RANGE
+  while (1)
+  {
+    ssize_t retval = copy_file_range(src_fd, NULL, dst_fd, NULL,
+                                     VSFTP_COPY_CHUNK, 0);
+    int saved_errno = errno;
+    vsf_sysutil_check_pending_actions(kVSFSysUtilIO, (int) retval, dst_fd);
+    if (retval == 0)
+    {
+      return 0;
+    }
+    if (retval > 0 || saved_errno == EINTR)
+    {
+      continue;
+    }
+    /* Across filesystems (before Linux 5.3), or a filesystem which can't:
+     * carry on by hand from wherever we got to
+     */
+    if (saved_errno == EXDEV || saved_errno == ENOSYS ||
+        saved_errno == EINVAL || saved_errno == EOPNOTSUPP)
+    {
+      break;
+    }
+    return -1;
+  }
+#endif
+  if (s_p_buf == 0)
+  {
+    vsf_secbuf_alloc(&s_p_buf, VSFTP_DATA_BUFSIZE);
+  }
+  while (1)
+  {
+    int retval = vsf_sysutil_read(src_fd, s_p_buf, VSFTP_DATA_BUFSIZE);
+    if (retval == 0)
+    {
+      return 0;
+    }
+    if (vsf_sysutil_retval_is_error(retval) ||
+        vsf_sysutil_write_loop(dst_fd, s_p_buf, (unsigned int) retval) !=
+          retval)
+    {
+      return -1;
+    }
+  }
+}
+
+int
+vsf_sysutil_write_more(const int fd, const void* p_buf, unsigned int size)
+{
+#ifdef MSG_MORE
+  unsigned int num_written = 0;
+  while (num_written < size)
+  {
+    int retval = send(fd, (const char*) p_buf + num_written,
+                      size - num_written, MSG_MORE);
+    int saved_errno = errno;
+    vsf_sysutil_check_pending_actions(kVSFSysUtilIO, retval, fd);
+    if (retval < 0 && saved_errno == EINTR)
+    {
+      continue;
+    }
+    if (retval <= 0)
+    {
+      return -1;
+    }
+    num_written += (unsigned int) retval;
+  }
+  return (int) num_written;
+#else
+  return vsf_sysutil_write_loop(fd, p_buf, size);
+#endif
+}
+
+#ifdef VSF_SYSDEP_HAVE_TCP_INFO
+static unsigned int s_tcp_autotune_max[2];
+
+static unsigned int
+read_tcp_mem_max(const char* p_filename)
+{
+  /* "min default max", in bytes */
+  char buf[128];
+  unsigned int val = 0;
+  unsigned int field = 0;
+  int i;
+  int len;
+  int fd = vsf_sysutil_open_file(p_filename, kVSFSysUtilOpenReadOnly);
+  if (vsf_sysutil_retval_is_error(fd))
+  {
+    return 0;
+  }
+  len = vsf_sysutil_read(fd, buf, sizeof(buf) - 1);
+  vsf_sysutil_close(fd);
+  if (len <= 0)
+  {
+    return 0;
+  }
+  for (i = 0; i < len; i++)
+  {
+    if (buf[i] >= '0' && buf[i] <= '9')
+    {
+      val = val * 10 + (unsigned int) (buf[i] - '0');
+    }
+    else if (i > 0 && buf[i - 1] >= '0' && buf[i - 1] <= '9')
+    {
+      if (++field == 3)
+      {
+        return val;
+      }
+      val = 0;
+    }
+  }
+  return 0;
+}
+#endif
+
+void
+vsf_sysutil_load_tcp_autotune_max(void)
+{
+#ifdef VSF_SYSDEP_HAVE_TCP_INFO
+  s_tcp_autotune_max[0] = read_tcp_mem_max("/proc/sys/net/ipv4/tcp_wmem");
+  s_tcp_autotune_max[1] = read_tcp_mem_max("/proc/sys/net/ipv4/tcp_rmem");
+#endif
+}
+
+unsigned int
+vsf_sysutil_get_tcp_autotune_max(int is_recv)
+{
+#ifdef VSF_SYSDEP_HAVE_TCP_INFO
+  return s_tcp_autotune_max[is_recv != 0];
+#else
+  (void) is_recv;
+  return 0;
+#endif
+}
+
+unsigned int
+vsf_sysutil_get_tcp_rtt(int fd)
+{
+#ifdef VSF_SYSDEP_HAVE_TCP_INFO
+  struct tcp_info info;
+  socklen_t len = sizeof(info);
+  vsf_sysutil_memclr(&info, sizeof(info));
+  if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0)
+  {
+    return 0;
+  }
+  return info.tcpi_rtt;
+#else
+  (void) fd;
+  return 0;
+#endif
+}
+
+void
+vsf_sysutil_set_notsent_lowat(int fd, unsigned int bytes)
+{
+#ifdef VSF_SYSDEP_HAVE_NOTSENT_LOWAT
+  int lowat = (int) bytes;
+  (void) setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat,
+                    sizeof(lowat));
+#else
+  (void) fd;
+  (void) bytes;
+#endif
+}
@@ -12,12 +12,28 @@
  */
 
 struct mystr;
+struct vsf_sysutil_statbuf;
 
 /* Authentication of local users */
 /* Return 0 for fail, 1 for success */
 int vsf_sysdep_check_auth(const struct mystr* p_user,
                           const struct mystr* p_pass,
                           const struct mystr* p_remote_host);
+/* As vsf_sysdep_check_auth(), but for a user already vouched for by an
+ * auth_workers process: just set up credentials and the session (PAM
+ * session, utmp and wtmp), if any.
+ */
+int vsf_sysdep_open_auth_session(const struct mystr* p_user,
+                                 const struct mystr* p_remote_host);
+/* For auth_workers processes: check the password and that the account may
+ * log in, but set up no session. Each call has a PAM handle of its own;
+ * vsf_sysdep_init_verify_auth() loads the modules up front and keeps them
+ * loaded, so that starting one is cheap.
+ */
+void vsf_sysdep_init_verify_auth(void);
+int vsf_sysdep_verify_auth(const struct mystr* p_user,
+                           const struct mystr* p_pass,
+                           const struct mystr* p_remote_host);
 
 /* Support for fine grained privilege (capabilities) */
 int vsf_sysdep_has_capabilities(void);
@@ -38,6 +54,29 @@ int vsf_sysutil_sendfile(const int out_fd, const int in_fd,
                          filesize_t* p_offset, filesize_t num_send,
                          unsigned int max_chunk);
 
+/* Writes a few bytes to a socket, to go out together with whatever is written
+ * next (e.g. a header followed by a sendfile()) rather than in a little
+ * packet of their own, where the system can. Returns the bytes written, or
+ * -1 on error.
+ */
+int vsf_sysutil_write_more(const int fd, const void* p_buf, unsigned int size);
+
+/* TCP details of a connected socket. The first returns the smoothed round
+ * trip time in microseconds, or 0 if the system can't tell us. The second
+ * limits how much unsent data the kernel queues (TCP_NOTSENT_LOWAT), and does
+ * nothing on systems without support.
+ */
+unsigned int vsf_sysutil_get_tcp_rtt(int fd);
+void vsf_sysutil_set_notsent_lowat(int fd, unsigned int bytes);
+
+/* The most the kernel lets a TCP send (or, with is_recv set, receive) buffer
+ * grow to by itself, i.e. the last field of net.ipv4.tcp_wmem (tcp_rmem) on
+ * Linux. The first function reads them, and must be called before any
+ * chroot(); the second returns 0 if they are not known.
+ */
+void vsf_sysutil_load_tcp_autotune_max(void);
+unsigned int vsf_sysutil_get_tcp_autotune_max(int is_recv);
+
 /* Support for changing the process name as reported by the operating system.
  * A useful status monitor. NOTE - we don't guarantee that this call will
  * have any effect.
@@ -50,10 +89,63 @@ void vsf_sysutil_set_proctitle_prefix(const struct mystr* p_str);
 /* For now, maps read/write private pages. API to be extended.. */
 void vsf_sysutil_map_anon_pages_init(void);
 void* vsf_sysutil_map_anon_pages(unsigned int length);
+/* Zero filled read/write pages which stay shared with any children we fork */
+void* vsf_sysutil_map_shared_pages(unsigned int length);
+
+/* Message sending/receiving over a UNIX socket, with optional file
+ * descriptor passing. A "send_fd" of -1 means none; "p_recv_fd" is set to -1
+ * if no descriptor arrived. Both return what sendmsg() / recvmsg() return.
+ */
+int vsf_sysutil_send_msg(int sock_fd, const void* p_buf, unsigned int len,
+                         int send_fd);
+int vsf_sysutil_recv_msg(int sock_fd, void* p_buf, unsigned int len,
+                         int* p_recv_fd);
+
+/* The sub-second part of a modification time, or 0 where the system does
+ * not record one.
+ */
+long vsf_sysutil_statbuf_get_mtime_nsec(
+  const struct vsf_sysutil_statbuf* p_stat);
 
-/* File descriptor passing/receiving */
-void vsf_sysutil_send_fd(int sock_fd, int send_fd);
-int vsf_sysutil_recv_fd(int sock_fd);
+/* Scheduling hints for listener shards. Both do nothing on systems without
+ * support. The second asks for SIGTERM when our parent exits.
+ */
+void vsf_sysutil_set_cpu_affinity(unsigned int cpu);
+void vsf_sysutil_exit_with_parent(void);
+
+
+/* Hints for files being uploaded, which do nothing on systems without
+ * support. The first reserves disk space, up to what is free, without
+ * changing the file size. The second starts writing out a range of dirty
+ * pages; the third waits for a range to be written and drops it from the
+ * page cache.
+ */
+void vsf_sysutil_preallocate(int fd, filesize_t offset, filesize_t len);
+void vsf_sysutil_start_writeback(int fd, filesize_t offset, filesize_t len);
+void vsf_sysutil_finish_writeback(int fd, filesize_t offset, filesize_t len);
+
+/* Page cache hints for a range of an open file; again, nothing happens on
+ * systems without support.
+ */
+enum EVSFSysUtilAdvice
+{
+  kVSFSysUtilAdviceSequential = 1,
+  kVSFSysUtilAdviceWillNeed,
+  kVSFSysUtilAdviceDontNeed
+};
+void vsf_sysutil_advise(int fd, filesize_t offset, filesize_t len,
+                        enum EVSFSysUtilAdvice advice);
+
+/* Flushes the whole filesystem holding an open file to disk, where that can
+ * be done in one go; otherwise just the file itself. Returns 0 on success.
+ */
+int vsf_sysutil_syncfs(int fd);
+
+/* Copies the whole of one open file into another, empty one: by sharing the
+ * data blocks (a reflink) where the filesystem can, else inside the kernel,
+ * else by reading and writing. Returns 0 on success.
+ */
+int vsf_sysutil_copy_file(int src_fd, int dst_fd);
 
 #endif /* VSF_SYSDEPUTIL_H */
 
@@ -130,6 +130,12 @@ str_rename(const struct mystr* p_from_str, const struct mystr* p_to_str)
   return vsf_sysutil_rename(str_getbuf(p_from_str), str_getbuf(p_to_str));
 }
 
+int
+str_link(const struct mystr* p_from_str, const struct mystr* p_to_str)
+{
+  return vsf_sysutil_link(str_getbuf(p_from_str), str_getbuf(p_to_str));
+}
+
 struct vsf_sysutil_dir*
 str_opendir(const struct mystr* p_str)
 {
@@ -28,6 +28,7 @@ int str_chmod(const struct mystr* p_str, unsigned int mode);
 int str_stat(const struct mystr* p_str, struct vsf_sysutil_statbuf** p_ptr);
 int str_lstat(const struct mystr* p_str, struct vsf_sysutil_statbuf** p_ptr);
 int str_rename(const struct mystr* p_from_str, const struct mystr* p_to_str);
+int str_link(const struct mystr* p_from_str, const struct mystr* p_to_str);
 struct vsf_sysutil_dir* str_opendir(const struct mystr* p_str);
 void str_next_dirent(struct mystr* p_filename_str,
                      struct vsf_sysutil_dir* p_dir);
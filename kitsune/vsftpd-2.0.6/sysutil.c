@@ -22,6 +22,12 @@
 #define _LARGEFILE64_SOURCE 1
 #define _LARGE_FILES 1
 
+/* For accept4(). Must come before <sys/socket.h>, but after <features.h>,
+ * which would clear it.
+ */
+#include <limits.h>
+#define __USE_GNU
+
 /* For Linux, this adds nothing :-) */
 #include "port/porting_junk.h"
 
@@ -31,6 +37,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -45,6 +52,7 @@
 #include <ctype.h>
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 /* Must be before netinet/ip.h. Found on FreeBSD, Solaris */
 #include <netinet/in_systm.h>
 #include <netinet/ip.h>
@@ -297,6 +305,13 @@ vsf_sysutil_unblock_sig(const enum EVSFSysUtilSignal sig)
     die("sigprocmask");
   }
 }
+
+void
+vsf_sysutil_send_sig(const int pid, const enum EVSFSysUtilSignal sig)
+{
+  /* The target may well have gone already; not our problem */
+  (void) kill(pid, vsf_sysutil_translate_sig(sig));
+}
 void
 vsf_sysutil_install_io_handler(vsf_context_io_t handler, void* p_private)
 {
@@ -434,6 +449,79 @@ vsf_sysutil_write_loop(const int fd, const void* p_buf, unsigned int size)
   }
 }
 
+int
+vsf_sysutil_writev_loop(const int fd, struct vsf_sysutil_iovec* p_iov,
+                        unsigned int count)
+{
+  /* Conservative; POSIX only promises 16 */
+  enum { kMaxVecs = 64 };
+  struct iovec vecs[kMaxVecs];
+  int num_written = 0;
+  while (1)
+  {
+    unsigned int num_vecs = 0;
+    unsigned int left;
+    int retval;
+    int saved_errno;
+    while (count > 0 && p_iov->len == 0)
+    {
+      p_iov++;
+      count--;
+    }
+    if (count == 0)
+    {
+      /* Hit the write target, cool. */
+      return num_written;
+    }
+    while (num_vecs < count && num_vecs < kMaxVecs)
+    {
+      vecs[num_vecs].iov_base = (void*) p_iov[num_vecs].p_base;
+      vecs[num_vecs].iov_len = p_iov[num_vecs].len;
+      num_vecs++;
+    }
+    retval = writev(fd, vecs, (int) num_vecs);
+    saved_errno = errno;
+    vsf_sysutil_check_pending_actions(kVSFSysUtilIO, retval, fd);
+    if (retval < 0 && saved_errno == EINTR)
+    {
+      continue;
+    }
+    if (retval < 0)
+    {
+      /* Error */
+      return retval;
+    }
+    else if (retval == 0)
+    {
+      /* Written all we're going to write.. */
+      return num_written;
+    }
+    if (num_written > INT_MAX - retval)
+    {
+      die("size too big in vsf_sysutil_writev_loop");
+    }
+    num_written += retval;
+    /* Step past what went out */
+    left = (unsigned int) retval;
+    while (left > 0)
+    {
+      unsigned int num = p_iov->len;
+      if (num > left)
+      {
+        num = left;
+      }
+      p_iov->p_base = (const char*) p_iov->p_base + num;
+      p_iov->len -= num;
+      left -= num;
+      if (p_iov->len == 0)
+      {
+        p_iov++;
+        count--;
+      }
+    }
+  }
+}
+
 filesize_t
 vsf_sysutil_get_file_offset(const int file_fd)
 {
@@ -460,6 +548,18 @@ vsf_sysutil_lseek_to(const int fd, filesize_t seek_pos)
   }
 }
 
+int
+vsf_sysutil_ftruncate(const int fd, filesize_t length)
+{
+  return ftruncate(fd, length);
+}
+
+int
+vsf_sysutil_fsync(const int fd)
+{
+  return fsync(fd);
+}
+
 void*
 vsf_sysutil_malloc(unsigned int size)
 {
@@ -513,6 +613,20 @@ vsf_sysutil_getpid(void)
   return (unsigned int) s_current_pid;
 }
 
+unsigned int
+vsf_sysutil_get_num_cpus(void)
+{
+  long retval = -1;
+#ifdef _SC_NPROCESSORS_ONLN
+  retval = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if (retval < 1)
+  {
+    retval = 1;
+  }
+  return (unsigned int) retval;
+}
+
 int
 vsf_sysutil_fork(void)
 {
@@ -644,6 +758,23 @@ vsf_sysutil_activate_reuseaddr(int fd)
   }
 }
 
+void
+vsf_sysutil_activate_reuseport(int fd)
+{
+#ifdef SO_REUSEPORT
+  int reuseport = 1;
+  int retval = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuseport,
+                          sizeof(reuseport));
+  if (retval != 0)
+  {
+    die("setsockopt: reuseport");
+  }
+#else
+  (void) fd;
+  die("SO_REUSEPORT not supported");
+#endif
+}
+
 void
 vsf_sysutil_set_nodelay(int fd)
 {
@@ -656,6 +787,19 @@ vsf_sysutil_set_nodelay(int fd)
   }
 }
 
+void
+vsf_sysutil_set_fastopen(int fd, unsigned int queue_len)
+{
+#ifdef TCP_FASTOPEN
+  int qlen = (int) queue_len;
+  /* Only an optimisation; the kernel may not have it switched on */
+  (void) setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen));
+#else
+  (void) fd;
+  (void) queue_len;
+#endif
+}
+
 void
 vsf_sysutil_activate_sigurg(int fd)
 {
@@ -687,13 +831,47 @@ vsf_sysutil_set_iptos_throughput(int fd)
 }
 
 void
-vsf_sysutil_activate_linger(int fd)
+vsf_sysutil_set_sockbuf_size(int fd, int is_recv, unsigned int size)
+{
+  int bufsize = (int) size;
+  /* Only a hint; the kernel caps it at its own maximum anyway */
+  (void) setsockopt(fd, SOL_SOCKET, is_recv ? SO_RCVBUF : SO_SNDBUF,
+                    &bufsize, sizeof(bufsize));
+}
+
+void
+vsf_sysutil_set_io_timeout(int fd, unsigned int seconds)
+{
+  int retval;
+  struct timeval the_timeout;
+  vsf_sysutil_memclr(&the_timeout, sizeof(the_timeout));
+  the_timeout.tv_sec = seconds;
+  retval = setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &the_timeout,
+                      sizeof(the_timeout));
+  if (retval != 0)
+  {
+    die("setsockopt: rcvtimeo");
+  }
+  retval = setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &the_timeout,
+                      sizeof(the_timeout));
+  if (retval != 0)
+  {
+    die("setsockopt: sndtimeo");
+  }
+}
+
+void
+vsf_sysutil_activate_linger(int fd, unsigned int seconds)
 {
   int retval;
   struct linger the_linger;
   vsf_sysutil_memclr(&the_linger, sizeof(the_linger));
   the_linger.l_onoff = 1;
   the_linger.l_linger = 32767;
+  if (seconds > 0 && seconds < 32767)
+  {
+    the_linger.l_linger = (int) seconds;
+  }
   retval = setsockopt(fd, SOL_SOCKET, SO_LINGER, &the_linger,
                       sizeof(the_linger));
   if (retval != 0)
@@ -959,6 +1137,12 @@ vsf_sysutil_rename(const char* p_from, const char* p_to)
   return rename(p_from, p_to);
 }
 
+int
+vsf_sysutil_link(const char* p_from, const char* p_to)
+{
+  return link(p_from, p_to);
+}
+
 struct vsf_sysutil_dir*
 vsf_sysutil_opendir(const char* p_dirname)
 {
@@ -1088,6 +1272,9 @@ vsf_sysutil_translate_memprot(const enum EVSFSysUtilMapPermission perm)
     case kVSFSysUtilMapProtNone:
       retval = PROT_NONE;
       break;
+    case kVSFSysUtilMapProtReadWrite:
+      retval = PROT_READ | PROT_WRITE;
+      break;
     default:
       bug("bad value in vsf_sysutil_translate_memprot");
       break;
@@ -1117,6 +1304,58 @@ vsf_sysutil_memunmap(void* p_start, unsigned int length)
   }
 }
 
+void*
+vsf_sysutil_map_new_shared_file(const char* p_filename, unsigned int length,
+                                unsigned int mode)
+{
+  void* p_ret;
+  int fd;
+  /* O_EXCL so we never follow a planted symlink */
+  (void) unlink(p_filename);
+  fd = open(p_filename, O_CREAT | O_EXCL | O_RDWR, mode);
+  if (fd < 0)
+  {
+    die2("cannot create file: ", p_filename);
+  }
+  if (ftruncate(fd, (off_t) length) != 0)
+  {
+    die("ftruncate");
+  }
+  p_ret = mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p_ret == MAP_FAILED)
+  {
+    die("mmap");
+  }
+  vsf_sysutil_close(fd);
+  return p_ret;
+}
+
+const void*
+vsf_sysutil_map_file_readonly(const char* p_filename, unsigned int* p_length)
+{
+  struct stat the_stat;
+  void* p_ret;
+  int fd = open(p_filename, O_RDONLY);
+  if (fd < 0)
+  {
+    return 0;
+  }
+  if (fstat(fd, &the_stat) != 0 || the_stat.st_size <= 0 ||
+      (filesize_t) the_stat.st_size > (filesize_t) INT_MAX)
+  {
+    vsf_sysutil_close(fd);
+    return 0;
+  }
+  *p_length = (unsigned int) the_stat.st_size;
+  p_ret = mmap(0, *p_length, PROT_READ, MAP_SHARED, fd, 0);
+  vsf_sysutil_close(fd);
+  if (p_ret == MAP_FAILED)
+  {
+    return 0;
+  }
+  return p_ret;
+}
+
 static int
 vsf_sysutil_translate_openmode(const enum EVSFSysUtilOpenMode mode)
 {
@@ -1445,6 +1684,34 @@ vsf_sysutil_statbuf_get_sortkey_mtime(
   return intbuf;
 }
 
+long
+vsf_sysutil_statbuf_get_mtime(const struct vsf_sysutil_statbuf* p_statbuf)
+{
+  const struct stat* p_stat = (const struct stat*) p_statbuf;
+  return (long) p_stat->st_mtime;
+}
+
+long
+vsf_sysutil_statbuf_get_ctime(const struct vsf_sysutil_statbuf* p_statbuf)
+{
+  const struct stat* p_stat = (const struct stat*) p_statbuf;
+  return (long) p_stat->st_ctime;
+}
+
+filesize_t
+vsf_sysutil_statbuf_get_inode(const struct vsf_sysutil_statbuf* p_statbuf)
+{
+  const struct stat* p_stat = (const struct stat*) p_statbuf;
+  return (filesize_t) p_stat->st_ino;
+}
+
+filesize_t
+vsf_sysutil_statbuf_get_dev(const struct vsf_sysutil_statbuf* p_statbuf)
+{
+  const struct stat* p_stat = (const struct stat*) p_statbuf;
+  return (filesize_t) p_stat->st_dev;
+}
+
 void
 vsf_sysutil_fchown(const int fd, const int uid, const int gid)
 {
@@ -1569,6 +1836,9 @@ vsf_sysutil_get_error(void)
     case EOPNOTSUPP:
       retval = kVSFSysUtilErrOPNOTSUPP;
       break;
+    case EAGAIN:
+      retval = kVSFSysUtilErrAGAIN;
+      break;
   }
   return retval;
 }
@@ -1610,6 +1880,62 @@ vsf_sysutil_unix_stream_socketpair(void)
   return retval;
 }
 
+struct vsf_sysutil_socketpair_retval
+vsf_sysutil_unix_dgram_socketpair(void)
+{
+  struct vsf_sysutil_socketpair_retval retval;
+  int the_sockets[2];
+  int sys_retval = socketpair(PF_UNIX, SOCK_DGRAM, 0, the_sockets);
+  if (sys_retval != 0)
+  {
+    die("socketpair");
+  }
+  retval.socket_one = the_sockets[0];
+  retval.socket_two = the_sockets[1];
+  return retval;
+}
+
+int
+vsf_sysutil_get_unix_listen_sock(const char* p_path, unsigned int backlog)
+{
+  struct sockaddr_un the_addr;
+  unsigned int old_umask;
+  int retval;
+  int fd;
+  if (vsf_sysutil_strlen(p_path) >= sizeof(the_addr.sun_path))
+  {
+    die2("unix socket path too long: ", p_path);
+  }
+  vsf_sysutil_memclr(&the_addr, sizeof(the_addr));
+  the_addr.sun_family = AF_UNIX;
+  vsf_sysutil_strcpy(the_addr.sun_path, p_path, sizeof(the_addr.sun_path));
+  fd = socket(PF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    die("socket");
+  }
+  /* Clear out any stale socket from a previous run */
+  (void) unlink(p_path);
+  /* Only whoever started us may connect */
+  old_umask = umask(077);
+  retval = bind(fd, (struct sockaddr*) &the_addr, sizeof(the_addr));
+  (void) umask(old_umask);
+  if (retval != 0)
+  {
+    die2("could not bind unix socket: ", p_path);
+  }
+  vsf_sysutil_listen(fd, backlog);
+  return fd;
+}
+
+int
+vsf_sysutil_accept_unix(int fd)
+{
+  int retval = accept(fd, NULL, NULL);
+  vsf_sysutil_check_pending_actions(kVSFSysUtilUnknown, 0, 0);
+  return retval;
+}
+
 int
 vsf_sysutil_bind(int fd, const struct vsf_sysutil_sockaddr* p_sockptr)
 {
@@ -1640,6 +1966,33 @@ vsf_sysutil_listen(int fd, const unsigned int backlog)
   }
 }
 
+/* accept() which also marks the new socket close-on-exec, in the same system
+ * call where there is one. Otherwise just a plain accept().
+ */
+static int
+accept_cloexec(int fd, struct sockaddr* p_sockaddr, unsigned int* p_socklen)
+{
+  socklen_t socklen = *p_socklen;
+  int retval;
+#ifdef SOCK_CLOEXEC
+  static int s_no_accept4;
+  if (!s_no_accept4)
+  {
+    retval = accept4(fd, p_sockaddr, &socklen, SOCK_CLOEXEC);
+    if (retval >= 0 || errno != ENOSYS)
+    {
+      *p_socklen = socklen;
+      return retval;
+    }
+    /* Built on a newer system than we run on */
+    s_no_accept4 = 1;
+  }
+#endif
+  retval = accept(fd, p_sockaddr, &socklen);
+  *p_socklen = socklen;
+  return retval;
+}
+
 /* Warning: callers of this function assume it does NOT make use of any
  * non re-entrant calls such as malloc().
  */
@@ -1675,7 +2028,7 @@ vsf_sysutil_accept_timeout(int fd, struct vsf_sysutil_sockaddr* p_sockaddr,
       return -1;
     }
   }
-  retval = accept(fd, &remote_addr.u.u_sockaddr, &socklen);
+  retval = accept_cloexec(fd, &remote_addr.u.u_sockaddr, &socklen);
   vsf_sysutil_check_pending_actions(kVSFSysUtilUnknown, 0, 0);
   if (retval < 0)
   {
@@ -1709,6 +2062,35 @@ vsf_sysutil_accept_timeout(int fd, struct vsf_sysutil_sockaddr* p_sockaddr,
   return retval;
 }
 
+/* Blocks until "fd1" or "fd2" is readable, returning that descriptor, or -1
+ * if a signal interrupted the wait. "fd1" wins if both are ready.
+ */
+int
+vsf_sysutil_wait_readable(int fd1, int fd2)
+{
+  fd_set read_fdset;
+  int max_fd = fd1;
+  int retval;
+  if (fd2 > max_fd)
+  {
+    max_fd = fd2;
+  }
+  FD_ZERO(&read_fdset);
+  FD_SET(fd1, &read_fdset);
+  FD_SET(fd2, &read_fdset);
+  retval = select(max_fd + 1, &read_fdset, NULL, NULL, NULL);
+  vsf_sysutil_check_pending_actions(kVSFSysUtilUnknown, 0, 0);
+  if (retval <= 0)
+  {
+    return -1;
+  }
+  if (FD_ISSET(fd1, &read_fdset))
+  {
+    return fd1;
+  }
+  return fd2;
+}
+
 int
 vsf_sysutil_connect_timeout(int fd, const struct vsf_sysutil_sockaddr* p_addr,
                             unsigned int wait_seconds)
@@ -1798,6 +2180,16 @@ vsf_sysutil_getsockname(int fd, struct vsf_sysutil_sockaddr** p_sockptr)
 
 void
 vsf_sysutil_getpeername(int fd, struct vsf_sysutil_sockaddr** p_sockptr)
+{
+  if (vsf_sysutil_getpeername_failok(fd, p_sockptr) != 0)
+  {
+    die("getpeername");
+  }
+}
+
+int
+vsf_sysutil_getpeername_failok(int fd,
+                               struct vsf_sysutil_sockaddr** p_sockptr)
 {
   struct vsf_sysutil_sockaddr the_addr;
   int retval;
@@ -1806,12 +2198,12 @@ vsf_sysutil_getpeername(int fd, struct vsf_sysutil_sockaddr** p_sockptr)
   retval = getpeername(fd, &the_addr.u.u_sockaddr, &socklen);
   if (retval != 0)
   {
-    die("getpeername");
+    return -1;
   }
   if (the_addr.u.u_sockaddr.sa_family != AF_INET &&
       the_addr.u.u_sockaddr.sa_family != AF_INET6)
   {
-    die("can only support ipv4 and ipv6 currently");
+    return -1;
   }
   vsf_sysutil_sockaddr_alloc(p_sockptr);
   if (socklen > sizeof(the_addr))
@@ -1819,6 +2211,7 @@ vsf_sysutil_getpeername(int fd, struct vsf_sysutil_sockaddr** p_sockptr)
     socklen = sizeof(the_addr);
   }
   vsf_sysutil_memcpy(*p_sockptr, &the_addr, socklen);
+  return 0;
 }
 
 void
@@ -2116,6 +2509,21 @@ vsf_sysutil_sockaddr_set_port(struct vsf_sysutil_sockaddr* p_sockptr,
   }
 }
 
+unsigned short
+vsf_sysutil_sockaddr_get_port(const struct vsf_sysutil_sockaddr* p_sockptr)
+{
+  if (p_sockptr->u.u_sockaddr.sa_family == AF_INET)
+  {
+    return ntohs(p_sockptr->u.u_sockaddr_in.sin_port);
+  }
+  else if (p_sockptr->u.u_sockaddr.sa_family == AF_INET6)
+  {
+    return ntohs(p_sockptr->u.u_sockaddr_in6.sin6_port);
+  }
+  bug("bad family");
+  return 0;
+}
+
 int
 vsf_sysutil_is_port_reserved(unsigned short the_port)
 {
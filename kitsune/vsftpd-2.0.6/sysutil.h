@@ -16,7 +16,8 @@ enum EVSFSysUtilError
   kVSFSysUtilErrNOSYS,
   kVSFSysUtilErrINTR,
   kVSFSysUtilErrINVAL,
-  kVSFSysUtilErrOPNOTSUPP
+  kVSFSysUtilErrOPNOTSUPP,
+  kVSFSysUtilErrAGAIN
 };
 enum EVSFSysUtilError vsf_sysutil_get_error(void);
 
@@ -54,6 +55,7 @@ void vsf_sysutil_check_pending_actions(
   const enum EVSFSysUtilInterruptContext context, int retval, int fd);
 void vsf_sysutil_block_sig(const enum EVSFSysUtilSignal sig);
 void vsf_sysutil_unblock_sig(const enum EVSFSysUtilSignal sig);
+void vsf_sysutil_send_sig(const int pid, const enum EVSFSysUtilSignal sig);
 
 /* Alarm setting/clearing utility functions */
 void vsf_sysutil_set_alarm(const unsigned int trigger_seconds);
@@ -65,6 +67,7 @@ int vsf_sysutil_mkdir(const char* p_dirname, const unsigned int mode);
 int vsf_sysutil_rmdir(const char* p_dirname);
 int vsf_sysutil_chdir(const char* p_dirname);
 int vsf_sysutil_rename(const char* p_from, const char* p_to);
+int vsf_sysutil_link(const char* p_from, const char* p_to);
 
 struct vsf_sysutil_dir;
 struct vsf_sysutil_dir* vsf_sysutil_opendir(const char* p_dirname);
@@ -97,6 +100,8 @@ int vsf_sysutil_write_access(const char* p_filename);
 /* Reading and writing */
 void vsf_sysutil_lseek_to(const int fd, filesize_t seek_pos);
 filesize_t vsf_sysutil_get_file_offset(const int file_fd);
+int vsf_sysutil_ftruncate(const int fd, filesize_t length);
+int vsf_sysutil_fsync(const int fd);
 int vsf_sysutil_read(const int fd, void* p_buf, const unsigned int size);
 int vsf_sysutil_write(const int fd, const void* p_buf,
                       const unsigned int size);
@@ -105,6 +110,17 @@ int vsf_sysutil_write(const int fd, const void* p_buf,
  */
 int vsf_sysutil_read_loop(const int fd, void* p_buf, unsigned int size);
 int vsf_sysutil_write_loop(const int fd, const void* p_buf, unsigned int size);
+/* Gather write of several buffers, likewise looping until all are written.
+ * The entries are advanced past whatever was written, so on error they
+ * describe what is left.
+ */
+struct vsf_sysutil_iovec
+{
+  const void* p_base;
+  unsigned int len;
+};
+int vsf_sysutil_writev_loop(const int fd, struct vsf_sysutil_iovec* p_iov,
+                            unsigned int count);
 
 struct vsf_sysutil_statbuf;
 int vsf_sysutil_stat(const char* p_name, struct vsf_sysutil_statbuf** p_ptr);
@@ -132,6 +148,12 @@ int vsf_sysutil_statbuf_is_readable_other(
   const struct vsf_sysutil_statbuf* p_stat);
 const char* vsf_sysutil_statbuf_get_sortkey_mtime(
   const struct vsf_sysutil_statbuf* p_stat);
+long vsf_sysutil_statbuf_get_mtime(const struct vsf_sysutil_statbuf* p_stat);
+long vsf_sysutil_statbuf_get_ctime(const struct vsf_sysutil_statbuf* p_stat);
+filesize_t vsf_sysutil_statbuf_get_inode(
+  const struct vsf_sysutil_statbuf* p_stat);
+filesize_t vsf_sysutil_statbuf_get_dev(
+  const struct vsf_sysutil_statbuf* p_stat);
 
 int vsf_sysutil_chmod(const char* p_filename, unsigned int mode);
 void vsf_sysutil_fchown(const int fd, const int uid, const int gid);
@@ -150,11 +172,20 @@ void vsf_sysutil_unlock_file(int fd);
 enum EVSFSysUtilMapPermission
 {
   kVSFSysUtilMapProtReadOnly = 1,
-  kVSFSysUtilMapProtNone
+  kVSFSysUtilMapProtNone,
+  kVSFSysUtilMapProtReadWrite
 };
 void vsf_sysutil_memprotect(void* p_addr, unsigned int len,
                             const enum EVSFSysUtilMapPermission perm);
 void vsf_sysutil_memunmap(void* p_start, unsigned int length);
+/* Create a new file of the given size and map it shared, read/write. Any
+ * existing file of that name is replaced.
+ */
+void* vsf_sysutil_map_new_shared_file(const char* p_filename,
+                                      unsigned int length, unsigned int mode);
+/* Map an entire existing file read only. Returns 0 on failure. */
+const void* vsf_sysutil_map_file_readonly(const char* p_filename,
+                                          unsigned int* p_length);
 
 /* Memory allocating/freeing */
 void* vsf_sysutil_malloc(unsigned int size);
@@ -163,6 +194,8 @@ void vsf_sysutil_free(void* p_ptr);
 
 /* Process creation/exit/process handling */
 unsigned int vsf_sysutil_getpid(void);
+/* Number of CPUs online; at least 1 */
+unsigned int vsf_sysutil_get_num_cpus(void);
 int vsf_sysutil_fork(void);
 int vsf_sysutil_fork_failok(void);
 void vsf_sysutil_exit(int exit_code);
@@ -228,6 +261,8 @@ void vsf_sysutil_sockaddr_set_ipv6addr(struct vsf_sysutil_sockaddr* p_sockptr,
 void vsf_sysutil_sockaddr_set_any(struct vsf_sysutil_sockaddr* p_sockaddr);
 void vsf_sysutil_sockaddr_set_port(struct vsf_sysutil_sockaddr* p_sockptr,
                                    unsigned short the_port);
+unsigned short vsf_sysutil_sockaddr_get_port(
+  const struct vsf_sysutil_sockaddr* p_sockptr);
 int vsf_sysutil_is_port_reserved(unsigned short port);
 int vsf_sysutil_get_ipsock(const struct vsf_sysutil_sockaddr* p_sockaddr);
 unsigned int vsf_sysutil_get_ipaddr_size(void);
@@ -241,25 +276,48 @@ int vsf_sysutil_get_ipv4_sock(void);
 int vsf_sysutil_get_ipv6_sock(void);
 struct vsf_sysutil_socketpair_retval
   vsf_sysutil_unix_stream_socketpair(void);
+struct vsf_sysutil_socketpair_retval
+  vsf_sysutil_unix_dgram_socketpair(void);
+int vsf_sysutil_get_unix_listen_sock(const char* p_path,
+                                     unsigned int backlog);
+int vsf_sysutil_accept_unix(int fd);
 int vsf_sysutil_bind(int fd, const struct vsf_sysutil_sockaddr* p_sockptr);
 void vsf_sysutil_listen(int fd, const unsigned int backlog);
 void vsf_sysutil_getsockname(int fd, struct vsf_sysutil_sockaddr** p_sockptr);
 void vsf_sysutil_getpeername(int fd, struct vsf_sysutil_sockaddr** p_sockptr);
+/* As above, but returns -1 rather than dying if fd is not a connected IPv4
+ * or IPv6 socket
+ */
+int vsf_sysutil_getpeername_failok(int fd,
+                                   struct vsf_sysutil_sockaddr** p_sockptr);
 int vsf_sysutil_accept_timeout(int fd, struct vsf_sysutil_sockaddr* p_sockaddr,
                                unsigned int wait_seconds);
 int vsf_sysutil_connect_timeout(int fd,
                                 const struct vsf_sysutil_sockaddr* p_sockaddr,
                                 unsigned int wait_seconds);
+int vsf_sysutil_wait_readable(int fd1, int fd2);
 void vsf_sysutil_dns_resolve(struct vsf_sysutil_sockaddr** p_sockptr,
                              const char* p_name);
 /* Option setting on sockets */
 void vsf_sysutil_activate_keepalive(int fd);
 void vsf_sysutil_set_iptos_throughput(int fd);
+/* Sets the send (or, with is_recv set, receive) buffer size; failure is
+ * ignored. On Linux this also stops the kernel tuning that buffer itself.
+ */
+void vsf_sysutil_set_sockbuf_size(int fd, int is_recv, unsigned int size);
 void vsf_sysutil_activate_reuseaddr(int fd);
+void vsf_sysutil_activate_reuseport(int fd);
 void vsf_sysutil_set_nodelay(int fd);
+/* Does nothing where TCP Fast Open is unsupported */
+void vsf_sysutil_set_fastopen(int fd, unsigned int queue_len);
 void vsf_sysutil_activate_sigurg(int fd);
 void vsf_sysutil_activate_oobinline(int fd);
-void vsf_sysutil_activate_linger(int fd);
+/* Blocking reads and writes give up with kVSFSysUtilErrAGAIN once nothing
+ * has moved for this long; 0 means never
+ */
+void vsf_sysutil_set_io_timeout(int fd, unsigned int seconds);
+/* A close() then blocks for at most this long; 0 means as long as it takes */
+void vsf_sysutil_activate_linger(int fd, unsigned int seconds);
 void vsf_sysutil_deactivate_linger_failok(int fd);
 void vsf_sysutil_activate_noblock(int fd);
 void vsf_sysutil_deactivate_noblock(int fd);
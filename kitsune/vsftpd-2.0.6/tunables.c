@@ -74,6 +74,14 @@ int tunable_pasv_addr_resolve = 0;
 int tunable_debug_ssl = 0;
 int tunable_require_cert = 0;
 int tunable_validate_cert = 0;
+int tunable_deflate_enable = 0;
+int tunable_block_mode_enable = 0;
+int tunable_deflate_sidecar_enable = 0;
+int tunable_checksum_cache_enable = 0;
+int tunable_allo_prealloc_enable = 0;
+int tunable_atomic_upload_enable = 0;
+int tunable_sockbuf_autotune_enable = 0;
+int tunable_upload_sync_enable = 0;
 
 unsigned int tunable_accept_timeout = 60;
 unsigned int tunable_connect_timeout = 60;
@@ -89,6 +97,7 @@ unsigned int tunable_anon_max_rate = 0;
 unsigned int tunable_local_max_rate = 0;
 /* IPPORT_FTP */
 unsigned int tunable_listen_port = 21;
+unsigned int tunable_listen_shards = 0;
 unsigned int tunable_max_clients = 0;
 /* -rw-rw-rw- */
 unsigned int tunable_file_open_mode = 0666;
@@ -99,6 +108,17 @@ unsigned int tunable_delay_successful_login = 0;
 unsigned int tunable_max_login_fails = 3;
 /* -rw------- */
 unsigned int tunable_chown_upload_mode = 0600;
+unsigned int tunable_deflate_level = 6;
+unsigned int tunable_tcp_fastopen = 0;
+unsigned int tunable_auth_workers = 0;
+unsigned int tunable_auth_cache_ttl = 10;
+unsigned int tunable_write_behind_size = 0;
+unsigned int tunable_stream_download_size = 0;
+/* 1Gbit/s */
+unsigned int tunable_sockbuf_link_rate = 125000000;
+unsigned int tunable_sockbuf_max_size = 16777216;
+unsigned int tunable_tcp_notsent_lowat = 0;
+unsigned int tunable_allo_max_size = 1073741824;
 
 const char* tunable_secure_chroot_dir = "/usr/share/empty";
 const char* tunable_ftp_username = "ftp";
@@ -131,4 +151,7 @@ const char* tunable_ssl_ciphers = "DES-CBC3-SHA";
 const char* tunable_rsa_private_key_file = 0;
 const char* tunable_dsa_private_key_file = 0;
 const char* tunable_ca_certs_file = 0;
+const char* tunable_deflate_exclude_file = 0;
+const char* tunable_stats_socket = 0;
+const char* tunable_scoreboard_file = 0;
 
@@ -70,6 +70,14 @@ extern int tunable_pasv_addr_resolve;         /* DNS resolve pasv_addr */
 extern int tunable_debug_ssl;                 /* Verbose SSL logging */
 extern int tunable_require_cert;              /* SSL client cert required */
 extern int tunable_validate_cert;             /* SSL certs must be valid */
+extern int tunable_deflate_enable;            /* Allow MODE Z compression */
+extern int tunable_block_mode_enable;         /* Allow MODE B */
+extern int tunable_deflate_sidecar_enable;    /* Send precompressed .zz files */
+extern int tunable_checksum_cache_enable;     /* Cache HASH results */
+extern int tunable_allo_prealloc_enable;      /* ALLO reserves disk space */
+extern int tunable_atomic_upload_enable;      /* Upload to temp file, rename */
+extern int tunable_upload_sync_enable;        /* Uploads on disk before 226 */
+extern int tunable_sockbuf_autotune_enable;   /* Size data bufs from RTT */
 
 /* Integer/numeric defines */
 extern unsigned int tunable_accept_timeout;
@@ -84,6 +92,7 @@ extern unsigned int tunable_pasv_max_port;
 extern unsigned int tunable_anon_max_rate;
 extern unsigned int tunable_local_max_rate;
 extern unsigned int tunable_listen_port;
+extern unsigned int tunable_listen_shards;
 extern unsigned int tunable_max_clients;
 extern unsigned int tunable_file_open_mode;
 extern unsigned int tunable_max_per_ip;
@@ -92,6 +101,16 @@ extern unsigned int tunable_delay_failed_login;
 extern unsigned int tunable_delay_successful_login;
 extern unsigned int tunable_max_login_fails;
 extern unsigned int tunable_chown_upload_mode;
+extern unsigned int tunable_deflate_level;
+extern unsigned int tunable_tcp_fastopen;
+extern unsigned int tunable_auth_workers;
+extern unsigned int tunable_auth_cache_ttl;
+extern unsigned int tunable_write_behind_size;
+extern unsigned int tunable_stream_download_size;
+extern unsigned int tunable_sockbuf_link_rate;
+extern unsigned int tunable_sockbuf_max_size;
+extern unsigned int tunable_tcp_notsent_lowat;
+extern unsigned int tunable_allo_max_size;
 
 /* String defines */
 extern const char* tunable_secure_chroot_dir;
@@ -125,6 +144,9 @@ extern const char* tunable_ssl_ciphers;
 extern const char* tunable_rsa_private_key_file;
 extern const char* tunable_dsa_private_key_file;
 extern const char* tunable_ca_certs_file;
+extern const char* tunable_deflate_exclude_file;
+extern const char* tunable_stats_socket;
+extern const char* tunable_scoreboard_file;
 
 #endif /* VSF_TUNABLES_H */
 
@@ -26,6 +26,9 @@
 #include "readwrite.h"
 #include "sysutil.h"
 #include "sysdeputil.h"
+#include "stats.h"
+#include "lineidx.h"
+#include "authsvc.h"
 
 static void drop_all_privs(void);
 //static void handle_sigchld(int duff); Kitsune
@@ -90,15 +93,15 @@ vsf_two_process_start(struct vsf_session* p_sess)
    * login processing
    */
   vsf_sysutil_close(p_sess->parent_fd);
+  vsf_authsvc_close();
   if (tunable_ssl_enable)
   {
     vsf_sysutil_close(p_sess->ssl_consumer_fd);
   }
   if (tunable_local_enable && tunable_userlist_enable)
   {
-    int retval = str_fileread(&p_sess->userlist_str, tunable_userlist_file,
-                              VSFTP_CONF_FILE_MAX);
-    if (vsf_sysutil_retval_is_error(retval))
+    p_sess->p_userlist_idx = vsf_lineidx_load_file(tunable_userlist_file);
+    if (!p_sess->p_userlist_idx)
     {
       die2("cannot open user list file:", tunable_userlist_file);
     }
@@ -136,11 +139,12 @@ vsf_two_process_login(struct vsf_session* p_sess,
                       const struct mystr* p_pass_str)
 {
   char result;
-  priv_sock_send_cmd(p_sess->child_fd, PRIV_SOCK_LOGIN);
-  priv_sock_send_str(p_sess->child_fd, &p_sess->user_str);
-  priv_sock_send_str(p_sess->child_fd, p_pass_str);
-  priv_sock_send_int(p_sess->child_fd, p_sess->control_use_ssl);
-  priv_sock_send_int(p_sess->child_fd, p_sess->data_use_ssl);
+  priv_sock_msg_start(PRIV_SOCK_LOGIN);
+  priv_sock_msg_add_str(&p_sess->user_str);
+  priv_sock_msg_add_str(p_pass_str);
+  priv_sock_msg_add_int(p_sess->control_use_ssl);
+  priv_sock_msg_add_int(p_sess->data_use_ssl);
+  priv_sock_msg_send(p_sess->child_fd);
   result = priv_sock_get_result(p_sess->child_fd);
   if (result == PRIV_SOCK_RESULT_OK)
   {
@@ -148,6 +152,7 @@ vsf_two_process_login(struct vsf_session* p_sess,
      * process_post_login().
      * Exit normally, unless we are remaining as the SSL read / write child.
      */
+    vsf_stats_cmd_end();
     if (!p_sess->control_use_ssl)
     {
       vsf_sysutil_exit(0);
@@ -179,21 +184,23 @@ int
 vsf_two_process_get_priv_data_sock(struct vsf_session* p_sess)
 {
   char res;
-  priv_sock_send_cmd(p_sess->child_fd, PRIV_SOCK_GET_DATA_SOCK);
-  res = priv_sock_get_result(p_sess->child_fd);
+  priv_sock_msg_start(PRIV_SOCK_GET_DATA_SOCK);
+  priv_sock_msg_send(p_sess->child_fd);
+  res = priv_sock_msg_recv(p_sess->child_fd);
   if (res != PRIV_SOCK_RESULT_OK)
   {
     die("could not get privileged socket");
   }
-  return priv_sock_recv_fd(p_sess->child_fd);
+  return priv_sock_msg_get_fd();
 }
 
 void
 vsf_two_process_chown_upload(struct vsf_session* p_sess, int fd)
 {
   char res;
-  priv_sock_send_cmd(p_sess->child_fd, PRIV_SOCK_CHOWN);
-  priv_sock_send_fd(p_sess->child_fd, fd);
+  priv_sock_msg_start(PRIV_SOCK_CHOWN);
+  priv_sock_msg_add_fd(fd);
+  priv_sock_msg_send(p_sess->child_fd);
   res = priv_sock_get_result(p_sess->child_fd);
   if (res != PRIV_SOCK_RESULT_OK)
   {
@@ -207,29 +214,29 @@ process_login_req(struct vsf_session* p_sess)
 {
   enum EVSFPrivopLoginResult e_login_result = kVSFLoginNull;
   char cmd;
-  if (!kitsune_is_updating()) {  /* Kitsune */
-    vsf_sysutil_unblock_sig(kVSFSysUtilSigCHLD);
-    /* Blocks */
-    cmd = priv_sock_get_cmd(p_sess->parent_fd);
-    vsf_sysutil_block_sig(kVSFSysUtilSigCHLD);
-    if (cmd != PRIV_SOCK_LOGIN)
-    {
-      die("bad request");
-    }
-  }
-
-  /* Kitsune, update point */
+  /* Kitsune, update point. The whole login request arrives in one message,
+   * so we take updates before receiving it rather than part way through.
+   */
   kitsune_update("twoprocess.c");
   /* Kitsune, allow updating from blocking loop */
   vsf_sysutil_kitsune_set_update_point("twoprocess.c");
 
+  vsf_sysutil_unblock_sig(kVSFSysUtilSigCHLD);
+  /* Blocks */
+  cmd = priv_sock_msg_recv(p_sess->parent_fd);
+  vsf_sysutil_block_sig(kVSFSysUtilSigCHLD);
+  if (cmd != PRIV_SOCK_LOGIN)
+  {
+    die("bad request");
+  }
+
   /* Get username and password - we must distrust these */
   {
     struct mystr password_str = INIT_MYSTR;
-    priv_sock_get_str(p_sess->parent_fd, &p_sess->user_str);
-    priv_sock_get_str(p_sess->parent_fd, &password_str);
-    p_sess->control_use_ssl = priv_sock_get_int(p_sess->parent_fd);
-    p_sess->data_use_ssl = priv_sock_get_int(p_sess->parent_fd);
+    priv_sock_msg_get_str(&p_sess->user_str);
+    priv_sock_msg_get_str(&password_str);
+    p_sess->control_use_ssl = priv_sock_msg_get_int();
+    p_sess->data_use_ssl = priv_sock_msg_get_int();
     if (!tunable_ssl_enable)
     {
       p_sess->control_use_ssl = 0;
@@ -296,7 +303,6 @@ process_ssl_slave_req(struct vsf_session* p_sess)
   while (1)
   {
     char cmd = priv_sock_get_cmd(p_sess->ssl_slave_fd);
-    int retval;
     if (cmd == PRIV_SOCK_GET_USER_CMD)
     {
       ftp_getline(p_sess, &p_sess->ftp_cmd_str, p_sess->p_control_line_buf);
@@ -305,8 +311,11 @@ process_ssl_slave_req(struct vsf_session* p_sess)
     else if (cmd == PRIV_SOCK_WRITE_USER_RESP)
     {
       priv_sock_get_str(p_sess->ssl_slave_fd, &p_sess->ftp_cmd_str);
-      retval = ftp_write_str(p_sess, &p_sess->ftp_cmd_str, kVSFRWControl);
-      priv_sock_send_int(p_sess->ssl_slave_fd, retval);
+      /* Replies are not acknowledged; see ftp_write_str() */
+      if (ftp_write_str(p_sess, &p_sess->ftp_cmd_str, kVSFRWControl) != 0)
+      {
+        die("ftp_write_str");
+      }
     }
     else
     {
@@ -322,6 +331,8 @@ common_do_login(struct vsf_session* p_sess, const struct mystr* p_user_str,
   int was_anon = anon;
   const struct mystr* p_orig_user_str = p_user_str;
   int newpid;
+  /* No more logins to check; don't pass access on to the post-login child */
+  vsf_authsvc_close();
   vsf_sysutil_install_null_sighandler(kVSFSysUtilSigCHLD);
   /* Tells the pre-login child all is OK (it may exit in response) */
   priv_sock_send_result(p_sess->parent_fd, PRIV_SOCK_RESULT_OK);
@@ -437,7 +448,7 @@ handle_per_user_config(const struct mystr* p_user_str)
   if (!vsf_sysutil_retval_is_error(retval) &&
       vsf_sysutil_statbuf_get_uid(p_statbuf) == VSFTP_ROOT_UID)
   {
-    vsf_parseconf_load_file(str_getbuf(&filename_str), 1);
+    vsf_parseconf_load_file_cached(str_getbuf(&filename_str), p_statbuf);
   }
   str_free(&filename_str);
   vsf_sysutil_free(p_statbuf);
@@ -61,5 +61,10 @@ if find_func SSL_library_init ssl.o; then
   echo "-lssl -lcrypto";
 fi
 
+# zlib (MODE Z)
+if find_func deflateInit_ zlibio.o; then
+  echo "-lz";
+fi
+
 exit 0;
 
@@ -0,0 +1,184 @@
+/*
+ * Part of Very Secure FTPd
+ * Licence: GPL v2
+ * Author: Chris Evans
+ * zlibio.c
+ *
+ * Routines to wrap zlib, for MODE Z compressed data transfers. These only
+ * transform buffers - the callers take care of the actual I/O.
+ */
+
+#include "zlibio.h"
+#include "sysutil.h"
+#include "utility.h"
+#include "builddefs.h"
+
+#ifdef VSF_BUILD_ZLIB
+
+#include <zlib.h>
+
+struct vsf_zlib_stream
+{
+  z_stream zs;
+  int is_deflate;
+  int is_done;
+};
+
+static struct vsf_zlib_stream* zlib_stream_alloc(int is_deflate);
+
+static struct vsf_zlib_stream*
+zlib_stream_alloc(int is_deflate)
+{
+  struct vsf_zlib_stream* p_stream =
+    vsf_sysutil_malloc(sizeof(struct vsf_zlib_stream));
+  vsf_sysutil_memclr(p_stream, sizeof(*p_stream));
+  p_stream->zs.zalloc = Z_NULL;
+  p_stream->zs.zfree = Z_NULL;
+  p_stream->zs.opaque = Z_NULL;
+  p_stream->is_deflate = is_deflate;
+  return p_stream;
+}
+
+struct vsf_zlib_stream*
+zlib_deflate_new(int level)
+{
+  struct vsf_zlib_stream* p_stream = zlib_stream_alloc(1);
+  if (level < Z_NO_COMPRESSION || level > Z_BEST_COMPRESSION)
+  {
+    level = Z_DEFAULT_COMPRESSION;
+  }
+  if (deflateInit(&p_stream->zs, level) != Z_OK)
+  {
+    die("deflateInit");
+  }
+  return p_stream;
+}
+
+struct vsf_zlib_stream*
+zlib_inflate_new(void)
+{
+  struct vsf_zlib_stream* p_stream = zlib_stream_alloc(0);
+  if (inflateInit(&p_stream->zs) != Z_OK)
+  {
+    die("inflateInit");
+  }
+  return p_stream;
+}
+
+void
+zlib_stream_free(struct vsf_zlib_stream* p_stream)
+{
+  if (p_stream->is_deflate)
+  {
+    (void) deflateEnd(&p_stream->zs);
+  }
+  else
+  {
+    (void) inflateEnd(&p_stream->zs);
+  }
+  vsf_sysutil_free(p_stream);
+}
+
+void
+zlib_stream_set_input(struct vsf_zlib_stream* p_stream, const char* p_buf,
+                      unsigned int len)
+{
+  /* zlib doesn't const its input, but it never writes to it */
+  p_stream->zs.next_in = (Bytef*) p_buf;
+  p_stream->zs.avail_in = len;
+}
+
+int
+zlib_stream_run(struct vsf_zlib_stream* p_stream, char* p_buf,
+                unsigned int len, int finish)
+{
+  int retval;
+  p_stream->zs.next_out = (Bytef*) p_buf;
+  p_stream->zs.avail_out = len;
+  if (p_stream->is_deflate)
+  {
+    retval = deflate(&p_stream->zs, finish ? Z_FINISH : Z_NO_FLUSH);
+    if (retval == Z_STREAM_ERROR)
+    {
+      bug("deflate");
+    }
+  }
+  else
+  {
+    if (p_stream->is_done)
+    {
+      /* Ignore any trailing junk after the end of the stream */
+      p_stream->zs.avail_in = 0;
+      return 0;
+    }
+    retval = inflate(&p_stream->zs, Z_NO_FLUSH);
+    if (retval == Z_STREAM_END)
+    {
+      p_stream->is_done = 1;
+    }
+    else if (retval != Z_OK && retval != Z_BUF_ERROR)
+    {
+      return -1;
+    }
+  }
+  return (int) (len - p_stream->zs.avail_out);
+}
+
+int
+zlib_stream_is_done(const struct vsf_zlib_stream* p_stream)
+{
+  return p_stream->is_done;
+}
+
+#else /* VSF_BUILD_ZLIB */
+
+struct vsf_zlib_stream*
+zlib_deflate_new(int level)
+{
+  (void) level;
+  die("deflate_enable is set but zlib support not compiled in");
+  return 0;
+}
+
+struct vsf_zlib_stream*
+zlib_inflate_new(void)
+{
+  die("deflate_enable is set but zlib support not compiled in");
+  return 0;
+}
+
+void
+zlib_stream_free(struct vsf_zlib_stream* p_stream)
+{
+  (void) p_stream;
+}
+
+void
+zlib_stream_set_input(struct vsf_zlib_stream* p_stream, const char* p_buf,
+                      unsigned int len)
+{
+  (void) p_stream;
+  (void) p_buf;
+  (void) len;
+}
+
+int
+zlib_stream_run(struct vsf_zlib_stream* p_stream, char* p_buf,
+                unsigned int len, int finish)
+{
+  (void) p_stream;
+  (void) p_buf;
+  (void) len;
+  (void) finish;
+  return -1;
+}
+
+int
+zlib_stream_is_done(const struct vsf_zlib_stream* p_stream)
+{
+  (void) p_stream;
+  return 0;
+}
+
+#endif /* VSF_BUILD_ZLIB */
+
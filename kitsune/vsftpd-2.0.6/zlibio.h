@@ -0,0 +1,76 @@
+#ifndef VSF_ZLIBIO_H
+#define VSF_ZLIBIO_H
+
+struct vsf_zlib_stream;
+
+/* zlib_deflate_new()
+ * PURPOSE
+ * Create a new compression stream, producing zlib (RFC 1950) format data as
+ * used by MODE Z.
+ * PARAMETERS
+ * level        - the compression level, 0 (store only) to 9 (best)
+ * RETURNS
+ * A handle to the new stream.
+ */
+struct vsf_zlib_stream* zlib_deflate_new(int level);
+
+/* zlib_inflate_new()
+ * PURPOSE
+ * Create a new decompression stream, accepting zlib format data.
+ * RETURNS
+ * A handle to the new stream.
+ */
+struct vsf_zlib_stream* zlib_inflate_new(void);
+
+/* zlib_stream_free()
+ * PURPOSE
+ * Release all resources associated with a stream.
+ * PARAMETERS
+ * p_stream     - the stream to free
+ */
+void zlib_stream_free(struct vsf_zlib_stream* p_stream);
+
+/* zlib_stream_set_input()
+ * PURPOSE
+ * Feed a buffer of input into the stream. The buffer must remain valid until
+ * zlib_stream_run() has returned 0, indicating it has all been consumed.
+ * PARAMETERS
+ * p_stream     - the stream
+ * p_buf        - the input data
+ * len          - the length of the input data
+ */
+void zlib_stream_set_input(struct vsf_zlib_stream* p_stream,
+                           const char* p_buf, unsigned int len);
+
+/* zlib_stream_run()
+ * PURPOSE
+ * Run the stream, producing output from the pending input. The caller
+ * should keep calling this until it returns 0.
+ * PARAMETERS
+ * p_stream     - the stream
+ * p_buf        - the output buffer
+ * len          - the size of the output buffer
+ * finish       - for compression streams, non-zero to flush out all
+ *                remaining data and terminate the stream. Ignored for
+ *                decompression streams.
+ * RETURNS
+ * The number of bytes stored in the output buffer. 0 means all input has
+ * been consumed (and, if "finish" was set, the stream is complete). -1 on
+ * a corrupt input stream.
+ */
+int zlib_stream_run(struct vsf_zlib_stream* p_stream, char* p_buf,
+                    unsigned int len, int finish);
+
+/* zlib_stream_is_done()
+ * PURPOSE
+ * Check whether a decompression stream has seen the end of the compressed
+ * data, i.e. that the input wasn't cut short.
+ * PARAMETERS
+ * p_stream     - the stream
+ * RETURNS
+ * 1 if the end of the stream has been reached, 0 otherwise.
+ */
+int zlib_stream_is_done(const struct vsf_zlib_stream* p_stream);
+
+#endif /* VSF_ZLIBIO_H */
+